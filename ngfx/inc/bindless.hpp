@@ -0,0 +1,67 @@
+#ifndef NGFX_BINDLESS_H
+#define NGFX_BINDLESS_H
+
+#include "vulkan/vulkan.hpp"
+#include "context.hpp"
+#include "util.hpp"
+
+namespace ngfx
+{
+  // Global descriptor set shared by every bindless pipeline. It is bound
+  // once per command buffer and draws pick cameras and textures through
+  // util::BindlessPushConstants, so no sets are switched between draws.
+  //
+  //   binding 0: mat4 cameras[kMaxCameras], storage buffer
+  //   binding 1: vec4 palette[256], uniform buffer
+  //   binding 2: sampler2D textures[], partially bound, update after bind
+  //
+  // Requires Context::descriptorIndexing
+  struct Bindless
+  {
+    static const uint32_t kMaxCameras = 1024;
+    static const uint32_t kMaxTextures = 4096;
+
+    vk::DescriptorSetLayout descLayout;
+    vk::DescriptorPool descPool;
+    vk::DescriptorSet descSet;
+    // Compatible with every bindless pipeline
+    vk::PipelineLayout layout;
+
+    util::FastBuffer camBuffer;
+
+    uint32_t cameraCount;
+    uint32_t textureCount;
+    // kMaxTextures clamped to the device update after bind limits
+    uint32_t textureCapacity;
+
+    // Pointer to device, used for destructor
+    vk::Device *device;
+    Bindless(Context *c);
+    ~Bindless(void);
+
+    // Reserve count consecutive camera slots, returns the first
+    uint32_t addCameras(uint32_t count);
+    // Stage matrices of slots [first, first + count) for the next upload
+    void writeCameras(uint32_t first, uint32_t count, const glm::mat4 *mats);
+
+    // Register a texture, returns its index into textures[]
+    uint32_t addTexture(vk::ImageView view, vk::Sampler sampler);
+    // Replace a texture. Valid while the set is bound in pending command
+    // buffers, the new image is seen by their next submission
+    void writeTexture(uint32_t index, vk::ImageView view, vk::Sampler sampler);
+
+    // Record a copy of the camera slots written since the last upload
+    vk::DeviceSize recordUpload(vk::CommandBuffer cmd);
+    void upload(vk::Queue q);
+
+    void bind(vk::CommandBuffer cmd,
+              vk::PipelineBindPoint point = vk::PipelineBindPoint::eGraphics);
+    void push(vk::CommandBuffer cmd, const util::BindlessPushConstants &push);
+
+    private:
+      void createDescriptorPool(void);
+      void createDescriptorSets(Context *c);
+  };
+}
+
+#endif //NGFX_BINDLESS_H
@@ -18,7 +18,7 @@ namespace ngfx
         // Set projection matrix
         proj = glm::perspective(
             glm::radians(90.0),
-            (glm::float64) (extent.width / extent.height),
+            (glm::float64) extent.width / extent.height,
             0.1,
             1000.0);
         
@@ -77,12 +77,13 @@ namespace ngfx
         // yaw = rotation about y axis
         // roll = rotation about z axis
 
-        glm::float64 cosPitch = glm::cos(pitch);
-        glm::float64 sinPitch = glm::sin(pitch);
-        glm::float64 cosYaw = glm::cos(yaw);
-        glm::float64 sinYaw = glm::sin(yaw);
-        glm::float64 cosRoll = glm::cos(roll);
-        glm::float64 sinRoll = glm::sin(roll);
+        // Single precision, the matrix is float anyway
+        float cosPitch = glm::cos((float) pitch);
+        float sinPitch = glm::sin((float) pitch);
+        float cosYaw = glm::cos((float) yaw);
+        float sinYaw = glm::sin((float) yaw);
+        float cosRoll = glm::cos((float) roll);
+        float sinRoll = glm::sin((float) roll);
         
         // Compute 3 axis rotation matrix (RxRyRz)
         glm::vec3 x = {
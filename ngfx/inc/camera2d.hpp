@@ -0,0 +1,125 @@
+#ifndef NGFX_CAMERA2D_H
+#define NGFX_CAMERA2D_H
+
+#include <cmath>
+#include "vulkan/vulkan.hpp"
+#include "glm/glm.hpp"
+
+namespace ngfx
+{
+  // Orthographic camera for the 2D workloads, looking down z at the
+  // instance plane. zoom is the inverse of the half height of the view in
+  // world units, rotation turns the view counter clockwise. The matrix is
+  // a few float multiplies, sin and cos only change with the rotation.
+  //
+  // cam drops in wherever a Camera matrix is used, e.g. copied into
+  // CameraArray::cams[i].cam. Many cameras are built at once with
+  // buildCameras2D from SoA arrays
+  class Camera2D
+  {
+    public:
+      glm::vec2 center;
+      float zoom;
+      // Width over height of the target
+      float aspect;
+      glm::mat4 cam;
+
+      Camera2D(vk::Extent2D extent)
+        : center(0.0f), zoom(1.0f),
+          aspect((float) extent.width / extent.height),
+          _rotation(0.0f), _cos(1.0f), _sin(0.0f)
+      {
+        build();
+      }
+
+      void move(glm::vec2 delta, float deltaZoom, float deltaRotation)
+      {
+        center += delta;
+        zoom *= deltaZoom;
+        if (deltaRotation != 0.0f)
+        {
+          setRotation(_rotation + deltaRotation);
+        }
+      }
+
+      void jump(glm::vec2 newCenter, float newZoom, float newRotation)
+      {
+        center = newCenter;
+        zoom = newZoom;
+        setRotation(newRotation);
+      }
+
+      float rotation(void) const { return _rotation; }
+      void setRotation(float radians)
+      {
+        _rotation = radians;
+        _cos = std::cos(radians);
+        _sin = std::sin(radians);
+      }
+
+      void build(void)
+      {
+        float sx = zoom / aspect;
+        float sy = zoom;
+        cam = glm::mat4(
+            glm::vec4(sx * _cos, -sy * _sin, 0.0f, 0.0f),
+            glm::vec4(sx * _sin, sy * _cos, 0.0f, 0.0f),
+            glm::vec4(0.0f, 0.0f, 1.0f, 0.0f),
+            glm::vec4(-sx * (_cos * center.x + _sin * center.y),
+                      sy * (_sin * center.x - _cos * center.y),
+                      0.0f,
+                      1.0f));
+      }
+
+      // World AABB of the view as (min x, min y, max x, max y), tight
+      // for the rotated rectangle
+      glm::vec4 footprint(void) const
+      {
+        float hx = aspect / zoom;
+        float hy = 1.0f / zoom;
+        float ex = std::abs(_cos) * hx + std::abs(_sin) * hy;
+        float ey = std::abs(_sin) * hx + std::abs(_cos) * hy;
+        return glm::vec4(center.x - ex, center.y - ey,
+                         center.x + ex, center.y + ey);
+      }
+
+      // Point under a pixel of an extent sized target, origin top left
+      glm::vec2 screenToWorld(glm::vec2 pixel, vk::Extent2D extent) const
+      {
+        float nx = (2.0f * pixel.x / extent.width - 1.0f) * aspect / zoom;
+        float ny = (2.0f * pixel.y / extent.height - 1.0f) / zoom;
+        return center + glm::vec2(_cos * nx - _sin * ny,
+                                  _sin * nx + _cos * ny);
+      }
+
+    private:
+      float _rotation;
+      float _cos;
+      float _sin;
+  };
+
+  // Matrices of count cameras from SoA parameters, as Camera2D::build.
+  // Branch free so the loop vectorizes
+  void buildCameras2D(
+      const float *x,
+      const float *y,
+      const float *zoom,
+      const float *cosRotation,
+      const float *sinRotation,
+      uint32_t count,
+      float aspect,
+      glm::mat4 *out);
+
+  // Footprints of count cameras, as Camera2D::footprint
+  void footprints2D(
+      const float *x,
+      const float *y,
+      const float *zoom,
+      const float *cosRotation,
+      const float *sinRotation,
+      uint32_t count,
+      float aspect,
+      glm::vec4 *out);
+}
+
+#endif // NGFX_CAMERA2D_H
@@ -5,6 +5,10 @@
 #include "util.hpp"
 #include "context.hpp"
 #include "camera.hpp"
+#include "pipeline.hpp"
+#include "instance_streams.hpp"
+#include "bindless.hpp"
+#include "descriptors.hpp"
 
 namespace ngfx
 {
@@ -13,32 +17,115 @@ namespace ngfx
     public:
       uint w = 256;
       uint h = 256;
+      uint32_t count;
+      // Top left part of every w x h target drawn into, see
+      // setRenderExtent. Targets are never reallocated
+      vk::Extent2D renderExtent;
+      // renderExtent of the last recordReadback, the size of frame()
+      vk::Extent2D frameExtent;
       static vk::VertexInputAttributeDescription attribute[];
       static vk::VertexInputBindingDescription binding[];
       vk::RenderPass pass;
-      util::Fbo fbo;
+      // One offscreen target per camera
+      std::vector<util::Fbo> fbos;
       vk::PipelineLayout layout;
       vk::Pipeline pipeline;
-      
-      Camera cam;
+      util::ShaderVariant variant;
+
+      std::vector<Camera> cams;
+      // Bytes between cameras in camBuffer, each camera is bound at its
+      // own dynamic offset so the set never has to be rewritten
+      vk::DeviceSize camStride;
+      // cam.cam of every camera at camStride, mirrored into camBuffer
+      std::vector<glm::mat4> camData;
       util::FastBuffer camBuffer;
 
       vk::DescriptorSetLayout descLayout;
-      vk::DescriptorPool descPool;
+      vk::DescriptorUpdateTemplate descTemplate;
+      // Set 1 of pulled variants, bound by InstanceStreams::bindStorage
+      vk::DescriptorSetLayout storageLayout;
+      // Own pool rather than Context::descriptors, so destroying the array
+      // frees its set without touching sets of other owners
+      util::DescriptorAllocator descriptors;
       vk::DescriptorSet descSet;
 
+      // When set, cameras live in bindless slots [firstCamera,
+      // firstCamera + count) and layout is the shared bindless layout
+      Bindless *bindless;
+      uint32_t firstCamera;
+
+      // Host visible copy of every camera image, RGBA8 in camera order
+      vk::Buffer readbackBuffer;
+      vk::DeviceMemory readbackMemory;
+      void *readbackData;
+
       // Pointer to device, used for destructor
       vk::Device *device;
       // TODO:: Remove this once testing is completed
       vk::Queue *q;
-      CameraArray(Context *c);
+      CameraArray(
+          Context *c,
+          uint32_t count = 1,
+          const util::ShaderVariant &variant = util::ShaderVariant(),
+          Bindless *bindless = nullptr,
+          vk::Extent2D extent = vk::Extent2D(256, 256));
       ~CameraArray(void);
-    
+
+      // Copy current camera matrices into the staging buffer
+      void stageCameras(void);
+      // Blocking upload of the staged matrices
+      void uploadCameras(void);
+      // Record an update of every camera from count matrices. The data
+      // travels inside the command buffer, so nothing is shared with
+      // frames still in flight. For render threads fed by snapshots
+      void recordCameras(vk::CommandBuffer cmd, const glm::mat4 *mats);
+
+      // Record one render pass per camera drawing instanceCount instances
+      // of the indexed shape. alpha is only read by interpolating variants,
+      // see InstanceStreams::alpha. Pulled variants ignore the shape, the
+      // buffers may be null. When ranges is set camera i draws ranges[i]
+      // instead of [0, instanceCount), e.g. the output of LodTree::select
+      void record(
+          vk::CommandBuffer cmd,
+          util::FastBuffer *vertices,
+          util::FastBuffer *indices,
+          uint32_t indexCount,
+          InstanceStreams *instances,
+          uint32_t instanceCount,
+          float alpha = 1.0f,
+          const util::InstanceRange *ranges = nullptr);
+
+      // Render the following records at a lower resolution, clamped to
+      // [1, w] x [1, h]. Takes effect without reallocating, e.g. driven by
+      // ResolutionController
+      void setRenderExtent(vk::Extent2D extent);
+      // UV of the bottom right of the rendered part of a target, for
+      // consumers sampling the camera images
+      glm::vec2 uvScale(void);
+
+      // Replace every camera image with layer i of image, scaled from
+      // extent. image is in shader read only layout before and after, the
+      // targets are left as the render pass leaves them. For images
+      // produced by compute passes such as Heatmap
+      void recordBlit(
+          vk::CommandBuffer cmd,
+          vk::Image image,
+          vk::Extent2D extent);
+
+      // Record copies of every camera image into readbackBuffer. Contents
+      // are valid through frame() once the command buffer has completed,
+      // tightly packed at frameExtent inside slots of frameSize() bytes
+      void recordReadback(vk::CommandBuffer cmd);
+      const uint8_t *frame(uint32_t camera);
+      vk::DeviceSize frameSize(void);
+
     private:
-      void buildFbo(Context *c);
+      void buildFbo(Context *c, util::Fbo *fbo);
+      void buildReadback(Context *c);
       void buildRenderPass(void);
-      void createDescriptorPool(void);
-      void createDescriptorSets(void);
+      void buildDescriptors(void);
+      void buildLayout(void);
+      void createDescriptorSets(Context *c);
   };
 }
 
@@ -0,0 +1,108 @@
+#ifndef NGFX_CAMERAATLAS_H
+#define NGFX_CAMERAATLAS_H
+
+#include <vector>
+#include "vulkan/vulkan.hpp"
+#include "glm/glm.hpp"
+#include "context.hpp"
+#include "util.hpp"
+#include "camera.hpp"
+#include "pipeline.hpp"
+#include "instance_streams.hpp"
+
+namespace ngfx
+{
+  namespace util
+  {
+    // Shelf packer, tallest first. Places every size into rects inside an
+    // atlas at most maxWidth wide and returns the atlas extent
+    vk::Extent2D packRects(
+        const vk::Extent2D *sizes,
+        uint32_t count,
+        uint32_t maxWidth,
+        vk::Rect2D *rects);
+  }
+
+  // Cameras of different sizes packed into tiles of one atlas image and
+  // drawn in a single render pass, one framebuffer for all of them.
+  //
+  // With Context::viewportIndex, groups of kGroup cameras are drawn by one
+  // instanced draw, each instance picking its camera and viewport in the
+  // vertex shader. Otherwise every camera is a draw into its own viewport
+  // and scissor inside the same pass.
+  //
+  // Reads positions from InstanceStreams of a pulled variant. Consumers
+  // sample the atlas through view with uvRects, or crop frame() by rects
+  struct CameraAtlas
+  {
+    // Cameras sharing one camera uniform binding and one instanced draw.
+    // The minimum maxViewports of multiViewport devices
+    static const uint32_t kGroup = 16;
+
+    uint32_t count;
+    util::ShaderVariant variant;
+    bool viewportIndex;
+    // Whole atlas, rects[i] is the tile of camera i in pixels
+    vk::Extent2D extent;
+    std::vector<vk::Rect2D> rects;
+    // (u0, v0, u1, v1) of every tile
+    std::vector<glm::vec4> uvRects;
+
+    std::vector<Camera> cams;
+    // cam of every camera, padded to whole groups
+    std::vector<glm::mat4> camData;
+    util::FastBuffer camBuffer;
+
+    vk::RenderPass pass;
+    // In shader read only layout once the first record has executed
+    util::Fbo fbo;
+    vk::DescriptorSetLayout descLayout;
+    vk::DescriptorUpdateTemplate descTemplate;
+    vk::DescriptorSetLayout storageLayout;
+    // Allocated from Context::descriptors
+    vk::DescriptorSet descSet;
+    vk::PipelineLayout layout;
+    vk::Pipeline pipeline;
+
+    // Host visible copy of the atlas, RGBA8 rows of extent.width
+    vk::Buffer readbackBuffer;
+    vk::DeviceMemory readbackMemory;
+    void *readbackData;
+
+    // Pointer to device, used for destructor
+    vk::Device *device;
+
+    // maxWidth 0 picks a roughly square atlas
+    CameraAtlas(
+        Context *c,
+        const std::vector<vk::Extent2D> &sizes,
+        const util::ShaderVariant &variant,
+        uint32_t maxWidth = 0);
+    ~CameraAtlas(void);
+
+    // Copy current camera matrices, uploaded by the next record
+    void stageCameras(void);
+
+    // Clear the atlas and draw instanceCount instances into every tile.
+    // alpha is only read by interpolating variants
+    void record(
+        vk::CommandBuffer cmd,
+        InstanceStreams *instances,
+        uint32_t instanceCount,
+        float alpha = 1.0f);
+
+    // Record a copy of the atlas into readbackBuffer, valid through
+    // frame() once the command buffer has completed
+    void recordReadback(vk::CommandBuffer cmd);
+    const uint8_t *frame(void);
+    vk::DeviceSize frameSize(void);
+
+    private:
+      void buildRenderPass(void);
+      void buildFbo(Context *c);
+      void buildDescriptors(Context *c);
+      void buildReadback(Context *c);
+  };
+}
+
+#endif //NGFX_CAMERAATLAS_H
@@ -11,6 +11,14 @@ namespace ngfx
   static bool kDebug = false;
 #endif
 
+#if defined(NGFX_TRACE)
+  static bool kTrace = true;
+#else
+  static bool kTrace = false;
+#endif
+  // Chrome trace files are written as <kTraceFile>_<n>.json
+  static const char * const kTraceFile = "ngfx_trace";
+
   static const uint32_t kMaxFramesInFlight = 2;
   static const char * const kValLayers[] = {
     "VK_LAYER_KHRONOS_validation",
@@ -21,6 +29,9 @@ namespace ngfx
       VK_KHR_SWAPCHAIN_EXTENSION_NAME
   };
   static const uint kDeviceExtensionCount = 1;
+
+  // Environment variable selecting a physical device by index, UUID or name
+  static const char * const kDeviceOverrideEnv = "NGFX_DEVICE";
 }
 
 #endif // CONFIG_H
@@ -1,10 +1,12 @@
 #ifndef CONTEXT_H
 #define CONTEXT_H
 
+#include <memory>
 #include <vulkan/vulkan.hpp>
 #include "ngfx.hpp"
 #include "config.hpp"
 #include "util.hpp"
+#include "descriptors.hpp"
 
 // TODO: Docs
 namespace ngfx
@@ -17,7 +19,11 @@ namespace ngfx
     static const bool kResizable = false;
     static const bool kVsync = false;
 
+    // Null for headless contexts
     GLFWwindow *window;
+    // No window, surface or swapchain. Used for offscreen only rendering
+    // and for opening several contexts on one machine
+    bool headless;
     vk::Instance instance;
     vk::DebugUtilsMessengerEXT debugMessenger;
     vk::SurfaceKHR surface;
@@ -31,10 +37,45 @@ namespace ngfx
     util::SwapchainSupportDetails swapInfo;
     vk::PipelineCache pipelineCache;
     vk::CommandPool cmdPool;
+    // Long lived sets, destroy() before the device
+    util::DescriptorAllocator descriptors;
+    // Sets used by a single frame, see beginFrame. Only valid for command
+    // buffers recorded and submitted within that frame
+    util::DescriptorAllocator frameDescriptors[kMaxFramesInFlight];
+    // Every FastBuffer and Fbo allocation on device, see memory.hpp
+    util::MemoryTracker memory;
+    // util::kPaletteSize entry color ramp shared by every env descriptor
+    // set, uniform buffer. Static after the constructor
+    std::unique_ptr<util::FastBuffer> palette;
 
     // Useful configuration info
     vk::SampleCountFlags msaaSamples;
-    Context();
+    // VK_EXT_descriptor_indexing is enabled, Bindless can be used
+    bool descriptorIndexing;
+    // VK_EXT_calibrated_timestamps is enabled, only looked for by tracing
+    // builds (see trace.hpp)
+    bool calibratedTimestamps;
+    // VK_EXT_memory_budget is enabled, budgets come from the driver
+    bool memoryBudget;
+    // VK_EXT_external_memory_host is enabled, host allocations can be
+    // imported as buffers, see util::HostBuffer
+    bool externalHostMemory;
+    // VK_KHR_shader_atomic_int64 is enabled, PointRaster keeps full
+    // draw order
+    bool atomicInt64;
+    // VK_EXT_shader_viewport_index_layer and multiViewport are enabled,
+    // CameraAtlas picks viewports from the vertex shader
+    bool viewportIndex;
+    // deviceOverride picks a physical device by index, UUID or name,
+    // see util::pickPhysicalDevice
+    Context(const char *deviceOverride = nullptr, bool headless = false);
+    // Recycle the sets of frame % kMaxFramesInFlight and return its
+    // allocator. Call once that frame's fence has signaled
+    util::DescriptorAllocator &beginFrame(uint32_t frame);
+    // Destroys the device, instance and window. Every object created from
+    // the context must be gone by then. Safe to call more than once, the
+    // destructor calls it as a fallback
+    void destroy(void);
     ~Context();
   };  
 }
@@ -0,0 +1,77 @@
+#ifndef NGFX_DESCRIPTORS_H
+#define NGFX_DESCRIPTORS_H
+
+#include <vector>
+#include "vulkan/vulkan.hpp"
+#include "util.hpp"
+
+namespace ngfx
+{
+  namespace util
+  {
+    // Hands out descriptor sets from shared pools. A new pool is created
+    // whenever the current one runs out, sets are never freed one by one
+    // and reset() recycles every pool at once. Keep one allocator per frame
+    // in flight for sets rebuilt each frame, and a long lived one (see
+    // Context::descriptors) for static sets
+    class DescriptorAllocator
+    {
+      public:
+        static const uint32_t kSetsPerPool = 64;
+
+        DescriptorAllocator(void);
+        ~DescriptorAllocator(void);
+
+        void init(vk::Device *device);
+        vk::DescriptorSet allocate(vk::DescriptorSetLayout layout);
+        // Return every set to its pool, keeping the pools for reuse
+        void reset(void);
+        // Destroy all pools, needed before the device goes away
+        void destroy(void);
+
+      private:
+        vk::Device *_device;
+        vk::DescriptorPool _current;
+        std::vector<vk::DescriptorPool> _used;
+        std::vector<vk::DescriptorPool> _free;
+
+        vk::DescriptorPool nextPool(void);
+    };
+
+    // Writes every binding of a set in one call, reading descriptor infos
+    // from a packed struct at the offsets given in entries
+    vk::DescriptorUpdateTemplate createUpdateTemplate(
+        vk::Device *device,
+        vk::DescriptorSetLayout layout,
+        const vk::DescriptorUpdateTemplateEntry *entries,
+        uint32_t entryCount);
+
+    // Set 0 of env.vert. The camera binding is a dynamic uniform buffer so
+    // every camera lives in one buffer at its own offset
+    struct EnvDescriptors
+    {
+      vk::DescriptorBufferInfo camera;
+      vk::DescriptorBufferInfo palette;
+    };
+
+    void buildEnvDescriptorLayout(
+        vk::Device *device,
+        vk::DescriptorSetLayout *layout);
+
+    vk::DescriptorUpdateTemplate createEnvTemplate(
+        vk::Device *device,
+        vk::DescriptorSetLayout layout);
+
+    // Set 1 of points.vert, InstanceStream i is the storage buffer at
+    // binding i. Identical layouts are compatible, so pipelines and
+    // InstanceStreams each build their own
+    void buildInstanceStorageLayout(
+        vk::Device *device,
+        vk::DescriptorSetLayout *layout);
+
+    // Size of one camera slot in a dynamic camera buffer
+    vk::DeviceSize cameraStride(vk::PhysicalDevice *phys);
+  }
+}
+
+#endif //NGFX_DESCRIPTORS_H
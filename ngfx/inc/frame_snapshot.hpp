@@ -0,0 +1,61 @@
+#ifndef NGFX_FRAMESNAPSHOT_H
+#define NGFX_FRAMESNAPSHOT_H
+
+#include <vector>
+#include "glm/glm.hpp"
+#include "util.hpp"
+#include "pipeline.hpp"
+#include "camera.hpp"
+#include "triple_buffer.hpp"
+
+namespace ngfx
+{
+  // One overlay quad, offset in normalized screen coordinates
+  struct OverlayCommand
+  {
+    glm::vec2 offset;
+
+    bool operator==(const OverlayCommand &other) const
+    {
+      return offset == other.offset;
+    }
+  };
+
+  // Everything the render thread needs for a frame, immutable once
+  // published. Versions let the renderer skip uploads of unchanged state
+  struct FrameSnapshot
+  {
+    std::vector<glm::mat4> cameras;
+    uint64_t cameraVersion = 0;
+    // Raw stream contents, valid when the version is non zero
+    std::vector<uint8_t> streams[util::kInstanceStreamCount];
+    uint64_t streamVersions[util::kInstanceStreamCount] = {};
+    std::vector<OverlayCommand> overlay;
+  };
+
+  typedef util::TripleBuffer<FrameSnapshot> SnapshotBuffer;
+
+  // Writer side of a SnapshotBuffer, owned by the simulation or main
+  // thread. Setters change the pending state, publish() hands it to the
+  // render thread without blocking. Only state the target slot is missing
+  // is copied, so unchanged instance streams cost nothing per publish
+  class SnapshotPublisher
+  {
+    public:
+      SnapshotPublisher(SnapshotBuffer *buffer);
+
+      void setCameras(const std::vector<Camera> &cams);
+      void setStream(util::InstanceStream stream,
+                     const void *data,
+                     size_t bytes);
+      void setOverlay(const std::vector<OverlayCommand> &overlay);
+
+      void publish(void);
+
+    private:
+      SnapshotBuffer *_buffer;
+      FrameSnapshot _pending;
+  };
+}
+
+#endif //NGFX_FRAMESNAPSHOT_H
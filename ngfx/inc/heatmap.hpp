@@ -0,0 +1,109 @@
+#ifndef NGFX_HEATMAP_H
+#define NGFX_HEATMAP_H
+
+#include <vector>
+#include "vulkan/vulkan.hpp"
+#include "glm/glm.hpp"
+#include "context.hpp"
+#include "util.hpp"
+#include "camera.hpp"
+#include "camera_array.hpp"
+#include "instance_streams.hpp"
+
+namespace ngfx
+{
+  // Push constant block shared by heatmap_splat.comp and
+  // heatmap_tonemap.comp
+  struct HeatmapPushConstants
+  {
+    glm::vec4 instanceXform;
+    float alpha;
+    uint32_t instanceCount;
+    uint32_t radius;
+    float sigma;
+    float saturation;
+    uint32_t logScale;
+  };
+
+  struct HeatmapSettings
+  {
+    // Gaussian blur radius in pixels, 0 shows raw counts
+    uint32_t radius = 0;
+    float sigma = 1.0f;
+    // Density mapped to the top of the colormap
+    float saturation = 64.0f;
+    bool logScale = true;
+  };
+
+  // Density view for zoomed out cameras where bodies are sub-pixel. A
+  // compute pass splats every body into a per camera R32_UINT layer with
+  // atomic adds, a second one blurs, tone maps and colors the counts into
+  // RGBA8 layers. Cost grows with bodies and pixels, never with the shape.
+  //
+  // Reads positions from InstanceStreams of a pulled variant. Results are
+  // sampled through view(i), e.g. by Overlay, or copied into the targets
+  // of a CameraArray with recordCopy
+  struct Heatmap
+  {
+    uint32_t count;
+    vk::Extent2D extent;
+    util::ShaderVariant variant;
+    HeatmapSettings settings;
+
+    // One layer per camera
+    vk::Image countImage;
+    vk::DeviceMemory countMemory;
+    vk::ImageView countView;
+    vk::Image colorImage;
+    vk::DeviceMemory colorMemory;
+    vk::ImageView colorView;
+    // Single layer views of colorImage, in shader read only layout
+    // once the first record has executed
+    std::vector<vk::ImageView> layerViews;
+
+    std::vector<glm::mat4> camData;
+    util::FastBuffer camBuffer;
+
+    vk::DescriptorSetLayout descLayout;
+    vk::DescriptorSetLayout storageLayout;
+    // Allocated from Context::descriptors
+    vk::DescriptorSet descSet;
+    vk::PipelineLayout layout;
+    vk::Pipeline splatPipeline;
+    vk::Pipeline tonemapPipeline;
+
+    // Pointer to device, used for destructor
+    vk::Device *device;
+
+    Heatmap(
+        Context *c,
+        uint32_t count,
+        vk::Extent2D extent,
+        const util::ShaderVariant &variant);
+    ~Heatmap(void);
+
+    // Stage the matrices of count cameras, copied by the next record
+    void writeCameras(const std::vector<Camera> &cams);
+
+    // Clear, splat instanceCount bodies into every camera and tone map.
+    // alpha is only read by interpolating variants
+    void record(
+        vk::CommandBuffer cmd,
+        InstanceStreams *instances,
+        uint32_t instanceCount,
+        float alpha = 1.0f,
+        glm::vec4 instanceXform = glm::vec4(0.0, 0.0, 1.0, 1.0));
+
+    // Scale every layer into the matching camera target, see
+    // CameraArray::recordBlit
+    void recordCopy(vk::CommandBuffer cmd, CameraArray *cameras);
+
+    vk::ImageView view(uint32_t camera);
+
+    private:
+      void buildImages(Context *c);
+      void buildDescriptors(Context *c);
+  };
+}
+
+#endif //NGFX_HEATMAP_H
@@ -0,0 +1,130 @@
+#ifndef NGFX_INSTANCESTREAMS_H
+#define NGFX_INSTANCESTREAMS_H
+
+#include <vector>
+#include "vulkan/vulkan.hpp"
+#include "context.hpp"
+#include "util.hpp"
+#include "pipeline.hpp"
+
+namespace ngfx
+{
+  // SoA instance storage, one buffer and vertex binding per enabled
+  // util::InstanceStream. Streams are uploaded independently, so a
+  // simulation that moves bodies every step but recolors them rarely only
+  // pays for the position stream. Writers can fill the mapped staging
+  // memory of a stream directly instead of gathering into a temporary.
+  //
+  // With frames > 1 every stream also gets a staging buffer per frame in
+  // flight. map() and write() go to the staging of the frame selected by
+  // beginFrame() and recordUpload() copies from it, so writers never wait
+  // for other frames still reading the previous contents. The mapped
+  // memory then only holds what was written for that frame, and streams
+  // upload through recordUpload() alone
+  struct InstanceStreams
+  {
+    struct Staging
+    {
+      vk::Buffer buffer;
+      vk::DeviceMemory memory;
+      void *data;
+    };
+
+    util::ShaderVariant variant;
+    uint32_t capacity;
+    uint32_t frames;
+    util::FastBuffer streams[util::kInstanceStreamCount];
+    // Per frame staging of every enabled stream when frames > 1
+    std::vector<Staging> staging[util::kInstanceStreamCount];
+    // Imported host memory read in place of streams[i] when valid
+    util::HostBuffer shared[util::kInstanceStreamCount];
+    bool dirty[util::kInstanceStreamCount];
+
+    vk::Device *device;
+    vk::PhysicalDevice *phys;
+
+    // Pulled variants read the streams as storage buffers, see
+    // util::buildInstanceStorageLayout. One set per ePosition/ePrevious
+    // assignment, so tick() never rewrites a set in flight
+    vk::DescriptorSetLayout storageLayout;
+    vk::DescriptorSet storageSets[2];
+
+    InstanceStreams(
+        Context *c,
+        const util::ShaderVariant &variant,
+        uint32_t capacity,
+        uint32_t frames = 1);
+    ~InstanceStreams(void);
+
+    bool enabled(util::InstanceStream stream);
+
+    // Select the staging of a frame, once its fence has signalled
+    void beginFrame(uint32_t frame);
+    
+    // Mapped staging memory for the stream, call markDirty after writing
+    void *map(util::InstanceStream stream);
+    void markDirty(util::InstanceStream stream);
+    // Mark only instances [first, first + count) of the stream
+    void markDirty(util::InstanceStream stream, uint32_t first, uint32_t count);
+    
+    // Copy capacity elements from data and mark the stream dirty
+    void write(util::InstanceStream stream, void *data);
+
+    // Read the stream straight from caller owned memory holding at least
+    // sharedSize(stream) bytes, see util::HostBuffer. Returns false when
+    // the memory cannot be imported and write() has to be used instead.
+    // Positions of interpolating variants are never shared. Pulled
+    // variants rewrite their storage sets, so share before recording
+    bool share(util::InstanceStream stream, void *host);
+    vk::DeviceSize sharedSize(util::InstanceStream stream);
+
+    // Transfer every dirty stream in a single submit and clear the flags.
+    // Streams with partial ranges pending should use recordUpload instead.
+    // Not available with frames > 1
+    void upload(vk::Queue q);
+
+    // Record the dirty ranges of every stream into the frame's transfer
+    // command buffer. Returns the number of dirty bytes, written in place
+    // by direct streams
+    vk::DeviceSize recordUpload(vk::CommandBuffer cmd);
+
+    // Bind enabled streams to consecutive bindings, matching the layout
+    // produced by util::buildVertexInput
+    void bind(vk::CommandBuffer cmd, uint32_t firstBinding);
+    // Pulled variants bind the storage set instead, at index set of layout
+    void bindStorage(
+        vk::CommandBuffer cmd,
+        vk::PipelineLayout layout,
+        uint32_t set,
+        vk::PipelineBindPoint point = vk::PipelineBindPoint::eGraphics);
+
+    // Interpolating variants keep the positions of the last two ticks
+    // resident. tick() writes capacity new positions over the older
+    // buffer and swaps which one binds as current, so a tick uploads once
+    // and rendered frames only change the alpha push constant. time is in
+    // any unit, as long as alpha() is given the same clock
+    void tick(void *positions, double time);
+
+    // Blend factor for a frame drawn at now. Interpolation lags one tick
+    // and moves from the previous to the current positions over a tick
+    // period. Extrapolation starts at the current positions and projects
+    // forward, up to kMaxExtrapolation
+    float alpha(double now, bool extrapolate = false);
+    static constexpr double kMaxExtrapolation = 2.0;
+
+    double previousTime;
+    double currentTime;
+    uint64_t ticks;
+
+  private:
+    // ePosition and ePrevious trade buffers on every tick
+    bool _swapped;
+    uint32_t _frame;
+    uint32_t slot(util::InstanceStream stream);
+    uint32_t slot(util::InstanceStream stream, bool swapped);
+    void writeStorage(void);
+    vk::BufferUsageFlags usage(void);
+  };
+}
+
+#endif //NGFX_INSTANCESTREAMS_H
@@ -0,0 +1,103 @@
+#ifndef NGFX_LOD_H
+#define NGFX_LOD_H
+
+#include <vector>
+#include "vulkan/vulkan.hpp"
+#include "glm/glm.hpp"
+#include "util.hpp"
+#include "pipeline.hpp"
+#include "camera.hpp"
+#include "instance_streams.hpp"
+
+namespace ngfx
+{
+  struct LodSettings
+  {
+    // Nodes whose cell projects below this many pixels draw as one
+    // aggregate impostor
+    float pixelThreshold = 2.0f;
+    // Nodes with at most this many bodies are not split further
+    uint32_t leafSize = 8;
+  };
+
+  struct LodNode
+  {
+    // Mass weighted centroid of the bodies below
+    glm::vec2 center;
+    // Square quadtree cell
+    glm::vec2 cellMin;
+    float side;
+    float mass;
+    // Mass weighted mean RGBA8 color
+    uint32_t color;
+    // Range of sorted bodies below the node
+    uint32_t first;
+    uint32_t count;
+    // Non empty children are stored consecutively from child
+    uint32_t child;
+    uint32_t childCount;
+  };
+
+  // Quadtree over instance positions for cameras that see whole clusters.
+  // build() sorts bodies by Morton code with a linear radix sort and links
+  // a node per occupied cell, so a full rebuild every simulation step is
+  // O(n) and keeps bodies of a cell contiguous. select() walks the tree
+  // for one camera and emits a body per visible leaf body, or one
+  // aggregate per node smaller than LodSettings::pixelThreshold, so the
+  // instances drawn follow on-screen detail instead of the body count.
+  //
+  // Mass is scale squared, one without scales, and an aggregate is drawn
+  // with scale sqrt(mass) so it covers the summed area of its bodies
+  struct LodTree
+  {
+    static const uint32_t kMaxLevel = 16;
+
+    LodSettings settings;
+    std::vector<LodNode> nodes;
+
+    // Rebuild from count float32 positions. colors are RGBA8 and scales
+    // per body factors, either may be null
+    void build(
+        const glm::vec2 *positions,
+        uint32_t count,
+        const uint32_t *colors = nullptr,
+        const float *scales = nullptr);
+
+    // Write at most maxCount instances seen by a camera with matrix cam
+    // rendering extent pixels. Returns the number written, colors and
+    // scales may be null
+    uint32_t select(
+        const glm::mat4 &cam,
+        vk::Extent2D extent,
+        uint32_t maxCount,
+        glm::vec2 *positions,
+        uint32_t *colors,
+        float *scales);
+
+    // Select for every camera into consecutive ranges of out, which must
+    // be a float32 variant with RGBA8 colors when colored. ranges[i] is
+    // the range of camera i, for CameraArray::record. Marks the written
+    // streams dirty and returns the total
+    uint32_t select(
+        const std::vector<Camera> &cams,
+        vk::Extent2D extent,
+        InstanceStreams *out,
+        util::InstanceRange *ranges);
+
+    private:
+      std::vector<uint32_t> _keys;
+      std::vector<uint32_t> _order;
+      std::vector<uint32_t> _scratchKeys;
+      std::vector<uint32_t> _scratchOrder;
+      std::vector<uint32_t> _stack;
+      // Bodies in Morton order
+      std::vector<glm::vec2> _positions;
+      std::vector<uint32_t> _colors;
+      std::vector<float> _masses;
+
+      void sortKeys(void);
+      void buildNode(uint32_t index, uint32_t level);
+  };
+}
+
+#endif //NGFX_LOD_H
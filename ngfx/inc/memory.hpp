@@ -0,0 +1,136 @@
+#ifndef NGFX_MEMORY_H
+#define NGFX_MEMORY_H
+
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <utility>
+#include "ngfx.hpp"
+
+namespace ngfx
+{
+  namespace util
+  {
+    // What an allocation is for, used to break usage down by subsystem
+    enum class MemoryTag
+    {
+      eOther,
+      eGeometry,
+      eInstances,
+      eCameras,
+      eReadback,
+      eTextures
+    };
+    static const uint32_t kMemoryTagCount = 6;
+
+    const char *memoryTagName(MemoryTag tag);
+
+    struct MemoryCounter
+    {
+      vk::DeviceSize bytes = 0;
+      vk::DeviceSize highWater = 0;
+      uint32_t allocations = 0;
+    };
+
+    // What to do when an allocation would take a heap over its budget.
+    // Allocations are always attempted, eEvict only gives the callbacks
+    // registered with onEvict() a chance to make room first. Callbacks also
+    // run when an allocation fails with out of device memory
+    enum class BudgetPolicy
+    {
+      eWarn,
+      eEvict
+    };
+
+    // Called with the heap index and the bytes wanted, returns the bytes
+    // it released. Runs on the allocating thread without the tracker lock,
+    // so owners must not free concurrently with allocations on the device.
+    // FastBuffer::makeStatic registers one for its staging memory
+    typedef std::function<vk::DeviceSize(uint32_t, vk::DeviceSize)>
+      EvictCallback;
+
+    // Device memory accounting for one device, per heap, memory type and
+    // MemoryTag. Heap budgets and usage come from VK_EXT_memory_budget when
+    // enabled, otherwise kDefaultBudget of each heap and the tracked bytes
+    class MemoryTracker
+    {
+      public:
+        static constexpr double kDefaultBudget = 0.8;
+
+        BudgetPolicy policy = BudgetPolicy::eWarn;
+
+        MemoryTracker(void);
+        ~MemoryTracker(void);
+
+        // Registers the tracker for util::allocateMemory on device
+        void init(vk::PhysicalDevice *phys,
+                  vk::Device *device,
+                  bool memoryBudget);
+        static MemoryTracker *find(vk::Device device);
+
+        vk::Result allocate(const vk::MemoryAllocateInfo &info,
+                            MemoryTag tag,
+                            vk::DeviceMemory *memory);
+        void free(vk::DeviceMemory memory);
+
+        // Whether bytes more of memoryType keep its heap within budget
+        bool fits(uint32_t memoryType, vk::DeviceSize bytes);
+        // Returns an id for removeEvict(), called before the owner is gone
+        uint32_t onEvict(EvictCallback callback);
+        void removeEvict(uint32_t id);
+
+        vk::DeviceSize heapBudget(uint32_t heap);
+        vk::DeviceSize heapUsage(uint32_t heap);
+        const MemoryCounter &heap(uint32_t heap) { return _heaps[heap]; }
+        const MemoryCounter &type(uint32_t type) { return _types[type]; }
+        const MemoryCounter &tag(MemoryTag tag)
+        {
+          return _tags[static_cast<uint32_t>(tag)];
+        }
+
+        // Human readable table of usage, budgets and high-water marks
+        void report(std::ostream &out);
+
+      private:
+        struct Allocation
+        {
+          vk::DeviceSize size;
+          uint32_t type;
+          MemoryTag tag;
+        };
+
+        vk::PhysicalDevice *_phys;
+        vk::Device *_device;
+        // Registry key, the Context clears device before the tracker dies
+        VkDevice _handle;
+        bool _memoryBudget;
+        vk::PhysicalDeviceMemoryProperties _props;
+        std::mutex _lock;
+        std::unordered_map<VkDeviceMemory, Allocation> _allocations;
+        std::vector<MemoryCounter> _heaps;
+        std::vector<MemoryCounter> _types;
+        MemoryCounter _tags[kMemoryTagCount];
+        std::vector<bool> _overBudget;
+        std::vector<std::pair<uint32_t, EvictCallback>> _evict;
+        uint32_t _nextEvict;
+
+        // Driver reported budget and usage, refreshed on every query
+        void queryBudget(vk::DeviceSize *budget, vk::DeviceSize *usage);
+        bool fitsLocked(uint32_t heap, vk::DeviceSize bytes);
+        vk::DeviceSize makeRoom(uint32_t heap, vk::DeviceSize bytes);
+    };
+
+    // Allocate through the device's MemoryTracker, or directly when the
+    // device has none
+    vk::Result allocateMemory(
+        vk::Device *device,
+        const vk::MemoryAllocateInfo &info,
+        MemoryTag tag,
+        vk::DeviceMemory *memory);
+
+    void freeMemory(vk::Device *device, vk::DeviceMemory memory);
+  }
+}
+
+#endif //NGFX_MEMORY_H
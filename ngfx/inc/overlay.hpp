@@ -4,6 +4,8 @@
 #include "vulkan/vulkan.hpp"
 #include "context.hpp"
 #include "swap_data.hpp"
+#include "bindless.hpp"
+#include "descriptors.hpp"
 
 namespace ngfx
 {
@@ -19,25 +21,36 @@ namespace ngfx
       vk::PipelineLayout layout;
       vk::Pipeline pipeline;
       vk::DescriptorSetLayout descLayout;
-      vk::DescriptorPool descPool;
+      vk::DescriptorUpdateTemplate descTemplate;
+      // Allocated from Context::descriptors
       vk::DescriptorSet descSet;
 
       // current image view used by overlay
       vk::ImageView view;
 
+      // When set, view is bindless texture and layout is the shared
+      // bindless layout
+      Bindless *bindless;
+      uint32_t texture;
+
       // Pointer for device held for use in destructor only
       // Pointer must stay valid for lifetime
       vk::Device *device;
 
-      Overlay(Context *c, SwapData *s, vk::ImageView v);
+      Overlay(Context *c,
+              SwapData *s,
+              vk::ImageView v,
+              Bindless *bindless = nullptr);
 
+      // Sample a different image. Without bindless the set must not be
+      // in use by pending command buffers
       void updateSampler(vk::ImageView view);
 
       ~Overlay();
 
     private:
-      void createDescriptorPool(void);
-      void createDescriptorSets(void);
+      void buildDescriptors(void);
+      void createDescriptorSets(Context *c);
   };
 }
 
@@ -0,0 +1,59 @@
+#ifndef NGFX_PACK_H
+#define NGFX_PACK_H
+
+#include "ngfx.hpp"
+#include "util.hpp"
+
+// CPU side packers for the compact instance layouts in util.hpp.
+// The inner loops are branch free so they vectorize, and use F16C/SSE2
+// directly where the compiler target allows it
+namespace ngfx
+{
+  namespace util
+  {
+    static const uint32_t kPaletteSize = 256;
+
+    // A run of instances sharing one decode transform. xform is pushed as
+    // EnvPushConstants::instanceXform when drawing [first, first + count)
+    struct PackedChunk
+    {
+      glm::vec4 xform;
+      uint32_t first;
+      uint32_t count;
+    };
+
+    uint16_t floatToHalf(float f);
+
+    // Positions relative to origin, stored as half floats.
+    // Returns the chunk transform (origin, unit scale)
+    PackedChunk packHalf(
+        const Instance *src,
+        uint32_t count,
+        glm::vec2 origin,
+        InstanceHalf *dst);
+
+    // Quantize positions to snorm16 in chunks of chunkSize instances, each
+    // with its own bounds. chunks must hold ceil(count / chunkSize) entries.
+    // Returns the number of chunks written
+    uint32_t packSnorm(
+        const Instance *src,
+        uint32_t count,
+        uint32_t chunkSize,
+        InstanceSnorm *dst,
+        PackedChunk *chunks);
+
+    // Map a scalar per instance (mass, speed...) linearly onto palette
+    // indices, clamping to [min, max]
+    void packPalette(
+        const float *src,
+        uint32_t count,
+        float min,
+        float max,
+        InstancePalette *dst);
+
+    // Fill a kPaletteSize entry palette with a ramp between two colors
+    void buildPalette(glm::vec4 from, glm::vec4 to, glm::vec4 *palette);
+  }
+}
+
+#endif //NGFX_PACK_H
@@ -0,0 +1,91 @@
+#ifndef NGFX_PICK_H
+#define NGFX_PICK_H
+
+#include <deque>
+#include <vector>
+#include "vulkan/vulkan.hpp"
+#include "context.hpp"
+#include "camera_array.hpp"
+#include "scene.hpp"
+
+namespace ngfx
+{
+  struct PickRequest
+  {
+    // Camera of a CameraArray, ignored for the Scene
+    uint32_t target;
+    // Pixel rect, clamped to the image. Rects over maxPixels keep their
+    // top left corner and are cut to at most maxPixels wide, then to the
+    // rows that fit
+    int32_t x;
+    int32_t y;
+    uint32_t width = 1;
+    uint32_t height = 1;
+    // Returned with the result, e.g. to drop stale hover requests
+    uint64_t tag = 0;
+  };
+
+  struct PickResult
+  {
+    PickRequest request;
+    // Row major over the clamped rect, 0 for background, otherwise the
+    // instance index + 1. Instance indices count from the start of the
+    // streams drawn, so they are selection indices for LodTree ranges
+    std::vector<uint32_t> ids;
+  };
+
+  // Asynchronous readback of the R32_UINT pick attachment written by
+  // pickIds variants. Requests are copied into one of a few small host
+  // visible slots after the pass, and each slot signals a vk::Event once
+  // copied, so poll() never waits on a fence. Results arrive a frame or
+  // two later, exact for whatever was drawn, interpolated or culled
+  class PickReadback
+  {
+    public:
+      PickReadback(
+          Context *c,
+          uint32_t slots = 3,
+          uint32_t maxPixels = 4096);
+      ~PickReadback(void);
+
+      // Queued until the next record with a free slot
+      void request(const PickRequest &r);
+
+      // Copy queued requests after the passes have been recorded
+      void record(vk::CommandBuffer cmd, CameraArray *cameras);
+      // frame is the swapchain image the scene pass rendered
+      void record(vk::CommandBuffer cmd, Scene *scene, uint32_t frame);
+
+      // Append the results of every completed slot
+      void poll(std::vector<PickResult> *out);
+
+    private:
+      struct Slot
+      {
+        vk::Event event;
+        bool pending = false;
+        std::vector<PickRequest> requests;
+        // Offsets in pixels from the start of the slot
+        std::vector<uint32_t> offsets;
+      };
+
+      void record(
+          vk::CommandBuffer cmd,
+          const vk::Image *images,
+          uint32_t imageCount,
+          vk::Extent2D extent);
+
+      uint32_t _maxPixels;
+      std::vector<Slot> _slots;
+      std::deque<PickRequest> _queue;
+
+      vk::Buffer _buffer;
+      vk::DeviceMemory _memory;
+      uint32_t *_data;
+
+      // Pointer to device, used for destructor
+      vk::Device *_device;
+  };
+}
+
+#endif //NGFX_PICK_H
@@ -1,18 +1,115 @@
 #ifndef NGFX_PIPELINE_H
 #define NGFX_PIPELINE_H
 
+#include <vector>
 #include "vulkan/vulkan.hpp"
 
 namespace ngfx
 {
   namespace util
   {
+    // Layout of the per-instance position attribute, decoded in env.vert
+    enum class InstanceFormat : uint32_t
+    {
+      eFloat32 = 0, // absolute position
+      eFloat16 = 1, // position relative to a tile origin
+      eSnorm16 = 2, // quantized position with per-chunk scale/offset
+    };
+
+    // Layout of the optional per-instance color attribute
+    enum class ColorFormat : uint32_t
+    {
+      eRgba8 = 0,    // R8G8B8A8_UNORM color
+      ePalette8 = 1, // R8_UNORM index into the palette uniform
+    };
+
+    // Compile time shader variant. Each field maps to a specialization
+    // constant (see constant_id in env.vert/overlay.vert), so the driver can
+    // strip unused attributes and fold the camera index for each pipeline
+    struct ShaderVariant
+    {
+      // Matrices in the camera uniform, CAMERA_COUNT. Chosen by the owner
+      // of the pipeline, not the caller: CameraArray and Scene bind each
+      // camera at its own dynamic offset and use 1, CameraAtlas binds
+      // groups of CameraAtlas::kGroup
+      uint32_t cameraCount = 1;
+      InstanceFormat instanceFormat = InstanceFormat::eFloat32;
+      bool instanceColor = false;
+      ColorFormat colorFormat = ColorFormat::eRgba8;
+      bool instanceRotation = false;
+      bool instanceVelocity = false;
+      bool instanceScale = false;
+      // Blend the previous and current positions by the alpha push
+      // constant, see InstanceStreams::tick
+      bool interpolate = false;
+      // Draw from points.vert without vertex or index buffers, pulling
+      // instance streams from storage buffers. ePointList draws one point
+      // per instance, any other topology a quad of spriteSize half extent
+      bool pulled = false;
+      float spriteSize = 0.05f;
+      // Also write instance + 1 into an R32_UINT attachment for GPU
+      // picking, see PickReadback
+      bool pickIds = false;
+      vk::PrimitiveTopology topology = vk::PrimitiveTopology::eLineList;
+    };
+
+    // Per-instance attributes are stored SoA, one vertex binding per
+    // stream, so streams that change at different rates upload separately.
+    // Env.vert reads stream i at location 3 + i
+    enum class InstanceStream : uint32_t
+    {
+      ePosition = 0,
+      eColor = 1,
+      eRotation = 2,
+      eVelocity = 3,
+      eScale = 4,
+      // Positions of the previous simulation tick, same format as ePosition
+      ePrevious = 5,
+    };
+    static const uint32_t kInstanceStreamCount = 6;
+
+    // Instances [first, first + count) of the streams
+    struct InstanceRange
+    {
+      uint32_t first;
+      uint32_t count;
+    };
+
+    bool streamEnabled(const ShaderVariant &variant, InstanceStream stream);
+    uint32_t streamStride(const ShaderVariant &variant, InstanceStream stream);
+
+    // Vertices drawn per instance by a pulled variant
+    uint32_t pulledVertexCount(const ShaderVariant &variant);
+
+    // Vertex input state for a variant. Binding 0 holds util::Vertex,
+    // binding 1 the instance positions, followed by one binding per enabled
+    // stream in InstanceStream order
+    struct VertexInput
+    {
+      std::vector<vk::VertexInputBindingDescription> bindings;
+      std::vector<vk::VertexInputAttributeDescription> attributes;
+    };
+
+    uint32_t instanceStride(InstanceFormat format);
+
+    // Start from the float32 base descriptions, patch the instance position
+    // format and append the streams enabled by the variant. Disabled
+    // streams read the position binding, so every env.vert input is backed
+    void buildVertexInput(
+        const ShaderVariant &variant,
+        const vk::VertexInputBindingDescription *baseBindings,
+        size_t baseBindingCount,
+        const vk::VertexInputAttributeDescription *baseAttributes,
+        size_t baseAttributeCount,
+        VertexInput *input);
+
     void buildLayout(
         vk::Device *device,
         size_t descLayoutCount,
         vk::DescriptorSetLayout *descLayouts,
         size_t pushSize,
-        vk::PipelineLayout *pipelineLayout);
+        vk::PipelineLayout *pipelineLayout,
+        vk::ShaderStageFlags pushStages = vk::ShaderStageFlagBits::eVertex);
 
     void buildPipeline(
         vk::Device *device,
@@ -23,10 +120,24 @@ namespace ngfx
         size_t attributeSize,
         const std::string &vertPath,
         const std::string &fragPath,
-        bool overlay,
+        const ShaderVariant &variant,
         vk::PipelineLayout *pipelineLayout,
         vk::RenderPass *renderPass,
         vk::PipelineCache *cache,
+        vk::Pipeline *pipeline,
+        uint32_t viewportCount = 1);
+
+    // Dynamic state of buildPipeline pipelines, drawing into the top left
+    // extent of the target
+    void setViewport(vk::CommandBuffer cmd, vk::Extent2D extent);
+
+    // Compute pipeline specialized with the same constants as buildPipeline
+    void buildComputePipeline(
+        vk::Device *device,
+        const std::string &compPath,
+        const ShaderVariant &variant,
+        vk::PipelineLayout *pipelineLayout,
+        vk::PipelineCache *cache,
         vk::Pipeline *pipeline);
   }
 }
@@ -0,0 +1,103 @@
+#ifndef NGFX_POINTRASTER_H
+#define NGFX_POINTRASTER_H
+
+#include <vector>
+#include "vulkan/vulkan.hpp"
+#include "glm/glm.hpp"
+#include "context.hpp"
+#include "util.hpp"
+#include "camera.hpp"
+#include "camera_array.hpp"
+#include "instance_streams.hpp"
+
+namespace ngfx
+{
+  // Push constant block shared by point_raster.comp and point_resolve.comp
+  struct PointRasterPushConstants
+  {
+    glm::vec4 instanceXform;
+    float alpha;
+    uint32_t instanceCount;
+    uint32_t width;
+    uint32_t height;
+  };
+
+  // Compute rasterizer for bodies smaller than a pixel, where the fixed
+  // function path spends most of its time on primitive setup. Each body is
+  // projected by one invocation per camera and written as a single pixel
+  // with an atomic max over (draw order, color) keys, then resolved into
+  // RGBA8 layers. With Context::atomicInt64 the keys are 64 bit and keep
+  // exact draw order, otherwise order is quantized to 8 bits.
+  //
+  // Reads InstanceStreams of a pulled variant, shapes are ignored. Results
+  // go to cameras with recordCopy or are sampled through view(i)
+  struct PointRaster
+  {
+    uint32_t count;
+    vk::Extent2D extent;
+    util::ShaderVariant variant;
+    // 64 bit keys, see Context::atomicInt64
+    bool wide;
+
+    // count * extent keys, one per pixel per camera
+    vk::Buffer targetBuffer;
+    vk::DeviceMemory targetMemory;
+    vk::DeviceSize targetSize;
+    vk::Image colorImage;
+    vk::DeviceMemory colorMemory;
+    vk::ImageView colorView;
+    // Single layer views of colorImage, in shader read only layout
+    // once the first record has executed
+    std::vector<vk::ImageView> layerViews;
+
+    std::vector<glm::mat4> camData;
+    util::FastBuffer camBuffer;
+
+    vk::DescriptorSetLayout descLayout;
+    vk::DescriptorSetLayout storageLayout;
+    // Allocated from Context::descriptors
+    vk::DescriptorSet descSet;
+    vk::PipelineLayout layout;
+    vk::Pipeline rasterPipeline;
+    vk::Pipeline resolvePipeline;
+
+    // Pointer to device, used for destructor
+    vk::Device *device;
+
+    PointRaster(
+        Context *c,
+        uint32_t count,
+        vk::Extent2D extent,
+        const util::ShaderVariant &variant);
+    ~PointRaster(void);
+
+    // Whether count cameras of extent fit one target binding
+    // (maxStorageBufferRange) and one layered image (maxImageArrayLayers).
+    // The constructor throws otherwise
+    static bool fits(Context *c, uint32_t count, vk::Extent2D extent);
+
+    // Stage the matrices of count cameras, copied by the next record
+    void writeCameras(const std::vector<Camera> &cams);
+
+    // Clear, rasterize instanceCount bodies into every camera and resolve.
+    // alpha is only read by interpolating variants
+    void record(
+        vk::CommandBuffer cmd,
+        InstanceStreams *instances,
+        uint32_t instanceCount,
+        float alpha = 1.0f,
+        glm::vec4 instanceXform = glm::vec4(0.0, 0.0, 1.0, 1.0));
+
+    // Copy every layer into the matching camera target, see
+    // CameraArray::recordBlit
+    void recordCopy(vk::CommandBuffer cmd, CameraArray *cameras);
+
+    vk::ImageView view(uint32_t camera);
+
+    private:
+      void buildTargets(Context *c);
+      void buildDescriptors(Context *c);
+  };
+}
+
+#endif //NGFX_POINTRASTER_H
@@ -0,0 +1,164 @@
+#ifndef NGFX_RENDERER_H
+#define NGFX_RENDERER_H
+
+#include <memory>
+#include "vulkan/vulkan.hpp"
+#include "context.hpp"
+#include "util.hpp"
+#include "camera.hpp"
+#include "camera2d.hpp"
+#include "camera_array.hpp"
+#include "instance_streams.hpp"
+#include "heatmap.hpp"
+#include "trails.hpp"
+#include "lod.hpp"
+#include "resolution.hpp"
+#include "pick.hpp"
+
+namespace ngfx
+{
+  struct RendererConfig
+  {
+    // Physical device override, see util::pickPhysicalDevice
+    const char *device = nullptr;
+    uint32_t cameraCount = 1;
+    vk::Extent2D extent = vk::Extent2D(256, 256);
+    util::ShaderVariant variant;
+    uint32_t instanceCapacity = 1024;
+    // Shape drawn per instance, a triangle outline when null
+    const util::Vertex *vertices = nullptr;
+    uint32_t vertexCount = 0;
+    const uint16_t *indices = nullptr;
+    uint32_t indexCount = 0;
+    // Render density heatmaps instead of shapes, see Heatmap. Implies a
+    // pulled variant
+    bool heatmap = false;
+    // Keep this many past positions per body and draw them as trails, see
+    // Trails. 0 disables, otherwise implies a pulled variant
+    uint32_t trailLength = 0;
+    // Draw each camera from a LodTree selection instead of every body.
+    // Needs float32 positions, RGBA8 colors when colored, and no
+    // interpolation, rotation or velocity streams
+    bool lod = false;
+    LodSettings lodSettings;
+    // Instances selected over all cameras per frame, instanceCapacity
+    // when 0. Cameras past it draw fewer bodies
+    uint32_t lodCapacity = 0;
+    // GPU time of the camera passes to hold by lowering their resolution,
+    // see ResolutionController. Devices without timestamps hold the host
+    // time of the whole render instead. 0 always renders at extent
+    double frameBudgetMs = 0.0;
+    // Drive every camera with an orthographic Camera2D, see camera2D().
+    // camera() is overwritten on each render
+    bool camera2D = false;
+  };
+
+  // Embedding API for linking ngfx into a simulation. Owns a headless
+  // Context and renders every camera offscreen into host readable frames.
+  //
+  // Instance streams are either written by copy or shared: the simulation
+  // allocates its arrays with allocateStream() and the GPU reads them in
+  // place through VK_EXT_external_memory_host, so a step costs no upload.
+  // Shared arrays must not be written while render() runs. render() is
+  // blocking, so calling it between simulation steps is enough
+  class Renderer
+  {
+    public:
+      Renderer(const RendererConfig &config);
+      ~Renderer(void);
+
+      // Memory for a stream that can be passed to shareStream, null when
+      // the stream is not enabled by the variant. Free with freeStream
+      void *allocateStream(util::InstanceStream stream);
+      static void freeStream(void *host);
+
+      // Render the stream from host memory instead of its own buffer.
+      // Returns true when imported. Otherwise the memory is copied on
+      // every render(), which still saves a separate write() call
+      bool shareStream(util::InstanceStream stream, void *host);
+      // Copy capacity elements, uploaded on the next render()
+      void writeStream(util::InstanceStream stream, void *data);
+      // Copy instances [first, first + count)
+      void writeStream(
+          util::InstanceStream stream,
+          const void *data,
+          uint32_t first,
+          uint32_t count);
+
+      // Positions of a simulation step taken at time, for variants with
+      // interpolate set. Frames then blend the last two steps by alpha()
+      void tick(void *positions, double time);
+      float alpha(double now, bool extrapolate = false);
+
+      uint32_t cameraCount(void);
+      Camera &camera(uint32_t i);
+      // Only valid when RendererConfig::camera2D was set
+      Camera2D &camera2D(uint32_t i);
+
+      // Draw instanceCount instances into every camera and read back.
+      // alpha blends ticked positions, see alpha()
+      void render(uint32_t instanceCount, float alpha = 1.0f);
+
+      // RGBA8 image of a camera from the last render, tightly packed at
+      // frameExtent(). Below extent when a frame budget is set
+      const uint8_t *frame(uint32_t camera);
+      // Bytes of frame(), frameRowBytes() rows of frameExtent().height
+      vk::DeviceSize frameSize(void);
+      uint32_t frameRowBytes(void);
+      vk::Extent2D frameExtent(void);
+
+      Context &context(void);
+      // Null unless RendererConfig::heatmap was set
+      Heatmap *heatmap(void);
+      // Null unless RendererConfig::trailLength was set. setLength changes
+      // the drawn length up to the configured one without reallocating
+      Trails *trails(void);
+      // Null unless RendererConfig::lod was set
+      LodTree *lod(void);
+
+      // Read instance ids under a rect of a camera, for pickIds variants.
+      // Requests are copied by the next render() and returned by
+      // pollPicks() once it has completed
+      void pick(const PickRequest &r);
+      void pollPicks(std::vector<PickResult> *out);
+
+    private:
+      // Latest host copy of a stream, shared memory or _lodStreams
+      const void *hostStream(util::InstanceStream stream);
+
+      Context c;
+      util::ShaderVariant _variant;
+      uint32_t _indexCount;
+      std::unique_ptr<util::FastBuffer> _vertices;
+      std::unique_ptr<util::FastBuffer> _indices;
+      std::unique_ptr<InstanceStreams> _instances;
+      std::unique_ptr<CameraArray> _cameras;
+      // Empty unless RendererConfig::camera2D, copied into _cameras
+      std::vector<Camera2D> _cameras2D;
+      std::unique_ptr<Heatmap> _heatmap;
+      std::unique_ptr<ResolutionController> _resolution;
+      std::unique_ptr<Trails> _trails;
+      // Null unless the variant has pickIds
+      std::unique_ptr<PickReadback> _pick;
+      // Positions changed since the last trail append
+      bool _trailPending;
+      std::unique_ptr<LodTree> _lod;
+      // Per camera selections of _lod, drawn instead of _instances
+      std::unique_ptr<InstanceStreams> _lodInstances;
+      std::vector<util::InstanceRange> _lodRanges;
+      // Copies of written streams kept for the lod build when lod is set.
+      // Mapped stream memory can be write combined device memory, too
+      // slow to read every position from each render
+      std::vector<uint8_t> _lodStreams[util::kInstanceStreamCount];
+      // Caller memory passed to shareStream, read by the lod build
+      void *_hosts[util::kInstanceStreamCount];
+      // Shared streams the device could not import, copied every render
+      void *_copied[util::kInstanceStreamCount];
+
+      vk::CommandPool _pool;
+      vk::CommandBuffer _cmd;
+      vk::Fence _fence;
+  };
+}
+
+#endif //NGFX_RENDERER_H
@@ -0,0 +1,81 @@
+#ifndef NGFX_RESOLUTION_H
+#define NGFX_RESOLUTION_H
+
+#include <deque>
+#include "vulkan/vulkan.hpp"
+#include "context.hpp"
+#include "camera_array.hpp"
+
+namespace ngfx
+{
+  struct ResolutionSettings
+  {
+    // GPU time of the bracketed passes to hold
+    double targetMs = 8.0;
+    // Render extent per axis as a fraction of the targets
+    float minScale = 0.25f;
+    float maxScale = 1.0f;
+    // Relative error left alone, keeps the extent from flickering
+    double tolerance = 0.03;
+    // Weight of a new sample in the smoothed time
+    double smoothing = 0.3;
+    // Largest change of rendered pixels per resize
+    double maxStep = 2.0;
+  };
+
+  // Dynamic resolution for a CameraArray. Timestamps around the camera
+  // passes measure GPU time, and the rendered pixel count is scaled by
+  // target / measured, so the time converges in a step or two when pass
+  // time is dominated by pixels. Only CameraArray::renderExtent changes,
+  // nothing is reallocated.
+  //
+  // Timings are read without waiting, a frame or more late. Samples of
+  // frames recorded before a resize are dropped, so the controller never
+  // reacts twice to the same error
+  class ResolutionController
+  {
+    public:
+      ResolutionController(
+          Context *c,
+          CameraArray *cameras,
+          const ResolutionSettings &settings = ResolutionSettings(),
+          uint32_t framesInFlight = 3);
+      ~ResolutionController(void);
+
+      // Bracket the passes of the frame using slot frame, in
+      // [0, framesInFlight). Outside render passes
+      void begin(vk::CommandBuffer cmd, uint32_t frame);
+      void end(vk::CommandBuffer cmd, uint32_t frame);
+
+      // Feed every finished timing to the controller. Returns true when
+      // the render extent changed
+      bool update(void);
+      // Feed a timing measured elsewhere, e.g. without timestamp support
+      bool update(double gpuMs);
+
+      ResolutionSettings settings;
+      float scale;
+      // Smoothed GPU time, negative before the first sample
+      double filteredMs;
+      // False when the queue cannot write timestamps, begin() and end()
+      // then record nothing and update(double) is the only input
+      bool timestamps;
+
+    private:
+      void apply(void);
+
+      CameraArray *_cameras;
+      vk::QueryPool _queries;
+      double _periodMs;
+      uint64_t _mask;
+      // Slots in recording order, with the resize count they were
+      // recorded under
+      std::deque<std::pair<uint32_t, uint64_t>> _recorded;
+      uint64_t _resizes;
+
+      // Pointer to device, used for destructor
+      vk::Device *_device;
+  };
+}
+
+#endif //NGFX_RESOLUTION_H
@@ -6,6 +6,9 @@
 #include "swap_data.hpp"
 #include "util.hpp"
 #include "camera.hpp"
+#include "pipeline.hpp"
+#include "bindless.hpp"
+#include "descriptors.hpp"
 
 namespace ngfx
 {
@@ -15,27 +18,42 @@ namespace ngfx
     static vk::VertexInputBindingDescription binding[];
     vk::RenderPass pass;
     std::vector<vk::Framebuffer> frames;
+    vk::Extent2D extent;
+    // R32_UINT pick attachment per swapchain image of pickIds variants
+    std::vector<vk::Image> idImages;
+    std::vector<vk::ImageView> idViews;
+    std::vector<vk::DeviceMemory> idMemory;
     vk::PipelineLayout layout;
     vk::Pipeline pipeline;
+    util::ShaderVariant variant;
     util::Mvp mvp;
     
     Camera cam;
     util::FastBuffer camBuffer;
 
     vk::DescriptorSetLayout descLayout;
-    vk::DescriptorPool descPool;
+    vk::DescriptorUpdateTemplate descTemplate;
+    // Allocated from Context::descriptors
     vk::DescriptorSet descSet;
 
+    // When set, cam lives in bindless slot camera and layout is the shared
+    // bindless layout
+    Bindless *bindless;
+    uint32_t camera;
+
     // Pointer for device held for use in destructor only
     // Pointer must stay valid for lifetime
     vk::Device *device;
     vk::Queue *q;
-    Scene(Context *c, SwapData *s);
+    Scene(Context *c,
+          SwapData *s,
+          const util::ShaderVariant &variant = util::ShaderVariant(),
+          Bindless *bindless = nullptr);
     ~Scene();
 
     private:
-      void createDescriptorPool(void);
-      void createDescriptorSets(void);
+      void buildDescriptors(void);
+      void createDescriptorSets(Context *c);
   };
 }
 
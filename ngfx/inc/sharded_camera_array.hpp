@@ -0,0 +1,102 @@
+#ifndef NGFX_SHARDEDCAMERAARRAY_H
+#define NGFX_SHARDEDCAMERAARRAY_H
+
+#include <memory>
+#include <string>
+#include "vulkan/vulkan.hpp"
+#include "context.hpp"
+#include "util.hpp"
+#include "camera.hpp"
+#include "camera_array.hpp"
+#include "instance_streams.hpp"
+
+namespace ngfx
+{
+  // One headless device rendering a contiguous range of cameras
+  struct CameraShard
+  {
+    std::unique_ptr<Context> c;
+    std::unique_ptr<CameraArray> cameras;
+    std::unique_ptr<InstanceStreams> instances;
+    std::unique_ptr<util::FastBuffer> vertices;
+    std::unique_ptr<util::FastBuffer> indices;
+
+    // Re-recorded every frame, so the pool allows resets
+    vk::CommandPool pool;
+    vk::CommandBuffer cmd;
+    vk::Fence fence;
+    vk::QueryPool timestamps;
+    bool gpuTimestamps;
+    float timestampPeriod;
+
+    uint32_t firstCamera;
+    uint32_t cameraCount;
+    // Smoothed time of one frame on this device in ms
+    double frameMs;
+  };
+
+  // Renders a single camera set across several Vulkan devices, each in its
+  // own headless Context. Cameras are split into contiguous ranges, one per
+  // device, sized from the measured per-device frame time. Instance data is
+  // replicated to every device and readbacks are merged in camera order.
+  //
+  // Devices are selected like util::pickPhysicalDevice overrides, and the
+  // same device may be listed more than once. {"llvmpipe", "llvmpipe"}
+  // opens two lavapipe instances for testing on a single machine
+  class ShardedCameraArray
+  {
+    public:
+      // Global camera set, copied into the shards on every render
+      std::vector<Camera> cams;
+
+      ShardedCameraArray(
+          const std::vector<std::string> &devices,
+          uint32_t cameraCount,
+          const util::ShaderVariant &variant,
+          uint32_t instanceCapacity,
+          const util::Vertex *vertices,
+          uint32_t vertexCount,
+          const uint16_t *indices,
+          uint32_t indexCount);
+      ~ShardedCameraArray(void);
+
+      // Replicated to every device on the next render
+      void writeInstances(util::InstanceStream stream, void *data);
+
+      // Render every camera, wait for all devices and merge the readbacks
+      void render(uint32_t instanceCount);
+
+      // RGBA8 image of a camera from the last render
+      const uint8_t *frame(uint32_t camera);
+      vk::DeviceSize frameSize(void);
+
+      // Shift cameras towards the faster devices. Shards whose range
+      // changes by more than kRebalanceThreshold are rebuilt
+      void rebalance(void);
+
+      uint32_t shardCount(void);
+      const CameraShard &shard(uint32_t i);
+
+    private:
+      static constexpr double kRebalanceThreshold = 0.1;
+      // Weight of the newest sample in the smoothed frame time
+      static constexpr double kFrameTimeSmoothing = 0.2;
+
+      util::ShaderVariant _variant;
+      uint32_t _indexCount;
+      std::vector<CameraShard> _shards;
+      std::vector<uint8_t> _frames;
+
+      void buildShard(
+          CameraShard *shard,
+          const std::string &device,
+          uint32_t instanceCapacity,
+          const util::Vertex *vertices,
+          uint32_t vertexCount,
+          const uint16_t *indices);
+      void buildCameras(CameraShard *shard);
+      void destroyShard(CameraShard *shard);
+  };
+}
+
+#endif //NGFX_SHARDEDCAMERAARRAY_H
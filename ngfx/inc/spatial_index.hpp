@@ -0,0 +1,152 @@
+#ifndef NGFX_SPATIALINDEX_H
+#define NGFX_SPATIALINDEX_H
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "vulkan/vulkan.hpp"
+#include "glm/glm.hpp"
+#include "parallel_hashmap/phmap.h"
+#include "camera.hpp"
+
+namespace ngfx
+{
+  // Hashed grid over body positions. Only occupied cells are stored, so
+  // cells are sized from how crowded bodies are rather than from the
+  // bounding box, and clustered bodies still spread over many cells.
+  // Immutable once published, queries read it without locking
+  struct SpatialGrid
+  {
+    struct Entry
+    {
+      float x;
+      float y;
+      uint32_t id;
+    };
+
+    float cellSize;
+    // Occupied cells by cellKey()
+    phmap::flat_hash_map<uint64_t, std::vector<Entry>> cells;
+    // Per body, the indexed position, its cell and its slot in the cell
+    std::vector<glm::vec2> positions;
+    std::vector<uint64_t> cellOf;
+    std::vector<uint32_t> slotOf;
+    // Sum of squared cell sizes. occupancy / bodies is the mean number of
+    // bodies sharing a body's cell, including itself
+    uint64_t occupancy;
+    // meanOccupancy() right after the last rebuild
+    double rebuiltOccupancy;
+
+    static int32_t cellCoord(float v, float cellSize);
+    static uint64_t cellKey(int32_t x, int32_t y);
+    const std::vector<Entry> *cell(int32_t x, int32_t y) const;
+
+    // Index count bodies from scratch, choosing a cell size that keeps
+    // occupancy near SpatialIndex::kBodiesPerCell
+    void rebuild(const glm::vec2 *positions, uint32_t count);
+    // Move one body, only bodies changing cell touch the hash map
+    void move(uint32_t id, glm::vec2 p);
+    double meanOccupancy(void) const;
+
+    private:
+      void add(uint32_t id, glm::vec2 p);
+      void remove(uint32_t id);
+  };
+
+  // CPU picking and region queries over instance positions. update() and
+  // move() hand changes to a worker thread that applies them to a grid
+  // and publishes it, so the simulation and the queries never wait for
+  // the index. Queries see the latest published grid, which may lag the
+  // last change by a publish, see wait().
+  //
+  // The worker keeps two grids and brings the unpublished one up to date
+  // with the changes it missed. Bodies that stay in their cell cost a
+  // store, bodies crossing cells a hash map move. The grid is only
+  // rebuilt when the body count changes or the mean occupancy has halved
+  // or doubled since the last rebuild, so a point or small rect query
+  // touches a handful of cells however the bodies cluster.
+  // Screen queries map pixels onto the z = 0 plane through Camera::cam
+  class SpatialIndex
+  {
+    public:
+      static const uint32_t kBodiesPerCell = 4;
+
+      SpatialIndex(void);
+      ~SpatialIndex(void);
+
+      // Copy count positions for the worker, which indexes them as body
+      // ids [0, count). Pending changes not yet applied are replaced
+      void update(const glm::vec2 *positions, uint32_t count);
+      // Move a single body, for simulations that move few bodies per step.
+      // id must be below the count of the last update()
+      void move(uint32_t id, glm::vec2 p);
+      // Block until every change so far is published
+      void wait(void);
+      // Number of update() and move() calls published
+      uint64_t version(void);
+
+      // Nearest body within radius of p. Returns false when there is none
+      bool pick(glm::vec2 p, float radius, uint32_t *id);
+      // Bodies inside [lo, hi], appended to out
+      void rect(glm::vec2 lo, glm::vec2 hi, std::vector<uint32_t> *out);
+      // Up to k bodies closest to p, nearest first, replacing out
+      void nearest(glm::vec2 p, uint32_t k, std::vector<uint32_t> *out);
+
+      // Point on the z = 0 plane under a pixel of a camera rendering
+      // extent pixels, origin top left
+      static glm::vec2 screenToWorld(
+          const Camera &camera,
+          vk::Extent2D extent,
+          glm::vec2 pixel);
+
+      // Pick within pixelRadius pixels of a pixel
+      bool pickScreen(
+          const Camera &camera,
+          vk::Extent2D extent,
+          glm::vec2 pixel,
+          float pixelRadius,
+          uint32_t *id);
+      // Bodies inside the screen rectangle spanned by two pixels. The
+      // world rectangle bounds the corners, exact for cameras facing z
+      void rectScreen(
+          const Camera &camera,
+          vk::Extent2D extent,
+          glm::vec2 a,
+          glm::vec2 b,
+          std::vector<uint32_t> *out);
+
+    private:
+      // Changes between two published grids
+      struct Batch
+      {
+        bool full = false;
+        std::vector<glm::vec2> positions;
+        std::vector<std::pair<uint32_t, glm::vec2>> moves;
+
+        void clear(void);
+      };
+
+      std::shared_ptr<const SpatialGrid> grid(void);
+      void run(void);
+      static void apply(const Batch &batch, SpatialGrid *grid);
+
+      std::mutex _mutex;
+      std::condition_variable _pendingCv;
+      std::condition_variable _publishedCv;
+      Batch _pending;
+      uint64_t _requested;
+      uint64_t _published;
+      bool _stop;
+
+      // Guards only the pointer swap, never a build
+      std::mutex _gridMutex;
+      std::shared_ptr<const SpatialGrid> _grid;
+
+      std::thread _worker;
+  };
+}
+
+#endif //NGFX_SPATIALINDEX_H
@@ -1,12 +1,18 @@
 #ifndef NGFX_TESTRENDERER_H
 #define NGFX_TESTRENDERER_H
 
+#include <atomic>
 #include <chrono>
+#include <memory>
+#include <sstream>
+#include <thread>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_core.h>
+#include "bindless.hpp"
 #include "camera_array.hpp"
+#include "instance_streams.hpp"
 #include "ngfx.hpp"
 #include "config.hpp"
 #include "util.hpp"
@@ -16,6 +22,8 @@
 #include "overlay.hpp"
 #include "pipeline.hpp"
 #include "camera_array.hpp"
+#include "trace.hpp"
+#include "frame_snapshot.hpp"
 
 // TODO: Docs
 namespace ngfx
@@ -42,6 +50,7 @@ namespace ngfx
     {{-2.0, -2.0}},
   };
   const uint32_t kTestInstanceCount = 9;
+  const uint32_t kTestCameraCount = 4;
 
   const util::Vertex overlayVertices[] = {
       {{-0.25f, -0.25f}, {1.0f, 1.0f, 1.0f}, {0.0f, 0.0f}},
@@ -58,21 +67,39 @@ namespace ngfx
     glm::vec2 offset;
   } const overlayOffset = {{0.5, -0.5}};
 
+  const util::EnvPushConstants envPushConstants = {{0.0, 0.0, 1.0, 1.0}, 0};
+
   // TODO: Implement multiview extension to speed up camera_array rendering
   class TestRenderer
   {
   public:
     Context c;
     SwapData swapData;
+    // Null when the device lacks descriptor indexing
+    std::unique_ptr<Bindless> bindless;
     Scene scene;
     CameraArray cameraArray;
     Overlay overlay;
     Camera cam;
 
     TestRenderer()
-        : c(), swapData(&c), scene(&c, &swapData), 
-          cameraArray(&c), overlay(&c, &swapData, cameraArray.fbo.view),
-          cam(swapData.extent), _currentFrame(0) {}
+        : c(), swapData(&c),
+          bindless(c.descriptorIndexing ? new Bindless(&c) : nullptr),
+          scene(&c, &swapData, util::ShaderVariant(), bindless.get()), 
+          cameraArray(&c,
+                      kTestCameraCount,
+                      util::ShaderVariant(),
+                      bindless.get()),
+          overlay(&c, &swapData, cameraArray.fbos[0].view, bindless.get()),
+          cam(swapData.extent),
+          _envInstances(&c,
+                        util::ShaderVariant(),
+                        kTestInstanceCount,
+                        kMaxFramesInFlight),
+          _gpuTrace(&c),
+          _currentFrame(0),
+          _publisher(&_snapshots),
+          _running(false) {}
     
     // TODO: Move these somewhere better
     static void key_callback(
@@ -82,14 +109,38 @@ namespace ngfx
         int action,
         int mods)
     {
-      CameraArray *cameraArray = (CameraArray *) glfwGetWindowUserPointer(w);
-      Camera* cam = &cameraArray->cam;
+      // Runs on the main thread, only publishes a new snapshot
+      TestRenderer *r = (TestRenderer *) glfwGetWindowUserPointer(w);
+      Camera* cam = &r->_cams[0];
       glm::float64 delta = .1;
       glm::float64 theta = .1;
       if (key == GLFW_KEY_ESCAPE)
       {
         glfwSetWindowShouldClose(w, GLFW_TRUE);
       };
+      if (kTrace && key == GLFW_KEY_T && action == GLFW_PRESS)
+      {
+        writeTrace();
+        return;
+      };
+      if (key == GLFW_KEY_M && action == GLFW_PRESS)
+      {
+        r->c.memory.report(std::cout);
+        return;
+      };
+      if (key == GLFW_KEY_O && action == GLFW_PRESS)
+      {
+        // Toggle a second, mirrored overlay quad
+        std::vector<OverlayCommand> overlay = {{overlayOffset.offset}};
+        r->_mirrorOverlay = !r->_mirrorOverlay;
+        if (r->_mirrorOverlay)
+        {
+          overlay.push_back({overlayOffset.offset * glm::vec2(-1.0, 1.0)});
+        }
+        r->_publisher.setOverlay(overlay);
+        r->_publisher.publish();
+        return;
+      };
       if (key == GLFW_KEY_UP)
       {
         cam->move(glm::vec3(0, delta, 0), 0, 0, 0);
@@ -123,17 +174,33 @@ namespace ngfx
         cam->move(glm::vec3(0, 0, 0), 0, theta, 0);
       };
       cam->build();
-      cameraArray->camBuffer.stage(&cam->cam);
-      cameraArray->camBuffer.blockingCopy(*cameraArray->q);
+      r->_publisher.setCameras(r->_cams);
+      r->_publisher.publish();
     }
 
 
     void init(void)
     {
+      // Spread the test cameras along x so each offscreen target differs
+      for (uint32_t i = 0; i < cameraArray.count; i++)
+      {
+        cameraArray.cams[i].jump(glm::vec3(i * 0.5, 0.0, .1), 0, 0, 0);
+        cameraArray.cams[i].build();
+      }
+      cameraArray.stageCameras();
+      cameraArray.uploadCameras();
+
+      // Main thread copy, changed by input and published to the renderer
+      _cams = cameraArray.cams;
+      _publisher.setCameras(_cams);
+      _publisher.setOverlay({{overlayOffset.offset}});
+      _publisher.publish();
+      _snapshots.update();
+
       createEnvBuffers(); 
       createOverlayBuffers();
       buildOffscreenCommandBuffer();
-      buildCommandBuffers();
+      buildCommandBuffers(_snapshots.read().overlay);
 
       // Create sync tools
       for (uint i = 0; i < ngfx::kMaxFramesInFlight; i++)
@@ -165,37 +232,92 @@ namespace ngfx
     util::FastBuffer _overlayIndexBuffer;
     util::FastBuffer _envVertexBuffer;
     util::FastBuffer _envIndexBuffer;
-    util::FastBuffer _envInstanceBuffer;
+    InstanceStreams _envInstances;
+
+    trace::GpuTrace _gpuTrace;
+    // First GPU span of each swapchain command buffer, and the offscreen one
+    std::vector<uint32_t> _gpuSpans;
+    uint32_t _offscreenSpan;
+    static const uint32_t kSpansPerFrame = 2;
 
     util::SemaphoreSet _semaphores[ngfx::kMaxFramesInFlight];
     vk::Fence _inFlightFences[ngfx::kMaxFramesInFlight];
     uint32_t _currentFrame = 0;
 
+    // Main thread state, handed to the render thread through _snapshots
+    std::vector<Camera> _cams;
+    bool _mirrorOverlay = false;
+    SnapshotBuffer _snapshots;
+    SnapshotPublisher _publisher;
+
+    // Render thread state. Frame command buffers are re-recorded when the
+    // overlay changes, uploads go into a per frame command buffer
+    std::atomic<bool> _running;
+    vk::CommandPool _framePool;
+    vk::CommandBuffer _uploadCommands[ngfx::kMaxFramesInFlight];
+    std::vector<std::vector<OverlayCommand>> _recordedOverlay;
+    uint64_t _uploadedCameraVersion = 0;
+    uint64_t _uploadedStreamVersions[util::kInstanceStreamCount] = {};
+
+    // The main thread only polls input and publishes snapshots, drawing
+    // happens on a render thread so neither waits on the other
     void testLoop(void)
     {
-      double lastTime = glfwGetTime();
-      int nbFrames = 0;
       drawOffscreenFrame();
 
       // TODO: Move this elsewhere
-      glfwSetWindowUserPointer(c.window, &cameraArray);
+      glfwSetWindowUserPointer(c.window, this);
       glfwSetKeyCallback(c.window, key_callback);
-      while (!glfwWindowShouldClose(c.window)) {
-        
+
+      _running.store(true, std::memory_order_release);
+      std::thread renderThread(&TestRenderer::renderLoop, this);
+      while (!glfwWindowShouldClose(c.window))
+      {
+        glfwWaitEvents();
+      }
+      _running.store(false, std::memory_order_release);
+      renderThread.join();
+
+      c.device.waitIdle();
+      if (kTrace)
+      {
+        writeTrace();
+      }
+      glfwTerminate();
+    }
+
+    void renderLoop(void)
+    {
+      double lastTime = glfwGetTime();
+      int nbFrames = 0;
+      while (_running.load(std::memory_order_acquire))
+      {
         // Measure speed
         double currentTime = glfwGetTime();
         nbFrames++;
         if ( currentTime - lastTime >= 1.0 )
         {
-          printf("%f ms/frame: \n", 1000.0 / double(nbFrames));
+          std::ostringstream message;
+          message << 1000.0 / double(nbFrames) << " ms/frame";
+          util::log(util::LogLevel::eInfo, message.str());
           nbFrames = 0;
           lastTime += 1.0;
         }
-        glfwPollEvents();
-        drawFrame();
+        _snapshots.update();
+        drawFrame(_snapshots.read());
+      }
+    }
+
+    // Drains everything recorded so far into a new numbered file
+    static void writeTrace(void)
+    {
+      static uint32_t traceCount = 0;
+      std::string path = std::string(kTraceFile) + "_"
+        + std::to_string(traceCount++) + ".json";
+      if (trace::write(path))
+      {
+        std::cout << "trace written to " << path << std::endl;
       }
-      c.device.waitIdle();
-      glfwTerminate();
     }
 
     void cleanup(void)
@@ -210,15 +332,10 @@ namespace ngfx
         c.device.destroySemaphore(_semaphores[i].renderComplete);
         c.device.destroyFence(_inFlightFences[i]);
       }
+      c.device.destroyCommandPool(_framePool);
 
-      c.device.destroyCommandPool(c.cmdPool);
-      c.device.destroy();
-      util::DestroyDebugUtilsMessengerEXT(c.instance, c.debugMessenger);
-      vkDestroySurfaceKHR(c.instance, c.surface, nullptr);
-      c.instance.destroy();
-
-      glfwDestroyWindow(c.window);
-
+      bindless.reset();
+      c.destroy();
       glfwTerminate();
     }
 
@@ -233,40 +350,123 @@ namespace ngfx
             0,
             nullptr);
 
+      NGFX_TRACE_SCOPE("drawOffscreenFrame");
       c.graphicsQueue.submit(1, &submitInfo, nullptr);
       c.graphicsQueue.waitIdle();
+      _gpuTrace.collect(_offscreenSpan, 1);
+    }
+
+    // Record camera and instance changes of the snapshot into this
+    // frame's upload command buffer. Returns false when nothing changed
+    bool recordUploads(const FrameSnapshot &s)
+    {
+      bool cameras = s.cameraVersion != _uploadedCameraVersion
+        && s.cameras.size() >= cameraArray.count;
+      bool streams = false;
+      for (uint32_t i = 0; i < util::kInstanceStreamCount; i++)
+      {
+        streams |= s.streamVersions[i] != _uploadedStreamVersions[i]
+          && _envInstances.enabled(static_cast<util::InstanceStream>(i));
+      }
+      if (!cameras && !streams)
+      {
+        return false;
+      }
+
+      vk::CommandBuffer cmd = _uploadCommands[_currentFrame];
+      vk::CommandBufferBeginInfo beginInfo(
+          vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+          nullptr);
+      cmd.begin(beginInfo);
+      if (cameras)
+      {
+        cameraArray.recordCameras(cmd, s.cameras.data());
+        _uploadedCameraVersion = s.cameraVersion;
+      }
+      if (streams)
+      {
+        // Into this frame's staging, other frames in flight are untouched
+        for (uint32_t i = 0; i < util::kInstanceStreamCount; i++)
+        {
+          util::InstanceStream stream = static_cast<util::InstanceStream>(i);
+          if (s.streamVersions[i] == _uploadedStreamVersions[i]
+              || !_envInstances.enabled(stream))
+          {
+            continue;
+          }
+          size_t bytes = std::min<size_t>(s.streams[i].size(),
+                                          _envInstances.streams[i].size);
+          memcpy(_envInstances.map(stream), s.streams[i].data(), bytes);
+          _envInstances.markDirty(stream);
+          _uploadedStreamVersions[i] = s.streamVersions[i];
+        }
+        _envInstances.recordUpload(cmd);
+      }
+      cmd.end();
+      return true;
     }
 
-    void drawFrame(void)
+    void drawFrame(const FrameSnapshot &s)
     {
+      NGFX_TRACE_SCOPE("drawFrame");
       uint32_t imageIndex;
       { // Prepare frame
-        c.device.waitForFences(
-            1,
-            &_inFlightFences[_currentFrame],
-            true,
-            UINT64_MAX);
+        {
+          NGFX_TRACE_SCOPE("waitFrameFence");
+          c.device.waitForFences(
+              1,
+              &_inFlightFences[_currentFrame],
+              true,
+              UINT64_MAX);
+        }
+        c.beginFrame(_currentFrame);
+        _envInstances.beginFrame(_currentFrame);
 
-        c.device.acquireNextImageKHR(swapData.swapchain, UINT64_MAX,
-                                     _semaphores[_currentFrame].imageAvailable,
-                                     vk::Fence(nullptr), &imageIndex);
+        {
+          NGFX_TRACE_SCOPE("acquireNextImage");
+          c.device.acquireNextImageKHR(
+              swapData.swapchain, UINT64_MAX,
+              _semaphores[_currentFrame].imageAvailable,
+              vk::Fence(nullptr), &imageIndex);
+        }
 
         if (swapData.fences[imageIndex] != vk::Fence(nullptr))
         {
+          NGFX_TRACE_SCOPE("waitImageFence");
           c.device.waitForFences(1, &swapData.fences[imageIndex], true, UINT64_MAX);
+          // The last submission of this image is done, its spans are ready
+          _gpuTrace.collect(_gpuSpans[imageIndex], kSpansPerFrame);
+        }
+        // Safe to re-record, the image's last submission has completed
+        if (!(s.overlay == _recordedOverlay[imageIndex]))
+        {
+          NGFX_TRACE_SCOPE("recordCommandBuffer");
+          recordCommandBuffer(imageIndex, s.overlay);
+        }
+      }
+      vk::CommandBuffer cmds[2];
+      uint32_t cmdCount = 0;
+      {
+        NGFX_TRACE_SCOPE("recordUploads");
+        if (recordUploads(s))
+        {
+          cmds[cmdCount++] = _uploadCommands[_currentFrame];
         }
+        cmds[cmdCount++] = commandBuffers[imageIndex];
         swapData.fences[imageIndex] = _inFlightFences[_currentFrame];
         c.device.resetFences(1, (const vk::Fence *)&_inFlightFences[_currentFrame]);
       }
       { // Draw frame
+        NGFX_TRACE_SCOPE("submit");
         vk::PipelineStageFlags waitStages(
             vk::PipelineStageFlagBits::eColorAttachmentOutput);
         vk::SubmitInfo submitInfo(1, &_semaphores[_currentFrame].imageAvailable,
-                                  &waitStages, 1, &commandBuffers[imageIndex], 1,
+                                  &waitStages, cmdCount, cmds, 1,
                                   &_semaphores[_currentFrame].renderComplete);
         c.graphicsQueue.submit(1, &submitInfo, _inFlightFences[_currentFrame]);
       }
       { // Present frame 
+        NGFX_TRACE_SCOPE("present");
         vk::PresentInfoKHR presentInfo(
             1, &_semaphores[_currentFrame].renderComplete, 1, &swapData.swapchain,
             &imageIndex, nullptr);
@@ -290,166 +490,172 @@ namespace ngfx
           vk::CommandBufferUsageFlags(),
           nullptr);
       
-      vk::DeviceSize offsets[] = {0};
-
-      // TODO: Fix weird code for clearValue
-      // Currently requires two sub-classes to construct
-      const std::array<float, 4> clearColorPrimative = 
-      {0.1f, 0.1f, 0.1f, 1.0f};
-
-      vk::ClearColorValue clearColor(clearColorPrimative);
-      const vk::ClearValue clearValue(clearColor);
-      
       cmd->begin(beginInfo);
-
-      vk::RenderPassBeginInfo envPassInfo(
-          cameraArray.pass, cameraArray.fbo.frame,
-          vk::Rect2D(vk::Offset2D(0, 0), cameraArray.fbo.extent), 1,
-          &clearValue);
-
-      cmd->beginRenderPass(envPassInfo,
-          vk::SubpassContents::eInline);
-
-      cmd->bindPipeline(vk::PipelineBindPoint::eGraphics, cameraArray.pipeline);
-
-      cmd->bindVertexBuffers(
-          0,
-          1,
-          &_envVertexBuffer.localBuffer,
-          (const vk::DeviceSize *) offsets);
-      cmd->bindVertexBuffers(
-          1,
-          1,
-          &_envInstanceBuffer.localBuffer,
-          (const vk::DeviceSize *) offsets);
-
-
-      cmd->bindIndexBuffer(
-          _envIndexBuffer.localBuffer,
-          0,
-          vk::IndexType::eUint16);
-
-
-      cmd->bindDescriptorSets(
-          vk::PipelineBindPoint::eGraphics,
-          cameraArray.layout,
-          0,
-          1,
-          &cameraArray.descSet,
-          0,
-          nullptr);
-      
-      cmd->drawIndexed(
+      _offscreenSpan = _gpuTrace.spanCount();
+      _gpuTrace.reset(*cmd, _offscreenSpan, 1);
+      uint32_t span = _gpuTrace.begin(*cmd, "cameraArray");
+      cameraArray.record(
+          *cmd,
+          &_envVertexBuffer,
+          &_envIndexBuffer,
           util::array_size(testIndices),
-          util::array_size(testInstances),
-          0,
-          0,
-          0);
-      cmd->endRenderPass();
+          &_envInstances,
+          util::array_size(testInstances));
+      _gpuTrace.end(*cmd, span);
       cmd->end();
     }
 
     // TODO:: parallelize command buffer creation
-    void buildCommandBuffers(void)
+    void buildCommandBuffers(const std::vector<OverlayCommand> &commands)
     {
+      _framePool = util::createCommandPool(
+          &c.device,
+          c.qFamilies,
+          vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
+
       commandBuffers.resize(swapData.views.size());
+      _gpuSpans.resize(commandBuffers.size());
+      _recordedOverlay.resize(commandBuffers.size());
       vk::CommandBufferAllocateInfo allocInfo(
-          c.cmdPool,
+          _framePool,
           vk::CommandBufferLevel::ePrimary,
           (uint)commandBuffers.size());
       
       c.device.allocateCommandBuffers(&allocInfo, commandBuffers.data());
 
+      vk::CommandBufferAllocateInfo uploadAllocInfo(
+          _framePool,
+          vk::CommandBufferLevel::ePrimary,
+          kMaxFramesInFlight);
+      c.device.allocateCommandBuffers(&uploadAllocInfo, _uploadCommands);
+
       for (size_t i = 0; i < commandBuffers.size(); i++) {
-        vk::CommandBufferBeginInfo beginInfo(
-            vk::CommandBufferUsageFlags(),
-            nullptr);
+        _gpuSpans[i] = _gpuTrace.reserve(kSpansPerFrame);
+        recordCommandBuffer(i, commands);
+      }
+    }
 
-        vk::DeviceSize offsets[] = {0};
-
-        // TODO: Fix weird code for clearValue
-        // Currently requires two sub-classes to construct
-        const std::array<float, 4> clearColorPrimative = {0.1f, 0.1f, 0.1f,
-                                                          1.0f};
-        vk::ClearColorValue clearColor(clearColorPrimative);
-        const vk::ClearValue clearValue(clearColor);
-
-        vk::RenderPassBeginInfo envPassInfo(
-            scene.pass,
-            scene.frames[i],
-            vk::Rect2D(
-              vk::Offset2D(0, 0),
-              swapData.extent),
-            1,
-            &clearValue);
-
-        vk::RenderPassBeginInfo overlayPassInfo(
-            overlay.pass,
-            overlay.frames[i],
-            vk::Rect2D(
-              vk::Offset2D(0, 0),
-              swapData.extent),
-            0,
-            nullptr);
+    // Scene pass followed by one overlay quad per command
+    void recordCommandBuffer(
+        size_t i,
+        const std::vector<OverlayCommand> &commands)
+    {
+      vk::CommandBufferBeginInfo beginInfo(
+          vk::CommandBufferUsageFlags(),
+          nullptr);
 
-        commandBuffers[i].begin(beginInfo);
-        commandBuffers[i].beginRenderPass(
-            envPassInfo,
-            vk::SubpassContents::eInline);
-        commandBuffers[i].bindPipeline(
-            vk::PipelineBindPoint::eGraphics,
-            scene.pipeline);
-        commandBuffers[i].bindVertexBuffers(
-            0,
-            1,
-            &_envVertexBuffer.localBuffer,
-            (const vk::DeviceSize *)offsets);
-        commandBuffers[i].bindVertexBuffers(
-            1,
-            1,
-            &_envInstanceBuffer.localBuffer,
-            (const vk::DeviceSize *)offsets);
-        commandBuffers[i].bindIndexBuffer(
-            _envIndexBuffer.localBuffer,
-            0,
-            vk::IndexType::eUint16);
+      vk::DeviceSize offsets[] = {0};
+
+      // TODO: Fix weird code for clearValue
+      // Currently requires two sub-classes to construct
+      const std::array<float, 4> clearColorPrimative = {0.1f, 0.1f, 0.1f,
+                                                        1.0f};
+      vk::ClearColorValue clearColor(clearColorPrimative);
+      // Pick attachment of pickIds variants clears to background
+      const vk::ClearValue clearValues[] = {
+        vk::ClearValue(clearColor),
+        vk::ClearValue(
+            vk::ClearColorValue(std::array<uint32_t, 4>{0, 0, 0, 0}))
+      };
+
+      vk::RenderPassBeginInfo envPassInfo(
+          scene.pass,
+          scene.frames[i],
+          vk::Rect2D(
+            vk::Offset2D(0, 0),
+            swapData.extent),
+          scene.variant.pickIds ? 2 : 1,
+          clearValues);
+
+      vk::RenderPassBeginInfo overlayPassInfo(
+          overlay.pass,
+          overlay.frames[i],
+          vk::Rect2D(
+            vk::Offset2D(0, 0),
+            swapData.extent),
+          0,
+          nullptr);
+
+      commandBuffers[i].begin(beginInfo);
+      _gpuTrace.reset(commandBuffers[i], _gpuSpans[i], kSpansPerFrame);
+      uint32_t sceneSpan = _gpuTrace.begin(commandBuffers[i],
+                                           "scene",
+                                           _gpuSpans[i]);
+      // Bound once for both passes, draws only push indices
+      if (bindless)
+      {
+        bindless->bind(commandBuffers[i]);
+      }
+      commandBuffers[i].beginRenderPass(
+          envPassInfo,
+          vk::SubpassContents::eInline);
+      commandBuffers[i].bindPipeline(
+          vk::PipelineBindPoint::eGraphics,
+          scene.pipeline);
+      util::setViewport(commandBuffers[i], swapData.extent);
+      commandBuffers[i].bindVertexBuffers(
+          0,
+          1,
+          &_envVertexBuffer.localBuffer,
+          (const vk::DeviceSize *)offsets);
+      _envInstances.bind(commandBuffers[i], 1);
+      commandBuffers[i].bindIndexBuffer(
+          _envIndexBuffer.localBuffer,
+          0,
+          vk::IndexType::eUint16);
+      if (bindless)
+      {
+        bindless->push(commandBuffers[i], util::BindlessPushConstants{
+            envPushConstants.instanceXform, cameraArray.firstCamera, 0});
+      }
+      else
+      {
+        // Dynamic offset of camera 0
+        uint32_t camOffset = 0;
         commandBuffers[i].bindDescriptorSets(
             vk::PipelineBindPoint::eGraphics,
             cameraArray.layout,
             0,
             1,
             &cameraArray.descSet,
-            0,
-            nullptr);
-        commandBuffers[i].drawIndexed(
-            util::array_size(testIndices),
-            util::array_size(testInstances),
-            0,
-            0,
-            0);
-        commandBuffers[i].endRenderPass();
-
-        commandBuffers[i].beginRenderPass(overlayPassInfo,
-                                          vk::SubpassContents::eInline);
-
+            1,
+            &camOffset);
         commandBuffers[i].pushConstants(
-            overlay.layout, vk::ShaderStageFlagBits::eVertex, 0,
-            sizeof(OverlayTestOffset), (void *)&overlayOffset);
+            cameraArray.layout, vk::ShaderStageFlagBits::eVertex, 0,
+            sizeof(util::EnvPushConstants), (void *)&envPushConstants);
+      }
+      commandBuffers[i].drawIndexed(
+          util::array_size(testIndices),
+          util::array_size(testInstances),
+          0,
+          0,
+          0);
+      commandBuffers[i].endRenderPass();
+      _gpuTrace.end(commandBuffers[i], sceneSpan);
 
-        commandBuffers[i].bindPipeline(
-            vk::PipelineBindPoint::eGraphics,
-            overlay.pipeline);
+      uint32_t overlaySpan = _gpuTrace.begin(commandBuffers[i],
+                                             "overlay",
+                                             _gpuSpans[i] + 1);
+      commandBuffers[i].beginRenderPass(overlayPassInfo,
+                                        vk::SubpassContents::eInline);
 
-        commandBuffers[i].bindVertexBuffers(
-            0,
-            1,
-            &_overlayVertexBuffer.localBuffer,
-            (const vk::DeviceSize *)offsets);
+      commandBuffers[i].bindPipeline(
+          vk::PipelineBindPoint::eGraphics,
+          overlay.pipeline);
+      util::setViewport(commandBuffers[i], swapData.extent);
 
-        commandBuffers[i].bindIndexBuffer(
-            _overlayIndexBuffer.localBuffer,
-            0,
-            vk::IndexType::eUint16);
+      commandBuffers[i].bindVertexBuffers(
+          0,
+          1,
+          &_overlayVertexBuffer.localBuffer,
+          (const vk::DeviceSize *)offsets);
+
+      commandBuffers[i].bindIndexBuffer(
+          _overlayIndexBuffer.localBuffer,
+          0,
+          vk::IndexType::eUint16);
+      if (!bindless)
+      {
         commandBuffers[i].bindDescriptorSets(
             vk::PipelineBindPoint::eGraphics,
             overlay.layout,
@@ -458,15 +664,32 @@ namespace ngfx
             &overlay.descSet,
             0,
             nullptr);
+      }
+      for (const OverlayCommand &command : commands)
+      {
+        if (bindless)
+        {
+          bindless->push(commandBuffers[i], util::BindlessPushConstants{
+              glm::vec4(command.offset, 0.0, 0.0), 0, overlay.texture});
+        }
+        else
+        {
+          OverlayTestOffset offset = {command.offset};
+          commandBuffers[i].pushConstants(
+              overlay.layout, vk::ShaderStageFlagBits::eVertex, 0,
+              sizeof(OverlayTestOffset), (void *)&offset);
+        }
         commandBuffers[i].drawIndexed(
             util::array_size(overlayIndices),
             1,
             0,
             0,
             0);
-        commandBuffers[i].endRenderPass();
-        commandBuffers[i].end();
       }
+      commandBuffers[i].endRenderPass();
+      _gpuTrace.end(commandBuffers[i], overlaySpan);
+      commandBuffers[i].end();
+      _recordedOverlay[i] = commands;
     }
 
     // TODO: use dedicated transfer queue, remove need for blocking copy
@@ -477,7 +700,8 @@ namespace ngfx
           &c.physicalDevice,
           &c.cmdPool,
           sizeof(overlayVertices),
-          vk::BufferUsageFlagBits::eVertexBuffer);
+          vk::BufferUsageFlagBits::eVertexBuffer,
+          util::MemoryTag::eGeometry);
 
       _overlayVertexBuffer.init();
       _overlayVertexBuffer.stage((void *)overlayVertices);
@@ -488,7 +712,8 @@ namespace ngfx
           &c.physicalDevice,
           &c.cmdPool,
           sizeof(overlayIndices),
-          vk::BufferUsageFlagBits::eIndexBuffer);
+          vk::BufferUsageFlagBits::eIndexBuffer,
+          util::MemoryTag::eGeometry);
       
       _overlayIndexBuffer.init();
       _overlayIndexBuffer.stage((void *)overlayIndices);
@@ -502,7 +727,8 @@ namespace ngfx
           &c.physicalDevice, 
           &c.cmdPool,
           sizeof(testVertices),
-          vk::BufferUsageFlagBits::eVertexBuffer);
+          vk::BufferUsageFlagBits::eVertexBuffer,
+          util::MemoryTag::eGeometry);
       _envVertexBuffer.init();
       _envVertexBuffer.stage((void *) testVertices);
       _envVertexBuffer.copy(c.graphicsQueue);
@@ -512,20 +738,31 @@ namespace ngfx
           &c.physicalDevice, 
           &c.cmdPool,
           sizeof(testIndices),
-          vk::BufferUsageFlagBits::eIndexBuffer);
+          vk::BufferUsageFlagBits::eIndexBuffer,
+          util::MemoryTag::eGeometry);
       _envIndexBuffer.init();
       _envIndexBuffer.stage((void *) testIndices);
       _envIndexBuffer.copy(c.graphicsQueue);
 
-      _envInstanceBuffer = util::FastBuffer(
-          &c.device, 
-          &c.physicalDevice, 
-          &c.cmdPool,
-          sizeof(testInstances),
-          vk::BufferUsageFlagBits::eVertexBuffer);
-      _envInstanceBuffer.init();
-      _envInstanceBuffer.stage((void *) testInstances);
-      _envInstanceBuffer.blockingCopy(c.graphicsQueue);
+      // Per frame staging only uploads through recorded commands
+      _envInstances.write(util::InstanceStream::ePosition,
+                          (void *) testInstances);
+      vk::CommandBuffer cmd;
+      vk::CommandBufferAllocateInfo allocInfo(
+          c.cmdPool,
+          vk::CommandBufferLevel::ePrimary,
+          1);
+      c.device.allocateCommandBuffers(&allocInfo, &cmd);
+      vk::CommandBufferBeginInfo beginInfo(
+          vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+          nullptr);
+      cmd.begin(beginInfo);
+      _envInstances.recordUpload(cmd);
+      cmd.end();
+      vk::SubmitInfo submitInfo(0, nullptr, nullptr, 1, &cmd, 0, nullptr);
+      c.graphicsQueue.submit(1, &submitInfo, vk::Fence());
+      c.graphicsQueue.waitIdle();
+      c.device.freeCommandBuffers(c.cmdPool, 1, &cmd);
     }    
   };
 }
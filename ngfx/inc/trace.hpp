@@ -0,0 +1,111 @@
+#ifndef NGFX_TRACE_H
+#define NGFX_TRACE_H
+
+#include <string>
+#include "vulkan/vulkan.hpp"
+#include "context.hpp"
+
+// Timeline tracing, written as Chrome trace JSON (chrome://tracing,
+// ui.perfetto.dev). Build with -DNGFX_TRACE=ON to enable, otherwise every
+// marker and GpuTrace call compiles to nothing.
+//
+// CPU spans go into a lock free single producer ring per thread, GPU spans
+// come from timestamp queries mapped onto the CPU clock through
+// VK_EXT_calibrated_timestamps, or a one off estimate when it is missing
+namespace ngfx
+{
+  namespace trace
+  {
+    // Events kept per thread between writes, newer events are dropped
+    // when a ring is full
+    static const uint32_t kEventsPerThread = 1 << 16;
+
+    // Nanoseconds on the steady (CLOCK_MONOTONIC) clock
+    uint64_t now(void);
+
+    // Record a span on the calling thread's ring. track 0 is the calling
+    // thread, anything else names a GPU queue
+    void record(const char *name, uint64_t begin, uint64_t end,
+                uint32_t track = 0);
+
+    // Drain every ring into path. Returns false if the file can't be opened
+    bool write(const std::string &path);
+
+    class Scope
+    {
+      public:
+        Scope(const char *name) : _name(name), _begin(now()) {}
+        ~Scope(void) { record(_name, _begin, now()); }
+
+      private:
+        const char *_name;
+        uint64_t _begin;
+    };
+
+#ifdef NGFX_TRACE
+    // Timestamp spans recorded into command buffers. Spans are allocated in
+    // order and stay valid for the life of the GpuTrace, so pre recorded
+    // command buffers can keep reusing theirs
+    class GpuTrace
+    {
+      public:
+        GpuTrace(Context *c, uint32_t capacity = 256);
+        ~GpuTrace(void);
+
+        uint32_t spanCount(void) { return _spanCount; }
+        // Record a reset of spans [first, first + count), outside passes
+        void reset(vk::CommandBuffer cmd, uint32_t first, uint32_t count);
+        uint32_t begin(vk::CommandBuffer cmd, const char *name);
+        // Allocate count spans up front for a command buffer that is
+        // re-recorded, then begin them by index on every recording
+        uint32_t reserve(uint32_t count);
+        uint32_t begin(vk::CommandBuffer cmd, const char *name, uint32_t span);
+        void end(vk::CommandBuffer cmd, uint32_t span);
+        // Once the command buffer has completed, move its spans into the
+        // trace
+        void collect(uint32_t first, uint32_t count);
+        // Re-estimate the GPU to CPU clock offset
+        void calibrate(void);
+
+      private:
+        Context *_c;
+        bool _enabled;
+        uint32_t _capacity;
+        uint32_t _spanCount;
+        double _period;
+        uint64_t _mask;
+        int64_t _offset;
+        vk::QueryPool _queries;
+        std::vector<const char *> _names;
+        PFN_vkGetCalibratedTimestampsEXT _getCalibratedTimestamps;
+    };
+#else
+    class GpuTrace
+    {
+      public:
+        GpuTrace(Context *, uint32_t = 0) {}
+        uint32_t spanCount(void) { return 0; }
+        void reset(vk::CommandBuffer, uint32_t, uint32_t) {}
+        uint32_t begin(vk::CommandBuffer, const char *) { return 0; }
+        uint32_t reserve(uint32_t) { return 0; }
+        uint32_t begin(vk::CommandBuffer, const char *, uint32_t) { return 0; }
+        void end(vk::CommandBuffer, uint32_t) {}
+        void collect(uint32_t, uint32_t) {}
+        void calibrate(void) {}
+    };
+#endif
+  }
+}
+
+#define NGFX_TRACE_CONCAT_(a, b) a##b
+#define NGFX_TRACE_CONCAT(a, b) NGFX_TRACE_CONCAT_(a, b)
+
+#ifdef NGFX_TRACE
+// Span covering the rest of the enclosing scope. name must outlive write()
+#define NGFX_TRACE_SCOPE(name) \
+  ngfx::trace::Scope NGFX_TRACE_CONCAT(_traceScope, __LINE__)(name)
+#else
+#define NGFX_TRACE_SCOPE(name) do {} while (0)
+#endif
+
+#endif //NGFX_TRACE_H
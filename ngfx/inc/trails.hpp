@@ -0,0 +1,101 @@
+#ifndef NGFX_TRAILS_H
+#define NGFX_TRAILS_H
+
+#include "vulkan/vulkan.hpp"
+#include "glm/glm.hpp"
+#include "context.hpp"
+#include "util.hpp"
+#include "camera_array.hpp"
+#include "instance_streams.hpp"
+
+namespace ngfx
+{
+  // Push constant block shared by trail_append.comp and trails.vert
+  struct TrailPushConstants
+  {
+    glm::vec4 instanceXform;
+    glm::vec4 trailXform;
+    glm::vec4 color;
+    uint32_t camera;
+    uint32_t head;
+    uint32_t length;
+    uint32_t capacity;
+    uint32_t maxLength;
+    uint32_t instanceCount;
+  };
+
+  // Motion trails kept entirely on the GPU. A ring of maxLength slots
+  // holds a half float position per body, slot major so an append writes
+  // one contiguous block. recordAppend copies the current positions into
+  // the next slot with a small compute dispatch, record draws one line
+  // strip instance per body by indexing back from the head.
+  //
+  // The ring always keeps maxLength steps, so setLength only changes a
+  // push constant and a longer trail shows its full history at once.
+  // Reads positions from InstanceStreams of a pulled variant
+  struct Trails
+  {
+    CameraArray *cameras;
+    uint32_t capacity;
+    uint32_t maxLength;
+    // Points drawn per body, at most maxLength
+    uint32_t length;
+    // Slot of the newest append
+    uint32_t head;
+    // Appends since reset, trails never reach back further
+    uint32_t filled;
+    // Origin and scale of the half float ring entries, positions far from
+    // the origin lose precision as with InstanceFormat::eFloat16
+    glm::vec4 xform = glm::vec4(0.0, 0.0, 1.0, 1.0);
+    // Color of the newest point, older points fade towards the clear color
+    glm::vec4 color = glm::vec4(0.5, 0.7, 1.0, 1.0);
+
+    vk::Buffer ringBuffer;
+    vk::DeviceMemory ringMemory;
+
+    // Draws after the camera pass, keeping what it rendered
+    vk::RenderPass pass;
+    vk::DescriptorSetLayout ringLayout;
+    vk::DescriptorSetLayout storageLayout;
+    // Allocated from Context::descriptors
+    vk::DescriptorSet ringSet;
+    vk::PipelineLayout appendLayout;
+    vk::PipelineLayout drawLayout;
+    vk::Pipeline appendPipeline;
+    vk::Pipeline drawPipeline;
+
+    // Pointer to device, used for destructor
+    vk::Device *device;
+
+    Trails(
+        Context *c,
+        CameraArray *cameras,
+        uint32_t capacity,
+        uint32_t maxLength);
+    ~Trails(void);
+
+    // Clamped to maxLength, takes effect on the next record
+    void setLength(uint32_t length);
+    // Forget the history, e.g. after bodies were respawned
+    void reset(void);
+
+    // Append the current positions of instanceCount bodies, once per
+    // simulation step after the positions were uploaded
+    void recordAppend(
+        vk::CommandBuffer cmd,
+        InstanceStreams *instances,
+        uint32_t instanceCount,
+        glm::vec4 instanceXform = glm::vec4(0.0, 0.0, 1.0, 1.0));
+
+    // Draw the trails of instanceCount bodies over every camera target,
+    // after CameraArray::record
+    void record(vk::CommandBuffer cmd, uint32_t instanceCount);
+
+    private:
+      void buildRenderPass(void);
+      void buildDescriptors(Context *c);
+      void buildPipelines(Context *c);
+  };
+}
+
+#endif //NGFX_TRAILS_H
@@ -0,0 +1,57 @@
+#ifndef NGFX_TRIPLEBUFFER_H
+#define NGFX_TRIPLEBUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace ngfx
+{
+  namespace util
+  {
+    // Lock free single writer, single reader handoff of the latest value.
+    // The writer fills write() and publishes it, the reader picks up the
+    // newest published slot with update(). Neither side ever waits, the
+    // reader simply keeps the last value when nothing new was published
+    // and intermediate values are dropped when the writer is faster
+    template <typename T>
+    class TripleBuffer
+    {
+      public:
+        TripleBuffer(void) : _write(0), _middle(1), _read(2) {}
+
+        // Writer side. The slot keeps whatever was last written into it
+        // two publishes ago, so writers either overwrite it fully or track
+        // what it holds
+        T &write(void) { return _slots[_write]; }
+        void publish(void)
+        {
+          _write = _middle.exchange(_write | kFresh,
+                                    std::memory_order_acq_rel) & kIndex;
+        }
+
+        // Reader side. Returns true when a newer value was picked up
+        bool update(void)
+        {
+          if (!(_middle.load(std::memory_order_relaxed) & kFresh))
+          {
+            return false;
+          }
+          _read = _middle.exchange(_read, std::memory_order_acq_rel) & kIndex;
+          return true;
+        }
+        const T &read(void) { return _slots[_read]; }
+
+      private:
+        static const uint8_t kIndex = 0x3;
+        static const uint8_t kFresh = 0x4;
+
+        T _slots[3];
+        // Each side touches only its own index, kept off the shared line
+        alignas(64) uint8_t _write;
+        alignas(64) std::atomic<uint8_t> _middle;
+        alignas(64) uint8_t _read;
+    };
+  }
+}
+
+#endif //NGFX_TRIPLEBUFFER_H
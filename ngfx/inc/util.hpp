@@ -3,6 +3,7 @@
 
 #include "ngfx.hpp"
 #include "config.hpp"
+#include "memory.hpp"
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_core.h>
 
@@ -37,7 +38,6 @@ namespace ngfx
     };
 
     //TODO: Refactor along with vertex binding and attr code to make this useful
-    //TODO: AOSOA layout
     struct Vertex {
       glm::vec2 pos;
       glm::vec3 color;
@@ -49,29 +49,82 @@ namespace ngfx
       glm::vec2 pos;
    };
 
+    // Compact instance layouts, see InstanceFormat and pack.hpp
+
+    // R16G16_SFLOAT position relative to a tile origin
+    struct InstanceHalf {
+      uint16_t pos[2];
+    };
+
+    // R16G16_SNORM position, scaled and offset per chunk
+    struct InstanceSnorm {
+      int16_t pos[2];
+    };
+
+    // R8_UNORM index into the 256 entry color palette
+    struct InstancePalette {
+      uint8_t index;
+    };
+
     struct Mvp {
       glm::mat4 model;
       glm::mat4 view;
       glm::mat4 proj;
     };
 
+    // Push constant block of env.vert
+    struct EnvPushConstants {
+      // xy: origin, zw: scale applied to compact instance positions
+      glm::vec4 instanceXform;
+      uint32_t camera;
+      // Previous to current position blend of interpolating variants
+      float alpha;
+    };
+
+    // Push constant block of the bindless shaders, visible to every stage.
+    // camera and texture index the Bindless arrays, the overlay uses
+    // instanceXform.xy as its screen offset
+    struct BindlessPushConstants {
+      glm::vec4 instanceXform;
+      uint32_t camera;
+      uint32_t texture;
+      float alpha;
+    };
+
     // Abstracts buffer and transfer semantics for a fast uniform/vertex buffer
-    // that is easy to work with on the CPU side
+    // that is easy to work with on the CPU side.
+    // When the device exposes host visible device local memory (UMA, ReBAR)
+    // the buffer is mapped directly and copies become no-ops, otherwise a
+    // staging buffer is used.
+    //
+    // Host memory is not versioned. Staging memory is read by the copy and
+    // direct memory by every submit using the buffer, so stage(), data()
+    // writes and markDirty() ranges must wait until the fences of those
+    // submits have signalled. Owners with frames in flight keep one buffer
+    // per frame (InstanceStreams) or wait the frame fence before writing.
+    // Host writes made before a submit are visible to it without barriers
     // TODO: batch buffer allocations
     struct FastBuffer
     {
     public:
       bool valid;
+      // Mapped device local memory, no staging buffer or transfer needed.
+      // Writes land in memory the GPU reads, see the rule above
+      bool direct;
       vk::Device *device;
       vk::PhysicalDevice *phys;
       vk::CommandPool *pool;
       vk::DeviceSize size;
       vk::BufferUsageFlags usage;
+      // Accounted under this tag in the device's MemoryTracker
+      MemoryTag tag;
       vk::Buffer stagingBuffer;
       vk::DeviceMemory stagingMemory;
       vk::Buffer localBuffer;
       vk::DeviceMemory localMemory;
       vk::CommandBuffer commandBuffer;
+      // Byte ranges staged since the last recordDirty()
+      std::vector<vk::BufferCopy> dirty;
 
       FastBuffer(void);
 
@@ -80,18 +133,81 @@ namespace ngfx
           vk::PhysicalDevice *physDev,
           vk::CommandPool *cmdPool,
           vk::DeviceSize size,
-          vk::BufferUsageFlags usage);
+          vk::BufferUsageFlags usage,
+          MemoryTag tag = MemoryTag::eOther);
 
       void init(void);
       void stage(void* data);
+      // Persistently mapped staging memory, valid after init(). Writing
+      // here directly and calling copy() skips the memcpy in stage()
+      void *data(void);
+
+      // Partial uploads. Stage or mark byte ranges, then record a single
+      // copy of the coalesced ranges into a transfer command buffer.
+      // Bandwidth scales with the changed bytes instead of size.
+      // data points at the start of the full source array
+      void stage(void* data, vk::DeviceSize offset, vk::DeviceSize bytes);
+      void markDirty(vk::DeviceSize offset, vk::DeviceSize bytes);
+      // Returns the number of dirty bytes, zero if nothing was dirty. A
+      // direct buffer records nothing, its dirty bytes are already in
+      // place and the next submit makes them visible
+      vk::DeviceSize recordDirty(vk::CommandBuffer cmd);
+      // Copy the dirty ranges from source instead, direct buffers included.
+      // For callers keeping their own staging per frame in flight
+      vk::DeviceSize recordDirty(vk::CommandBuffer cmd, vk::Buffer source);
       void copy(vk::Queue q);
       void blockingCopy(vk::Queue q);
+
+      // Contents are final, call once no copy from staging is pending.
+      // The device's MemoryTracker may then free the staging memory to
+      // make room, after which stage(), data() and copies are invalid
+      void makeStatic(void);
       ~FastBuffer(void);
     
     private:
       void *_handle;
+      uint32_t _stagingHeap;
+      vk::DeviceSize _stagingBytes;
+      bool _evictable;
+      uint32_t _evictId;
+
+      void freeStaging(void);
+      vk::DeviceSize recordCopy(vk::CommandBuffer cmd, vk::Buffer source);
     };
 
+    // Caller owned host memory imported through VK_EXT_external_memory_host
+    // and bound to a buffer, so the GPU reads it in place with no staging
+    // copy. The pointer and size must be multiples of hostImportAlignment,
+    // allocateHostShared returns memory that is. The host must not write
+    // while a submit reading the buffer is in flight
+    struct HostBuffer
+    {
+    public:
+      bool valid;
+      vk::Device *device;
+      vk::Buffer buffer;
+      vk::DeviceMemory memory;
+      vk::DeviceSize size;
+
+      HostBuffer(void);
+      // False when the device cannot import this pointer, the caller falls
+      // back to copying
+      bool import(
+          vk::Device *dev,
+          vk::PhysicalDevice *physDev,
+          void *host,
+          vk::DeviceSize bytes,
+          vk::BufferUsageFlags usage);
+      void destroy(void);
+      ~HostBuffer(void);
+    };
+
+    // minImportedHostPointerAlignment, 0 without the extension
+    vk::DeviceSize hostImportAlignment(vk::PhysicalDevice *phys);
+    // bytes rounded up to the import alignment, free with freeHostShared
+    void *allocateHostShared(vk::PhysicalDevice *phys, size_t bytes);
+    void freeHostShared(void *host);
+
     struct Fbo
     {
       vk::Image image;
@@ -99,9 +215,32 @@ namespace ngfx
       vk::Extent2D extent;
       vk::DeviceMemory mem;
       vk::Framebuffer frame;
+      // R32_UINT pick attachment of pickIds variants, null otherwise
+      vk::Image idImage;
+      vk::ImageView idView;
+      vk::DeviceMemory idMem;
     };
 
-    std::vector<const char*> getRequiredExtensions(bool debug);
+    static const vk::Format kPickFormat = vk::Format::eR32Uint;
+
+    // Second attachment of passes drawing pickIds variants. Cleared passes
+    // start from undefined, loading passes from the transfer source layout
+    // every pass leaves it in for PickReadback
+    vk::AttachmentDescription pickAttachment(vk::AttachmentLoadOp load);
+
+    enum class LogLevel
+    {
+      eInfo,
+      eWarning,
+    };
+    typedef void (*LogCallback)(LogLevel level, const char *message);
+
+    // Library messages such as device selection or budget warnings go to
+    // callback. Nothing is printed until one is set, null silences again
+    void setLogCallback(LogCallback callback);
+    void log(LogLevel level, const std::string &message);
+
+    std::vector<const char*> getRequiredExtensions(bool debug, bool headless);
     
     bool checkValidationLayerSupport(void);
     
@@ -112,12 +251,27 @@ namespace ngfx
         void * pUserData);
   
     // TODO: maybe move this into QueueFamilyIndices      
+    // A null surface finds families for headless rendering
     void findQueueFamilies(
         vk::PhysicalDevice *phys,
         vk::SurfaceKHR *surface,
         QueueFamilyIndices *qFamilies);
     
     bool checkDeviceExtensionSupport(vk::PhysicalDevice *phys);
+
+    bool hasDeviceExtension(vk::PhysicalDevice *phys, const char *name);
+
+    // VK_EXT_descriptor_indexing with the features Bindless relies on:
+    // runtime sized, partially bound, update after bind sampled image arrays
+    // with non uniform indexing
+    bool supportsDescriptorIndexing(vk::PhysicalDevice *phys);
+
+    // VK_KHR_shader_atomic_int64 with 64 bit atomics on storage buffers
+    bool supportsAtomicInt64(vk::PhysicalDevice *phys);
+
+    // VK_EXT_shader_viewport_index_layer with multiViewport, so vertex
+    // shaders can write gl_ViewportIndex
+    bool supportsViewportIndex(vk::PhysicalDevice *phys);
    
     // TODO: maybe move this into SwapchainSupportDetails
     void querySwapchainSupport(
@@ -144,7 +298,8 @@ namespace ngfx
         std::string const& appName,
         std::string const& engineName,
         uint32_t apiVersion,
-        vk::Instance *instance);
+        vk::Instance *instance,
+        bool headless = false);
     
     VkResult createDebugMessenger(
         VkInstance *instance,
@@ -154,14 +309,37 @@ namespace ngfx
         VkInstance instance,
         VkDebugUtilsMessengerEXT debugMessenger);
    
+    // Higher is better. Weighs device type, device local heap size, a
+    // dedicated transfer queue, multiview, timeline semaphores and
+    // maxImageArrayLayers. rationale receives a human readable summary
+    int64_t scorePhysicalDevice(
+        vk::PhysicalDevice *phys,
+        std::string *rationale);
+
+    bool matchesDeviceOverride(
+        vk::PhysicalDevice *phys,
+        uint32_t index,
+        const std::string &override);
+
+    // Picks the highest scoring suitable device and logs the ranking.
+    // deviceOverride (or kDeviceOverrideEnv when null) selects a device by
+    // index, UUID or name instead
     vk::PhysicalDevice pickPhysicalDevice(
         vk::Instance *instance,
-        vk::SurfaceKHR *surface);
+        vk::SurfaceKHR *surface,
+        const char *deviceOverride = nullptr);
    
     void createLogicalDevice(
         vk::PhysicalDevice *physicalDevice,
         QueueFamilyIndices *indices,
-        vk::Device *device);
+        vk::Device *device,
+        bool headless = false,
+        bool descriptorIndexing = false,
+        bool calibratedTimestamps = false,
+        bool memoryBudget = false,
+        bool externalHostMemory = false,
+        bool atomicInt64 = false,
+        bool viewportIndex = false);
    
     std::vector<char> readFile(const std::string& filename);
     
@@ -173,14 +351,62 @@ namespace ngfx
     // TODO: Fix copy constructor use, add pool pointer as arg
     vk::CommandPool createCommandPool(
         vk::Device *device,
-        QueueFamilyIndices indices);
+        QueueFamilyIndices indices,
+        vk::CommandPoolCreateFlags flags = vk::CommandPoolCreateFlags());
     
     uint32_t findMemoryType(
         vk::PhysicalDevice &phys,
         uint32_t typeFilter,
         vk::MemoryPropertyFlags requiredProps);
 
+    // Non throwing variant for optional memory types
+    bool tryFindMemoryType(
+        vk::PhysicalDevice &phys,
+        uint32_t typeFilter,
+        vk::MemoryPropertyFlags requiredProps,
+        uint32_t *index);
+
     vk::SampleCountFlags getMaxUsableSampleCount(vk::PhysicalDevice *d);
+
+    // Device local 2D image with layers array layers, tracked as eTextures
+    void createImage(
+        vk::Device *device,
+        vk::PhysicalDevice *phys,
+        vk::Extent2D extent,
+        uint32_t layers,
+        vk::Format format,
+        vk::ImageUsageFlags usage,
+        vk::Image *image,
+        vk::DeviceMemory *memory);
+
+    vk::ImageView createImageView(
+        vk::Device *device,
+        vk::Image image,
+        vk::ImageViewType type,
+        vk::Format format,
+        uint32_t firstLayer,
+        uint32_t layers);
+
+    // Device local buffer without staging, for data produced on the GPU
+    void createDeviceBuffer(
+        vk::Device *device,
+        vk::PhysicalDevice *phys,
+        vk::DeviceSize size,
+        vk::BufferUsageFlags usage,
+        MemoryTag tag,
+        vk::Buffer *buffer,
+        vk::DeviceMemory *memory);
+
+    // Persistently mapped host coherent buffer, for staging
+    void createHostBuffer(
+        vk::Device *device,
+        vk::PhysicalDevice *phys,
+        vk::DeviceSize size,
+        vk::BufferUsageFlags usage,
+        MemoryTag tag,
+        vk::Buffer *buffer,
+        vk::DeviceMemory *memory,
+        void **mapped);
   }
 }
 #endif // UTIL_H
@@ -1,4 +0,0 @@
-/usr/bin/glslc env.vert -o env_vert.spv
-/usr/bin/glslc env.frag -o env_frag.spv
-/usr/bin/glslc overlay.vert -o overlay_vert.spv
-/usr/bin/glslc overlay.frag -o overlay_frag.spv
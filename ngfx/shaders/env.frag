@@ -5,6 +5,15 @@ layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
 layout(location = 0) out vec4 outColor;
 
+#ifdef PICK_IDS
+// R32_UINT pick attachment, see PickReadback
+layout(location = 2) flat in uint fragId;
+layout(location = 1) out uint outId;
+#endif
+
 void main() {
     outColor = vec4(fragColor, 1.0);
+#ifdef PICK_IDS
+    outId = fragId;
+#endif
 }
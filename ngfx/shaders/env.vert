@@ -1,20 +1,104 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+// Specialization constants, see util::ShaderVariant
+layout(constant_id = 0) const uint CAMERA_COUNT = 1;
+layout(constant_id = 1) const uint INSTANCE_FORMAT = 0;
+layout(constant_id = 2) const bool INSTANCE_COLOR = false;
+layout(constant_id = 3) const bool INSTANCE_ROTATION = false;
+layout(constant_id = 4) const bool POINT_TOPOLOGY = false;
+layout(constant_id = 5) const uint COLOR_FORMAT = 0;
+layout(constant_id = 6) const bool INSTANCE_VELOCITY = false;
+layout(constant_id = 7) const bool INSTANCE_SCALE = false;
+layout(constant_id = 8) const bool INTERPOLATE = false;
+
+const uint FORMAT_FLOAT32 = 0;
+const uint COLOR_PALETTE8 = 1;
+
 layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
 layout(location = 3) in vec2 inOffset;
+layout(location = 4) in vec4 inInstanceColor;
+layout(location = 5) in float inRotation;
+layout(location = 6) in vec2 inVelocity;
+layout(location = 7) in float inScale;
+layout(location = 8) in vec2 inPreviousOffset;
 
+// BINDLESS builds index every camera of the shared Bindless set
+#ifdef BINDLESS
+layout(std430, binding = 0) readonly buffer cameraBufferObject {
+  mat4 mat[];
+} mvp;
+#else
 layout(binding = 0) uniform uniformBufferObject {
-  mat4 mat;
+  mat4 mat[CAMERA_COUNT];
 } mvp;
+#endif
+
+layout(binding = 1) uniform paletteBufferObject {
+  vec4 color[256];
+} palette;
+
+layout(push_constant) uniform PushConst {
+  vec4 instanceXform;
+  uint camera;
+#ifdef BINDLESS
+  uint texture;
+#endif
+  // 0 shows the previous tick, 1 the current, beyond 1 extrapolates
+  float alpha;
+} pushConst;
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+// Instance + 1 for the pick attachment, 0 is background
+layout(location = 2) flat out uint fragId;
 
 void main() {
-  gl_Position = mvp.mat * vec4(inPosition + inOffset, 0.0, 1.0);
-  fragColor = inColor;  
+  vec2 offset = inOffset;
+  if (INTERPOLATE) {
+    offset = mix(inPreviousOffset, inOffset, pushConst.alpha);
+  }
+  if (INSTANCE_FORMAT != FORMAT_FLOAT32) {
+    offset = pushConst.instanceXform.xy + offset * pushConst.instanceXform.zw;
+  }
+
+  vec2 pos = inPosition;
+  if (INSTANCE_SCALE) {
+    pos *= inScale;
+  }
+  if (INSTANCE_ROTATION) {
+    float c = cos(inRotation);
+    float s = sin(inRotation);
+    pos = vec2(c * pos.x - s * pos.y, s * pos.x + c * pos.y);
+  } else if (INSTANCE_VELOCITY) {
+    // Face along the direction of travel, the test shape points along +y
+    float speed = length(inVelocity);
+    if (speed > 0.0) {
+      vec2 d = inVelocity / speed;
+      pos = vec2(d.y * pos.x + d.x * pos.y, -d.x * pos.x + d.y * pos.y);
+    }
+  }
+
+#ifdef BINDLESS
+  uint camera = pushConst.camera;
+#else
+  uint camera = (CAMERA_COUNT == 1) ? 0 : pushConst.camera;
+#endif
+  gl_Position = mvp.mat[camera] * vec4(pos + offset, 0.0, 1.0);
+  if (POINT_TOPOLOGY) {
+    gl_PointSize = 1.0;
+  }
+
+  fragColor = inColor;
+  if (INSTANCE_COLOR) {
+    vec3 instanceColor = inInstanceColor.rgb;
+    if (COLOR_FORMAT == COLOR_PALETTE8) {
+      instanceColor = palette.color[uint(inInstanceColor.r * 255.0 + 0.5)].rgb;
+    }
+    fragColor *= instanceColor;
+  }
   fragTexCoord = inTexCoord;
+  fragId = uint(gl_InstanceIndex) + 1;
 }
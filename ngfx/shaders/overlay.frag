@@ -1,7 +1,22 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
 
+// BINDLESS builds pick from the Bindless texture array by push constant
+#ifdef BINDLESS
+layout(binding = 2) uniform sampler2D textures[];
+layout(push_constant) uniform PushConst {
+  vec4 xform;
+  uint camera;
+  uint texture;
+  float alpha;
+} pushConst;
+#define texSampler textures[pushConst.texture]
+#else
 layout(binding = 0) uniform sampler2D texSampler;
+#endif
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
@@ -1,18 +1,39 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+// Specialization constants, see util::ShaderVariant
+layout(constant_id = 4) const bool POINT_TOPOLOGY = false;
+
 layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
+// BINDLESS builds share util::BindlessPushConstants, offset is xform.xy
+#ifdef BINDLESS
+layout(push_constant) uniform PushConst {
+  vec4 xform;
+  uint camera;
+  uint texture;
+  float alpha;
+} pushConst;
+#else
 layout(push_constant) uniform PushConst {
   vec2 offset;
 } pushConst;
+#endif
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
 
 void main() {
-  gl_Position = vec4(inPosition + pushConst.offset, 0.0, 1.0);
+#ifdef BINDLESS
+  vec2 offset = pushConst.xform.xy;
+#else
+  vec2 offset = pushConst.offset;
+#endif
+  gl_Position = vec4(inPosition + offset, 0.0, 1.0);
+  if (POINT_TOPOLOGY) {
+    gl_PointSize = 1.0;
+  }
   fragColor = inColor;  
   fragTexCoord = inTexCoord;
 }
@@ -0,0 +1,139 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#ifdef VIEWPORT_INDEX
+#extension GL_ARB_shader_viewport_layer_array : enable
+#endif
+
+// Vertex pulled bodies, no vertex or index buffers are bound. Instance
+// streams are read from storage buffers by gl_VertexIndex, one point or
+// one 6 vertex quad per body. Specialization constants as env.vert
+//
+// ATLAS builds draw a group of CAMERA_COUNT CameraAtlas tiles, the
+// camera uniform holds the whole group. VIEWPORT_INDEX builds draw the
+// group at once, one instance and one viewport per camera
+layout(constant_id = 0) const uint CAMERA_COUNT = 1;
+layout(constant_id = 1) const uint INSTANCE_FORMAT = 0;
+layout(constant_id = 2) const bool INSTANCE_COLOR = false;
+layout(constant_id = 4) const bool POINT_TOPOLOGY = false;
+layout(constant_id = 5) const uint COLOR_FORMAT = 0;
+layout(constant_id = 7) const bool INSTANCE_SCALE = false;
+layout(constant_id = 8) const bool INTERPOLATE = false;
+layout(constant_id = 9) const float SPRITE_SIZE = 0.05;
+
+const uint FORMAT_FLOAT32 = 0;
+const uint FORMAT_FLOAT16 = 1;
+const uint COLOR_PALETTE8 = 1;
+
+#ifdef BINDLESS
+layout(std430, set = 0, binding = 0) readonly buffer cameraBufferObject {
+  mat4 mat[];
+} mvp;
+#else
+layout(set = 0, binding = 0) uniform uniformBufferObject {
+  mat4 mat[CAMERA_COUNT];
+} mvp;
+#endif
+
+layout(set = 0, binding = 1) uniform paletteBufferObject {
+  vec4 color[256];
+} palette;
+
+// Set 1 binds InstanceStream i at binding i, see InstanceStreams::bindStorage.
+// Positions are read as raw words so every InstanceFormat shares a binding
+layout(std430, set = 1, binding = 0) readonly buffer positionBuffer {
+  uint words[];
+} positions;
+layout(std430, set = 1, binding = 1) readonly buffer colorBuffer {
+  uint words[];
+} colors;
+layout(std430, set = 1, binding = 4) readonly buffer scaleBuffer {
+  float scale[];
+} scales;
+layout(std430, set = 1, binding = 5) readonly buffer previousBuffer {
+  uint words[];
+} previous;
+
+layout(push_constant) uniform PushConst {
+  vec4 instanceXform;
+  uint camera;
+#ifdef BINDLESS
+  uint texture;
+#endif
+  float alpha;
+} pushConst;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+// Instance + 1 for the pick attachment, 0 is background
+layout(location = 2) flat out uint fragId;
+
+// Two triangles wound like the indexed shapes
+const vec2 kCorners[6] = vec2[](
+  vec2(-1.0, -1.0), vec2(-1.0, 1.0), vec2(1.0, 1.0),
+  vec2(-1.0, -1.0), vec2(1.0, 1.0), vec2(1.0, -1.0));
+
+vec2 loadPosition(uint body, bool prev) {
+  if (INSTANCE_FORMAT == FORMAT_FLOAT32) {
+    uint i = body * 2;
+    return prev
+      ? vec2(uintBitsToFloat(previous.words[i]),
+             uintBitsToFloat(previous.words[i + 1]))
+      : vec2(uintBitsToFloat(positions.words[i]),
+             uintBitsToFloat(positions.words[i + 1]));
+  }
+  uint word = prev ? previous.words[body] : positions.words[body];
+  return (INSTANCE_FORMAT == FORMAT_FLOAT16)
+    ? unpackHalf2x16(word)
+    : unpackSnorm2x16(word);
+}
+
+void main() {
+  uint body = POINT_TOPOLOGY ? gl_VertexIndex : gl_VertexIndex / 6;
+
+  vec2 offset = loadPosition(body, false);
+  if (INTERPOLATE) {
+    offset = mix(loadPosition(body, true), offset, pushConst.alpha);
+  }
+  if (INSTANCE_FORMAT != FORMAT_FLOAT32) {
+    offset = pushConst.instanceXform.xy + offset * pushConst.instanceXform.zw;
+  }
+
+  vec2 corner = vec2(0.0);
+  if (!POINT_TOPOLOGY) {
+    corner = kCorners[gl_VertexIndex % 6];
+    float size = SPRITE_SIZE;
+    if (INSTANCE_SCALE) {
+      size *= scales.scale[body];
+    }
+    offset += corner * size;
+  }
+
+#if defined(BINDLESS)
+  uint camera = pushConst.camera;
+#elif defined(VIEWPORT_INDEX)
+  uint camera = pushConst.camera + uint(gl_InstanceIndex);
+  gl_ViewportIndex = int(camera);
+#elif defined(ATLAS)
+  uint camera = pushConst.camera;
+#else
+  uint camera = (CAMERA_COUNT == 1) ? 0 : pushConst.camera;
+#endif
+  gl_Position = mvp.mat[camera] * vec4(offset, 0.0, 1.0);
+  if (POINT_TOPOLOGY) {
+    gl_PointSize = 1.0;
+  }
+
+  fragColor = vec3(0.9);
+  if (INSTANCE_COLOR) {
+    uint word = colors.words[COLOR_FORMAT == COLOR_PALETTE8 ? body / 4 : body];
+    vec3 instanceColor;
+    if (COLOR_FORMAT == COLOR_PALETTE8) {
+      instanceColor = palette.color[(word >> ((body % 4) * 8)) & 0xff].rgb;
+    } else {
+      instanceColor = unpackUnorm4x8(word).rgb;
+    }
+    fragColor *= instanceColor;
+  }
+  fragTexCoord = corner * 0.5 + 0.5;
+  fragId = body + 1;
+}
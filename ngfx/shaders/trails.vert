@@ -0,0 +1,56 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// One line strip instance per body, walking back length slots of the
+// trail ring from head. Older points fade towards the clear color
+#ifdef BINDLESS
+layout(std430, set = 0, binding = 0) readonly buffer cameraBufferObject {
+  mat4 mat[];
+} mvp;
+#else
+layout(set = 0, binding = 0) uniform uniformBufferObject {
+  mat4 mat[1];
+} mvp;
+#endif
+
+layout(std430, set = 1, binding = 0) readonly buffer ringBuffer {
+  uint words[];
+} ring;
+
+layout(push_constant) uniform PushConst {
+  vec4 instanceXform;
+  vec4 trailXform;
+  vec4 color;
+  uint camera;
+  uint head;
+  uint length;
+  uint capacity;
+  uint maxLength;
+  uint instanceCount;
+} pushConst;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+// Picking a trail picks its body
+layout(location = 2) flat out uint fragId;
+
+const vec3 kClearColor = vec3(0.1);
+
+void main() {
+  uint age = gl_VertexIndex;
+  uint slot = (pushConst.head + pushConst.maxLength - age) % pushConst.maxLength;
+  vec2 local = unpackHalf2x16(ring.words[slot * pushConst.capacity + gl_InstanceIndex]);
+  vec2 pos = pushConst.trailXform.xy + local * pushConst.trailXform.zw;
+
+#ifdef BINDLESS
+  uint camera = pushConst.camera;
+#else
+  uint camera = 0;
+#endif
+  gl_Position = mvp.mat[camera] * vec4(pos, 0.0, 1.0);
+
+  float fade = 1.0 - float(age) / float(max(pushConst.length, 1));
+  fragColor = mix(kClearColor, pushConst.color.rgb, fade);
+  fragTexCoord = vec2(fade, 0.0);
+  fragId = uint(gl_InstanceIndex) + 1;
+}
@@ -0,0 +1,988 @@
+/*
+ * ngfx_bench
+ * Headless benchmark suite. Sweeps instance counts, camera counts, camera
+ * resolutions, upload, readback and draw paths on one device and writes
+ * the timings as JSON, for tracking performance regressions between
+ * releases. The draw paths compare the env.vert line list pipeline with
+ * vertex pulled points and sprites and the PointRaster compute path.
+ *
+ *   ngfx_bench [--device llvmpipe] [--instances 1000,1000000]
+ *              [--cameras 1,64] [--resolutions 256x256,512x512]
+ *              [--upload full,partial,none] [--readback copy,none]
+ *              [--draw indexed,points,sprites,compute]
+ *              [--warmup 5] [--repetitions 20] [--max-draws 4e9]
+ *              [--budget 8] [--output ngfx_bench.json]
+ *   ngfx_bench --shards llvmpipe,llvmpipe [--instances ...] [--cameras ...]
+ *
+ * Every list defaults to the full sweep. Scenarios that would not fit the
+ * device local heap budget, draw more than --max-draws instances
+ * across all cameras per frame, or whose compute targets exceed the
+ * device's storage buffer range, are written with a skip reason.
+ *
+ * --budget runs the indexed, points and sprites draws under a
+ * ResolutionController holding that many ms, GPU time of the camera
+ * passes or host frame time without timestamps. Warmup frames converge,
+ * the timed frames report the scale held and the smoothed time against
+ * the target.
+ *
+ * --shards splits every camera set across a ShardedCameraArray instead,
+ * one shard per listed device, rebalancing during warmup. A device may be
+ * listed more than once to run several shards on one machine. Writes the
+ * frame time and each shard's camera count and frame time.
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include "ngfx.hpp"
+#include "context.hpp"
+#include "util.hpp"
+#include "camera_array.hpp"
+#include "instance_streams.hpp"
+#include "point_raster.hpp"
+#include "resolution.hpp"
+#include "sharded_camera_array.hpp"
+
+namespace ngfx
+{
+  namespace bench
+  {
+    const util::Vertex kVertices[] = {
+      {{-0.5f, -0.5f}, {0.9f, 0.9f, 0.9f}, {0.0f, 0.0f}},
+      {{0.0f, 0.5f}, {0.9f, 0.9f, 0.9f}, {1.0f, 0.0f}},
+      {{0.5f, -0.5f}, {0.9f, 0.9f, 0.9f}, {1.0f, 1.0f}},
+    };
+
+    const uint16_t kIndices[] = {
+      0, 1, 1, 2, 2, 0
+    };
+
+    // Instances are scattered over this square around the cameras
+    const float kSpread = 4.0f;
+    // Fraction of instances rewritten per frame by the partial upload path
+    const double kPartialFraction = 0.01;
+
+    enum class UploadPath
+    {
+      eFull,    // every position staged and copied each frame
+      ePartial, // kPartialFraction of positions, as one dirty range
+      eNone     // static instances
+    };
+
+    enum class ReadbackPath
+    {
+      eCopy, // every camera copied to host memory and read
+      eNone
+    };
+
+    enum class DrawPath
+    {
+      eIndexed, // triangle outline per instance from vertex attributes
+      ePoints,  // vertex pulled point per instance
+      eSprites, // vertex pulled quad per instance
+      eCompute  // PointRaster, copied into the camera targets
+    };
+
+    const char *uploadName(UploadPath path)
+    {
+      switch (path)
+      {
+        case UploadPath::eFull: return "full";
+        case UploadPath::ePartial: return "partial";
+        default: return "none";
+      }
+    }
+
+    const char *readbackName(ReadbackPath path)
+    {
+      return (path == ReadbackPath::eCopy) ? "copy" : "none";
+    }
+
+    const char *drawName(DrawPath path)
+    {
+      switch (path)
+      {
+        case DrawPath::eIndexed: return "indexed";
+        case DrawPath::ePoints: return "points";
+        case DrawPath::eSprites: return "sprites";
+        default: return "compute";
+      }
+    }
+
+    struct Options
+    {
+      std::string device;
+      std::vector<uint32_t> instances = {
+        1000, 10000, 100000, 1000000, 10000000};
+      std::vector<uint32_t> cameras = {1, 16, 256, 4096};
+      std::vector<vk::Extent2D> resolutions = {vk::Extent2D(256, 256)};
+      std::vector<UploadPath> uploads = {
+        UploadPath::eFull, UploadPath::ePartial, UploadPath::eNone};
+      std::vector<ReadbackPath> readbacks = {
+        ReadbackPath::eCopy, ReadbackPath::eNone};
+      std::vector<DrawPath> draws = {
+        DrawPath::eIndexed,
+        DrawPath::ePoints,
+        DrawPath::eSprites,
+        DrawPath::eCompute};
+      uint32_t warmup = 5;
+      uint32_t repetitions = 20;
+      double maxDraws = 4e9;
+      // ResolutionController target in ms, 0 renders at full resolution
+      double budgetMs = 0.0;
+      std::string output = "ngfx_bench.json";
+      // Devices of the sharded sweep, empty runs the single device sweep
+      std::vector<std::string> shards;
+    };
+
+    struct Scenario
+    {
+      uint32_t instances;
+      uint32_t cameras;
+      vk::Extent2D resolution;
+      UploadPath upload;
+      ReadbackPath readback;
+      DrawPath draw;
+    };
+
+    struct Stats
+    {
+      double mean = 0.0;
+      double median = 0.0;
+      double min = 0.0;
+      double max = 0.0;
+      double p95 = 0.0;
+    };
+
+    struct Result
+    {
+      Scenario scenario;
+      // Empty when the scenario ran
+      std::string skipped;
+      // Submit to readback consumed, measured on the host
+      Stats cpuMs;
+      // Timestamp queries around the command buffer, when supported
+      bool gpuValid = false;
+      Stats gpuMs;
+      vk::DeviceSize uploadBytes = 0;
+      vk::DeviceSize readbackBytes = 0;
+      // Tracked bytes per tag while the scenario was resident
+      vk::DeviceSize tagBytes[util::kMemoryTagCount] = {};
+      vk::DeviceSize deviceLocalUsage = 0;
+      // Set when run under --budget
+      bool budget = false;
+      float scale = 1.0f;
+      // ResolutionController::filteredMs over the timed frames
+      Stats heldMs;
+    };
+
+    struct ShardedResult
+    {
+      uint32_t instances;
+      uint32_t cameras;
+      std::string skipped;
+      // Render of all shards, submit to merged readback
+      Stats cpuMs;
+      // Per shard after the last rebalance
+      std::vector<uint32_t> shardCameras;
+      std::vector<double> shardMs;
+    };
+
+    Stats summarize(std::vector<double> samples)
+    {
+      Stats stats;
+      if (samples.empty())
+      {
+        return stats;
+      }
+      std::sort(samples.begin(), samples.end());
+      double sum = 0.0;
+      for (double sample : samples)
+      {
+        sum += sample;
+      }
+      stats.mean = sum / samples.size();
+      stats.median = samples[samples.size() / 2];
+      stats.min = samples.front();
+      stats.max = samples.back();
+      stats.p95 = samples[std::min<size_t>(
+          samples.size() - 1,
+          (size_t) std::ceil(0.95 * samples.size()) - 1)];
+      return stats;
+    }
+
+    std::vector<std::string> split(const std::string &list)
+    {
+      std::vector<std::string> items;
+      std::stringstream stream(list);
+      std::string item;
+      while (std::getline(stream, item, ','))
+      {
+        if (!item.empty())
+        {
+          items.push_back(item);
+        }
+      }
+      return items;
+    }
+
+    Options parseOptions(int argc, char **argv)
+    {
+      Options options;
+      for (int i = 1; i < argc; i++)
+      {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+          throw std::runtime_error("missing value for " + arg);
+        }
+        std::string value = argv[++i];
+
+        if (arg == "--device")
+        {
+          options.device = value;
+        }
+        else if (arg == "--instances" || arg == "--cameras")
+        {
+          std::vector<uint32_t> *counts = (arg == "--instances")
+            ? &options.instances
+            : &options.cameras;
+          counts->clear();
+          for (const std::string &item : split(value))
+          {
+            // Accepts 1e6 as well as 1000000
+            counts->push_back((uint32_t) std::stod(item));
+          }
+        }
+        else if (arg == "--resolutions")
+        {
+          options.resolutions.clear();
+          for (const std::string &item : split(value))
+          {
+            size_t x = item.find('x');
+            if (x == std::string::npos)
+            {
+              throw std::runtime_error("resolution must be WxH: " + item);
+            }
+            options.resolutions.push_back(vk::Extent2D(
+                std::stoul(item.substr(0, x)),
+                std::stoul(item.substr(x + 1))));
+          }
+        }
+        else if (arg == "--upload")
+        {
+          options.uploads.clear();
+          for (const std::string &item : split(value))
+          {
+            if (item == "full")
+            {
+              options.uploads.push_back(UploadPath::eFull);
+            }
+            else if (item == "partial")
+            {
+              options.uploads.push_back(UploadPath::ePartial);
+            }
+            else if (item == "none")
+            {
+              options.uploads.push_back(UploadPath::eNone);
+            }
+            else
+            {
+              throw std::runtime_error("unknown upload path: " + item);
+            }
+          }
+        }
+        else if (arg == "--readback")
+        {
+          options.readbacks.clear();
+          for (const std::string &item : split(value))
+          {
+            if (item == "copy")
+            {
+              options.readbacks.push_back(ReadbackPath::eCopy);
+            }
+            else if (item == "none")
+            {
+              options.readbacks.push_back(ReadbackPath::eNone);
+            }
+            else
+            {
+              throw std::runtime_error("unknown readback path: " + item);
+            }
+          }
+        }
+        else if (arg == "--draw")
+        {
+          options.draws.clear();
+          for (const std::string &item : split(value))
+          {
+            if (item == "indexed")
+            {
+              options.draws.push_back(DrawPath::eIndexed);
+            }
+            else if (item == "points")
+            {
+              options.draws.push_back(DrawPath::ePoints);
+            }
+            else if (item == "sprites")
+            {
+              options.draws.push_back(DrawPath::eSprites);
+            }
+            else if (item == "compute")
+            {
+              options.draws.push_back(DrawPath::eCompute);
+            }
+            else
+            {
+              throw std::runtime_error("unknown draw path: " + item);
+            }
+          }
+        }
+        else if (arg == "--warmup")
+        {
+          options.warmup = std::stoul(value);
+        }
+        else if (arg == "--repetitions")
+        {
+          options.repetitions = std::max(1ul, std::stoul(value));
+        }
+        else if (arg == "--max-draws")
+        {
+          options.maxDraws = std::stod(value);
+        }
+        else if (arg == "--budget")
+        {
+          options.budgetMs = std::stod(value);
+        }
+        else if (arg == "--output")
+        {
+          options.output = value;
+        }
+        else if (arg == "--shards")
+        {
+          options.shards = split(value);
+        }
+        else
+        {
+          throw std::runtime_error("unknown option " + arg);
+        }
+      }
+      return options;
+    }
+
+    // Runs every scenario on one headless Context. Geometry is shared, the
+    // camera array and instance streams are rebuilt per scenario
+    class Runner
+    {
+      public:
+        Runner(const Options &options)
+          : _options(options),
+            c(options.device.empty() ? nullptr : options.device.c_str(), true)
+        {
+          _vertices.reset(new util::FastBuffer(
+              &c.device,
+              &c.physicalDevice,
+              &c.cmdPool,
+              sizeof(kVertices),
+              vk::BufferUsageFlagBits::eVertexBuffer,
+              util::MemoryTag::eGeometry));
+          _vertices->init();
+          _vertices->stage((void *) kVertices);
+          _vertices->blockingCopy(c.graphicsQueue);
+          _vertices->makeStatic();
+
+          _indices.reset(new util::FastBuffer(
+              &c.device,
+              &c.physicalDevice,
+              &c.cmdPool,
+              sizeof(kIndices),
+              vk::BufferUsageFlagBits::eIndexBuffer,
+              util::MemoryTag::eGeometry));
+          _indices->init();
+          _indices->stage((void *) kIndices);
+          _indices->blockingCopy(c.graphicsQueue);
+          _indices->makeStatic();
+
+          _pool = util::createCommandPool(
+              &c.device,
+              c.qFamilies,
+              vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
+          vk::CommandBufferAllocateInfo allocInfo(
+              _pool,
+              vk::CommandBufferLevel::ePrimary,
+              1);
+          c.device.allocateCommandBuffers(&allocInfo, &_cmd);
+
+          vk::FenceCreateInfo fenceCI;
+          c.device.createFence(&fenceCI, nullptr, &_fence);
+
+          uint32_t familyCount = 0;
+          c.physicalDevice.getQueueFamilyProperties(
+              &familyCount,
+              (vk::QueueFamilyProperties *) nullptr);
+          std::vector<vk::QueueFamilyProperties> families(familyCount);
+          c.physicalDevice.getQueueFamilyProperties(&familyCount,
+                                                    families.data());
+          _gpuTimestamps =
+              families[c.qFamilies.graphicsFamily.value()].timestampValidBits
+              > 0;
+          _timestampPeriod =
+              c.physicalDevice.getProperties().limits.timestampPeriod;
+
+          vk::QueryPoolCreateInfo queryCI(
+              vk::QueryPoolCreateFlags(),
+              vk::QueryType::eTimestamp,
+              2,
+              vk::QueryPipelineStatisticFlags());
+          c.device.createQueryPool(&queryCI, nullptr, &_timestamps);
+
+          // Largest device local heap, where the camera targets live
+          vk::PhysicalDeviceMemoryProperties props =
+              c.physicalDevice.getMemoryProperties();
+          _localHeap = 0;
+          for (uint32_t i = 0; i < props.memoryHeapCount; i++)
+          {
+            if ((props.memoryHeaps[i].flags
+                 & vk::MemoryHeapFlagBits::eDeviceLocal)
+                && props.memoryHeaps[i].size
+                   > props.memoryHeaps[_localHeap].size)
+            {
+              _localHeap = i;
+            }
+          }
+        }
+
+        ~Runner(void)
+        {
+          c.device.waitIdle();
+          c.device.destroyQueryPool(_timestamps);
+          c.device.destroyFence(_fence);
+          c.device.destroyCommandPool(_pool);
+          _vertices.reset();
+          _indices.reset();
+
+          c.destroy();
+        }
+
+        Result run(const Scenario &scenario)
+        {
+          Result result;
+          result.scenario = scenario;
+
+          double draws = (double) scenario.instances * scenario.cameras;
+          if (draws > _options.maxDraws)
+          {
+            result.skipped = "exceeds --max-draws";
+            return result;
+          }
+
+          // Targets, readback and instance streams with their staging
+          vk::DeviceSize frameBytes = (vk::DeviceSize) scenario.resolution.width
+            * scenario.resolution.height * 4;
+          vk::DeviceSize estimate = 2 * scenario.cameras * frameBytes
+            + 2 * (vk::DeviceSize) scenario.instances * sizeof(util::Instance);
+          if (scenario.draw == DrawPath::eCompute)
+          {
+            // 64 bit keys and the resolved colors
+            estimate += 3 * scenario.cameras * frameBytes;
+          }
+          if (c.memory.heapUsage(_localHeap) + estimate
+              > c.memory.heapBudget(_localHeap))
+          {
+            result.skipped = "exceeds memory budget";
+            return result;
+          }
+          if (scenario.draw == DrawPath::eCompute
+              && !PointRaster::fits(&c, scenario.cameras, scenario.resolution))
+          {
+            result.skipped = "exceeds point raster limits";
+            return result;
+          }
+
+          util::ShaderVariant variant;
+          if (scenario.draw != DrawPath::eIndexed)
+          {
+            variant.pulled = true;
+            variant.topology = (scenario.draw == DrawPath::eSprites)
+              ? vk::PrimitiveTopology::eTriangleList
+              : vk::PrimitiveTopology::ePointList;
+          }
+          std::unique_ptr<InstanceStreams> instances(
+              new InstanceStreams(&c, variant, scenario.instances));
+          std::unique_ptr<CameraArray> cameras(new CameraArray(
+              &c,
+              scenario.cameras,
+              variant,
+              nullptr,
+              scenario.resolution));
+          std::unique_ptr<PointRaster> raster;
+          if (scenario.draw == DrawPath::eCompute)
+          {
+            raster.reset(new PointRaster(&c,
+                                         scenario.cameras,
+                                         scenario.resolution,
+                                         variant));
+            raster->writeCameras(cameras->cams);
+          }
+          // PointRaster ignores renderExtent
+          std::unique_ptr<ResolutionController> resolution;
+          if (_options.budgetMs > 0.0 && !raster)
+          {
+            ResolutionSettings settings;
+            settings.targetMs = _options.budgetMs;
+            resolution.reset(new ResolutionController(&c,
+                                                      cameras.get(),
+                                                      settings,
+                                                      1));
+          }
+
+          std::vector<util::Instance> positions(scenario.instances);
+          std::mt19937 rng(scenario.instances);
+          std::uniform_real_distribution<float> spread(-kSpread, kSpread);
+          for (util::Instance &instance : positions)
+          {
+            instance.pos = glm::vec2(spread(rng), spread(rng));
+          }
+          instances->write(util::InstanceStream::ePosition, positions.data());
+          instances->upload(c.graphicsQueue);
+          c.graphicsQueue.waitIdle();
+
+          for (uint32_t t = 0; t < util::kMemoryTagCount; t++)
+          {
+            result.tagBytes[t] =
+                c.memory.tag(static_cast<util::MemoryTag>(t)).bytes;
+          }
+          result.deviceLocalUsage = c.memory.heapUsage(_localHeap);
+
+          std::vector<uint8_t> host;
+          if (scenario.readback == ReadbackPath::eCopy)
+          {
+            host.resize(scenario.cameras * cameras->frameSize());
+          }
+
+          uint32_t partialCount = std::max<uint32_t>(
+              1,
+              (uint32_t) (scenario.instances * kPartialFraction));
+          uint32_t partialFirst = 0;
+
+          std::vector<double> cpuMs;
+          std::vector<double> gpuMs;
+          std::vector<double> heldMs;
+          for (uint32_t rep = 0;
+               rep < _options.warmup + _options.repetitions;
+               rep++)
+          {
+            auto start = std::chrono::steady_clock::now();
+
+            if (scenario.upload == UploadPath::eFull)
+            {
+              instances->write(util::InstanceStream::ePosition,
+                               positions.data());
+            }
+            else if (scenario.upload == UploadPath::ePartial)
+            {
+              // Rolling window, written straight into staging memory
+              util::Instance *mapped = (util::Instance *) instances->map(
+                  util::InstanceStream::ePosition);
+              uint32_t count = std::min(partialCount,
+                                        scenario.instances - partialFirst);
+              memcpy(mapped + partialFirst,
+                     positions.data() + partialFirst,
+                     count * sizeof(util::Instance));
+              instances->markDirty(util::InstanceStream::ePosition,
+                                   partialFirst,
+                                   count);
+              partialFirst = (partialFirst + count) % scenario.instances;
+            }
+
+            vk::CommandBufferBeginInfo beginInfo(
+                vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+                nullptr);
+            _cmd.begin(beginInfo);
+            // Queues without timestampValidBits only get the CPU time
+            if (_gpuTimestamps)
+            {
+              _cmd.resetQueryPool(_timestamps, 0, 2);
+              _cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe,
+                                  _timestamps,
+                                  0);
+            }
+            vk::DeviceSize uploaded = instances->recordUpload(_cmd);
+            if (raster)
+            {
+              raster->record(_cmd, instances.get(), scenario.instances);
+              raster->recordCopy(_cmd, cameras.get());
+            }
+            else
+            {
+              if (resolution)
+              {
+                resolution->begin(_cmd, 0);
+              }
+              cameras->record(_cmd,
+                              _vertices.get(),
+                              _indices.get(),
+                              util::array_size(kIndices),
+                              instances.get(),
+                              scenario.instances);
+              if (resolution)
+              {
+                resolution->end(_cmd, 0);
+              }
+            }
+            if (scenario.readback == ReadbackPath::eCopy)
+            {
+              cameras->recordReadback(_cmd);
+            }
+            if (_gpuTimestamps)
+            {
+              _cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe,
+                                  _timestamps,
+                                  1);
+            }
+            _cmd.end();
+
+            vk::SubmitInfo submitInfo(0, nullptr, nullptr, 1, &_cmd, 0, nullptr);
+            c.graphicsQueue.submit(1, &submitInfo, _fence);
+            c.device.waitForFences(1, &_fence, true, UINT64_MAX);
+            c.device.resetFences(1, &_fence);
+
+            if (scenario.readback == ReadbackPath::eCopy)
+            {
+              memcpy(host.data(), cameras->frame(0), host.size());
+            }
+
+            double ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+
+            // Same inputs as Renderer::render
+            if (resolution && resolution->timestamps)
+            {
+              resolution->update();
+            }
+            else if (resolution)
+            {
+              resolution->update(ms);
+            }
+
+            if (rep < _options.warmup)
+            {
+              continue;
+            }
+            cpuMs.push_back(ms);
+            if (resolution)
+            {
+              heldMs.push_back(resolution->filteredMs);
+            }
+            result.uploadBytes = uploaded;
+            result.readbackBytes = host.size();
+
+            if (_gpuTimestamps)
+            {
+              uint64_t ticks[2];
+              c.device.getQueryPoolResults(
+                  _timestamps,
+                  0,
+                  2,
+                  sizeof(ticks),
+                  ticks,
+                  sizeof(uint64_t),
+                  vk::QueryResultFlagBits::e64
+                  | vk::QueryResultFlagBits::eWait);
+              gpuMs.push_back(
+                  (ticks[1] - ticks[0]) * _timestampPeriod * 1e-6);
+            }
+          }
+
+          c.device.waitIdle();
+          if (resolution)
+          {
+            result.budget = true;
+            result.scale = resolution->scale;
+            result.heldMs = summarize(heldMs);
+          }
+          resolution.reset();
+          raster.reset();
+          cameras.reset();
+          instances.reset();
+          // Every owner of a long lived set in this scenario is gone
+          c.descriptors.reset();
+
+          result.cpuMs = summarize(cpuMs);
+          result.gpuValid = !gpuMs.empty();
+          result.gpuMs = summarize(gpuMs);
+          return result;
+        }
+
+        std::string deviceName(void)
+        {
+          return c.physicalDevice.getProperties().deviceName;
+        }
+
+      private:
+        const Options &_options;
+        Context c;
+        std::unique_ptr<util::FastBuffer> _vertices;
+        std::unique_ptr<util::FastBuffer> _indices;
+        vk::CommandPool _pool;
+        vk::CommandBuffer _cmd;
+        vk::Fence _fence;
+        vk::QueryPool _timestamps;
+        bool _gpuTimestamps;
+        float _timestampPeriod;
+        uint32_t _localHeap;
+    };
+
+    void writeStats(std::ostream &out, const char *name, const Stats &stats)
+    {
+      out << "\"" << name << "\": {"
+          << "\"mean\": " << stats.mean
+          << ", \"median\": " << stats.median
+          << ", \"min\": " << stats.min
+          << ", \"max\": " << stats.max
+          << ", \"p95\": " << stats.p95 << "}";
+    }
+
+    void writeResult(std::ostream &out, const Result &result)
+    {
+      const Scenario &s = result.scenario;
+      out << "    {\"instances\": " << s.instances
+          << ", \"cameras\": " << s.cameras
+          << ", \"width\": " << s.resolution.width
+          << ", \"height\": " << s.resolution.height
+          << ", \"upload\": \"" << uploadName(s.upload) << "\""
+          << ", \"readback\": \"" << readbackName(s.readback) << "\""
+          << ", \"draw\": \"" << drawName(s.draw) << "\"";
+      if (!result.skipped.empty())
+      {
+        out << ", \"skipped\": \"" << result.skipped << "\"}";
+        return;
+      }
+
+      out << ",\n     ";
+      writeStats(out, "cpuMs", result.cpuMs);
+      out << ",\n     ";
+      if (result.gpuValid)
+      {
+        writeStats(out, "gpuMs", result.gpuMs);
+      }
+      else
+      {
+        out << "\"gpuMs\": null";
+      }
+
+      // Throughput from the median frame, GPU time when it is known
+      double ms = result.gpuValid ? result.gpuMs.median : result.cpuMs.median;
+      double seconds = std::max(ms, 1e-6) * 1e-3;
+      double cpuSeconds = std::max(result.cpuMs.median, 1e-6) * 1e-3;
+      out << ",\n     \"instanceDrawsPerSecond\": "
+          << (double) s.instances * s.cameras / seconds
+          << ", \"framesPerSecond\": " << 1.0 / cpuSeconds
+          << ", \"uploadBytes\": " << result.uploadBytes
+          << ", \"uploadBytesPerSecond\": " << result.uploadBytes / cpuSeconds
+          << ", \"readbackBytes\": " << result.readbackBytes
+          << ", \"readbackBytesPerSecond\": "
+          << result.readbackBytes / cpuSeconds;
+
+      if (result.budget)
+      {
+        out << ",\n     \"budget\": {\"scale\": " << result.scale << ", ";
+        writeStats(out, "heldMs", result.heldMs);
+        out << "}";
+      }
+
+      out << ",\n     \"memory\": {";
+      for (uint32_t t = 0; t < util::kMemoryTagCount; t++)
+      {
+        out << "\"" << util::memoryTagName(static_cast<util::MemoryTag>(t))
+            << "\": " << result.tagBytes[t] << ", ";
+      }
+      out << "\"deviceLocalUsage\": " << result.deviceLocalUsage << "}}";
+    }
+
+    // Indexed draw of instances into cameras split across options.shards.
+    // Rebalances after every warmup frame, so the timed frames run with
+    // the split the measurements settled on
+    ShardedResult runSharded(const Options &options,
+                             uint32_t cameras,
+                             uint32_t instances)
+    {
+      ShardedResult result;
+      result.instances = instances;
+      result.cameras = cameras;
+      if (cameras < options.shards.size())
+      {
+        result.skipped = "fewer cameras than shards";
+        return result;
+      }
+      if ((double) instances * cameras > options.maxDraws)
+      {
+        result.skipped = "exceeds --max-draws";
+        return result;
+      }
+
+      ShardedCameraArray sharded(options.shards,
+                                 cameras,
+                                 util::ShaderVariant(),
+                                 instances,
+                                 kVertices,
+                                 util::array_size(kVertices),
+                                 kIndices,
+                                 util::array_size(kIndices));
+
+      std::vector<util::Instance> positions(instances);
+      std::mt19937 rng(instances);
+      std::uniform_real_distribution<float> spread(-kSpread, kSpread);
+      for (util::Instance &instance : positions)
+      {
+        instance.pos = glm::vec2(spread(rng), spread(rng));
+      }
+      sharded.writeInstances(util::InstanceStream::ePosition,
+                             positions.data());
+
+      std::vector<double> cpuMs;
+      for (uint32_t rep = 0; rep < options.warmup + options.repetitions; rep++)
+      {
+        auto start = std::chrono::steady_clock::now();
+        sharded.render(instances);
+        double ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+
+        if (rep < options.warmup)
+        {
+          sharded.rebalance();
+          continue;
+        }
+        cpuMs.push_back(ms);
+      }
+
+      result.cpuMs = summarize(cpuMs);
+      for (uint32_t i = 0; i < sharded.shardCount(); i++)
+      {
+        result.shardCameras.push_back(sharded.shard(i).cameraCount);
+        result.shardMs.push_back(sharded.shard(i).frameMs);
+      }
+      return result;
+    }
+
+    void writeShardedResult(std::ostream &out, const ShardedResult &result)
+    {
+      out << "    {\"instances\": " << result.instances
+          << ", \"cameras\": " << result.cameras;
+      if (!result.skipped.empty())
+      {
+        out << ", \"skipped\": \"" << result.skipped << "\"}";
+        return;
+      }
+
+      out << ",\n     ";
+      writeStats(out, "cpuMs", result.cpuMs);
+      out << ",\n     \"shards\": [";
+      for (size_t i = 0; i < result.shardCameras.size(); i++)
+      {
+        out << (i > 0 ? ", " : "")
+            << "{\"cameras\": " << result.shardCameras[i]
+            << ", \"frameMs\": " << result.shardMs[i] << "}";
+      }
+      out << "]}";
+    }
+
+    int runShardedSweep(const Options &options)
+    {
+      std::vector<ShardedResult> results;
+      for (uint32_t cameras : options.cameras)
+      for (uint32_t instances : options.instances)
+      {
+        std::cout << "bench: " << instances << " instances, " << cameras
+                  << " cameras across " << options.shards.size()
+                  << " shards" << std::endl;
+        results.push_back(runSharded(options, cameras, instances));
+      }
+
+      std::ofstream out(options.output);
+      out << "{\n  \"shards\": [";
+      for (size_t i = 0; i < options.shards.size(); i++)
+      {
+        out << (i > 0 ? ", " : "") << "\"" << options.shards[i] << "\"";
+      }
+      out << "]"
+          << ",\n  \"warmup\": " << options.warmup
+          << ",\n  \"repetitions\": " << options.repetitions
+          << ",\n  \"results\": [\n";
+      for (size_t i = 0; i < results.size(); i++)
+      {
+        writeShardedResult(out, results[i]);
+        out << (i + 1 < results.size() ? ",\n" : "\n");
+      }
+      out << "  ]\n}\n";
+      std::cout << "bench: wrote " << results.size() << " results to "
+                << options.output << std::endl;
+      return EXIT_SUCCESS;
+    }
+  }
+}
+
+static void printLog(ngfx::util::LogLevel level, const char *message)
+{
+  (level == ngfx::util::LogLevel::eWarning ? std::cerr : std::cout)
+    << "ngfx: " << message << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  using namespace ngfx::bench;
+
+  ngfx::util::setLogCallback(printLog);
+  try
+  {
+    Options options = parseOptions(argc, argv);
+    if (!options.shards.empty())
+    {
+      return runShardedSweep(options);
+    }
+    Runner runner(options);
+
+    std::vector<Result> results;
+    for (const vk::Extent2D &resolution : options.resolutions)
+    for (uint32_t cameras : options.cameras)
+    for (uint32_t instances : options.instances)
+    for (UploadPath upload : options.uploads)
+    for (ReadbackPath readback : options.readbacks)
+    for (DrawPath draw : options.draws)
+    {
+      Scenario scenario = {
+        instances, cameras, resolution, upload, readback, draw};
+      std::cout << "bench: " << instances << " instances, " << cameras
+                << " cameras at " << resolution.width << "x"
+                << resolution.height << ", upload " << uploadName(upload)
+                << ", readback " << readbackName(readback)
+                << ", draw " << drawName(draw) << std::endl;
+      results.push_back(runner.run(scenario));
+    }
+
+    std::ofstream out(options.output);
+    out << "{\n  \"device\": \"" << runner.deviceName() << "\""
+        << ",\n  \"warmup\": " << options.warmup
+        << ",\n  \"repetitions\": " << options.repetitions
+        << ",\n  \"budgetMs\": " << options.budgetMs
+        << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+      writeResult(out, results[i]);
+      out << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+    std::cout << "bench: wrote " << results.size() << " results to "
+              << options.output << std::endl;
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
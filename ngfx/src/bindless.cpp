@@ -0,0 +1,260 @@
+#include "bindless.hpp"
+#include <algorithm>
+#include "vulkan/vulkan.hpp"
+#include "context.hpp"
+#include "pipeline.hpp"
+#include "pack.hpp"
+
+namespace ngfx
+{
+  Bindless::Bindless(Context *c)
+    : camBuffer(
+          &c->device,
+          &c->physicalDevice,
+          &c->cmdPool,
+          kMaxCameras * sizeof(glm::mat4),
+          vk::BufferUsageFlagBits::eStorageBuffer,
+          util::MemoryTag::eCameras),
+      cameraCount(0), textureCount(0), device(&c->device)
+  {
+    if (!c->descriptorIndexing)
+    {
+      throw std::runtime_error("bindless requires descriptor indexing");
+    }
+
+    // Combined image samplers count against both limits
+    vk::PhysicalDeviceDescriptorIndexingPropertiesEXT indexingProps;
+    vk::PhysicalDeviceProperties2 props;
+    props.pNext = &indexingProps;
+    c->physicalDevice.getProperties2(&props);
+    textureCapacity = std::min({
+        kMaxTextures,
+        indexingProps.maxPerStageDescriptorUpdateAfterBindSampledImages,
+        indexingProps.maxPerStageDescriptorUpdateAfterBindSamplers,
+        indexingProps.maxDescriptorSetUpdateAfterBindSampledImages});
+
+    //Descriptors & buffers
+    vk::DescriptorSetLayoutBinding bindings[] = {
+      vk::DescriptorSetLayoutBinding(
+         0,
+         vk::DescriptorType::eStorageBuffer,
+         1,
+         vk::ShaderStageFlagBits::eVertex, 
+         nullptr),
+      vk::DescriptorSetLayoutBinding(
+         1,
+         vk::DescriptorType::eUniformBuffer,
+         1,
+         vk::ShaderStageFlagBits::eVertex, 
+         nullptr),
+      vk::DescriptorSetLayoutBinding(
+         2,
+         vk::DescriptorType::eCombinedImageSampler,
+         textureCapacity,
+         vk::ShaderStageFlagBits::eFragment, 
+         nullptr)
+    };
+
+    // Textures may be unwritten and change while the set is in use
+    vk::DescriptorBindingFlagsEXT bindingFlags[] = {
+      vk::DescriptorBindingFlagsEXT(),
+      vk::DescriptorBindingFlagsEXT(),
+      vk::DescriptorBindingFlagBitsEXT::ePartiallyBound
+        | vk::DescriptorBindingFlagBitsEXT::eUpdateAfterBind
+        | vk::DescriptorBindingFlagBitsEXT::eVariableDescriptorCount
+    };
+
+    vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsCI(
+        util::array_size(bindingFlags),
+        bindingFlags);
+    
+    vk::DescriptorSetLayoutCreateInfo layoutCI(
+        vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPoolEXT,
+        util::array_size(bindings),
+        bindings); 
+    layoutCI.pNext = &bindingFlagsCI;
+    
+    device->createDescriptorSetLayout(
+        &layoutCI,
+        nullptr,
+        &descLayout);
+
+    util::buildLayout(
+        device,
+        1,
+        &descLayout,
+        sizeof(util::BindlessPushConstants),
+        &layout,
+        vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment);
+
+    camBuffer.init();
+    createDescriptorPool();
+    createDescriptorSets(c);
+  }
+
+  void Bindless::createDescriptorPool(void)
+  {
+    vk::DescriptorPoolSize poolSize[] = {
+      vk::DescriptorPoolSize(
+          vk::DescriptorType::eStorageBuffer,
+          1),
+      vk::DescriptorPoolSize(
+          vk::DescriptorType::eUniformBuffer,
+          1),
+      vk::DescriptorPoolSize(
+          vk::DescriptorType::eCombinedImageSampler,
+          textureCapacity)
+    };
+
+    vk::DescriptorPoolCreateInfo poolInfo(
+        vk::DescriptorPoolCreateFlagBits::eUpdateAfterBindEXT,
+        1,
+        util::array_size(poolSize),
+        poolSize); 
+    
+    device->createDescriptorPool(
+       &poolInfo, 
+       nullptr, 
+       &descPool);
+  }
+
+  void Bindless::createDescriptorSets(Context *c)
+  {
+    vk::DescriptorSetVariableDescriptorCountAllocateInfoEXT countInfo(
+        1,
+        &textureCapacity);
+
+    vk::DescriptorSetAllocateInfo allocInfo(descPool,
+                                            1,
+                                            &descLayout);
+    allocInfo.pNext = &countInfo;
+
+    device->allocateDescriptorSets(&allocInfo, &descSet);
+
+    vk::DescriptorBufferInfo camInfo(
+        camBuffer.localBuffer,
+        0,
+        camBuffer.size);
+    
+    vk::DescriptorBufferInfo paletteInfo(
+        c->palette->localBuffer,
+        0,
+        c->palette->size);
+    
+    vk::WriteDescriptorSet descWrite[] = { 
+      vk::WriteDescriptorSet(
+          descSet,
+          0,
+          0,
+          1,
+          vk::DescriptorType::eStorageBuffer,
+          nullptr,
+          &camInfo,
+          nullptr),
+      vk::WriteDescriptorSet(
+          descSet,
+          1,
+          0,
+          1,
+          vk::DescriptorType::eUniformBuffer,
+          nullptr,
+          &paletteInfo,
+          nullptr)
+    };
+
+    device->updateDescriptorSets(
+        util::array_size(descWrite),
+        descWrite,
+        0,
+        nullptr); 
+  }
+
+  uint32_t Bindless::addCameras(uint32_t count)
+  {
+    if (cameraCount + count > kMaxCameras)
+    {
+      throw std::runtime_error("out of bindless camera slots");
+    }
+    uint32_t first = cameraCount;
+    cameraCount += count;
+    return first;
+  }
+
+  void Bindless::writeCameras(uint32_t first,
+                              uint32_t count,
+                              const glm::mat4 *mats)
+  {
+    vk::DeviceSize offset = first * sizeof(glm::mat4);
+    vk::DeviceSize bytes = count * sizeof(glm::mat4);
+    memcpy((uint8_t *) camBuffer.data() + offset, mats, bytes);
+    camBuffer.markDirty(offset, bytes);
+  }
+
+  uint32_t Bindless::addTexture(vk::ImageView view, vk::Sampler sampler)
+  {
+    if (textureCount == textureCapacity)
+    {
+      throw std::runtime_error("out of bindless texture slots");
+    }
+    uint32_t index = textureCount++;
+    writeTexture(index, view, sampler);
+    return index;
+  }
+
+  void Bindless::writeTexture(uint32_t index,
+                              vk::ImageView view,
+                              vk::Sampler sampler)
+  {
+    vk::DescriptorImageInfo imageInfo(
+        sampler,
+        view,
+        vk::ImageLayout::eShaderReadOnlyOptimal);
+
+    vk::WriteDescriptorSet descWrite(
+        descSet,
+        2,
+        index,
+        1,
+        vk::DescriptorType::eCombinedImageSampler,
+        &imageInfo,
+        nullptr,
+        nullptr);
+
+    device->updateDescriptorSets(1, &descWrite, 0, nullptr);
+  }
+
+  vk::DeviceSize Bindless::recordUpload(vk::CommandBuffer cmd)
+  {
+    return camBuffer.recordDirty(cmd);
+  }
+
+  void Bindless::upload(vk::Queue q)
+  {
+    // Whole buffer, ranges staged so far are covered
+    camBuffer.blockingCopy(q);
+    camBuffer.dirty.clear();
+  }
+
+  void Bindless::bind(vk::CommandBuffer cmd, vk::PipelineBindPoint point)
+  {
+    cmd.bindDescriptorSets(point, layout, 0, 1, &descSet, 0, nullptr);
+  }
+
+  void Bindless::push(vk::CommandBuffer cmd,
+                      const util::BindlessPushConstants &push)
+  {
+    cmd.pushConstants(
+        layout,
+        vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+        0,
+        sizeof(util::BindlessPushConstants),
+        (void *) &push);
+  }
+
+  Bindless::~Bindless(void)
+  {
+    device->destroyPipelineLayout(layout);
+    device->destroyDescriptorPool(descPool);
+    device->destroyDescriptorSetLayout(descLayout);
+  }
+}
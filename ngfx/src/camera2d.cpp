@@ -0,0 +1,69 @@
+#include "camera2d.hpp"
+#include "trace.hpp"
+
+namespace ngfx
+{
+  void buildCameras2D(const float *x,
+                      const float *y,
+                      const float *zoom,
+                      const float *cosRotation,
+                      const float *sinRotation,
+                      uint32_t count,
+                      float aspect,
+                      glm::mat4 *out)
+  {
+    NGFX_TRACE_SCOPE("buildCameras2D");
+    float invAspect = 1.0f / aspect;
+    float *dst = (float *) out;
+    for (uint32_t i = 0; i < count; i++)
+    {
+      float c = cosRotation[i];
+      float s = sinRotation[i];
+      float sx = zoom[i] * invAspect;
+      float sy = zoom[i];
+      float *m = dst + i * 16;
+      m[0] = sx * c;
+      m[1] = -sy * s;
+      m[2] = 0.0f;
+      m[3] = 0.0f;
+      m[4] = sx * s;
+      m[5] = sy * c;
+      m[6] = 0.0f;
+      m[7] = 0.0f;
+      m[8] = 0.0f;
+      m[9] = 0.0f;
+      m[10] = 1.0f;
+      m[11] = 0.0f;
+      m[12] = -sx * (c * x[i] + s * y[i]);
+      m[13] = sy * (s * x[i] - c * y[i]);
+      m[14] = 0.0f;
+      m[15] = 1.0f;
+    }
+  }
+
+  void footprints2D(const float *x,
+                    const float *y,
+                    const float *zoom,
+                    const float *cosRotation,
+                    const float *sinRotation,
+                    uint32_t count,
+                    float aspect,
+                    glm::vec4 *out)
+  {
+    float *dst = (float *) out;
+    for (uint32_t i = 0; i < count; i++)
+    {
+      float hy = 1.0f / zoom[i];
+      float hx = aspect * hy;
+      float c = std::abs(cosRotation[i]);
+      float s = std::abs(sinRotation[i]);
+      float ex = c * hx + s * hy;
+      float ey = s * hx + c * hy;
+      float *f = dst + i * 4;
+      f[0] = x[i] - ex;
+      f[1] = y[i] - ey;
+      f[2] = x[i] + ex;
+      f[3] = y[i] + ey;
+    }
+  }
+}
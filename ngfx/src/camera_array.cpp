@@ -1,8 +1,11 @@
 #include "camera_array.hpp"
+#include <algorithm>
 #include "vulkan/vulkan.hpp"
 #include "context.hpp"
 #include "util.hpp"
 #include "pipeline.hpp"
+#include "pack.hpp"
+#include "trace.hpp"
 
 namespace ngfx
 {
@@ -42,121 +45,615 @@ namespace ngfx
         vk::VertexInputRate::eInstance)
   };
 
-  CameraArray::CameraArray(Context *c)
-    : w(256), h(256), device(&c->device), cam(vk::Extent2D(w, h)), 
+  CameraArray::CameraArray(Context *c,
+                           uint32_t count,
+                           const util::ShaderVariant &shaderVariant,
+                           Bindless *bindless,
+                           vk::Extent2D extent)
+    : w(extent.width), h(extent.height), count(count),
+      renderExtent(extent), frameExtent(extent), variant(shaderVariant),
+      cams(count, Camera(vk::Extent2D(w, h))),
+      camStride(util::cameraStride(&c->physicalDevice)),
+      camData(count * camStride / sizeof(glm::mat4)),
       camBuffer(
           &c->device,
           &c->physicalDevice,
           &c->cmdPool,
-          sizeof(cam.cam),
-          vk::BufferUsageFlagBits::eUniformBuffer)
+          count * camStride,
+          vk::BufferUsageFlagBits::eUniformBuffer,
+          util::MemoryTag::eCameras),
+      bindless(bindless), firstCamera(0), device(&c->device)
   {
     buildRenderPass();
-    buildFbo(c);
-
-    //Descriptors & buffers
-    vk::DescriptorSetLayoutBinding bindings[] = {
-      vk::DescriptorSetLayoutBinding(
-         0,
-         vk::DescriptorType::eUniformBuffer,
-         1,
-         vk::ShaderStageFlagBits::eVertex, 
-         nullptr)
-    };
-    
-    vk::DescriptorSetLayoutCreateInfo layoutCI(
-        vk::DescriptorSetLayoutCreateFlags(),
-        util::array_size(bindings),
-        bindings); 
-    
-    device->createDescriptorSetLayout(
-        &layoutCI,
-        nullptr,
-        &descLayout);
+    fbos.resize(count);
+    for (util::Fbo &fbo : fbos)
+    {
+      buildFbo(c, &fbo);
+    }
+    buildReadback(c);
 
-    vk::PipelineLayoutCreateInfo pipelineLayoutCI(
-        vk::PipelineLayoutCreateFlags(),
-        1,
-        &descLayout,
-        0,
-        nullptr);
+    if (bindless)
+    {
+      firstCamera = bindless->addCameras(count);
+    }
+    else
+    {
+      buildDescriptors();
+    }
+    buildLayout();
 
-    device->createPipelineLayout(
-        &pipelineLayoutCI,
-        nullptr,
-        &layout);
+    // Bindless shaders index every camera, otherwise each camera is
+    // selected by its dynamic offset and the shader sees a single matrix.
+    // Any cameraCount of the caller is overridden, see ShaderVariant
+    variant.cameraCount = 1;
+    // Sprites are expanded into triangles whatever the shape topology
+    if (variant.pulled
+        && variant.topology != vk::PrimitiveTopology::ePointList)
+    {
+      variant.topology = vk::PrimitiveTopology::eTriangleList;
+    }
+
+    // Pulled variants have no vertex input at all
+    util::VertexInput vertexInput;
+    std::string vertPath;
+    if (variant.pulled)
+    {
+      vertPath = bindless
+        ? "shaders/points_bindless_vert.spv"
+        : "shaders/points_vert.spv";
+    }
+    else
+    {
+      util::buildVertexInput(
+          variant,
+          binding,
+          util::array_size(binding),
+          attribute,
+          util::array_size(attribute),
+          &vertexInput);
+      vertPath = bindless
+        ? "shaders/env_bindless_vert.spv"
+        : "shaders/env_vert.spv";
+    }
 
     util::buildPipeline(
         &c->device,
-        fbo.extent,
-        binding,
-        util::array_size(binding),
-        attribute,
-        util::array_size(attribute),
-        "shaders/env_vert.spv",
-        "shaders/env_frag.spv",
-        false,
+        vk::Extent2D(w, h),
+        vertexInput.bindings.data(),
+        vertexInput.bindings.size(),
+        vertexInput.attributes.data(),
+        vertexInput.attributes.size(),
+        vertPath,
+        variant.pickIds ? "shaders/env_id_frag.spv" : "shaders/env_frag.spv",
+        variant,
         &layout,
         &pass,
         &c->pipelineCache,
         &pipeline);
 
-    camBuffer.init();
-    createDescriptorPool();
-    createDescriptorSets();
-    camBuffer.stage(&cam.cam);
-
     // TODO: Fix hack that stores queue here, prefer to restructure fastbuffer
     q = &c->graphicsQueue;
-    camBuffer.blockingCopy(c->graphicsQueue);
+    if (!bindless)
+    {
+      camBuffer.init();
+      createDescriptorSets(c);
+    }
+    stageCameras();
+    uploadCameras();
+  }
+
+  void CameraArray::buildDescriptors(void)
+  {
+    util::buildEnvDescriptorLayout(device, &descLayout);
+    descTemplate = util::createEnvTemplate(device, descLayout);
+  }
+
+  void CameraArray::buildLayout(void)
+  {
+    if (bindless && !variant.pulled)
+    {
+      layout = bindless->layout;
+      return;
+    }
+
+    // Set 0 matches the camera set of the indexed path, so binding it and
+    // pushing constants work the same for both
+    vk::DescriptorSetLayout setLayouts[2] = {
+      bindless ? bindless->descLayout : descLayout
+    };
+    uint32_t setCount = 1;
+    if (variant.pulled)
+    {
+      util::buildInstanceStorageLayout(device, &storageLayout);
+      setLayouts[setCount++] = storageLayout;
+    }
+
+    if (bindless)
+    {
+      util::buildLayout(
+          device,
+          setCount,
+          setLayouts,
+          sizeof(util::BindlessPushConstants),
+          &layout,
+          vk::ShaderStageFlagBits::eVertex
+          | vk::ShaderStageFlagBits::eFragment);
+    }
+    else
+    {
+      util::buildLayout(
+          device,
+          setCount,
+          setLayouts,
+          sizeof(util::EnvPushConstants),
+          &layout);
+    }
+  }
+
+  void CameraArray::stageCameras(void)
+  {
+    for (uint32_t i = 0; i < count; i++)
+    {
+      camData[i * camStride / sizeof(glm::mat4)] = cams[i].cam;
+    }
+    if (bindless)
+    {
+      for (uint32_t i = 0; i < count; i++)
+      {
+        bindless->writeCameras(firstCamera + i, 1, &cams[i].cam);
+      }
+    }
+    else
+    {
+      camBuffer.stage(camData.data());
+    }
+  }
+
+  void CameraArray::uploadCameras(void)
+  {
+    NGFX_TRACE_SCOPE("CameraArray::uploadCameras");
+    if (bindless)
+    {
+      bindless->upload(*q);
+    }
+    else
+    {
+      camBuffer.blockingCopy(*q);
+    }
+  }
+
+  void CameraArray::recordCameras(vk::CommandBuffer cmd,
+                                  const glm::mat4 *mats)
+  {
+    // vkCmdUpdateBuffer limit per call
+    static const vk::DeviceSize kMaxUpdateBytes = 65536;
+
+    vk::Buffer target;
+    vk::DeviceSize offset;
+    vk::DeviceSize bytes;
+    const uint8_t *data;
+    if (bindless)
+    {
+      target = bindless->camBuffer.localBuffer;
+      offset = firstCamera * sizeof(glm::mat4);
+      bytes = count * sizeof(glm::mat4);
+      data = (const uint8_t *) mats;
+    }
+    else
+    {
+      for (uint32_t i = 0; i < count; i++)
+      {
+        camData[i * camStride / sizeof(glm::mat4)] = mats[i];
+      }
+      target = camBuffer.localBuffer;
+      offset = 0;
+      bytes = count * camStride;
+      data = (const uint8_t *) camData.data();
+    }
+
+    // Earlier frames must be done reading before the buffer changes
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eVertexShader,
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlags(),
+        0, nullptr, 0, nullptr, 0, nullptr);
+    for (vk::DeviceSize done = 0; done < bytes; done += kMaxUpdateBytes)
+    {
+      cmd.updateBuffer(target,
+                       offset + done,
+                       std::min(kMaxUpdateBytes, bytes - done),
+                       data + done);
+    }
+    vk::MemoryBarrier visible(
+        vk::AccessFlagBits::eTransferWrite,
+        vk::AccessFlagBits::eUniformRead | vk::AccessFlagBits::eShaderRead);
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eVertexShader,
+        vk::DependencyFlags(),
+        1, &visible, 0, nullptr, 0, nullptr);
+  }
+
+  void CameraArray::record(vk::CommandBuffer cmd,
+                           util::FastBuffer *vertices,
+                           util::FastBuffer *indices,
+                           uint32_t indexCount,
+                           InstanceStreams *instances,
+                           uint32_t instanceCount,
+                           float alpha,
+                           const util::InstanceRange *ranges)
+  {
+    vk::DeviceSize offsets[] = {0};
+
+    // TODO: Fix weird code for clearValue
+    // Currently requires two sub-classes to construct
+    const std::array<float, 4> clearColorPrimative = 
+    {0.1f, 0.1f, 0.1f, 1.0f};
+
+    vk::ClearColorValue clearColor(clearColorPrimative);
+    // The pick attachment, when present, clears to background
+    const vk::ClearValue clearValues[] = {
+      vk::ClearValue(clearColor),
+      vk::ClearValue(vk::ClearColorValue(std::array<uint32_t, 4>{0, 0, 0, 0}))
+    };
+
+    // One bind serves every pass, cameras are picked by push constant
+    if (bindless)
+    {
+      bindless->bind(cmd);
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+      util::EnvPushConstants push = {
+        glm::vec4(0.0, 0.0, 1.0, 1.0), i, alpha};
+
+      vk::RenderPassBeginInfo passInfo(
+          pass, fbos[i].frame,
+          vk::Rect2D(vk::Offset2D(0, 0), renderExtent),
+          variant.pickIds ? 2 : 1,
+          clearValues);
+
+      cmd.beginRenderPass(passInfo, vk::SubpassContents::eInline);
+      cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+      util::setViewport(cmd, renderExtent);
+      if (variant.pulled)
+      {
+        instances->bindStorage(cmd, layout, 1);
+      }
+      else
+      {
+        cmd.bindVertexBuffers(
+            0,
+            1,
+            &vertices->localBuffer,
+            (const vk::DeviceSize *) offsets);
+        instances->bind(cmd, 1);
+        cmd.bindIndexBuffer(
+            indices->localBuffer,
+            0,
+            vk::IndexType::eUint16);
+      }
+      if (bindless)
+      {
+        bindless->push(cmd, util::BindlessPushConstants{
+            push.instanceXform, firstCamera + i, 0, alpha});
+      }
+      else
+      {
+        uint32_t offset = (uint32_t) (i * camStride);
+        cmd.bindDescriptorSets(
+            vk::PipelineBindPoint::eGraphics,
+            layout,
+            0,
+            1,
+            &descSet,
+            1,
+            &offset);
+        cmd.pushConstants(
+            layout, vk::ShaderStageFlagBits::eVertex, 0,
+            sizeof(util::EnvPushConstants), (void *)&push);
+      }
+      util::InstanceRange range = ranges
+        ? ranges[i]
+        : util::InstanceRange{0, instanceCount};
+      if (variant.pulled)
+      {
+        uint32_t vertexCount = util::pulledVertexCount(variant);
+        cmd.draw(range.count * vertexCount, 1, range.first * vertexCount, 0);
+      }
+      else
+      {
+        cmd.drawIndexed(indexCount, range.count, 0, 0, range.first);
+      }
+      cmd.endRenderPass();
+    }
+  }
+
+  void CameraArray::setRenderExtent(vk::Extent2D extent)
+  {
+    renderExtent = vk::Extent2D(
+        std::min(std::max(extent.width, 1u), (uint32_t) w),
+        std::min(std::max(extent.height, 1u), (uint32_t) h));
+  }
+
+  glm::vec2 CameraArray::uvScale(void)
+  {
+    return glm::vec2((float) renderExtent.width / w,
+                     (float) renderExtent.height / h);
+  }
+
+  void CameraArray::recordBlit(vk::CommandBuffer cmd,
+                                vk::Image image,
+                                vk::Extent2D extent)
+  {
+    vk::ImageSubresourceRange range(
+        vk::ImageAspectFlagBits::eColor, 0, 1, 0, count);
+    vk::ImageSubresourceRange single(
+        vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+
+    std::vector<vk::ImageMemoryBarrier> barriers;
+    barriers.push_back(vk::ImageMemoryBarrier(
+        vk::AccessFlagBits::eShaderRead,
+        vk::AccessFlagBits::eTransferRead,
+        vk::ImageLayout::eShaderReadOnlyOptimal,
+        vk::ImageLayout::eTransferSrcOptimal,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        image,
+        range));
+    for (uint32_t i = 0; i < count; i++)
+    {
+      // Whatever the camera drew is replaced
+      barriers.push_back(vk::ImageMemoryBarrier(
+          vk::AccessFlagBits::eShaderRead,
+          vk::AccessFlagBits::eTransferWrite,
+          vk::ImageLayout::eUndefined,
+          vk::ImageLayout::eTransferDstOptimal,
+          VK_QUEUE_FAMILY_IGNORED,
+          VK_QUEUE_FAMILY_IGNORED,
+          fbos[i].image,
+          single));
+    }
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eFragmentShader,
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlags(),
+        0, nullptr, 0, nullptr, barriers.size(), barriers.data());
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+      vk::Extent2D target = renderExtent;
+      vk::ImageBlit region(
+          vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, i, 1),
+          {vk::Offset3D(0, 0, 0),
+           vk::Offset3D(extent.width, extent.height, 1)},
+          vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
+          {vk::Offset3D(0, 0, 0),
+           vk::Offset3D(target.width, target.height, 1)});
+      cmd.blitImage(image,
+                    vk::ImageLayout::eTransferSrcOptimal,
+                    fbos[i].image,
+                    vk::ImageLayout::eTransferDstOptimal,
+                    1,
+                    &region,
+                    vk::Filter::eLinear);
+    }
+
+    barriers.clear();
+    barriers.push_back(vk::ImageMemoryBarrier(
+        vk::AccessFlagBits::eTransferRead,
+        vk::AccessFlagBits::eShaderRead,
+        vk::ImageLayout::eTransferSrcOptimal,
+        vk::ImageLayout::eShaderReadOnlyOptimal,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        image,
+        range));
+    for (uint32_t i = 0; i < count; i++)
+    {
+      barriers.push_back(vk::ImageMemoryBarrier(
+          vk::AccessFlagBits::eTransferWrite,
+          vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eTransferRead,
+          vk::ImageLayout::eTransferDstOptimal,
+          vk::ImageLayout::eShaderReadOnlyOptimal,
+          VK_QUEUE_FAMILY_IGNORED,
+          VK_QUEUE_FAMILY_IGNORED,
+          fbos[i].image,
+          single));
+    }
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eFragmentShader
+        | vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlags(),
+        0, nullptr, 0, nullptr, barriers.size(), barriers.data());
+  }
+
+  vk::DeviceSize CameraArray::frameSize(void)
+  {
+    return (vk::DeviceSize) w * h * 4;
+  }
+
+  const uint8_t *CameraArray::frame(uint32_t camera)
+  {
+    return (const uint8_t *) readbackData + camera * frameSize();
+  }
+
+  void CameraArray::recordReadback(vk::CommandBuffer cmd)
+  {
+    vk::ImageSubresourceRange range(
+        vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+    frameExtent = renderExtent;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+      vk::ImageMemoryBarrier toTransfer(
+          vk::AccessFlagBits::eColorAttachmentWrite,
+          vk::AccessFlagBits::eTransferRead,
+          vk::ImageLayout::eShaderReadOnlyOptimal,
+          vk::ImageLayout::eTransferSrcOptimal,
+          VK_QUEUE_FAMILY_IGNORED,
+          VK_QUEUE_FAMILY_IGNORED,
+          fbos[i].image,
+          range);
+      cmd.pipelineBarrier(
+          vk::PipelineStageFlagBits::eColorAttachmentOutput,
+          vk::PipelineStageFlagBits::eTransfer,
+          vk::DependencyFlags(),
+          0, nullptr, 0, nullptr, 1, &toTransfer);
+
+      vk::BufferImageCopy region(
+          i * frameSize(),
+          0,
+          0,
+          vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
+          vk::Offset3D(0, 0, 0),
+          vk::Extent3D(frameExtent.width, frameExtent.height, 1));
+      cmd.copyImageToBuffer(
+          fbos[i].image,
+          vk::ImageLayout::eTransferSrcOptimal,
+          readbackBuffer,
+          1,
+          &region);
+
+      // Back to the render pass final layout for samplers such as Overlay
+      vk::ImageMemoryBarrier toShader(
+          vk::AccessFlagBits::eTransferRead,
+          vk::AccessFlagBits::eShaderRead,
+          vk::ImageLayout::eTransferSrcOptimal,
+          vk::ImageLayout::eShaderReadOnlyOptimal,
+          VK_QUEUE_FAMILY_IGNORED,
+          VK_QUEUE_FAMILY_IGNORED,
+          fbos[i].image,
+          range);
+      cmd.pipelineBarrier(
+          vk::PipelineStageFlagBits::eTransfer,
+          vk::PipelineStageFlagBits::eFragmentShader,
+          vk::DependencyFlags(),
+          0, nullptr, 0, nullptr, 1, &toShader);
+    }
+
+    vk::BufferMemoryBarrier toHost(
+        vk::AccessFlagBits::eTransferWrite,
+        vk::AccessFlagBits::eHostRead,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        readbackBuffer,
+        0,
+        VK_WHOLE_SIZE);
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eHost,
+        vk::DependencyFlags(),
+        0, nullptr, 1, &toHost, 0, nullptr);
+  }
+
+  void CameraArray::buildReadback(Context *c)
+  {
+    vk::BufferCreateInfo readbackCI(
+        vk::BufferCreateFlags(),
+        count * frameSize(),
+        vk::BufferUsageFlagBits::eTransferDst,
+        vk::SharingMode::eExclusive,
+        0,
+        nullptr);
+    device->createBuffer(&readbackCI, nullptr, &readbackBuffer);
+
+    vk::MemoryRequirements memReqs =
+        device->getBufferMemoryRequirements(readbackBuffer);
+
+    // Cached memory makes host reads fast, but is not exposed everywhere
+    uint32_t memType;
+    if (!util::tryFindMemoryType(c->physicalDevice,
+                                 memReqs.memoryTypeBits,
+                                 vk::MemoryPropertyFlagBits::eHostVisible
+                                 | vk::MemoryPropertyFlagBits::eHostCoherent
+                                 | vk::MemoryPropertyFlagBits::eHostCached,
+                                 &memType))
+    {
+      memType = util::findMemoryType(c->physicalDevice,
+                                     memReqs.memoryTypeBits,
+                                     vk::MemoryPropertyFlagBits::eHostVisible
+                                     | vk::MemoryPropertyFlagBits::eHostCoherent);
+    }
+
+    vk::MemoryAllocateInfo allocInfo(memReqs.size, memType);
+    util::allocateMemory(device,
+                         allocInfo,
+                         util::MemoryTag::eReadback,
+                         &readbackMemory);
+    device->bindBufferMemory(readbackBuffer, readbackMemory, 0);
+    device->mapMemory(readbackMemory,
+                      0,
+                      VK_WHOLE_SIZE,
+                      vk::MemoryMapFlags(),
+                      &readbackData);
   }
 
   void CameraArray::buildRenderPass()
   {
-    vk::AttachmentDescription colorAttachment(
-        vk::AttachmentDescriptionFlags(),
-        vk::Format::eR8G8B8A8Srgb,
-        vk::SampleCountFlagBits::e1,
-        vk::AttachmentLoadOp::eClear,
-        vk::AttachmentStoreOp::eStore,
-        vk::AttachmentLoadOp::eDontCare,
-        vk::AttachmentStoreOp::eDontCare,
-        vk::ImageLayout::eUndefined,
-        vk::ImageLayout::eShaderReadOnlyOptimal);
+    vk::AttachmentDescription attachments[] = {
+      vk::AttachmentDescription(
+          vk::AttachmentDescriptionFlags(),
+          vk::Format::eR8G8B8A8Srgb,
+          vk::SampleCountFlagBits::e1,
+          vk::AttachmentLoadOp::eClear,
+          vk::AttachmentStoreOp::eStore,
+          vk::AttachmentLoadOp::eDontCare,
+          vk::AttachmentStoreOp::eDontCare,
+          vk::ImageLayout::eUndefined,
+          vk::ImageLayout::eShaderReadOnlyOptimal),
+      util::pickAttachment(vk::AttachmentLoadOp::eClear)
+    };
+    uint32_t attachmentCount = variant.pickIds ? 2 : 1;
     
-    vk::AttachmentReference colorAttachmentRef(
-        0,
-        vk::ImageLayout::eColorAttachmentOptimal);
+    vk::AttachmentReference colorAttachmentRefs[] = {
+      vk::AttachmentReference(0, vk::ImageLayout::eColorAttachmentOptimal),
+      vk::AttachmentReference(1, vk::ImageLayout::eColorAttachmentOptimal)
+    };
     
     vk::SubpassDescription subpass(
         vk::SubpassDescriptionFlags(),
         vk::PipelineBindPoint::eGraphics,
         0,
         nullptr,
-        1,
-        &colorAttachmentRef,
+        attachmentCount,
+        colorAttachmentRefs,
         nullptr,
         nullptr,
         0,
         nullptr);
     
-    vk::SubpassDependency subpassDependency(
-        0,
-        VK_SUBPASS_EXTERNAL,
-        vk::PipelineStageFlagBits::eColorAttachmentOutput,
-        vk::PipelineStageFlagBits::eColorAttachmentOutput,
-        vk::AccessFlags(),
-        vk::AccessFlagBits::eColorAttachmentWrite,
-        vk::DependencyFlags());
+    vk::SubpassDependency subpassDependencies[] = {
+      vk::SubpassDependency(
+          0,
+          VK_SUBPASS_EXTERNAL,
+          vk::PipelineStageFlagBits::eColorAttachmentOutput,
+          vk::PipelineStageFlagBits::eColorAttachmentOutput,
+          vk::AccessFlags(),
+          vk::AccessFlagBits::eColorAttachmentWrite,
+          vk::DependencyFlags()),
+      // Readback and pick copies of an earlier frame finish before the
+      // clear
+      vk::SubpassDependency(
+          VK_SUBPASS_EXTERNAL,
+          0,
+          vk::PipelineStageFlagBits::eTransfer,
+          vk::PipelineStageFlagBits::eColorAttachmentOutput,
+          vk::AccessFlags(),
+          vk::AccessFlagBits::eColorAttachmentWrite,
+          vk::DependencyFlags())
+    };
 
     vk::RenderPassCreateInfo renderPassCI(
         vk::RenderPassCreateFlags(),
-        1,
-        &colorAttachment,
+        attachmentCount,
+        attachments,
         1,
         &subpass,
-        1,
-        &subpassDependency);
+        util::array_size(subpassDependencies),
+        subpassDependencies);
     
     device->createRenderPass(
         &renderPassCI,
@@ -164,14 +661,14 @@ namespace ngfx
         &pass);
   }
 
-  void CameraArray::buildFbo(Context *c)
+  void CameraArray::buildFbo(Context *c, util::Fbo *fbo)
   {
-    vk::Image *i = &fbo.image;
-    vk::DeviceMemory *m = &fbo.mem;
-    vk::ImageView *v = &fbo.view;
-    vk::Framebuffer *f = &fbo.frame;
+    vk::Image *i = &fbo->image;
+    vk::DeviceMemory *m = &fbo->mem;
+    vk::ImageView *v = &fbo->view;
+    vk::Framebuffer *f = &fbo->frame;
 
-    fbo.extent = vk::Extent2D(w, h);
+    fbo->extent = vk::Extent2D(w, h);
     
     vk::ImageCreateInfo imageCI(
         vk::ImageCreateFlags(),
@@ -184,7 +681,8 @@ namespace ngfx
         vk::ImageTiling::eOptimal,
         vk::ImageUsageFlagBits::eColorAttachment
         | vk::ImageUsageFlagBits::eSampled
-        | vk::ImageUsageFlagBits::eTransferSrc,
+        | vk::ImageUsageFlagBits::eTransferSrc
+        | vk::ImageUsageFlagBits::eTransferDst,
         vk::SharingMode::eExclusive);
     
     device->createImage(&imageCI, nullptr, i);
@@ -201,7 +699,7 @@ namespace ngfx
         memReqs.size,
         memType);
     
-    c->device.allocateMemory(&allocInfo, nullptr, m);
+    util::allocateMemory(&c->device, allocInfo, util::MemoryTag::eTextures, m);
     c->device.bindImageMemory(*i, *m, 0);
 
     vk::ImageViewCreateInfo viewCI(
@@ -219,12 +717,33 @@ namespace ngfx
 
     c->device.createImageView(&viewCI, nullptr, v);
 
+    vk::ImageView attachments[] = {*v, vk::ImageView()};
+    if (variant.pickIds)
+    {
+      util::createImage(device,
+                        &c->physicalDevice,
+                        fbo->extent,
+                        1,
+                        util::kPickFormat,
+                        vk::ImageUsageFlagBits::eColorAttachment
+                        | vk::ImageUsageFlagBits::eTransferSrc,
+                        &fbo->idImage,
+                        &fbo->idMem);
+      fbo->idView = util::createImageView(device,
+                                          fbo->idImage,
+                                          vk::ImageViewType::e2D,
+                                          util::kPickFormat,
+                                          0,
+                                          1);
+      attachments[1] = fbo->idView;
+    }
+
     // Framebuffer
     vk::FramebufferCreateInfo framebufferCI(
         vk::FramebufferCreateFlags(),
         pass,
-        1,
-        v,
+        variant.pickIds ? 2 : 1,
+        attachments,
         w,
         h,
         1); // Layer
@@ -235,59 +754,57 @@ namespace ngfx
         f);
   }
 
-  void CameraArray::createDescriptorPool(void) {
-    vk::DescriptorPoolSize poolSize[] = {
-      vk::DescriptorPoolSize(
-          vk::DescriptorType::eUniformBuffer,
-          1)
-    };
-
-    vk::DescriptorPoolCreateInfo poolInfo(
-        vk::DescriptorPoolCreateFlags(),
-        1,
-        util::array_size(poolSize),
-        poolSize); 
-    
-    device->createDescriptorPool(
-       &poolInfo, 
-       nullptr, 
-       &descPool);
-  }
-
-  void CameraArray::createDescriptorSets(void)
+  void CameraArray::createDescriptorSets(Context *c)
   {
-    vk::DescriptorSetAllocateInfo allocInfo(descPool,
-                                            1,
-                                            &descLayout);
-
-    device->allocateDescriptorSets(&allocInfo, &descSet);
+    descriptors.init(device);
+    descSet = descriptors.allocate(descLayout);
 
-    vk::DescriptorBufferInfo buffInfo(
-        camBuffer.localBuffer,
-        0,
-        sizeof(cam.cam));
-    
-    vk::WriteDescriptorSet descWrite[] = { 
-      vk::WriteDescriptorSet(
-          descSet,
-          0,
-          0,
-          1,
-          vk::DescriptorType::eUniformBuffer,
-          nullptr,
-          &buffInfo,
-          nullptr)
+    util::EnvDescriptors descriptors = {
+      vk::DescriptorBufferInfo(camBuffer.localBuffer, 0, sizeof(glm::mat4)),
+      vk::DescriptorBufferInfo(c->palette->localBuffer,
+                               0,
+                               c->palette->size)
     };
-
-    device->updateDescriptorSets(
-        util::array_size(descWrite),
-        descWrite,
-        0,
-        nullptr); 
+    device->updateDescriptorSetWithTemplate(descSet,
+                                            descTemplate,
+                                            &descriptors);
   }
   
   CameraArray::~CameraArray()
   {
+    device->unmapMemory(readbackMemory);
+    device->destroyBuffer(readbackBuffer);
+    util::freeMemory(device, readbackMemory);
+
+    for (util::Fbo &fbo : fbos)
+    {
+      device->destroyFramebuffer(fbo.frame);
+      device->destroyImageView(fbo.view);
+      device->destroyImage(fbo.image);
+      util::freeMemory(device, fbo.mem);
+      if (variant.pickIds)
+      {
+        device->destroyImageView(fbo.idView);
+        device->destroyImage(fbo.idImage);
+        util::freeMemory(device, fbo.idMem);
+      }
+    }
+
+    device->destroyPipeline(pipeline);
+    if (!bindless || variant.pulled)
+    {
+      device->destroyPipelineLayout(layout);
+    }
+    if (variant.pulled)
+    {
+      device->destroyDescriptorSetLayout(storageLayout);
+    }
+    if (!bindless)
+    {
+      descriptors.destroy();
+      device->destroyDescriptorUpdateTemplate(descTemplate);
+      device->destroyDescriptorSetLayout(descLayout);
+    }
     device->destroyRenderPass(pass);
   }
 }
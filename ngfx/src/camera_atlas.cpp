@@ -0,0 +1,465 @@
+#include "camera_atlas.hpp"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include "vulkan/vulkan.hpp"
+#include "context.hpp"
+#include "util.hpp"
+#include "pipeline.hpp"
+#include "descriptors.hpp"
+#include "pack.hpp"
+#include "trace.hpp"
+
+namespace ngfx
+{
+  namespace util
+  {
+    vk::Extent2D packRects(const vk::Extent2D *sizes,
+                           uint32_t count,
+                           uint32_t maxWidth,
+                           vk::Rect2D *rects)
+    {
+      std::vector<uint32_t> order(count);
+      std::iota(order.begin(), order.end(), 0);
+      std::stable_sort(order.begin(), order.end(),
+                       [sizes](uint32_t a, uint32_t b) {
+                         return sizes[a].height > sizes[b].height;
+                       });
+
+      uint32_t x = 0;
+      uint32_t y = 0;
+      uint32_t shelf = 0;
+      uint32_t width = 0;
+      for (uint32_t i : order)
+      {
+        vk::Extent2D size = sizes[i];
+        if (x > 0 && x + size.width > maxWidth)
+        {
+          y += shelf;
+          x = 0;
+          shelf = 0;
+        }
+        rects[i] = vk::Rect2D(vk::Offset2D(x, y), size);
+        x += size.width;
+        shelf = std::max(shelf, size.height);
+        width = std::max(width, x);
+      }
+      return vk::Extent2D(width, y + shelf);
+    }
+  }
+
+  static uint32_t groupCount(uint32_t count)
+  {
+    return (count + CameraAtlas::kGroup - 1) / CameraAtlas::kGroup;
+  }
+
+  CameraAtlas::CameraAtlas(Context *c,
+                           const std::vector<vk::Extent2D> &sizes,
+                           const util::ShaderVariant &shaderVariant,
+                           uint32_t maxWidth)
+    : count(sizes.size()), variant(shaderVariant),
+      viewportIndex(c->viewportIndex),
+      rects(sizes.size()), uvRects(sizes.size()),
+      camData(groupCount(sizes.size()) * kGroup),
+      camBuffer(
+          &c->device,
+          &c->physicalDevice,
+          &c->cmdPool,
+          groupCount(sizes.size()) * kGroup * sizeof(glm::mat4),
+          vk::BufferUsageFlagBits::eUniformBuffer,
+          util::MemoryTag::eCameras),
+      device(&c->device)
+  {
+    if (!variant.pulled)
+    {
+      throw std::runtime_error("camera atlas requires a pulled variant");
+    }
+    if (variant.pickIds)
+    {
+      throw std::runtime_error("camera atlas does not support pick ids");
+    }
+
+    if (maxWidth == 0)
+    {
+      double area = 0.0;
+      for (vk::Extent2D size : sizes)
+      {
+        area += (double) size.width * size.height;
+        maxWidth = std::max(maxWidth, size.width);
+      }
+      maxWidth = std::max(maxWidth, (uint32_t) std::ceil(std::sqrt(area)));
+    }
+    extent = util::packRects(sizes.data(), count, maxWidth, rects.data());
+    vk::PhysicalDeviceLimits limits = c->physicalDevice.getProperties().limits;
+    if (extent.width > limits.maxFramebufferWidth
+        || extent.height > limits.maxFramebufferHeight
+        || extent.width > limits.maxImageDimension2D
+        || extent.height > limits.maxImageDimension2D)
+    {
+      throw std::runtime_error("camera atlas exceeds the framebuffer limits");
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+      const vk::Rect2D &r = rects[i];
+      uvRects[i] = glm::vec4(
+          (float) r.offset.x / extent.width,
+          (float) r.offset.y / extent.height,
+          (float) (r.offset.x + r.extent.width) / extent.width,
+          (float) (r.offset.y + r.extent.height) / extent.height);
+      cams.push_back(Camera(r.extent));
+    }
+
+    buildRenderPass();
+    buildFbo(c);
+    buildReadback(c);
+    camBuffer.init();
+    buildDescriptors(c);
+
+    // The camera uniform holds one group, selected by dynamic offset
+    variant.cameraCount = kGroup;
+    if (variant.topology != vk::PrimitiveTopology::ePointList)
+    {
+      variant.topology = vk::PrimitiveTopology::eTriangleList;
+    }
+    util::VertexInput vertexInput;
+    util::buildPipeline(
+        device,
+        extent,
+        vertexInput.bindings.data(),
+        vertexInput.bindings.size(),
+        vertexInput.attributes.data(),
+        vertexInput.attributes.size(),
+        viewportIndex
+          ? "shaders/points_atlas_vi_vert.spv"
+          : "shaders/points_atlas_vert.spv",
+        "shaders/env_frag.spv",
+        variant,
+        &layout,
+        &pass,
+        &c->pipelineCache,
+        &pipeline,
+        viewportIndex ? kGroup : 1);
+
+    stageCameras();
+    camBuffer.blockingCopy(c->graphicsQueue);
+  }
+
+  void CameraAtlas::buildRenderPass(void)
+  {
+    vk::AttachmentDescription attachment(
+        vk::AttachmentDescriptionFlags(),
+        vk::Format::eR8G8B8A8Srgb,
+        vk::SampleCountFlagBits::e1,
+        vk::AttachmentLoadOp::eClear,
+        vk::AttachmentStoreOp::eStore,
+        vk::AttachmentLoadOp::eDontCare,
+        vk::AttachmentStoreOp::eDontCare,
+        vk::ImageLayout::eUndefined,
+        vk::ImageLayout::eShaderReadOnlyOptimal);
+    vk::AttachmentReference colorRef(
+        0, vk::ImageLayout::eColorAttachmentOptimal);
+    vk::SubpassDescription subpass(
+        vk::SubpassDescriptionFlags(),
+        vk::PipelineBindPoint::eGraphics,
+        0,
+        nullptr,
+        1,
+        &colorRef,
+        nullptr,
+        nullptr,
+        0,
+        nullptr);
+    // Readbacks of the previous frame finish before the clear
+    vk::SubpassDependency dependency(
+        VK_SUBPASS_EXTERNAL,
+        0,
+        vk::PipelineStageFlagBits::eTransfer
+        | vk::PipelineStageFlagBits::eFragmentShader,
+        vk::PipelineStageFlagBits::eColorAttachmentOutput,
+        vk::AccessFlags(),
+        vk::AccessFlagBits::eColorAttachmentWrite,
+        vk::DependencyFlags());
+    vk::RenderPassCreateInfo renderPassCI(
+        vk::RenderPassCreateFlags(),
+        1,
+        &attachment,
+        1,
+        &subpass,
+        1,
+        &dependency);
+    device->createRenderPass(&renderPassCI, nullptr, &pass);
+  }
+
+  void CameraAtlas::buildFbo(Context *c)
+  {
+    fbo.extent = extent;
+    util::createImage(device,
+                      &c->physicalDevice,
+                      extent,
+                      1,
+                      vk::Format::eR8G8B8A8Srgb,
+                      vk::ImageUsageFlagBits::eColorAttachment
+                      | vk::ImageUsageFlagBits::eSampled
+                      | vk::ImageUsageFlagBits::eTransferSrc,
+                      &fbo.image,
+                      &fbo.mem);
+    fbo.view = util::createImageView(device,
+                                     fbo.image,
+                                     vk::ImageViewType::e2D,
+                                     vk::Format::eR8G8B8A8Srgb,
+                                     0,
+                                     1);
+    vk::FramebufferCreateInfo framebufferCI(
+        vk::FramebufferCreateFlags(),
+        pass,
+        1,
+        &fbo.view,
+        extent.width,
+        extent.height,
+        1);
+    device->createFramebuffer(&framebufferCI, nullptr, &fbo.frame);
+  }
+
+  void CameraAtlas::buildDescriptors(Context *c)
+  {
+    util::buildEnvDescriptorLayout(device, &descLayout);
+    descTemplate = util::createEnvTemplate(device, descLayout);
+    util::buildInstanceStorageLayout(device, &storageLayout);
+
+    vk::DescriptorSetLayout setLayouts[] = {descLayout, storageLayout};
+    util::buildLayout(
+        device,
+        util::array_size(setLayouts),
+        setLayouts,
+        sizeof(util::EnvPushConstants),
+        &layout);
+
+    descSet = c->descriptors.allocate(descLayout);
+    util::EnvDescriptors descriptors = {
+      vk::DescriptorBufferInfo(camBuffer.localBuffer,
+                               0,
+                               kGroup * sizeof(glm::mat4)),
+      vk::DescriptorBufferInfo(c->palette->localBuffer,
+                               0,
+                               c->palette->size)
+    };
+    device->updateDescriptorSetWithTemplate(descSet,
+                                            descTemplate,
+                                            &descriptors);
+  }
+
+  void CameraAtlas::buildReadback(Context *c)
+  {
+    vk::BufferCreateInfo readbackCI(
+        vk::BufferCreateFlags(),
+        frameSize(),
+        vk::BufferUsageFlagBits::eTransferDst,
+        vk::SharingMode::eExclusive,
+        0,
+        nullptr);
+    device->createBuffer(&readbackCI, nullptr, &readbackBuffer);
+
+    vk::MemoryRequirements memReqs =
+        device->getBufferMemoryRequirements(readbackBuffer);
+    uint32_t memType;
+    if (!util::tryFindMemoryType(c->physicalDevice,
+                                 memReqs.memoryTypeBits,
+                                 vk::MemoryPropertyFlagBits::eHostVisible
+                                 | vk::MemoryPropertyFlagBits::eHostCoherent
+                                 | vk::MemoryPropertyFlagBits::eHostCached,
+                                 &memType))
+    {
+      memType = util::findMemoryType(c->physicalDevice,
+                                     memReqs.memoryTypeBits,
+                                     vk::MemoryPropertyFlagBits::eHostVisible
+                                     | vk::MemoryPropertyFlagBits::eHostCoherent);
+    }
+
+    vk::MemoryAllocateInfo allocInfo(memReqs.size, memType);
+    util::allocateMemory(device,
+                         allocInfo,
+                         util::MemoryTag::eReadback,
+                         &readbackMemory);
+    device->bindBufferMemory(readbackBuffer, readbackMemory, 0);
+    device->mapMemory(readbackMemory,
+                      0,
+                      VK_WHOLE_SIZE,
+                      vk::MemoryMapFlags(),
+                      &readbackData);
+  }
+
+  void CameraAtlas::stageCameras(void)
+  {
+    for (uint32_t i = 0; i < count; i++)
+    {
+      camData[i] = cams[i].cam;
+    }
+    camBuffer.stage(camData.data());
+    camBuffer.markDirty(0, camBuffer.size);
+  }
+
+  void CameraAtlas::record(vk::CommandBuffer cmd,
+                           InstanceStreams *instances,
+                           uint32_t instanceCount,
+                           float alpha)
+  {
+    NGFX_TRACE_SCOPE("CameraAtlas::record");
+    camBuffer.recordDirty(cmd);
+
+    const vk::ClearValue clearValue(vk::ClearColorValue(
+        std::array<float, 4>{0.1f, 0.1f, 0.1f, 1.0f}));
+    vk::RenderPassBeginInfo passInfo(
+        pass, fbo.frame,
+        vk::Rect2D(vk::Offset2D(0, 0), extent),
+        1,
+        &clearValue);
+    cmd.beginRenderPass(passInfo, vk::SubpassContents::eInline);
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+    cmd.setLineWidth(1.0f);
+    instances->bindStorage(cmd, layout, 1);
+
+    uint32_t vertexCount = instanceCount * util::pulledVertexCount(variant);
+    vk::Viewport viewports[kGroup];
+    vk::Rect2D scissors[kGroup];
+    for (uint32_t first = 0; first < count && vertexCount > 0; first += kGroup)
+    {
+      uint32_t n = (count - first < kGroup) ? count - first : kGroup;
+      // The pipeline declares kGroup viewports and every one must be set,
+      // the unused tail repeats the last camera and draws nothing
+      for (uint32_t i = 0; i < kGroup; i++)
+      {
+        const vk::Rect2D &r = rects[first + std::min(i, n - 1)];
+        scissors[i] = r;
+        viewports[i] = vk::Viewport((float) r.offset.x,
+                                    (float) r.offset.y,
+                                    (float) r.extent.width,
+                                    (float) r.extent.height,
+                                    0.0f,
+                                    1.0f);
+      }
+
+      uint32_t offset = (uint32_t) (first * sizeof(glm::mat4));
+      cmd.bindDescriptorSets(
+          vk::PipelineBindPoint::eGraphics,
+          layout,
+          0,
+          1,
+          &descSet,
+          1,
+          &offset);
+
+      util::EnvPushConstants push = {
+        glm::vec4(0.0, 0.0, 1.0, 1.0), 0, alpha};
+      if (viewportIndex)
+      {
+        // Instance i of the group is camera first + i in viewport i
+        cmd.setViewport(0, kGroup, viewports);
+        cmd.setScissor(0, kGroup, scissors);
+        cmd.pushConstants(
+            layout, vk::ShaderStageFlagBits::eVertex, 0,
+            sizeof(util::EnvPushConstants), (void *) &push);
+        cmd.draw(vertexCount, n, 0, 0);
+        continue;
+      }
+
+      for (uint32_t i = 0; i < n; i++)
+      {
+        push.camera = i;
+        cmd.setViewport(0, 1, &viewports[i]);
+        cmd.setScissor(0, 1, &scissors[i]);
+        cmd.pushConstants(
+            layout, vk::ShaderStageFlagBits::eVertex, 0,
+            sizeof(util::EnvPushConstants), (void *) &push);
+        cmd.draw(vertexCount, 1, 0, 0);
+      }
+    }
+    cmd.endRenderPass();
+  }
+
+  vk::DeviceSize CameraAtlas::frameSize(void)
+  {
+    return (vk::DeviceSize) extent.width * extent.height * 4;
+  }
+
+  const uint8_t *CameraAtlas::frame(void)
+  {
+    return (const uint8_t *) readbackData;
+  }
+
+  void CameraAtlas::recordReadback(vk::CommandBuffer cmd)
+  {
+    vk::ImageSubresourceRange range(
+        vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+    vk::ImageMemoryBarrier toTransfer(
+        vk::AccessFlagBits::eColorAttachmentWrite,
+        vk::AccessFlagBits::eTransferRead,
+        vk::ImageLayout::eShaderReadOnlyOptimal,
+        vk::ImageLayout::eTransferSrcOptimal,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        fbo.image,
+        range);
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eColorAttachmentOutput,
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlags(),
+        0, nullptr, 0, nullptr, 1, &toTransfer);
+
+    // One copy for every camera
+    vk::BufferImageCopy region(
+        0,
+        0,
+        0,
+        vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
+        vk::Offset3D(0, 0, 0),
+        vk::Extent3D(extent.width, extent.height, 1));
+    cmd.copyImageToBuffer(fbo.image,
+                          vk::ImageLayout::eTransferSrcOptimal,
+                          readbackBuffer,
+                          1,
+                          &region);
+
+    vk::ImageMemoryBarrier toShader(
+        vk::AccessFlagBits::eTransferRead,
+        vk::AccessFlagBits::eShaderRead,
+        vk::ImageLayout::eTransferSrcOptimal,
+        vk::ImageLayout::eShaderReadOnlyOptimal,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        fbo.image,
+        range);
+    vk::BufferMemoryBarrier toHost(
+        vk::AccessFlagBits::eTransferWrite,
+        vk::AccessFlagBits::eHostRead,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        readbackBuffer,
+        0,
+        VK_WHOLE_SIZE);
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eFragmentShader
+        | vk::PipelineStageFlagBits::eHost,
+        vk::DependencyFlags(),
+        0, nullptr, 1, &toHost, 1, &toShader);
+  }
+
+  CameraAtlas::~CameraAtlas(void)
+  {
+    device->unmapMemory(readbackMemory);
+    device->destroyBuffer(readbackBuffer);
+    util::freeMemory(device, readbackMemory);
+
+    device->destroyFramebuffer(fbo.frame);
+    device->destroyImageView(fbo.view);
+    device->destroyImage(fbo.image);
+    util::freeMemory(device, fbo.mem);
+
+    device->destroyPipeline(pipeline);
+    device->destroyPipelineLayout(layout);
+    device->destroyDescriptorSetLayout(storageLayout);
+    device->destroyDescriptorUpdateTemplate(descTemplate);
+    device->destroyDescriptorSetLayout(descLayout);
+    device->destroyRenderPass(pass);
+  }
+}
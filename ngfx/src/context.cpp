@@ -2,43 +2,83 @@
 #include "context.hpp"
 #include "config.hpp"
 #include "util.hpp"
+#include "pack.hpp"
+#include <glm/glm.hpp>
 
 
 namespace ngfx
 {
-  Context::Context()
+  Context::Context(const char *deviceOverride, bool headless)
+    : window(nullptr), headless(headless)
   {
-    glfwInit();
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    glfwWindowHint(GLFW_RESIZABLE, kResizable);
-    window = glfwCreateWindow(
-        kWidth,
-        kHeight,
-        "ngfx",
-        nullptr,
-        nullptr);
-    
-    glfwSetWindowUserPointer(window, this); 
+    if (!headless)
+    {
+      glfwInit();
+      glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+      glfwWindowHint(GLFW_RESIZABLE, kResizable);
+      window = glfwCreateWindow(
+          kWidth,
+          kHeight,
+          "ngfx",
+          nullptr,
+          nullptr);
+      
+      glfwSetWindowUserPointer(window, this); 
+    }
    
-    util::createInstance("test", "ngfx", VK_API_VERSION_1_1, &instance);
+    util::createInstance("test",
+                         "ngfx",
+                         VK_API_VERSION_1_1,
+                         &instance,
+                         headless);
     util::createDebugMessenger((VkInstance *) &instance,
                                (VkDebugUtilsMessengerEXT *) &debugMessenger);
     
-    glfwCreateWindowSurface(
-        instance,
-        window,
-        nullptr,
-        (VkSurfaceKHR *) &surface);
+    if (!headless)
+    {
+      glfwCreateWindowSurface(
+          instance,
+          window,
+          nullptr,
+          (VkSurfaceKHR *) &surface);
+    }
 
-    physicalDevice = util::pickPhysicalDevice(&instance, &surface); 
+    physicalDevice = util::pickPhysicalDevice(&instance,
+                                              &surface,
+                                              deviceOverride);
     msaaSamples = util::getMaxUsableSampleCount(&physicalDevice);
 
+    descriptorIndexing = util::supportsDescriptorIndexing(&physicalDevice);
+    calibratedTimestamps = kTrace && util::hasDeviceExtension(
+        &physicalDevice,
+        VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+    memoryBudget = util::hasDeviceExtension(
+        &physicalDevice,
+        VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    externalHostMemory = util::hasDeviceExtension(
+        &physicalDevice,
+        VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+    atomicInt64 = util::supportsAtomicInt64(&physicalDevice);
+    viewportIndex = util::supportsViewportIndex(&physicalDevice);
+
     util::findQueueFamilies(&physicalDevice, &surface, &qFamilies);
-    util::createLogicalDevice(&physicalDevice, &qFamilies, &device);
+    util::createLogicalDevice(&physicalDevice,
+                              &qFamilies,
+                              &device,
+                              headless,
+                              descriptorIndexing,
+                              calibratedTimestamps,
+                              memoryBudget,
+                              externalHostMemory,
+                              atomicInt64,
+                              viewportIndex);
     graphicsQueue = device.getQueue(qFamilies.graphicsFamily.value(), 0);
     presentQueue = device.getQueue(qFamilies.presentFamily.value(), 0);
     transferQueue = device.getQueue(qFamilies.transferFamily.value(), 0);
-    util::querySwapchainSupport(&physicalDevice, &surface, &swapInfo);
+    if (!headless)
+    {
+      util::querySwapchainSupport(&physicalDevice, &surface, &swapInfo);
+    }
 
     // Defining a single pipelineCache to be shared for the whole context
     // According to Vendors (Nvidia do's & dont's) this is recommended 
@@ -53,10 +93,72 @@ namespace ngfx
     // command pool
     // TODO: multiple pools for threaded recording
     cmdPool = util::createCommandPool(&device,  qFamilies);
+
+    memory.init(&physicalDevice, &device, memoryBudget);
+    descriptors.init(&device);
+    for (util::DescriptorAllocator &frame : frameDescriptors)
+    {
+      frame.init(&device);
+    }
+
+    palette.reset(new util::FastBuffer(
+        &device,
+        &physicalDevice,
+        &cmdPool,
+        util::kPaletteSize * sizeof(glm::vec4),
+        vk::BufferUsageFlagBits::eUniformBuffer));
+    palette->init();
+    std::vector<glm::vec4> colors(util::kPaletteSize);
+    util::buildPalette(glm::vec4(0.2, 0.4, 1.0, 1.0),
+                       glm::vec4(1.0, 0.3, 0.1, 1.0),
+                       colors.data());
+    palette->stage(colors.data());
+    palette->blockingCopy(graphicsQueue);
+    palette->makeStatic();
   };
 
-    // TODO: Add destructor to clean up vk objs
-  // Currently relies on cleanup() in test class which is bad 
-  Context::~Context(){};
+  util::DescriptorAllocator &Context::beginFrame(uint32_t frame)
+  {
+    util::DescriptorAllocator &allocator =
+        frameDescriptors[frame % kMaxFramesInFlight];
+    allocator.reset();
+    return allocator;
+  }
+
+  void Context::destroy(void)
+  {
+    if (!device)
+    {
+      return;
+    }
+    palette.reset();
+    descriptors.destroy();
+    for (util::DescriptorAllocator &frame : frameDescriptors)
+    {
+      frame.destroy();
+    }
+    device.destroyCommandPool(cmdPool);
+    device.destroyPipelineCache(pipelineCache);
+    device.destroy();
+    device = nullptr;
+
+    util::DestroyDebugUtilsMessengerEXT(instance, debugMessenger);
+    if (surface)
+    {
+      vkDestroySurfaceKHR(instance, surface, nullptr);
+    }
+    instance.destroy();
+    instance = nullptr;
+    if (window)
+    {
+      glfwDestroyWindow(window);
+      window = nullptr;
+    }
+  }
+
+  Context::~Context(void)
+  {
+    destroy();
+  }
 }
 
@@ -0,0 +1,225 @@
+#include "descriptors.hpp"
+#include "vulkan/vulkan.hpp"
+#include "pipeline.hpp"
+
+namespace ngfx
+{
+  namespace util
+  {
+    // Per set averages, pools hold kSetsPerPool sets of this mix
+    static const struct
+    {
+      vk::DescriptorType type;
+      float perSet;
+    } kPoolRatios[] = {
+      {vk::DescriptorType::eUniformBuffer, 1.0f},
+      {vk::DescriptorType::eUniformBufferDynamic, 1.0f},
+      {vk::DescriptorType::eStorageBuffer, 1.0f},
+      {vk::DescriptorType::eStorageImage, 0.5f},
+      {vk::DescriptorType::eCombinedImageSampler, 2.0f},
+    };
+
+    DescriptorAllocator::DescriptorAllocator(void)
+      : _device(nullptr), _current(nullptr) {}
+
+    void DescriptorAllocator::init(vk::Device *device)
+    {
+      _device = device;
+    }
+
+    vk::DescriptorPool DescriptorAllocator::nextPool(void)
+    {
+      if (!_free.empty())
+      {
+        vk::DescriptorPool pool = _free.back();
+        _free.pop_back();
+        return pool;
+      }
+
+      vk::DescriptorPoolSize poolSize[array_size(kPoolRatios)];
+      for (uint32_t i = 0; i < array_size(kPoolRatios); i++)
+      {
+        poolSize[i] = vk::DescriptorPoolSize(
+            kPoolRatios[i].type,
+            (uint32_t) (kPoolRatios[i].perSet * kSetsPerPool));
+      }
+
+      vk::DescriptorPoolCreateInfo poolInfo(
+          vk::DescriptorPoolCreateFlags(),
+          kSetsPerPool,
+          array_size(poolSize),
+          poolSize);
+
+      vk::DescriptorPool pool;
+      _device->createDescriptorPool(&poolInfo, nullptr, &pool);
+      return pool;
+    }
+
+    vk::DescriptorSet DescriptorAllocator::allocate(
+        vk::DescriptorSetLayout layout)
+    {
+      assert(_device);
+      if (!_current)
+      {
+        _current = nextPool();
+        _used.push_back(_current);
+      }
+
+      vk::DescriptorSet set;
+      vk::DescriptorSetAllocateInfo allocInfo(_current, 1, &layout);
+      vk::Result result = _device->allocateDescriptorSets(&allocInfo, &set);
+
+      // Full or fragmented, move on to a fresh pool and retry once
+      if (result == vk::Result::eErrorOutOfPoolMemory
+          || result == vk::Result::eErrorFragmentedPool)
+      {
+        _current = nextPool();
+        _used.push_back(_current);
+        allocInfo.descriptorPool = _current;
+        result = _device->allocateDescriptorSets(&allocInfo, &set);
+      }
+
+      if (result != vk::Result::eSuccess)
+      {
+        throw std::runtime_error("failed to allocate descriptor set");
+      }
+      return set;
+    }
+
+    void DescriptorAllocator::reset(void)
+    {
+      for (vk::DescriptorPool pool : _used)
+      {
+        _device->resetDescriptorPool(pool, vk::DescriptorPoolResetFlags());
+        _free.push_back(pool);
+      }
+      _used.clear();
+      _current = nullptr;
+    }
+
+    void DescriptorAllocator::destroy(void)
+    {
+      reset();
+      for (vk::DescriptorPool pool : _free)
+      {
+        _device->destroyDescriptorPool(pool);
+      }
+      _free.clear();
+    }
+
+    DescriptorAllocator::~DescriptorAllocator(void)
+    {
+      destroy();
+    }
+
+    vk::DescriptorUpdateTemplate createUpdateTemplate(
+        vk::Device *device,
+        vk::DescriptorSetLayout layout,
+        const vk::DescriptorUpdateTemplateEntry *entries,
+        uint32_t entryCount)
+    {
+      vk::DescriptorUpdateTemplateCreateInfo templateCI(
+          vk::DescriptorUpdateTemplateCreateFlags(),
+          entryCount,
+          entries,
+          vk::DescriptorUpdateTemplateType::eDescriptorSet,
+          layout);
+
+      vk::DescriptorUpdateTemplate updateTemplate;
+      device->createDescriptorUpdateTemplate(
+          &templateCI,
+          nullptr,
+          &updateTemplate);
+      return updateTemplate;
+    }
+
+    void buildEnvDescriptorLayout(vk::Device *device,
+                                  vk::DescriptorSetLayout *layout)
+    {
+      vk::DescriptorSetLayoutBinding bindings[] = {
+        vk::DescriptorSetLayoutBinding(
+           0,
+           vk::DescriptorType::eUniformBufferDynamic,
+           1,
+           vk::ShaderStageFlagBits::eVertex, 
+           nullptr),
+        vk::DescriptorSetLayoutBinding(
+           1,
+           vk::DescriptorType::eUniformBuffer,
+           1,
+           vk::ShaderStageFlagBits::eVertex, 
+           nullptr)
+      };
+      
+      vk::DescriptorSetLayoutCreateInfo layoutCI(
+          vk::DescriptorSetLayoutCreateFlags(),
+          array_size(bindings),
+          bindings); 
+      
+      device->createDescriptorSetLayout(
+          &layoutCI,
+          nullptr,
+          layout);
+    }
+
+    vk::DescriptorUpdateTemplate createEnvTemplate(
+        vk::Device *device,
+        vk::DescriptorSetLayout layout)
+    {
+      vk::DescriptorUpdateTemplateEntry entries[] = {
+        vk::DescriptorUpdateTemplateEntry(
+            0,
+            0,
+            1,
+            vk::DescriptorType::eUniformBufferDynamic,
+            offsetof(EnvDescriptors, camera),
+            sizeof(vk::DescriptorBufferInfo)),
+        vk::DescriptorUpdateTemplateEntry(
+            1,
+            0,
+            1,
+            vk::DescriptorType::eUniformBuffer,
+            offsetof(EnvDescriptors, palette),
+            sizeof(vk::DescriptorBufferInfo))
+      };
+
+      return createUpdateTemplate(device,
+                                  layout,
+                                  entries,
+                                  array_size(entries));
+    }
+
+    void buildInstanceStorageLayout(vk::Device *device,
+                                    vk::DescriptorSetLayout *layout)
+    {
+      vk::DescriptorSetLayoutBinding bindings[kInstanceStreamCount];
+      for (uint32_t i = 0; i < kInstanceStreamCount; i++)
+      {
+        bindings[i] = vk::DescriptorSetLayoutBinding(
+            i,
+            vk::DescriptorType::eStorageBuffer,
+            1,
+            vk::ShaderStageFlagBits::eVertex
+            | vk::ShaderStageFlagBits::eCompute,
+            nullptr);
+      }
+
+      vk::DescriptorSetLayoutCreateInfo layoutCI(
+          vk::DescriptorSetLayoutCreateFlags(),
+          array_size(bindings),
+          bindings);
+
+      device->createDescriptorSetLayout(
+          &layoutCI,
+          nullptr,
+          layout);
+    }
+
+    vk::DeviceSize cameraStride(vk::PhysicalDevice *phys)
+    {
+      vk::DeviceSize align =
+          phys->getProperties().limits.minUniformBufferOffsetAlignment;
+      return (sizeof(glm::mat4) + align - 1) / align * align;
+    }
+  }
+}
@@ -0,0 +1,55 @@
+#include "frame_snapshot.hpp"
+#include <cstring>
+#include "trace.hpp"
+
+namespace ngfx
+{
+  SnapshotPublisher::SnapshotPublisher(SnapshotBuffer *buffer)
+    : _buffer(buffer) {}
+
+  void SnapshotPublisher::setCameras(const std::vector<Camera> &cams)
+  {
+    _pending.cameras.resize(cams.size());
+    for (size_t i = 0; i < cams.size(); i++)
+    {
+      _pending.cameras[i] = cams[i].cam;
+    }
+    _pending.cameraVersion++;
+  }
+
+  void SnapshotPublisher::setStream(util::InstanceStream stream,
+                                    const void *data,
+                                    size_t bytes)
+  {
+    uint32_t i = static_cast<uint32_t>(stream);
+    _pending.streams[i].resize(bytes);
+    memcpy(_pending.streams[i].data(), data, bytes);
+    _pending.streamVersions[i]++;
+  }
+
+  void SnapshotPublisher::setOverlay(const std::vector<OverlayCommand> &overlay)
+  {
+    _pending.overlay = overlay;
+  }
+
+  void SnapshotPublisher::publish(void)
+  {
+    NGFX_TRACE_SCOPE("SnapshotPublisher::publish");
+    FrameSnapshot &slot = _buffer->write();
+    if (slot.cameraVersion != _pending.cameraVersion)
+    {
+      slot.cameras = _pending.cameras;
+      slot.cameraVersion = _pending.cameraVersion;
+    }
+    for (uint32_t i = 0; i < util::kInstanceStreamCount; i++)
+    {
+      if (slot.streamVersions[i] != _pending.streamVersions[i])
+      {
+        slot.streams[i] = _pending.streams[i];
+        slot.streamVersions[i] = _pending.streamVersions[i];
+      }
+    }
+    slot.overlay = _pending.overlay;
+    _buffer->publish();
+  }
+}
@@ -0,0 +1,331 @@
+#include "heatmap.hpp"
+#include "vulkan/vulkan.hpp"
+#include "context.hpp"
+#include "util.hpp"
+#include "pipeline.hpp"
+#include "descriptors.hpp"
+#include "trace.hpp"
+
+namespace ngfx
+{
+  static const uint32_t kSplatGroupSize = 256;
+  static const uint32_t kTonemapGroupSize = 8;
+
+  Heatmap::Heatmap(Context *c,
+                   uint32_t count,
+                   vk::Extent2D extent,
+                   const util::ShaderVariant &shaderVariant)
+    : count(count), extent(extent), variant(shaderVariant),
+      camData(count),
+      camBuffer(
+          &c->device,
+          &c->physicalDevice,
+          &c->cmdPool,
+          count * sizeof(glm::mat4),
+          vk::BufferUsageFlagBits::eStorageBuffer,
+          util::MemoryTag::eCameras),
+      device(&c->device)
+  {
+    if (!variant.pulled)
+    {
+      throw std::runtime_error("heatmap requires a pulled variant");
+    }
+
+    camBuffer.init();
+    buildImages(c);
+    buildDescriptors(c);
+
+    util::buildComputePipeline(device,
+                               "shaders/heatmap_splat_comp.spv",
+                               variant,
+                               &layout,
+                               &c->pipelineCache,
+                               &splatPipeline);
+    util::buildComputePipeline(device,
+                               "shaders/heatmap_tonemap_comp.spv",
+                               variant,
+                               &layout,
+                               &c->pipelineCache,
+                               &tonemapPipeline);
+  }
+
+  void Heatmap::buildImages(Context *c)
+  {
+    util::createImage(device,
+                      &c->physicalDevice,
+                      extent,
+                      count,
+                      vk::Format::eR32Uint,
+                      vk::ImageUsageFlagBits::eStorage
+                      | vk::ImageUsageFlagBits::eTransferDst,
+                      &countImage,
+                      &countMemory);
+    countView = util::createImageView(device,
+                                      countImage,
+                                      vk::ImageViewType::e2DArray,
+                                      vk::Format::eR32Uint,
+                                      0,
+                                      count);
+
+    util::createImage(device,
+                      &c->physicalDevice,
+                      extent,
+                      count,
+                      vk::Format::eR8G8B8A8Unorm,
+                      vk::ImageUsageFlagBits::eStorage
+                      | vk::ImageUsageFlagBits::eSampled
+                      | vk::ImageUsageFlagBits::eTransferSrc,
+                      &colorImage,
+                      &colorMemory);
+    colorView = util::createImageView(device,
+                                      colorImage,
+                                      vk::ImageViewType::e2DArray,
+                                      vk::Format::eR8G8B8A8Unorm,
+                                      0,
+                                      count);
+    layerViews.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      layerViews[i] = util::createImageView(device,
+                                            colorImage,
+                                            vk::ImageViewType::e2D,
+                                            vk::Format::eR8G8B8A8Unorm,
+                                            i,
+                                            1);
+    }
+  }
+
+  void Heatmap::buildDescriptors(Context *c)
+  {
+    vk::DescriptorSetLayoutBinding bindings[] = {
+      vk::DescriptorSetLayoutBinding(
+         0,
+         vk::DescriptorType::eStorageBuffer,
+         1,
+         vk::ShaderStageFlagBits::eCompute,
+         nullptr),
+      vk::DescriptorSetLayoutBinding(
+         1,
+         vk::DescriptorType::eStorageImage,
+         1,
+         vk::ShaderStageFlagBits::eCompute,
+         nullptr),
+      vk::DescriptorSetLayoutBinding(
+         2,
+         vk::DescriptorType::eStorageImage,
+         1,
+         vk::ShaderStageFlagBits::eCompute,
+         nullptr)
+    };
+    vk::DescriptorSetLayoutCreateInfo layoutCI(
+        vk::DescriptorSetLayoutCreateFlags(),
+        util::array_size(bindings),
+        bindings);
+    device->createDescriptorSetLayout(&layoutCI, nullptr, &descLayout);
+    util::buildInstanceStorageLayout(device, &storageLayout);
+
+    vk::DescriptorSetLayout setLayouts[] = {descLayout, storageLayout};
+    util::buildLayout(
+        device,
+        util::array_size(setLayouts),
+        setLayouts,
+        sizeof(HeatmapPushConstants),
+        &layout,
+        vk::ShaderStageFlagBits::eCompute);
+
+    descSet = c->descriptors.allocate(descLayout);
+    vk::DescriptorBufferInfo camInfo(camBuffer.localBuffer,
+                                     0,
+                                     VK_WHOLE_SIZE);
+    vk::DescriptorImageInfo countInfo(vk::Sampler(),
+                                      countView,
+                                      vk::ImageLayout::eGeneral);
+    vk::DescriptorImageInfo colorInfo(vk::Sampler(),
+                                      colorView,
+                                      vk::ImageLayout::eGeneral);
+    vk::WriteDescriptorSet writes[] = {
+      vk::WriteDescriptorSet(descSet, 0, 0, 1,
+                             vk::DescriptorType::eStorageBuffer,
+                             nullptr, &camInfo, nullptr),
+      vk::WriteDescriptorSet(descSet, 1, 0, 1,
+                             vk::DescriptorType::eStorageImage,
+                             &countInfo, nullptr, nullptr),
+      vk::WriteDescriptorSet(descSet, 2, 0, 1,
+                             vk::DescriptorType::eStorageImage,
+                             &colorInfo, nullptr, nullptr),
+    };
+    device->updateDescriptorSets(util::array_size(writes),
+                                 writes,
+                                 0,
+                                 nullptr);
+  }
+
+  void Heatmap::writeCameras(const std::vector<Camera> &cams)
+  {
+    for (uint32_t i = 0; i < count; i++)
+    {
+      camData[i] = cams[i].cam;
+    }
+    camBuffer.stage(camData.data());
+    camBuffer.markDirty(0, camBuffer.size);
+  }
+
+  void Heatmap::record(vk::CommandBuffer cmd,
+                       InstanceStreams *instances,
+                       uint32_t instanceCount,
+                       float alpha,
+                       glm::vec4 instanceXform)
+  {
+    NGFX_TRACE_SCOPE("Heatmap::record");
+    vk::ImageSubresourceRange range(
+        vk::ImageAspectFlagBits::eColor, 0, 1, 0, count);
+
+    camBuffer.recordDirty(cmd);
+
+    // Last frame's counts are not needed, clear from undefined
+    vk::ImageMemoryBarrier toClear(
+        vk::AccessFlagBits::eShaderRead,
+        vk::AccessFlagBits::eTransferWrite,
+        vk::ImageLayout::eUndefined,
+        vk::ImageLayout::eGeneral,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        countImage,
+        range);
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlags(),
+        0, nullptr, 0, nullptr, 1, &toClear);
+    vk::ClearColorValue zero(std::array<uint32_t, 4>{0, 0, 0, 0});
+    cmd.clearColorImage(countImage, vk::ImageLayout::eGeneral, &zero, 1, &range);
+
+    vk::ImageMemoryBarrier toSplat(
+        vk::AccessFlagBits::eTransferWrite,
+        vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+        vk::ImageLayout::eGeneral,
+        vk::ImageLayout::eGeneral,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        countImage,
+        range);
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::DependencyFlags(),
+        0, nullptr, 0, nullptr, 1, &toSplat);
+
+    HeatmapPushConstants push = {
+      instanceXform,
+      alpha,
+      instanceCount,
+      settings.radius,
+      settings.sigma,
+      settings.saturation,
+      settings.logScale
+    };
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                           layout,
+                           0,
+                           1,
+                           &descSet,
+                           0,
+                           nullptr);
+    instances->bindStorage(cmd, layout, 1, vk::PipelineBindPoint::eCompute);
+    cmd.pushConstants(layout,
+                      vk::ShaderStageFlagBits::eCompute,
+                      0,
+                      sizeof(HeatmapPushConstants),
+                      (void *) &push);
+    if (instanceCount > 0)
+    {
+      cmd.bindPipeline(vk::PipelineBindPoint::eCompute, splatPipeline);
+      cmd.dispatch(
+          (instanceCount + kSplatGroupSize - 1) / kSplatGroupSize,
+          count,
+          1);
+    }
+
+    // Counts complete, colors overwritten entirely
+    vk::ImageMemoryBarrier toTonemap[] = {
+      vk::ImageMemoryBarrier(
+          vk::AccessFlagBits::eShaderWrite,
+          vk::AccessFlagBits::eShaderRead,
+          vk::ImageLayout::eGeneral,
+          vk::ImageLayout::eGeneral,
+          VK_QUEUE_FAMILY_IGNORED,
+          VK_QUEUE_FAMILY_IGNORED,
+          countImage,
+          range),
+      vk::ImageMemoryBarrier(
+          vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eTransferRead,
+          vk::AccessFlagBits::eShaderWrite,
+          vk::ImageLayout::eUndefined,
+          vk::ImageLayout::eGeneral,
+          VK_QUEUE_FAMILY_IGNORED,
+          VK_QUEUE_FAMILY_IGNORED,
+          colorImage,
+          range),
+    };
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader
+        | vk::PipelineStageFlagBits::eFragmentShader
+        | vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::DependencyFlags(),
+        0, nullptr, 0, nullptr, util::array_size(toTonemap), toTonemap);
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, tonemapPipeline);
+    cmd.dispatch(
+        (extent.width + kTonemapGroupSize - 1) / kTonemapGroupSize,
+        (extent.height + kTonemapGroupSize - 1) / kTonemapGroupSize,
+        count);
+
+    vk::ImageMemoryBarrier toShader(
+        vk::AccessFlagBits::eShaderWrite,
+        vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eTransferRead,
+        vk::ImageLayout::eGeneral,
+        vk::ImageLayout::eShaderReadOnlyOptimal,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        colorImage,
+        range);
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eFragmentShader
+        | vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlags(),
+        0, nullptr, 0, nullptr, 1, &toShader);
+  }
+
+  void Heatmap::recordCopy(vk::CommandBuffer cmd, CameraArray *cameras)
+  {
+    NGFX_TRACE_SCOPE("Heatmap::recordCopy");
+    cameras->recordBlit(cmd, colorImage, extent);
+  }
+
+  vk::ImageView Heatmap::view(uint32_t camera)
+  {
+    return layerViews[camera];
+  }
+
+  Heatmap::~Heatmap(void)
+  {
+    device->destroyPipeline(splatPipeline);
+    device->destroyPipeline(tonemapPipeline);
+    device->destroyPipelineLayout(layout);
+    device->destroyDescriptorSetLayout(storageLayout);
+    device->destroyDescriptorSetLayout(descLayout);
+
+    for (vk::ImageView view : layerViews)
+    {
+      device->destroyImageView(view);
+    }
+    device->destroyImageView(colorView);
+    device->destroyImage(colorImage);
+    util::freeMemory(device, colorMemory);
+    device->destroyImageView(countView);
+    device->destroyImage(countImage);
+    util::freeMemory(device, countMemory);
+  }
+}
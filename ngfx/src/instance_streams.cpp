@@ -0,0 +1,342 @@
+#include "instance_streams.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include "vulkan/vulkan.hpp"
+#include "context.hpp"
+#include "util.hpp"
+#include "descriptors.hpp"
+#include "trace.hpp"
+
+namespace ngfx
+{
+  InstanceStreams::InstanceStreams(Context *c,
+                                   const util::ShaderVariant &variant,
+                                   uint32_t capacity,
+                                   uint32_t frames)
+    : variant(variant), capacity(capacity), frames(std::max(frames, 1u)),
+      device(&c->device), phys(&c->physicalDevice),
+      previousTime(0.0), currentTime(0.0), ticks(0), _swapped(false),
+      _frame(0)
+  {
+    for (uint32_t i = 0; i < util::kInstanceStreamCount; i++)
+    {
+      util::InstanceStream stream = static_cast<util::InstanceStream>(i);
+      dirty[i] = false;
+      if (!util::streamEnabled(variant, stream))
+      {
+        continue;
+      }
+
+      // Storage buffers are read in whole words, palette indices included
+      vk::DeviceSize bytes = capacity * util::streamStride(variant, stream);
+      if (variant.pulled)
+      {
+        bytes = (bytes + 3) & ~(vk::DeviceSize) 3;
+      }
+      streams[i] = util::FastBuffer(
+          &c->device,
+          &c->physicalDevice,
+          &c->cmdPool,
+          bytes,
+          usage(),
+          util::MemoryTag::eInstances);
+      streams[i].init();
+
+      if (this->frames > 1)
+      {
+        staging[i].resize(this->frames);
+        for (Staging &s : staging[i])
+        {
+          util::createHostBuffer(device,
+                                 phys,
+                                 bytes,
+                                 vk::BufferUsageFlagBits::eTransferSrc,
+                                 util::MemoryTag::eInstances,
+                                 &s.buffer,
+                                 &s.memory,
+                                 &s.data);
+        }
+      }
+    }
+
+    if (variant.pulled)
+    {
+      util::buildInstanceStorageLayout(device, &storageLayout);
+      storageSets[0] = c->descriptors.allocate(storageLayout);
+      storageSets[1] = c->descriptors.allocate(storageLayout);
+      writeStorage();
+    }
+  }
+
+  InstanceStreams::~InstanceStreams(void)
+  {
+    for (uint32_t i = 0; i < util::kInstanceStreamCount; i++)
+    {
+      for (Staging &s : staging[i])
+      {
+        device->unmapMemory(s.memory);
+        device->destroyBuffer(s.buffer);
+        util::freeMemory(device, s.memory);
+      }
+    }
+    if (variant.pulled)
+    {
+      device->destroyDescriptorSetLayout(storageLayout);
+    }
+  }
+
+  vk::BufferUsageFlags InstanceStreams::usage(void)
+  {
+    return variant.pulled
+      ? vk::BufferUsageFlagBits::eStorageBuffer
+      : vk::BufferUsageFlagBits::eVertexBuffer;
+  }
+
+  bool InstanceStreams::enabled(util::InstanceStream stream)
+  {
+    return streams[static_cast<uint32_t>(stream)].valid;
+  }
+
+  uint32_t InstanceStreams::slot(util::InstanceStream stream)
+  {
+    return slot(stream, _swapped);
+  }
+
+  uint32_t InstanceStreams::slot(util::InstanceStream stream, bool swapped)
+  {
+    uint32_t i = static_cast<uint32_t>(stream);
+    if (!swapped)
+    {
+      return i;
+    }
+    if (stream == util::InstanceStream::ePosition)
+    {
+      return static_cast<uint32_t>(util::InstanceStream::ePrevious);
+    }
+    if (stream == util::InstanceStream::ePrevious)
+    {
+      return static_cast<uint32_t>(util::InstanceStream::ePosition);
+    }
+    return i;
+  }
+
+  void InstanceStreams::beginFrame(uint32_t frame)
+  {
+    _frame = frame % frames;
+  }
+
+  void *InstanceStreams::map(util::InstanceStream stream)
+  {
+    uint32_t i = slot(stream);
+    return (frames > 1) ? staging[i][_frame].data : streams[i].data();
+  }
+
+  void InstanceStreams::markDirty(util::InstanceStream stream)
+  {
+    dirty[slot(stream)] = true;
+  }
+
+  void InstanceStreams::markDirty(util::InstanceStream stream,
+                                  uint32_t first,
+                                  uint32_t count)
+  {
+    util::FastBuffer *buffer = &streams[slot(stream)];
+    vk::DeviceSize stride = util::streamStride(variant, stream);
+    buffer->markDirty(first * stride, count * stride);
+  }
+
+  void InstanceStreams::write(util::InstanceStream stream, void *data)
+  {
+    // Pulled buffers may be padded past capacity elements
+    memcpy(map(stream),
+           data,
+           capacity * util::streamStride(variant, stream));
+    markDirty(stream);
+  }
+
+  bool InstanceStreams::share(util::InstanceStream stream, void *host)
+  {
+    uint32_t i = static_cast<uint32_t>(stream);
+    if (!streams[i].valid)
+    {
+      return false;
+    }
+    if (variant.interpolate
+        && (stream == util::InstanceStream::ePosition
+            || stream == util::InstanceStream::ePrevious))
+    {
+      return false;
+    }
+    if (!shared[i].import(device, phys, host, sharedSize(stream), usage()))
+    {
+      return false;
+    }
+    if (variant.pulled)
+    {
+      writeStorage();
+    }
+    return true;
+  }
+
+  vk::DeviceSize InstanceStreams::sharedSize(util::InstanceStream stream)
+  {
+    vk::DeviceSize bytes = streams[static_cast<uint32_t>(stream)].size;
+    vk::DeviceSize alignment = util::hostImportAlignment(phys);
+    if (alignment == 0)
+    {
+      return bytes;
+    }
+    return (bytes + alignment - 1) / alignment * alignment;
+  }
+
+  void InstanceStreams::upload(vk::Queue q)
+  {
+    NGFX_TRACE_SCOPE("InstanceStreams::upload");
+    assert(frames == 1);
+    vk::CommandBuffer cmds[util::kInstanceStreamCount];
+    uint32_t cmdCount = 0;
+    for (uint32_t i = 0; i < util::kInstanceStreamCount; i++)
+    {
+      if (dirty[i] && streams[i].valid && !streams[i].direct
+          && !shared[i].valid)
+      {
+        cmds[cmdCount++] = streams[i].commandBuffer;
+      }
+      dirty[i] = false;
+    }
+
+    if (cmdCount == 0)
+    {
+      return;
+    }
+
+    vk::SubmitInfo submitInfo(0, nullptr, nullptr, cmdCount, cmds, 0, nullptr);
+    q.submit(1, &submitInfo, vk::Fence());
+  }
+
+  vk::DeviceSize InstanceStreams::recordUpload(vk::CommandBuffer cmd)
+  {
+    vk::DeviceSize bytes = 0;
+    for (uint32_t i = 0; i < util::kInstanceStreamCount; i++)
+    {
+      if (!streams[i].valid || shared[i].valid)
+      {
+        dirty[i] = false;
+        continue;
+      }
+      if (dirty[i])
+      {
+        streams[i].markDirty(0, streams[i].size);
+        dirty[i] = false;
+      }
+      bytes += (frames > 1)
+        ? streams[i].recordDirty(cmd, staging[i][_frame].buffer)
+        : streams[i].recordDirty(cmd);
+    }
+    return bytes;
+  }
+
+  void InstanceStreams::bind(vk::CommandBuffer cmd, uint32_t firstBinding)
+  {
+    vk::DeviceSize offset = 0;
+    uint32_t binding = firstBinding;
+    for (uint32_t i = 0; i < util::kInstanceStreamCount; i++)
+    {
+      if (!streams[i].valid)
+      {
+        continue;
+      }
+      uint32_t s = slot(static_cast<util::InstanceStream>(i));
+      vk::Buffer *buffer = shared[s].valid
+        ? &shared[s].buffer
+        : &streams[s].localBuffer;
+      cmd.bindVertexBuffers(binding++, 1, buffer, &offset);
+    }
+  }
+
+  void InstanceStreams::bindStorage(vk::CommandBuffer cmd,
+                                    vk::PipelineLayout layout,
+                                    uint32_t set,
+                                    vk::PipelineBindPoint point)
+  {
+    cmd.bindDescriptorSets(point,
+                           layout,
+                           set,
+                           1,
+                           &storageSets[_swapped ? 1 : 0],
+                           0,
+                           nullptr);
+  }
+
+  void InstanceStreams::writeStorage(void)
+  {
+    vk::DescriptorBufferInfo infos[2][util::kInstanceStreamCount];
+    vk::WriteDescriptorSet writes[2];
+    for (uint32_t s = 0; s < 2; s++)
+    {
+      for (uint32_t i = 0; i < util::kInstanceStreamCount; i++)
+      {
+        // Disabled streams alias the positions, every binding stays valid
+        uint32_t physical = streams[i].valid
+          ? slot(static_cast<util::InstanceStream>(i), s == 1)
+          : slot(util::InstanceStream::ePosition, s == 1);
+        vk::Buffer buffer = shared[physical].valid
+          ? shared[physical].buffer
+          : streams[physical].localBuffer;
+        infos[s][i] = vk::DescriptorBufferInfo(buffer, 0, VK_WHOLE_SIZE);
+      }
+      writes[s] = vk::WriteDescriptorSet(
+          storageSets[s],
+          0,
+          0,
+          util::kInstanceStreamCount,
+          vk::DescriptorType::eStorageBuffer,
+          nullptr,
+          infos[s],
+          nullptr);
+    }
+    device->updateDescriptorSets(2, writes, 0, nullptr);
+  }
+
+  void InstanceStreams::tick(void *positions, double time)
+  {
+    NGFX_TRACE_SCOPE("InstanceStreams::tick");
+    if (!variant.interpolate)
+    {
+      write(util::InstanceStream::ePosition, positions);
+      return;
+    }
+
+    // The buffer holding the older tick becomes current and is
+    // overwritten, the old current one is now read as previous
+    if (ticks > 0)
+    {
+      _swapped = !_swapped;
+    }
+    write(util::InstanceStream::ePosition, positions);
+    if (ticks == 0)
+    {
+      write(util::InstanceStream::ePrevious, positions);
+      currentTime = time;
+    }
+    previousTime = currentTime;
+    currentTime = time;
+    ticks++;
+  }
+
+  float InstanceStreams::alpha(double now, bool extrapolate)
+  {
+    double span = currentTime - previousTime;
+    if (ticks < 2 || span <= 0.0)
+    {
+      return 1.0f;
+    }
+    double t = (now - currentTime) / span;
+    if (extrapolate)
+    {
+      return (float) std::min(kMaxExtrapolation, std::max(1.0, 1.0 + t));
+    }
+    return (float) std::min(1.0, std::max(0.0, t));
+  }
+}
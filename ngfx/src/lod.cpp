@@ -0,0 +1,319 @@
+#include "lod.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "trace.hpp"
+
+namespace ngfx
+{
+  // Interleave the low 16 bits of v with zeros
+  static uint32_t spreadBits(uint32_t v)
+  {
+    v &= 0xffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+  }
+
+  static glm::vec4 unpackColor(uint32_t c)
+  {
+    return glm::vec4(c & 0xff, (c >> 8) & 0xff, (c >> 16) & 0xff, c >> 24);
+  }
+
+  static uint32_t packColor(glm::vec4 c)
+  {
+    c = glm::clamp(c + 0.5f, glm::vec4(0.0f), glm::vec4(255.0f));
+    return (uint32_t) c.r | ((uint32_t) c.g << 8)
+      | ((uint32_t) c.b << 16) | ((uint32_t) c.a << 24);
+  }
+
+  void LodTree::build(const glm::vec2 *positions,
+                      uint32_t count,
+                      const uint32_t *colors,
+                      const float *scales)
+  {
+    NGFX_TRACE_SCOPE("LodTree::build");
+    nodes.clear();
+    if (count == 0)
+    {
+      return;
+    }
+
+    glm::vec2 lo = positions[0];
+    glm::vec2 hi = positions[0];
+    for (uint32_t i = 1; i < count; i++)
+    {
+      lo = glm::min(lo, positions[i]);
+      hi = glm::max(hi, positions[i]);
+    }
+    float side = std::max(hi.x - lo.x, hi.y - lo.y);
+    if (!(side > 0.0f))
+    {
+      side = 1.0f;
+    }
+
+    // x in the even bits, so child digit bit 0 is the x half
+    float toGrid = 65535.0f / side;
+    _keys.resize(count);
+    _order.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      glm::vec2 q = glm::clamp((positions[i] - lo) * toGrid,
+                               glm::vec2(0.0f),
+                               glm::vec2(65535.0f));
+      _keys[i] = spreadBits((uint32_t) q.x)
+        | (spreadBits((uint32_t) q.y) << 1);
+      _order[i] = i;
+    }
+    sortKeys();
+
+    _positions.resize(count);
+    _colors.resize(count);
+    _masses.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      uint32_t body = _order[i];
+      _positions[i] = positions[body];
+      _colors[i] = colors ? colors[body] : 0xffffffff;
+      _masses[i] = scales ? scales[body] * scales[body] : 1.0f;
+    }
+
+    LodNode root = {};
+    root.cellMin = lo;
+    root.side = side;
+    root.count = count;
+    nodes.push_back(root);
+    buildNode(0, 0);
+  }
+
+  // Stable LSD radix sort of _keys, 8 bits per pass, carrying _order
+  void LodTree::sortKeys(void)
+  {
+    size_t count = _keys.size();
+    _scratchKeys.resize(count);
+    _scratchOrder.resize(count);
+    for (uint32_t shift = 0; shift < 32; shift += 8)
+    {
+      uint32_t offsets[256] = {};
+      for (size_t i = 0; i < count; i++)
+      {
+        offsets[(_keys[i] >> shift) & 0xff]++;
+      }
+      uint32_t sum = 0;
+      for (uint32_t &offset : offsets)
+      {
+        uint32_t n = offset;
+        offset = sum;
+        sum += n;
+      }
+      for (size_t i = 0; i < count; i++)
+      {
+        uint32_t dst = offsets[(_keys[i] >> shift) & 0xff]++;
+        _scratchKeys[dst] = _keys[i];
+        _scratchOrder[dst] = _order[i];
+      }
+      _keys.swap(_scratchKeys);
+      _order.swap(_scratchOrder);
+    }
+  }
+
+  void LodTree::buildNode(uint32_t index, uint32_t level)
+  {
+    LodNode node = nodes[index];
+    uint32_t end = node.first + node.count;
+
+    if (node.count <= settings.leafSize || level == kMaxLevel)
+    {
+      glm::vec2 center(0.0f);
+      glm::vec4 color(0.0f);
+      float mass = 0.0f;
+      for (uint32_t i = node.first; i < end; i++)
+      {
+        center += _positions[i] * _masses[i];
+        color += unpackColor(_colors[i]) * _masses[i];
+        mass += _masses[i];
+      }
+      node.mass = mass;
+      node.center = (mass > 0.0f) ? center / mass : _positions[node.first];
+      node.color = (mass > 0.0f) ? packColor(color / mass) : _colors[node.first];
+      node.childCount = 0;
+      nodes[index] = node;
+      return;
+    }
+
+    // Codes of the node share their top 2 * level bits, so its bodies are
+    // ordered by the next digit
+    uint32_t shift = 2 * (kMaxLevel - 1 - level);
+    float half = node.side * 0.5f;
+    node.child = (uint32_t) nodes.size();
+    node.childCount = 0;
+    uint32_t first = node.first;
+    for (uint32_t digit = 0; digit < 4; digit++)
+    {
+      uint32_t last = (uint32_t) (std::partition_point(
+          _keys.begin() + first,
+          _keys.begin() + end,
+          [&](uint32_t key) { return ((key >> shift) & 3) <= digit; })
+        - _keys.begin());
+      if (last > first)
+      {
+        LodNode child = {};
+        child.cellMin = node.cellMin
+          + glm::vec2(digit & 1, digit >> 1) * half;
+        child.side = half;
+        child.first = first;
+        child.count = last - first;
+        nodes.push_back(child);
+        node.childCount++;
+      }
+      first = last;
+    }
+    nodes[index] = node;
+
+    glm::vec2 center(0.0f);
+    glm::vec4 color(0.0f);
+    float mass = 0.0f;
+    for (uint32_t i = 0; i < node.childCount; i++)
+    {
+      buildNode(node.child + i, level + 1);
+      const LodNode &child = nodes[node.child + i];
+      center += child.center * child.mass;
+      color += unpackColor(child.color) * child.mass;
+      mass += child.mass;
+    }
+    LodNode &built = nodes[index];
+    built.mass = mass;
+    built.center = (mass > 0.0f) ? center / mass : nodes[node.child].center;
+    built.color = (mass > 0.0f) ? packColor(color / mass) : nodes[node.child].color;
+  }
+
+  uint32_t LodTree::select(const glm::mat4 &cam,
+                           vk::Extent2D extent,
+                           uint32_t maxCount,
+                           glm::vec2 *positions,
+                           uint32_t *colors,
+                           float *scales)
+  {
+    if (nodes.empty())
+    {
+      return 0;
+    }
+
+    // Half extent in NDC of a unit square, cameras are affine in 2D
+    glm::vec2 unit(std::abs(cam[0][0]) + std::abs(cam[1][0]),
+                   std::abs(cam[0][1]) + std::abs(cam[1][1]));
+    glm::vec2 pixels(extent.width * 0.5f, extent.height * 0.5f);
+
+    uint32_t written = 0;
+    _stack.clear();
+    _stack.push_back(0);
+    while (!_stack.empty() && written < maxCount)
+    {
+      const LodNode &node = nodes[_stack.back()];
+      _stack.pop_back();
+
+      glm::vec2 c = node.cellMin + node.side * 0.5f;
+      glm::vec4 clip = cam * glm::vec4(c, 0.0f, 1.0f);
+      glm::vec2 ndc = glm::vec2(clip) / clip.w;
+      glm::vec2 halfNdc = unit * (node.side * 0.5f / clip.w);
+      if (std::abs(ndc.x) - halfNdc.x > 1.0f
+          || std::abs(ndc.y) - halfNdc.y > 1.0f)
+      {
+        continue;
+      }
+
+      glm::vec2 size = halfNdc * pixels * 2.0f;
+      if (node.count == 1
+          || std::max(size.x, size.y) < settings.pixelThreshold)
+      {
+        positions[written] = node.center;
+        if (colors)
+        {
+          colors[written] = node.color;
+        }
+        if (scales)
+        {
+          scales[written] = std::sqrt(node.mass);
+        }
+        written++;
+      }
+      else if (node.childCount == 0)
+      {
+        uint32_t n = std::min(node.count, maxCount - written);
+        for (uint32_t i = 0; i < n; i++)
+        {
+          uint32_t body = node.first + i;
+          positions[written] = _positions[body];
+          if (colors)
+          {
+            colors[written] = _colors[body];
+          }
+          if (scales)
+          {
+            scales[written] = std::sqrt(_masses[body]);
+          }
+          written++;
+        }
+      }
+      else
+      {
+        for (uint32_t i = 0; i < node.childCount; i++)
+        {
+          _stack.push_back(node.child + i);
+        }
+      }
+    }
+    return written;
+  }
+
+  uint32_t LodTree::select(const std::vector<Camera> &cams,
+                           vk::Extent2D extent,
+                           InstanceStreams *out,
+                           util::InstanceRange *ranges)
+  {
+    NGFX_TRACE_SCOPE("LodTree::select");
+    const util::ShaderVariant &variant = out->variant;
+    if (variant.instanceFormat != util::InstanceFormat::eFloat32
+        || (variant.instanceColor
+            && variant.colorFormat != util::ColorFormat::eRgba8))
+    {
+      throw std::runtime_error("lod output requires float32 positions"
+                               " and rgba8 colors");
+    }
+
+    glm::vec2 *positions =
+      (glm::vec2 *) out->map(util::InstanceStream::ePosition);
+    uint32_t *colors = variant.instanceColor
+      ? (uint32_t *) out->map(util::InstanceStream::eColor)
+      : nullptr;
+    float *scales = variant.instanceScale
+      ? (float *) out->map(util::InstanceStream::eScale)
+      : nullptr;
+
+    uint32_t total = 0;
+    for (size_t i = 0; i < cams.size(); i++)
+    {
+      uint32_t n = select(cams[i].cam,
+                          extent,
+                          out->capacity - total,
+                          positions + total,
+                          colors ? colors + total : nullptr,
+                          scales ? scales + total : nullptr);
+      ranges[i] = util::InstanceRange{total, n};
+      total += n;
+    }
+
+    out->markDirty(util::InstanceStream::ePosition, 0, total);
+    if (colors)
+    {
+      out->markDirty(util::InstanceStream::eColor, 0, total);
+    }
+    if (scales)
+    {
+      out->markDirty(util::InstanceStream::eScale, 0, total);
+    }
+    return total;
+  }
+}
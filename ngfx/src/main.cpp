@@ -12,7 +12,13 @@
 #include "ngfx.hpp"
 #include "test_renderer.hpp"
 
+static void printLog(ngfx::util::LogLevel level, const char *message) {
+  (level == ngfx::util::LogLevel::eWarning ? std::cerr : std::cout)
+    << "ngfx: " << message << std::endl;
+}
+
 int main() {
+  ngfx::util::setLogCallback(printLog);
   ngfx::TestRenderer app;
 
   try {
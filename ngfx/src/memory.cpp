@@ -0,0 +1,320 @@
+#include "memory.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include "util.hpp"
+
+namespace ngfx
+{
+  namespace util
+  {
+    // Trackers by device, for allocations made without a Context at hand
+    static std::mutex registryLock;
+    static std::unordered_map<VkDevice, MemoryTracker *> registry;
+
+    static void addBytes(MemoryCounter *counter, vk::DeviceSize bytes)
+    {
+      counter->bytes += bytes;
+      counter->highWater = std::max(counter->highWater, counter->bytes);
+      counter->allocations++;
+    }
+
+    static void subBytes(MemoryCounter *counter, vk::DeviceSize bytes)
+    {
+      counter->bytes -= bytes;
+      counter->allocations--;
+    }
+
+    static double toMB(vk::DeviceSize bytes)
+    {
+      return bytes / (1024.0 * 1024.0);
+    }
+
+    const char *memoryTagName(MemoryTag tag)
+    {
+      static const char *names[kMemoryTagCount] = {
+        "other",
+        "geometry",
+        "instances",
+        "cameras",
+        "readback",
+        "textures"
+      };
+      return names[static_cast<uint32_t>(tag)];
+    }
+
+    MemoryTracker::MemoryTracker(void)
+      : _phys(nullptr), _device(nullptr), _handle(VK_NULL_HANDLE),
+      _memoryBudget(false), _nextEvict(0)
+    {}
+
+    void MemoryTracker::init(vk::PhysicalDevice *phys,
+                             vk::Device *device,
+                             bool memoryBudget)
+    {
+      _phys = phys;
+      _device = device;
+      _handle = (VkDevice) *device;
+      _memoryBudget = memoryBudget;
+      _phys->getMemoryProperties(&_props);
+      _heaps.resize(_props.memoryHeapCount);
+      _types.resize(_props.memoryTypeCount);
+      _overBudget.resize(_props.memoryHeapCount, false);
+
+      std::lock_guard<std::mutex> lock(registryLock);
+      registry[_handle] = this;
+    }
+
+    MemoryTracker *MemoryTracker::find(vk::Device device)
+    {
+      std::lock_guard<std::mutex> lock(registryLock);
+      auto it = registry.find((VkDevice) device);
+      return (it == registry.end()) ? nullptr : it->second;
+    }
+
+    void MemoryTracker::queryBudget(vk::DeviceSize *budget,
+                                    vk::DeviceSize *usage)
+    {
+      if (_memoryBudget)
+      {
+        vk::PhysicalDeviceMemoryBudgetPropertiesEXT budgetProps;
+        vk::PhysicalDeviceMemoryProperties2 props;
+        props.pNext = &budgetProps;
+        _phys->getMemoryProperties2(&props);
+        for (uint32_t i = 0; i < _props.memoryHeapCount; i++)
+        {
+          budget[i] = budgetProps.heapBudget[i];
+          usage[i] = budgetProps.heapUsage[i];
+        }
+        return;
+      }
+
+      for (uint32_t i = 0; i < _props.memoryHeapCount; i++)
+      {
+        budget[i] = (vk::DeviceSize) (_props.memoryHeaps[i].size
+                                      * kDefaultBudget);
+        usage[i] = _heaps[i].bytes;
+      }
+    }
+
+    bool MemoryTracker::fitsLocked(uint32_t heap, vk::DeviceSize bytes)
+    {
+      vk::DeviceSize budget[VK_MAX_MEMORY_HEAPS];
+      vk::DeviceSize usage[VK_MAX_MEMORY_HEAPS];
+      queryBudget(budget, usage);
+      bool fits = usage[heap] + bytes <= budget[heap];
+      if (fits)
+      {
+        _overBudget[heap] = false;
+      }
+      return fits;
+    }
+
+    bool MemoryTracker::fits(uint32_t memoryType, vk::DeviceSize bytes)
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      return fitsLocked(_props.memoryTypes[memoryType].heapIndex, bytes);
+    }
+
+    uint32_t MemoryTracker::onEvict(EvictCallback callback)
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      _evict.push_back(std::make_pair(_nextEvict, callback));
+      return _nextEvict++;
+    }
+
+    void MemoryTracker::removeEvict(uint32_t id)
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      _evict.erase(std::remove_if(
+          _evict.begin(),
+          _evict.end(),
+          [id](const std::pair<uint32_t, EvictCallback> &e)
+          { return e.first == id; }),
+          _evict.end());
+    }
+
+    // Callbacks free through free(), so the lock is not held here
+    vk::DeviceSize MemoryTracker::makeRoom(uint32_t heap, vk::DeviceSize bytes)
+    {
+      std::vector<std::pair<uint32_t, EvictCallback>> callbacks;
+      {
+        std::lock_guard<std::mutex> lock(_lock);
+        callbacks = _evict;
+      }
+
+      vk::DeviceSize released = 0;
+      for (auto &callback : callbacks)
+      {
+        if (released >= bytes)
+        {
+          break;
+        }
+        released += callback.second(heap, bytes - released);
+      }
+      return released;
+    }
+
+    vk::Result MemoryTracker::allocate(const vk::MemoryAllocateInfo &info,
+                                       MemoryTag tag,
+                                       vk::DeviceMemory *memory)
+    {
+      uint32_t heap = _props.memoryTypes[info.memoryTypeIndex].heapIndex;
+
+      bool fits;
+      {
+        std::lock_guard<std::mutex> lock(_lock);
+        fits = fitsLocked(heap, info.allocationSize);
+      }
+      if (!fits && policy == BudgetPolicy::eEvict)
+      {
+        makeRoom(heap, info.allocationSize);
+      }
+      if (!fits)
+      {
+        std::lock_guard<std::mutex> lock(_lock);
+        if (!fitsLocked(heap, info.allocationSize) && !_overBudget[heap])
+        {
+          // Once per crossing, cleared when the heap is back under budget
+          std::ostringstream message;
+          message << "memory: heap " << heap << " over budget allocating "
+                  << std::fixed << std::setprecision(1)
+                  << toMB(info.allocationSize) << " MB for "
+                  << memoryTagName(tag);
+          log(LogLevel::eWarning, message.str());
+          _overBudget[heap] = true;
+        }
+      }
+
+      vk::Result result = _device->allocateMemory(&info, nullptr, memory);
+      if (result == vk::Result::eErrorOutOfDeviceMemory
+          && makeRoom(heap, info.allocationSize) > 0)
+      {
+        result = _device->allocateMemory(&info, nullptr, memory);
+      }
+      if (result != vk::Result::eSuccess)
+      {
+        return result;
+      }
+
+      std::lock_guard<std::mutex> lock(_lock);
+      _allocations[(VkDeviceMemory) *memory] =
+          Allocation{info.allocationSize, info.memoryTypeIndex, tag};
+      addBytes(&_heaps[heap], info.allocationSize);
+      addBytes(&_types[info.memoryTypeIndex], info.allocationSize);
+      addBytes(&_tags[static_cast<uint32_t>(tag)], info.allocationSize);
+      return result;
+    }
+
+    void MemoryTracker::free(vk::DeviceMemory memory)
+    {
+      {
+        std::lock_guard<std::mutex> lock(_lock);
+        auto it = _allocations.find((VkDeviceMemory) memory);
+        if (it != _allocations.end())
+        {
+          const Allocation &a = it->second;
+          subBytes(&_heaps[_props.memoryTypes[a.type].heapIndex], a.size);
+          subBytes(&_types[a.type], a.size);
+          subBytes(&_tags[static_cast<uint32_t>(a.tag)], a.size);
+          _allocations.erase(it);
+        }
+      }
+      _device->freeMemory(memory);
+    }
+
+    vk::DeviceSize MemoryTracker::heapBudget(uint32_t heap)
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      vk::DeviceSize budget[VK_MAX_MEMORY_HEAPS];
+      vk::DeviceSize usage[VK_MAX_MEMORY_HEAPS];
+      queryBudget(budget, usage);
+      return budget[heap];
+    }
+
+    vk::DeviceSize MemoryTracker::heapUsage(uint32_t heap)
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      vk::DeviceSize budget[VK_MAX_MEMORY_HEAPS];
+      vk::DeviceSize usage[VK_MAX_MEMORY_HEAPS];
+      queryBudget(budget, usage);
+      return usage[heap];
+    }
+
+    void MemoryTracker::report(std::ostream &out)
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      vk::DeviceSize budget[VK_MAX_MEMORY_HEAPS];
+      vk::DeviceSize usage[VK_MAX_MEMORY_HEAPS];
+      queryBudget(budget, usage);
+
+      out << std::fixed << std::setprecision(1)
+          << "memory (MB, " << (_memoryBudget ? "driver" : "estimated")
+          << " budget)" << std::endl;
+      for (uint32_t i = 0; i < _heaps.size(); i++)
+      {
+        bool local = (bool) (_props.memoryHeaps[i].flags
+                             & vk::MemoryHeapFlagBits::eDeviceLocal);
+        out << "  heap " << i << (local ? " (device local)" : "")
+            << ": ngfx " << toMB(_heaps[i].bytes)
+            << ", high " << toMB(_heaps[i].highWater)
+            << ", usage " << toMB(usage[i])
+            << " / " << toMB(budget[i]) << std::endl;
+        for (uint32_t t = 0; t < _types.size(); t++)
+        {
+          if (_props.memoryTypes[t].heapIndex != i || !_types[t].highWater)
+          {
+            continue;
+          }
+          out << "    type " << t << ": " << toMB(_types[t].bytes)
+              << ", high " << toMB(_types[t].highWater)
+              << ", " << _types[t].allocations << " allocations"
+              << std::endl;
+        }
+      }
+      for (uint32_t t = 0; t < kMemoryTagCount; t++)
+      {
+        out << "  " << memoryTagName(static_cast<MemoryTag>(t)) << ": "
+            << toMB(_tags[t].bytes) << ", high " << toMB(_tags[t].highWater)
+            << ", " << _tags[t].allocations << " allocations" << std::endl;
+      }
+    }
+
+    MemoryTracker::~MemoryTracker(void)
+    {
+      if (_handle != VK_NULL_HANDLE)
+      {
+        std::lock_guard<std::mutex> lock(registryLock);
+        auto it = registry.find(_handle);
+        if (it != registry.end() && it->second == this)
+        {
+          registry.erase(it);
+        }
+      }
+    }
+
+    vk::Result allocateMemory(vk::Device *device,
+                              const vk::MemoryAllocateInfo &info,
+                              MemoryTag tag,
+                              vk::DeviceMemory *memory)
+    {
+      MemoryTracker *tracker = MemoryTracker::find(*device);
+      if (tracker)
+      {
+        return tracker->allocate(info, tag, memory);
+      }
+      return device->allocateMemory(&info, nullptr, memory);
+    }
+
+    void freeMemory(vk::Device *device, vk::DeviceMemory memory)
+    {
+      MemoryTracker *tracker = MemoryTracker::find(*device);
+      if (tracker)
+      {
+        tracker->free(memory);
+        return;
+      }
+      device->freeMemory(memory);
+    }
+  }
+}
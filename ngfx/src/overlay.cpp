@@ -33,60 +33,23 @@ namespace ngfx
         vk::VertexInputRate::eVertex),
   };
 
-  void Overlay::createDescriptorPool(void)
+  void Overlay::createDescriptorSets(Context *c)
   {
-    vk::DescriptorPoolSize poolSize[] = {
-      vk::DescriptorPoolSize(
-          vk::DescriptorType::eCombinedImageSampler,
-          1)
-    };
-
-    vk::DescriptorPoolCreateInfo poolInfo(
-        vk::DescriptorPoolCreateFlags(),
-        1,
-        util::array_size(poolSize),
-        poolSize); 
-    
-    device->createDescriptorPool(
-       &poolInfo, 
-       nullptr, 
-       &descPool);
-  }
-
-  void Overlay::createDescriptorSets(void)
-  {
-    vk::DescriptorSetAllocateInfo allocInfo(descPool,
-                                            1,
-                                            &descLayout);
-
-    device->allocateDescriptorSets(&allocInfo, &descSet);
+    descSet = c->descriptors.allocate(descLayout);
 
     vk::DescriptorImageInfo imageInfo(
         sampler,
         view,
         vk::ImageLayout::eShaderReadOnlyOptimal);
 
-    vk::WriteDescriptorSet descWrite[] = { 
-      vk::WriteDescriptorSet(
-          descSet,
-          0,
-          0,
-          1,
-          vk::DescriptorType::eCombinedImageSampler,
-          &imageInfo,
-          nullptr,
-          nullptr)
-    };
-
-    device->updateDescriptorSets(
-        util::array_size(descWrite),
-        descWrite,
-        0,
-        nullptr);
+    device->updateDescriptorSetWithTemplate(descSet, descTemplate, &imageInfo);
   }
 
-  Overlay::Overlay(Context *c, SwapData *s, vk::ImageView v)
-    : device(&c->device), view(v)
+  Overlay::Overlay(Context *c,
+                   SwapData *s,
+                   vk::ImageView v,
+                   Bindless *bindless)
+    : view(v), bindless(bindless), texture(0), device(&c->device)
   {
     // RenderPass
     vk::AttachmentDescription
@@ -182,7 +145,45 @@ namespace ngfx
        nullptr,
        &sampler);
 
-    // Descriptors
+    if (bindless)
+    {
+      texture = bindless->addTexture(view, sampler);
+      layout = bindless->layout;
+    }
+    else
+    {
+      buildDescriptors();
+    }
+    
+    // Pipeline
+    util::ShaderVariant variant;
+    variant.topology = vk::PrimitiveTopology::eTriangleList;
+
+    util::buildPipeline(
+        device,
+        s->extent,
+        binding,
+        util::array_size(binding),
+        attribute,
+        util::array_size(attribute),
+        bindless ? "shaders/overlay_bindless_vert.spv"
+                 : "shaders/overlay_vert.spv",
+        bindless ? "shaders/overlay_bindless_frag.spv"
+                 : "shaders/overlay_frag.spv",
+        variant,
+        &layout,
+        &pass,
+        &c->pipelineCache,
+        &pipeline);
+    
+    if (!bindless)
+    {
+      createDescriptorSets(c);
+    }
+  }
+
+  void Overlay::buildDescriptors(void)
+  {
     vk::DescriptorSetLayoutBinding bindings[] = {
      vk::DescriptorSetLayoutBinding(
          0,
@@ -202,6 +203,21 @@ namespace ngfx
        nullptr,
        &descLayout);
 
+    vk::DescriptorUpdateTemplateEntry entries[] = {
+      vk::DescriptorUpdateTemplateEntry(
+          0,
+          0,
+          1,
+          vk::DescriptorType::eCombinedImageSampler,
+          0,
+          sizeof(vk::DescriptorImageInfo))
+    };
+    descTemplate = util::createUpdateTemplate(
+        device,
+        descLayout,
+        entries,
+        util::array_size(entries));
+
     // Layout
     util::buildLayout(
         device,
@@ -209,31 +225,35 @@ namespace ngfx
         &descLayout,
         sizeof(glm::vec2),
         &layout);
-    
-    // Pipeline
-    util::buildPipeline(
-        device,
-        s->extent,
-        binding,
-        util::array_size(binding),
-        attribute,
-        util::array_size(attribute),
-        "shaders/overlay_vert.spv",
-        "shaders/overlay_frag.spv",
-        true,
-        &layout,
-        &pass,
-        &c->pipelineCache,
-        &pipeline);
-    
-    createDescriptorPool();
-    createDescriptorSets();
+  }
+
+  void Overlay::updateSampler(vk::ImageView v)
+  {
+    view = v;
+    if (bindless)
+    {
+      bindless->writeTexture(texture, view, sampler);
+      return;
+    }
+
+    vk::DescriptorImageInfo imageInfo(
+        sampler,
+        view,
+        vk::ImageLayout::eShaderReadOnlyOptimal);
+
+    device->updateDescriptorSetWithTemplate(descSet, descTemplate, &imageInfo);
   }
 
   Overlay::~Overlay()
   {
-    device->destroyDescriptorPool(descPool);
-    device->destroyDescriptorSetLayout(descLayout);
+    device->destroyPipeline(pipeline);
+    device->destroySampler(sampler);
+    if (!bindless)
+    {
+      device->destroyPipelineLayout(layout);
+      device->destroyDescriptorUpdateTemplate(descTemplate);
+      device->destroyDescriptorSetLayout(descLayout);
+    }
 
     for(vk::Framebuffer &frame : frames)
     {
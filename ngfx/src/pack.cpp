@@ -0,0 +1,178 @@
+#include "pack.hpp"
+#include <cmath>
+#include <glm/glm.hpp>
+
+#if defined(__F16C__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace ngfx
+{
+  namespace util
+  {
+    // Round to nearest even, handles subnormals, infinity and NaN
+    uint16_t floatToHalf(float f)
+    {
+      uint32_t x;
+      memcpy(&x, &f, sizeof(x));
+
+      uint32_t sign = (x >> 16) & 0x8000;
+      uint32_t biased = (x >> 23) & 0xff;
+      uint32_t mant = x & 0x7fffff;
+      int32_t exp = (int32_t) biased - 127 + 15;
+
+      if (biased == 0xff)
+      {
+        return (uint16_t) (sign | 0x7c00 | (mant ? 0x200 : 0));
+      }
+      if (exp >= 0x1f)
+      {
+        return (uint16_t) (sign | 0x7c00);
+      }
+      if (exp <= 0)
+      {
+        if (exp < -10)
+        {
+          return (uint16_t) sign;
+        }
+        mant |= 0x800000;
+        uint32_t shift = (uint32_t) (14 - exp);
+        uint32_t half = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t mid = 1u << (shift - 1);
+        if (rem > mid || (rem == mid && (half & 1)))
+        {
+          half++;
+        }
+        return (uint16_t) (sign | half);
+      }
+
+      // A carry out of the mantissa correctly bumps the exponent
+      uint32_t half = ((uint32_t) exp << 10) | (mant >> 13);
+      uint32_t rem = mant & 0x1fff;
+      if (rem > 0x1000 || (rem == 0x1000 && (half & 1)))
+      {
+        half++;
+      }
+      return (uint16_t) (sign | half);
+    }
+
+    PackedChunk packHalf(const Instance *src,
+                         uint32_t count,
+                         glm::vec2 origin,
+                         InstanceHalf *dst)
+    {
+      const float *in = (const float *) src;
+      uint16_t *out = (uint16_t *) dst;
+      uint32_t n = count * 2;
+      uint32_t i = 0;
+
+#if defined(__F16C__)
+      // 4 instances per iteration
+      __m256 o = _mm256_setr_ps(origin.x, origin.y, origin.x, origin.y,
+                                origin.x, origin.y, origin.x, origin.y);
+      for (; i + 8 <= n; i += 8)
+      {
+        __m256 v = _mm256_sub_ps(_mm256_loadu_ps(in + i), o);
+        _mm_storeu_si128((__m128i *) (out + i),
+                         _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+      }
+#endif
+      for (; i < n; i += 2)
+      {
+        out[i] = floatToHalf(in[i] - origin.x);
+        out[i + 1] = floatToHalf(in[i + 1] - origin.y);
+      }
+
+      return PackedChunk{glm::vec4(origin, 1.0f, 1.0f), 0, count};
+    }
+
+    uint32_t packSnorm(const Instance *src,
+                       uint32_t count,
+                       uint32_t chunkSize,
+                       InstanceSnorm *dst,
+                       PackedChunk *chunks)
+    {
+      uint32_t chunkCount = 0;
+      for (uint32_t first = 0; first < count; first += chunkSize)
+      {
+        uint32_t n = std::min(chunkSize, count - first);
+        const float *in = (const float *) (src + first);
+        int16_t *out = (int16_t *) (dst + first);
+
+        // Bounds
+        glm::vec2 lo = src[first].pos;
+        glm::vec2 hi = src[first].pos;
+        for (uint32_t i = 1; i < n; i++)
+        {
+          lo = glm::min(lo, src[first + i].pos);
+          hi = glm::max(hi, src[first + i].pos);
+        }
+
+        glm::vec2 center = (lo + hi) * 0.5f;
+        glm::vec2 extent = (hi - lo) * 0.5f;
+        extent.x = (extent.x > 0.0f) ? extent.x : 1.0f;
+        extent.y = (extent.y > 0.0f) ? extent.y : 1.0f;
+        glm::vec2 inv = 32767.0f / extent;
+
+        uint32_t i = 0;
+#if defined(__SSE2__)
+        // 4 instances per iteration. Clamped like the scalar tail, packs
+        // alone would saturate to -32768
+        __m128 c = _mm_setr_ps(center.x, center.y, center.x, center.y);
+        __m128 s = _mm_setr_ps(inv.x, inv.y, inv.x, inv.y);
+        __m128 lim = _mm_set1_ps(32767.0f);
+        __m128 nlim = _mm_set1_ps(-32767.0f);
+        for (; i + 8 <= n * 2; i += 8)
+        {
+          __m128 a = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(in + i), c), s);
+          __m128 b = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(in + i + 4), c), s);
+          a = _mm_max_ps(_mm_min_ps(a, lim), nlim);
+          b = _mm_max_ps(_mm_min_ps(b, lim), nlim);
+          _mm_storeu_si128((__m128i *) (out + i),
+                           _mm_packs_epi32(_mm_cvtps_epi32(a),
+                                           _mm_cvtps_epi32(b)));
+        }
+#endif
+        for (; i < n * 2; i += 2)
+        {
+          float x = std::nearbyint((in[i] - center.x) * inv.x);
+          float y = std::nearbyint((in[i + 1] - center.y) * inv.y);
+          out[i] = (int16_t) glm::clamp(x, -32767.0f, 32767.0f);
+          out[i + 1] = (int16_t) glm::clamp(y, -32767.0f, 32767.0f);
+        }
+
+        chunks[chunkCount++] = PackedChunk{
+          glm::vec4(center, extent), first, n
+        };
+      }
+      return chunkCount;
+    }
+
+    void packPalette(const float *src,
+                     uint32_t count,
+                     float min,
+                     float max,
+                     InstancePalette *dst)
+    {
+      float range = max - min;
+      float scale = (range > 0.0f) ? (kPaletteSize - 1) / range : 0.0f;
+      for (uint32_t i = 0; i < count; i++)
+      {
+        float v = glm::clamp((src[i] - min) * scale,
+                             0.0f,
+                             (float) (kPaletteSize - 1));
+        dst[i].index = (uint8_t) (v + 0.5f);
+      }
+    }
+
+    void buildPalette(glm::vec4 from, glm::vec4 to, glm::vec4 *palette)
+    {
+      for (uint32_t i = 0; i < kPaletteSize; i++)
+      {
+        float t = (float) i / (kPaletteSize - 1);
+        palette[i] = glm::mix(from, to, t);
+      }
+    }
+  }
+}
@@ -0,0 +1,236 @@
+#include "pick.hpp"
+#include <algorithm>
+#include "vulkan/vulkan.hpp"
+#include "util.hpp"
+#include "memory.hpp"
+#include "trace.hpp"
+
+namespace ngfx
+{
+  PickReadback::PickReadback(Context *c,
+                             uint32_t slots,
+                             uint32_t maxPixels)
+    : _maxPixels(maxPixels), _slots(slots), _device(&c->device)
+  {
+    vk::BufferCreateInfo bufferCI(
+        vk::BufferCreateFlags(),
+        (vk::DeviceSize) slots * maxPixels * sizeof(uint32_t),
+        vk::BufferUsageFlagBits::eTransferDst,
+        vk::SharingMode::eExclusive,
+        0,
+        nullptr);
+    _device->createBuffer(&bufferCI, nullptr, &_buffer);
+
+    vk::MemoryRequirements memReqs =
+        _device->getBufferMemoryRequirements(_buffer);
+
+    // Cached memory makes host reads fast, but is not exposed everywhere
+    uint32_t memType;
+    if (!util::tryFindMemoryType(c->physicalDevice,
+                                 memReqs.memoryTypeBits,
+                                 vk::MemoryPropertyFlagBits::eHostVisible
+                                 | vk::MemoryPropertyFlagBits::eHostCoherent
+                                 | vk::MemoryPropertyFlagBits::eHostCached,
+                                 &memType))
+    {
+      memType = util::findMemoryType(c->physicalDevice,
+                                     memReqs.memoryTypeBits,
+                                     vk::MemoryPropertyFlagBits::eHostVisible
+                                     | vk::MemoryPropertyFlagBits::eHostCoherent);
+    }
+
+    vk::MemoryAllocateInfo allocInfo(memReqs.size, memType);
+    util::allocateMemory(_device,
+                         allocInfo,
+                         util::MemoryTag::eReadback,
+                         &_memory);
+    _device->bindBufferMemory(_buffer, _memory, 0);
+    _device->mapMemory(_memory,
+                       0,
+                       VK_WHOLE_SIZE,
+                       vk::MemoryMapFlags(),
+                       (void **) &_data);
+
+    vk::EventCreateInfo eventCI;
+    for (Slot &slot : _slots)
+    {
+      _device->createEvent(&eventCI, nullptr, &slot.event);
+    }
+  }
+
+  void PickReadback::request(const PickRequest &r)
+  {
+    _queue.push_back(r);
+  }
+
+  void PickReadback::record(vk::CommandBuffer cmd, CameraArray *cameras)
+  {
+    if (!cameras->variant.pickIds)
+    {
+      throw std::runtime_error("camera array has no pick attachment");
+    }
+    std::vector<vk::Image> images(cameras->count);
+    for (uint32_t i = 0; i < cameras->count; i++)
+    {
+      images[i] = cameras->fbos[i].idImage;
+    }
+    record(cmd,
+           images.data(),
+           cameras->count,
+           cameras->renderExtent);
+  }
+
+  void PickReadback::record(vk::CommandBuffer cmd, Scene *scene, uint32_t frame)
+  {
+    if (!scene->variant.pickIds)
+    {
+      throw std::runtime_error("scene has no pick attachment");
+    }
+    // Every request reads the image of this frame
+    std::vector<vk::Image> images(1, scene->idImages[frame]);
+    for (PickRequest &r : _queue)
+    {
+      r.target = 0;
+    }
+    record(cmd, images.data(), 1, scene->extent);
+  }
+
+  void PickReadback::record(vk::CommandBuffer cmd,
+                            const vk::Image *images,
+                            uint32_t imageCount,
+                            vk::Extent2D extent)
+  {
+    NGFX_TRACE_SCOPE("PickReadback::record");
+    if (_queue.empty())
+    {
+      return;
+    }
+    auto free = std::find_if(_slots.begin(),
+                             _slots.end(),
+                             [](const Slot &s) { return !s.pending; });
+    if (free == _slots.end())
+    {
+      return;
+    }
+    Slot &slot = *free;
+    uint32_t base = (uint32_t) (free - _slots.begin()) * _maxPixels;
+
+    slot.requests.clear();
+    slot.offsets.clear();
+    std::vector<vk::BufferImageCopy> copies;
+    std::vector<uint32_t> targets;
+    uint32_t used = 0;
+    while (!_queue.empty())
+    {
+      PickRequest r = _queue.front();
+      int32_t x0 = std::max(r.x, 0);
+      int32_t y0 = std::max(r.y, 0);
+      int32_t x1 = std::min(r.x + (int32_t) r.width, (int32_t) extent.width);
+      int32_t y1 = std::min(r.y + (int32_t) r.height, (int32_t) extent.height);
+      r.x = x0;
+      r.y = y0;
+      r.width = (x1 > x0) ? x1 - x0 : 0;
+      r.height = (y1 > y0) ? y1 - y0 : 0;
+      if (r.target >= imageCount)
+      {
+        r.width = r.height = 0;
+      }
+
+      uint32_t pixels = r.width * r.height;
+      if (pixels > _maxPixels)
+      {
+        // Would never fit a slot. Rows wider than a slot are cut first so
+        // at least one row is kept
+        r.width = std::min(r.width, _maxPixels);
+        r.height = std::min(r.height, _maxPixels / r.width);
+        pixels = r.width * r.height;
+      }
+      if (used + pixels > _maxPixels)
+      {
+        break;
+      }
+      _queue.pop_front();
+
+      if (pixels > 0)
+      {
+        copies.push_back(vk::BufferImageCopy(
+            (base + used) * sizeof(uint32_t),
+            0,
+            0,
+            vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
+            vk::Offset3D(r.x, r.y, 0),
+            vk::Extent3D(r.width, r.height, 1)));
+        targets.push_back(r.target);
+      }
+      slot.requests.push_back(r);
+      slot.offsets.push_back(used);
+      used += pixels;
+    }
+    if (slot.requests.empty())
+    {
+      return;
+    }
+
+    // The passes leave the pick attachments in transfer source layout
+    vk::MemoryBarrier toCopy(vk::AccessFlagBits::eColorAttachmentWrite,
+                             vk::AccessFlagBits::eTransferRead);
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eColorAttachmentOutput,
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlags(),
+        1, &toCopy, 0, nullptr, 0, nullptr);
+    for (size_t i = 0; i < copies.size(); i++)
+    {
+      cmd.copyImageToBuffer(images[targets[i]],
+                            vk::ImageLayout::eTransferSrcOptimal,
+                            _buffer,
+                            1,
+                            &copies[i]);
+    }
+
+    vk::MemoryBarrier toHost(vk::AccessFlagBits::eTransferWrite,
+                             vk::AccessFlagBits::eHostRead);
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eHost,
+        vk::DependencyFlags(),
+        1, &toHost, 0, nullptr, 0, nullptr);
+    cmd.setEvent(slot.event, vk::PipelineStageFlagBits::eTransfer);
+    slot.pending = true;
+  }
+
+  void PickReadback::poll(std::vector<PickResult> *out)
+  {
+    for (size_t s = 0; s < _slots.size(); s++)
+    {
+      Slot &slot = _slots[s];
+      if (!slot.pending
+          || _device->getEventStatus(slot.event) != vk::Result::eEventSet)
+      {
+        continue;
+      }
+
+      const uint32_t *data = _data + s * _maxPixels;
+      for (size_t i = 0; i < slot.requests.size(); i++)
+      {
+        const PickRequest &r = slot.requests[i];
+        const uint32_t *ids = data + slot.offsets[i];
+        out->push_back(PickResult{r, std::vector<uint32_t>(
+            ids, ids + r.width * r.height)});
+      }
+      _device->resetEvent(slot.event);
+      slot.pending = false;
+    }
+  }
+
+  PickReadback::~PickReadback(void)
+  {
+    for (Slot &slot : _slots)
+    {
+      _device->destroyEvent(slot.event);
+    }
+    _device->unmapMemory(_memory);
+    _device->destroyBuffer(_buffer);
+    util::freeMemory(_device, _memory);
+  }
+}
@@ -1,21 +1,259 @@
 #include <cstddef>
 #include <vulkan/vulkan.hpp>
 #include "util.hpp"
+#include "pipeline.hpp"
 
 namespace ngfx
 {
   namespace util
   {
+    // Mirrors the constant_id declarations in env.vert/overlay.vert
+    struct SpecializationData
+    {
+      uint32_t cameraCount;
+      uint32_t instanceFormat;
+      VkBool32 instanceColor;
+      VkBool32 instanceRotation;
+      VkBool32 pointTopology;
+      uint32_t colorFormat;
+      VkBool32 instanceVelocity;
+      VkBool32 instanceScale;
+      VkBool32 interpolate;
+      float spriteSize;
+    };
+
+    static const vk::SpecializationMapEntry kSpecializationEntries[] = {
+      vk::SpecializationMapEntry(
+          0,
+          offsetof(SpecializationData, cameraCount),
+          sizeof(uint32_t)),
+      vk::SpecializationMapEntry(
+          1,
+          offsetof(SpecializationData, instanceFormat),
+          sizeof(uint32_t)),
+      vk::SpecializationMapEntry(
+          2,
+          offsetof(SpecializationData, instanceColor),
+          sizeof(VkBool32)),
+      vk::SpecializationMapEntry(
+          3,
+          offsetof(SpecializationData, instanceRotation),
+          sizeof(VkBool32)),
+      vk::SpecializationMapEntry(
+          4,
+          offsetof(SpecializationData, pointTopology),
+          sizeof(VkBool32)),
+      vk::SpecializationMapEntry(
+          5,
+          offsetof(SpecializationData, colorFormat),
+          sizeof(uint32_t)),
+      vk::SpecializationMapEntry(
+          6,
+          offsetof(SpecializationData, instanceVelocity),
+          sizeof(VkBool32)),
+      vk::SpecializationMapEntry(
+          7,
+          offsetof(SpecializationData, instanceScale),
+          sizeof(VkBool32)),
+      vk::SpecializationMapEntry(
+          8,
+          offsetof(SpecializationData, interpolate),
+          sizeof(VkBool32)),
+      vk::SpecializationMapEntry(
+          9,
+          offsetof(SpecializationData, spriteSize),
+          sizeof(float)),
+    };
+
+    // Fill data from variant, the returned info points at it
+    static vk::SpecializationInfo specialize(const ShaderVariant &variant,
+                                             SpecializationData *data)
+    {
+      *data = {
+        variant.cameraCount,
+        static_cast<uint32_t>(variant.instanceFormat),
+        variant.instanceColor,
+        variant.instanceRotation,
+        variant.topology == vk::PrimitiveTopology::ePointList,
+        static_cast<uint32_t>(variant.colorFormat),
+        variant.instanceVelocity,
+        variant.instanceScale,
+        variant.interpolate,
+        variant.spriteSize
+      };
+      return vk::SpecializationInfo(
+          util::array_size(kSpecializationEntries),
+          kSpecializationEntries,
+          sizeof(SpecializationData),
+          data);
+    }
+
+    // Location of the per-instance position attribute in env.vert
+    static const uint32_t kInstancePositionLocation = 3;
+
+    uint32_t instanceStride(InstanceFormat format)
+    {
+      switch (format)
+      {
+        case InstanceFormat::eFloat16:
+          return sizeof(InstanceHalf);
+        case InstanceFormat::eSnorm16:
+          return sizeof(InstanceSnorm);
+        default:
+          return sizeof(Instance);
+      }
+    }
+
+    static vk::Format instanceVkFormat(InstanceFormat format)
+    {
+      switch (format)
+      {
+        case InstanceFormat::eFloat16:
+          return vk::Format::eR16G16Sfloat;
+        case InstanceFormat::eSnorm16:
+          return vk::Format::eR16G16Snorm;
+        default:
+          return vk::Format::eR32G32Sfloat;
+      }
+    }
+
+    bool streamEnabled(const ShaderVariant &variant, InstanceStream stream)
+    {
+      switch (stream)
+      {
+        case InstanceStream::ePosition:
+          return true;
+        case InstanceStream::eColor:
+          return variant.instanceColor;
+        case InstanceStream::eRotation:
+          return variant.instanceRotation;
+        case InstanceStream::eVelocity:
+          return variant.instanceVelocity;
+        case InstanceStream::eScale:
+          return variant.instanceScale;
+        case InstanceStream::ePrevious:
+          return variant.interpolate;
+      }
+      return false;
+    }
+
+    uint32_t streamStride(const ShaderVariant &variant, InstanceStream stream)
+    {
+      switch (stream)
+      {
+        case InstanceStream::ePosition:
+        case InstanceStream::ePrevious:
+          return instanceStride(variant.instanceFormat);
+        case InstanceStream::eColor:
+          return (variant.colorFormat == ColorFormat::ePalette8)
+            ? sizeof(InstancePalette) : sizeof(uint32_t);
+        case InstanceStream::eRotation:
+          return sizeof(float);
+        case InstanceStream::eVelocity:
+          return sizeof(glm::vec2);
+        case InstanceStream::eScale:
+          return sizeof(float);
+      }
+      return 0;
+    }
+
+    uint32_t pulledVertexCount(const ShaderVariant &variant)
+    {
+      return (variant.topology == vk::PrimitiveTopology::ePointList) ? 1 : 6;
+    }
+
+    static vk::Format streamVkFormat(const ShaderVariant &variant,
+                                     InstanceStream stream)
+    {
+      switch (stream)
+      {
+        case InstanceStream::ePosition:
+        case InstanceStream::ePrevious:
+          return instanceVkFormat(variant.instanceFormat);
+        case InstanceStream::eColor:
+          return (variant.colorFormat == ColorFormat::ePalette8)
+            ? vk::Format::eR8Unorm : vk::Format::eR8G8B8A8Unorm;
+        case InstanceStream::eRotation:
+          return vk::Format::eR32Sfloat;
+        case InstanceStream::eVelocity:
+          return vk::Format::eR32G32Sfloat;
+        case InstanceStream::eScale:
+          return vk::Format::eR32Sfloat;
+      }
+      return vk::Format::eUndefined;
+    }
+
+    void buildVertexInput(
+        const ShaderVariant &variant,
+        const vk::VertexInputBindingDescription *baseBindings,
+        size_t baseBindingCount,
+        const vk::VertexInputAttributeDescription *baseAttributes,
+        size_t baseAttributeCount,
+        VertexInput *input)
+    {
+      input->bindings.assign(baseBindings, baseBindings + baseBindingCount);
+      input->attributes.assign(baseAttributes,
+                               baseAttributes + baseAttributeCount);
+
+      uint32_t instanceBinding = 0;
+      for (vk::VertexInputAttributeDescription &attr : input->attributes)
+      {
+        if (attr.location == kInstancePositionLocation)
+        {
+          attr.format = instanceVkFormat(variant.instanceFormat);
+          attr.offset = 0;
+          instanceBinding = attr.binding;
+        }
+      }
+      for (vk::VertexInputBindingDescription &bind : input->bindings)
+      {
+        if (bind.binding == instanceBinding)
+        {
+          bind.stride = instanceStride(variant.instanceFormat);
+        }
+      }
+
+      // Remaining streams each get their own binding, packed in stream order
+      uint32_t nextBinding = static_cast<uint32_t>(input->bindings.size());
+      for (uint32_t i = 1; i < kInstanceStreamCount; i++)
+      {
+        InstanceStream stream = static_cast<InstanceStream>(i);
+        if (!streamEnabled(variant, stream))
+        {
+          // env.vert declares every stream, so disabled ones still need a
+          // source. They alias the instance positions, which any float
+          // input accepts, and the specialized shader never reads them
+          input->attributes.push_back(vk::VertexInputAttributeDescription(
+              kInstancePositionLocation + i,
+              instanceBinding,
+              instanceVkFormat(variant.instanceFormat),
+              0));
+          continue;
+        }
+        input->bindings.push_back(vk::VertexInputBindingDescription(
+            nextBinding,
+            streamStride(variant, stream),
+            vk::VertexInputRate::eInstance));
+        input->attributes.push_back(vk::VertexInputAttributeDescription(
+            kInstancePositionLocation + i,
+            nextBinding,
+            streamVkFormat(variant, stream),
+            0));
+        nextBinding++;
+      }
+    }
+
     void buildLayout(
         vk::Device *device,
         size_t descLayoutCount,
         vk::DescriptorSetLayout *descLayouts,
         size_t pushSize,
-        vk::PipelineLayout *pipelineLayout)
+        vk::PipelineLayout *pipelineLayout,
+        vk::ShaderStageFlags pushStages)
     {
       vk::PushConstantRange pushConstants[] = {
         vk::PushConstantRange(
-            vk::ShaderStageFlagBits::eVertex,
+            pushStages,
             0,
             pushSize),
       };
@@ -46,11 +284,12 @@ namespace ngfx
         size_t attributeSize,
         const std::string &vertPath,
         const std::string &fragPath,
-        bool overlay, //TODO: Fix hacky way of passing primative type to pipeline
+        const ShaderVariant &variant,
         vk::PipelineLayout *pipelineLayout,
         vk::RenderPass *renderPass,
         vk::PipelineCache *cache,
-        vk::Pipeline *pipeline) 
+        vk::Pipeline *pipeline,
+        uint32_t viewportCount)
   {
       auto vertShaderCode = util::readFile(vertPath);
       auto fragShaderCode = util::readFile(fragPath);
@@ -60,11 +299,15 @@ namespace ngfx
        vk::ShaderModule fragModule =
         util::createShaderModule(device, fragShaderCode);
 
+      SpecializationData specData;
+      vk::SpecializationInfo specInfo = specialize(variant, &specData);
+
       vk::PipelineShaderStageCreateInfo vertStageCI(
           vk::PipelineShaderStageCreateFlags(),
-        vk::ShaderStageFlagBits::eVertex,
+          vk::ShaderStageFlagBits::eVertex,
           vertModule,
-          "main");
+          "main",
+          &specInfo);
 
       vk::PipelineShaderStageCreateInfo fragStageCI(
           vk::PipelineShaderStageCreateFlags(),
@@ -86,8 +329,7 @@ namespace ngfx
 
       vk::PipelineInputAssemblyStateCreateInfo inputAssembly(
           vk::PipelineInputAssemblyStateCreateFlags(),
-          overlay ? vk::PrimitiveTopology::eTriangleList
-          : vk::PrimitiveTopology::eLineList,
+          variant.topology,
           false);
 
       vk::Viewport viewport(
@@ -100,11 +342,12 @@ namespace ngfx
 
       vk::Rect2D scissor(vk::Offset2D(0, 0), extent);
 
+      // Both are dynamic, only the counts matter past the first
       vk::PipelineViewportStateCreateInfo viewportCI(
           vk::PipelineViewportStateCreateFlags(),
-          1,
+          viewportCount,
           &viewport,
-          1,
+          viewportCount,
           &scissor);
 
       vk::PipelineRasterizationStateCreateInfo rasterizerCI(
@@ -113,7 +356,8 @@ namespace ngfx
           false,
           vk::PolygonMode::eFill,
           vk::CullModeFlagBits::eBack,
-          overlay ? vk::FrontFace::eClockwise
+          variant.topology == vk::PrimitiveTopology::eTriangleList
+          ? vk::FrontFace::eClockwise
           : vk::FrontFace::eCounterClockwise,
           false,
           0.0f,
@@ -130,34 +374,48 @@ namespace ngfx
           false,
           false);
 
-      vk::PipelineColorBlendAttachmentState colorBlendAttachment(
-          false,
-          vk::BlendFactor::eOne,
-          vk::BlendFactor::eZero,
-          vk::BlendOp::eAdd,
-          vk::BlendFactor::eOne,
-          vk::BlendFactor::eZero,
-          vk::BlendOp::eAdd,
-          vk::ColorComponentFlagBits::eR
-          | vk::ColorComponentFlagBits::eG
-          | vk::ColorComponentFlagBits::eB
-          | vk::ColorComponentFlagBits::eA);
+      // Color, then the R32_UINT pick attachment of pickIds variants
+      vk::PipelineColorBlendAttachmentState colorBlendAttachments[] = {
+        vk::PipelineColorBlendAttachmentState(
+            false,
+            vk::BlendFactor::eOne,
+            vk::BlendFactor::eZero,
+            vk::BlendOp::eAdd,
+            vk::BlendFactor::eOne,
+            vk::BlendFactor::eZero,
+            vk::BlendOp::eAdd,
+            vk::ColorComponentFlagBits::eR
+            | vk::ColorComponentFlagBits::eG
+            | vk::ColorComponentFlagBits::eB
+            | vk::ColorComponentFlagBits::eA),
+        vk::PipelineColorBlendAttachmentState(
+            false,
+            vk::BlendFactor::eOne,
+            vk::BlendFactor::eZero,
+            vk::BlendOp::eAdd,
+            vk::BlendFactor::eOne,
+            vk::BlendFactor::eZero,
+            vk::BlendOp::eAdd,
+            vk::ColorComponentFlagBits::eR)
+      };
 
       vk::PipelineColorBlendStateCreateInfo colorBlendingCI(
           vk::PipelineColorBlendStateCreateFlags(),
           false,
           vk::LogicOp::eCopy,
-          1,
-          &colorBlendAttachment);
+          variant.pickIds ? 2 : 1,
+          colorBlendAttachments);
 
+      // Set per pass with setViewport, so targets can render a sub rect
       vk::DynamicState dynamicStates[] = {
         vk::DynamicState::eViewport,
+        vk::DynamicState::eScissor,
         vk::DynamicState::eLineWidth
       };
 
       vk::PipelineDynamicStateCreateInfo dynamicStateCI(
           vk::PipelineDynamicStateCreateFlags(),
-          2,
+          util::array_size(dynamicStates),
           dynamicStates);
 
       vk::GraphicsPipelineCreateInfo pipelineCI(
@@ -189,5 +447,57 @@ namespace ngfx
       device->destroyShaderModule(vertModule);
       device->destroyShaderModule(fragModule);
     }
+
+    void setViewport(vk::CommandBuffer cmd, vk::Extent2D extent)
+    {
+      vk::Viewport viewport(
+          0.0f,
+          0.0f,
+          (float) extent.width,
+          (float) extent.height,
+          0.0f,
+          1.0f);
+      vk::Rect2D scissor(vk::Offset2D(0, 0), extent);
+      cmd.setViewport(0, 1, &viewport);
+      cmd.setScissor(0, 1, &scissor);
+      cmd.setLineWidth(1.0f);
+    }
+
+    void buildComputePipeline(
+        vk::Device *device,
+        const std::string &compPath,
+        const ShaderVariant &variant,
+        vk::PipelineLayout *pipelineLayout,
+        vk::PipelineCache *cache,
+        vk::Pipeline *pipeline)
+    {
+      auto compShaderCode = util::readFile(compPath);
+      vk::ShaderModule compModule =
+        util::createShaderModule(device, compShaderCode);
+
+      SpecializationData specData;
+      vk::SpecializationInfo specInfo = specialize(variant, &specData);
+
+      vk::PipelineShaderStageCreateInfo compStageCI(
+          vk::PipelineShaderStageCreateFlags(),
+          vk::ShaderStageFlagBits::eCompute,
+          compModule,
+          "main",
+          &specInfo);
+
+      vk::ComputePipelineCreateInfo pipelineCI(
+          vk::PipelineCreateFlags(),
+          compStageCI,
+          *pipelineLayout);
+
+      device->createComputePipelines(
+          *cache,
+          1,
+          &pipelineCI,
+          nullptr,
+          pipeline);
+
+      device->destroyShaderModule(compModule);
+    }
   }
 }
@@ -0,0 +1,353 @@
+#include "point_raster.hpp"
+#include "vulkan/vulkan.hpp"
+#include "context.hpp"
+#include "util.hpp"
+#include "pipeline.hpp"
+#include "descriptors.hpp"
+#include "pack.hpp"
+#include "trace.hpp"
+
+namespace ngfx
+{
+  static const uint32_t kRasterGroupSize = 256;
+  static const uint32_t kResolveGroupSize = 8;
+
+  static vk::DeviceSize targetBytes(uint32_t count,
+                                    vk::Extent2D extent,
+                                    bool wide)
+  {
+    return (vk::DeviceSize) count * extent.width * extent.height
+      * (wide ? sizeof(uint64_t) : sizeof(uint32_t));
+  }
+
+  bool PointRaster::fits(Context *c, uint32_t count, vk::Extent2D extent)
+  {
+    vk::PhysicalDeviceLimits limits = c->physicalDevice.getProperties().limits;
+    return targetBytes(count, extent, c->atomicInt64)
+        <= limits.maxStorageBufferRange
+      && count <= limits.maxImageArrayLayers;
+  }
+
+  PointRaster::PointRaster(Context *c,
+                           uint32_t count,
+                           vk::Extent2D extent,
+                           const util::ShaderVariant &shaderVariant)
+    : count(count), extent(extent), variant(shaderVariant),
+      wide(c->atomicInt64),
+      camData(count),
+      camBuffer(
+          &c->device,
+          &c->physicalDevice,
+          &c->cmdPool,
+          count * sizeof(glm::mat4),
+          vk::BufferUsageFlagBits::eStorageBuffer,
+          util::MemoryTag::eCameras),
+      device(&c->device)
+  {
+    if (!variant.pulled)
+    {
+      throw std::runtime_error("point raster requires a pulled variant");
+    }
+    // targetBuffer is bound whole as one storage buffer
+    if (!fits(c, count, extent))
+    {
+      throw std::runtime_error("point raster targets exceed device limits");
+    }
+
+    camBuffer.init();
+    buildTargets(c);
+    buildDescriptors(c);
+
+    util::buildComputePipeline(
+        device,
+        wide ? "shaders/point_raster_wide_comp.spv"
+             : "shaders/point_raster_comp.spv",
+        variant,
+        &layout,
+        &c->pipelineCache,
+        &rasterPipeline);
+    util::buildComputePipeline(
+        device,
+        wide ? "shaders/point_resolve_wide_comp.spv"
+             : "shaders/point_resolve_comp.spv",
+        variant,
+        &layout,
+        &c->pipelineCache,
+        &resolvePipeline);
+  }
+
+  void PointRaster::buildTargets(Context *c)
+  {
+    targetSize = targetBytes(count, extent, wide);
+    util::createDeviceBuffer(device,
+                             &c->physicalDevice,
+                             targetSize,
+                             vk::BufferUsageFlagBits::eStorageBuffer
+                             | vk::BufferUsageFlagBits::eTransferDst,
+                             util::MemoryTag::eTextures,
+                             &targetBuffer,
+                             &targetMemory);
+
+    util::createImage(device,
+                      &c->physicalDevice,
+                      extent,
+                      count,
+                      vk::Format::eR8G8B8A8Unorm,
+                      vk::ImageUsageFlagBits::eStorage
+                      | vk::ImageUsageFlagBits::eSampled
+                      | vk::ImageUsageFlagBits::eTransferSrc,
+                      &colorImage,
+                      &colorMemory);
+    colorView = util::createImageView(device,
+                                      colorImage,
+                                      vk::ImageViewType::e2DArray,
+                                      vk::Format::eR8G8B8A8Unorm,
+                                      0,
+                                      count);
+    layerViews.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      layerViews[i] = util::createImageView(device,
+                                            colorImage,
+                                            vk::ImageViewType::e2D,
+                                            vk::Format::eR8G8B8A8Unorm,
+                                            i,
+                                            1);
+    }
+  }
+
+  void PointRaster::buildDescriptors(Context *c)
+  {
+    vk::DescriptorSetLayoutBinding bindings[] = {
+      vk::DescriptorSetLayoutBinding(
+         0,
+         vk::DescriptorType::eStorageBuffer,
+         1,
+         vk::ShaderStageFlagBits::eCompute,
+         nullptr),
+      vk::DescriptorSetLayoutBinding(
+         1,
+         vk::DescriptorType::eStorageBuffer,
+         1,
+         vk::ShaderStageFlagBits::eCompute,
+         nullptr),
+      vk::DescriptorSetLayoutBinding(
+         2,
+         vk::DescriptorType::eUniformBuffer,
+         1,
+         vk::ShaderStageFlagBits::eCompute,
+         nullptr),
+      vk::DescriptorSetLayoutBinding(
+         3,
+         vk::DescriptorType::eStorageImage,
+         1,
+         vk::ShaderStageFlagBits::eCompute,
+         nullptr)
+    };
+    vk::DescriptorSetLayoutCreateInfo layoutCI(
+        vk::DescriptorSetLayoutCreateFlags(),
+        util::array_size(bindings),
+        bindings);
+    device->createDescriptorSetLayout(&layoutCI, nullptr, &descLayout);
+    util::buildInstanceStorageLayout(device, &storageLayout);
+
+    vk::DescriptorSetLayout setLayouts[] = {descLayout, storageLayout};
+    util::buildLayout(
+        device,
+        util::array_size(setLayouts),
+        setLayouts,
+        sizeof(PointRasterPushConstants),
+        &layout,
+        vk::ShaderStageFlagBits::eCompute);
+
+    descSet = c->descriptors.allocate(descLayout);
+    vk::DescriptorBufferInfo camInfo(camBuffer.localBuffer,
+                                     0,
+                                     VK_WHOLE_SIZE);
+    vk::DescriptorBufferInfo targetInfo(targetBuffer, 0, VK_WHOLE_SIZE);
+    vk::DescriptorBufferInfo paletteInfo(c->palette->localBuffer,
+                                         0,
+                                         c->palette->size);
+    vk::DescriptorImageInfo colorInfo(vk::Sampler(),
+                                      colorView,
+                                      vk::ImageLayout::eGeneral);
+    vk::WriteDescriptorSet writes[] = {
+      vk::WriteDescriptorSet(descSet, 0, 0, 1,
+                             vk::DescriptorType::eStorageBuffer,
+                             nullptr, &camInfo, nullptr),
+      vk::WriteDescriptorSet(descSet, 1, 0, 1,
+                             vk::DescriptorType::eStorageBuffer,
+                             nullptr, &targetInfo, nullptr),
+      vk::WriteDescriptorSet(descSet, 2, 0, 1,
+                             vk::DescriptorType::eUniformBuffer,
+                             nullptr, &paletteInfo, nullptr),
+      vk::WriteDescriptorSet(descSet, 3, 0, 1,
+                             vk::DescriptorType::eStorageImage,
+                             &colorInfo, nullptr, nullptr),
+    };
+    device->updateDescriptorSets(util::array_size(writes),
+                                 writes,
+                                 0,
+                                 nullptr);
+  }
+
+  void PointRaster::writeCameras(const std::vector<Camera> &cams)
+  {
+    for (uint32_t i = 0; i < count; i++)
+    {
+      camData[i] = cams[i].cam;
+    }
+    camBuffer.stage(camData.data());
+    camBuffer.markDirty(0, camBuffer.size);
+  }
+
+  void PointRaster::record(vk::CommandBuffer cmd,
+                           InstanceStreams *instances,
+                           uint32_t instanceCount,
+                           float alpha,
+                           glm::vec4 instanceXform)
+  {
+    NGFX_TRACE_SCOPE("PointRaster::record");
+    vk::ImageSubresourceRange range(
+        vk::ImageAspectFlagBits::eColor, 0, 1, 0, count);
+
+    camBuffer.recordDirty(cmd);
+
+    // Last frame's resolve must be done with the keys before clearing
+    vk::BufferMemoryBarrier toClear(
+        vk::AccessFlagBits::eShaderRead,
+        vk::AccessFlagBits::eTransferWrite,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        targetBuffer,
+        0,
+        VK_WHOLE_SIZE);
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlags(),
+        0, nullptr, 1, &toClear, 0, nullptr);
+    cmd.fillBuffer(targetBuffer, 0, VK_WHOLE_SIZE, 0);
+
+    vk::BufferMemoryBarrier toRaster(
+        vk::AccessFlagBits::eTransferWrite,
+        vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        targetBuffer,
+        0,
+        VK_WHOLE_SIZE);
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::DependencyFlags(),
+        0, nullptr, 1, &toRaster, 0, nullptr);
+
+    PointRasterPushConstants push = {
+      instanceXform,
+      alpha,
+      instanceCount,
+      extent.width,
+      extent.height
+    };
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                           layout,
+                           0,
+                           1,
+                           &descSet,
+                           0,
+                           nullptr);
+    instances->bindStorage(cmd, layout, 1, vk::PipelineBindPoint::eCompute);
+    cmd.pushConstants(layout,
+                      vk::ShaderStageFlagBits::eCompute,
+                      0,
+                      sizeof(PointRasterPushConstants),
+                      (void *) &push);
+    if (instanceCount > 0)
+    {
+      cmd.bindPipeline(vk::PipelineBindPoint::eCompute, rasterPipeline);
+      cmd.dispatch(
+          (instanceCount + kRasterGroupSize - 1) / kRasterGroupSize,
+          count,
+          1);
+    }
+
+    // Keys complete, colors overwritten entirely
+    vk::BufferMemoryBarrier toResolve(
+        vk::AccessFlagBits::eShaderWrite,
+        vk::AccessFlagBits::eShaderRead,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        targetBuffer,
+        0,
+        VK_WHOLE_SIZE);
+    vk::ImageMemoryBarrier toStorage(
+        vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eTransferRead,
+        vk::AccessFlagBits::eShaderWrite,
+        vk::ImageLayout::eUndefined,
+        vk::ImageLayout::eGeneral,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        colorImage,
+        range);
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader
+        | vk::PipelineStageFlagBits::eFragmentShader
+        | vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::DependencyFlags(),
+        0, nullptr, 1, &toResolve, 1, &toStorage);
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, resolvePipeline);
+    cmd.dispatch(
+        (extent.width + kResolveGroupSize - 1) / kResolveGroupSize,
+        (extent.height + kResolveGroupSize - 1) / kResolveGroupSize,
+        count);
+
+    vk::ImageMemoryBarrier toShader(
+        vk::AccessFlagBits::eShaderWrite,
+        vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eTransferRead,
+        vk::ImageLayout::eGeneral,
+        vk::ImageLayout::eShaderReadOnlyOptimal,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        colorImage,
+        range);
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eFragmentShader
+        | vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlags(),
+        0, nullptr, 0, nullptr, 1, &toShader);
+  }
+
+  void PointRaster::recordCopy(vk::CommandBuffer cmd, CameraArray *cameras)
+  {
+    NGFX_TRACE_SCOPE("PointRaster::recordCopy");
+    cameras->recordBlit(cmd, colorImage, extent);
+  }
+
+  vk::ImageView PointRaster::view(uint32_t camera)
+  {
+    return layerViews[camera];
+  }
+
+  PointRaster::~PointRaster(void)
+  {
+    device->destroyPipeline(rasterPipeline);
+    device->destroyPipeline(resolvePipeline);
+    device->destroyPipelineLayout(layout);
+    device->destroyDescriptorSetLayout(storageLayout);
+    device->destroyDescriptorSetLayout(descLayout);
+
+    for (vk::ImageView view : layerViews)
+    {
+      device->destroyImageView(view);
+    }
+    device->destroyImageView(colorView);
+    device->destroyImage(colorImage);
+    util::freeMemory(device, colorMemory);
+    device->destroyBuffer(targetBuffer);
+    util::freeMemory(device, targetMemory);
+  }
+}
@@ -0,0 +1,445 @@
+#include "renderer.hpp"
+#include <chrono>
+#include <cstring>
+#include "vulkan/vulkan.hpp"
+#include "context.hpp"
+#include "util.hpp"
+#include "trace.hpp"
+
+namespace ngfx
+{
+  static const util::Vertex kDefaultVertices[] = {
+    {{-0.5f, -0.5f}, {0.9f, 0.9f, 0.9f}, {0.0f, 0.0f}},
+    {{0.0f, 0.5f}, {0.9f, 0.9f, 0.9f}, {1.0f, 0.0f}},
+    {{0.5f, -0.5f}, {0.9f, 0.9f, 0.9f}, {1.0f, 1.0f}},
+  };
+
+  static const uint16_t kDefaultIndices[] = {
+    0, 1, 1, 2, 2, 0
+  };
+
+  Renderer::Renderer(const RendererConfig &config)
+    : c(config.device, true), _variant(config.variant), _trailPending(false)
+  {
+    if (config.heatmap || config.trailLength > 0)
+    {
+      _variant.pulled = true;
+    }
+    if (config.lod
+        && (_variant.instanceFormat != util::InstanceFormat::eFloat32
+            || (_variant.instanceColor
+                && _variant.colorFormat != util::ColorFormat::eRgba8)
+            || _variant.interpolate
+            || _variant.instanceRotation
+            || _variant.instanceVelocity))
+    {
+      throw std::runtime_error("variant not supported by lod");
+    }
+    const util::Vertex *vertices = config.vertices;
+    uint32_t vertexCount = config.vertexCount;
+    const uint16_t *indices = config.indices;
+    _indexCount = config.indexCount;
+    if (!vertices || !indices)
+    {
+      vertices = kDefaultVertices;
+      vertexCount = util::array_size(kDefaultVertices);
+      indices = kDefaultIndices;
+      _indexCount = util::array_size(kDefaultIndices);
+    }
+
+    _vertices.reset(new util::FastBuffer(
+        &c.device,
+        &c.physicalDevice,
+        &c.cmdPool,
+        vertexCount * sizeof(util::Vertex),
+        vk::BufferUsageFlagBits::eVertexBuffer,
+        util::MemoryTag::eGeometry));
+    _vertices->init();
+    _vertices->stage((void *) vertices);
+    _vertices->blockingCopy(c.graphicsQueue);
+    _vertices->makeStatic();
+
+    _indices.reset(new util::FastBuffer(
+        &c.device,
+        &c.physicalDevice,
+        &c.cmdPool,
+        _indexCount * sizeof(uint16_t),
+        vk::BufferUsageFlagBits::eIndexBuffer,
+        util::MemoryTag::eGeometry));
+    _indices->init();
+    _indices->stage((void *) indices);
+    _indices->blockingCopy(c.graphicsQueue);
+    _indices->makeStatic();
+
+    _instances.reset(
+        new InstanceStreams(&c, _variant, config.instanceCapacity));
+    _cameras.reset(new CameraArray(&c,
+                                   config.cameraCount,
+                                   _variant,
+                                   nullptr,
+                                   config.extent));
+    if (config.camera2D)
+    {
+      _cameras2D.assign(config.cameraCount, Camera2D(config.extent));
+    }
+    if (config.heatmap)
+    {
+      _heatmap.reset(new Heatmap(&c,
+                                 config.cameraCount,
+                                 config.extent,
+                                 _variant));
+    }
+    if (config.trailLength > 0)
+    {
+      _trails.reset(new Trails(&c,
+                               _cameras.get(),
+                               config.instanceCapacity,
+                               config.trailLength));
+    }
+    if (_variant.pickIds)
+    {
+      if (config.heatmap)
+      {
+        throw std::runtime_error("heatmap does not support pick ids");
+      }
+      // render() waits for every frame, one slot is enough
+      _pick.reset(new PickReadback(&c, 1));
+    }
+    if (config.frameBudgetMs > 0.0)
+    {
+      ResolutionSettings settings;
+      settings.targetMs = config.frameBudgetMs;
+      // render() waits for every frame, one slot is enough
+      _resolution.reset(new ResolutionController(&c,
+                                                 _cameras.get(),
+                                                 settings,
+                                                 1));
+    }
+    if (config.lod)
+    {
+      _lod.reset(new LodTree());
+      _lod->settings = config.lodSettings;
+      _lodInstances.reset(new InstanceStreams(
+          &c,
+          _variant,
+          config.lodCapacity ? config.lodCapacity : config.instanceCapacity));
+      _lodRanges.resize(config.cameraCount);
+      for (uint32_t i = 0; i < util::kInstanceStreamCount; i++)
+      {
+        util::InstanceStream stream = static_cast<util::InstanceStream>(i);
+        if (_instances->enabled(stream))
+        {
+          _lodStreams[i].resize((size_t) config.instanceCapacity
+                                * util::streamStride(_variant, stream));
+        }
+      }
+    }
+    for (uint32_t i = 0; i < util::kInstanceStreamCount; i++)
+    {
+      _copied[i] = nullptr;
+      _hosts[i] = nullptr;
+    }
+
+    _pool = util::createCommandPool(
+        &c.device,
+        c.qFamilies,
+        vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
+    vk::CommandBufferAllocateInfo allocInfo(
+        _pool,
+        vk::CommandBufferLevel::ePrimary,
+        1);
+    c.device.allocateCommandBuffers(&allocInfo, &_cmd);
+
+    vk::FenceCreateInfo fenceCI;
+    c.device.createFence(&fenceCI, nullptr, &_fence);
+  }
+
+  void *Renderer::allocateStream(util::InstanceStream stream)
+  {
+    if (!_instances->enabled(stream))
+    {
+      return nullptr;
+    }
+    return util::allocateHostShared(&c.physicalDevice,
+                                    _instances->sharedSize(stream));
+  }
+
+  void Renderer::freeStream(void *host)
+  {
+    util::freeHostShared(host);
+  }
+
+  bool Renderer::shareStream(util::InstanceStream stream, void *host)
+  {
+    uint32_t i = static_cast<uint32_t>(stream);
+    _hosts[i] = host;
+    if (_instances->share(stream, host))
+    {
+      _copied[i] = nullptr;
+      return true;
+    }
+    // Interpolated positions only change through tick()
+    if (_variant.interpolate
+        && (stream == util::InstanceStream::ePosition
+            || stream == util::InstanceStream::ePrevious))
+    {
+      return false;
+    }
+    _copied[i] = host;
+    return false;
+  }
+
+  void Renderer::writeStream(util::InstanceStream stream, void *data)
+  {
+    _instances->write(stream, data);
+    std::vector<uint8_t> &copy = _lodStreams[static_cast<uint32_t>(stream)];
+    if (!copy.empty())
+    {
+      memcpy(copy.data(), data, copy.size());
+    }
+    _trailPending |= stream == util::InstanceStream::ePosition;
+  }
+
+  void Renderer::writeStream(util::InstanceStream stream,
+                             const void *data,
+                             uint32_t first,
+                             uint32_t count)
+  {
+    vk::DeviceSize stride = util::streamStride(_variant, stream);
+    uint8_t *mapped = (uint8_t *) _instances->map(stream);
+    memcpy(mapped + first * stride, data, count * stride);
+    _instances->markDirty(stream, first, count);
+    std::vector<uint8_t> &copy = _lodStreams[static_cast<uint32_t>(stream)];
+    if (!copy.empty())
+    {
+      memcpy(copy.data() + first * stride, data, count * stride);
+    }
+    _trailPending |= stream == util::InstanceStream::ePosition;
+  }
+
+  void Renderer::tick(void *positions, double time)
+  {
+    _instances->tick(positions, time);
+    _trailPending = true;
+  }
+
+  float Renderer::alpha(double now, bool extrapolate)
+  {
+    return _instances->alpha(now, extrapolate);
+  }
+
+  uint32_t Renderer::cameraCount(void)
+  {
+    return _cameras->count;
+  }
+
+  Camera &Renderer::camera(uint32_t i)
+  {
+    return _cameras->cams[i];
+  }
+
+  Camera2D &Renderer::camera2D(uint32_t i)
+  {
+    return _cameras2D[i];
+  }
+
+  void Renderer::render(uint32_t instanceCount, float alpha)
+  {
+    NGFX_TRACE_SCOPE("Renderer::render");
+    // The previous render waited for its fence
+    c.beginFrame(0);
+    for (uint32_t i = 0; i < util::kInstanceStreamCount; i++)
+    {
+      if (_copied[i])
+      {
+        _instances->write(static_cast<util::InstanceStream>(i), _copied[i]);
+      }
+    }
+
+    // Heatmap, lod and staging all read cams, so 2D cameras only swap the
+    // matrix
+    for (uint32_t i = 0; i < _cameras2D.size(); i++)
+    {
+      _cameras2D[i].build();
+      _cameras->cams[i].cam = _cameras2D[i].cam;
+    }
+    _cameras->stageCameras();
+    _cameras->camBuffer.markDirty(0, _cameras->camBuffer.size);
+
+    vk::CommandBufferBeginInfo beginInfo(
+        vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+        nullptr);
+    _cmd.begin(beginInfo);
+    _cameras->camBuffer.recordDirty(_cmd);
+    _instances->recordUpload(_cmd);
+    // Shared positions change in place, assume a step per render
+    uint32_t position = static_cast<uint32_t>(util::InstanceStream::ePosition);
+    if (_trails
+        && (_trailPending
+            || _copied[position]
+            || _instances->shared[position].valid))
+    {
+      _trails->recordAppend(_cmd, _instances.get(), instanceCount);
+      _trailPending = false;
+    }
+    if (_resolution)
+    {
+      _resolution->begin(_cmd, 0);
+    }
+    if (_heatmap)
+    {
+      _heatmap->writeCameras(_cameras->cams);
+      _heatmap->record(_cmd, _instances.get(), instanceCount, alpha);
+      _heatmap->recordCopy(_cmd, _cameras.get());
+    }
+    else if (_lod)
+    {
+      const glm::vec2 *positions = (const glm::vec2 *) hostStream(
+          util::InstanceStream::ePosition);
+      const uint32_t *colors = _variant.instanceColor
+        ? (const uint32_t *) hostStream(util::InstanceStream::eColor)
+        : nullptr;
+      const float *scales = _variant.instanceScale
+        ? (const float *) hostStream(util::InstanceStream::eScale)
+        : nullptr;
+      _lod->build(positions, instanceCount, colors, scales);
+      _lod->select(_cameras->cams,
+                   _cameras->renderExtent,
+                   _lodInstances.get(),
+                   _lodRanges.data());
+      _lodInstances->recordUpload(_cmd);
+      _cameras->record(_cmd,
+                       _vertices.get(),
+                       _indices.get(),
+                       _indexCount,
+                       _lodInstances.get(),
+                       instanceCount,
+                       alpha,
+                       _lodRanges.data());
+    }
+    else
+    {
+      _cameras->record(_cmd,
+                       _vertices.get(),
+                       _indices.get(),
+                       _indexCount,
+                       _instances.get(),
+                       instanceCount,
+                       alpha);
+    }
+    if (_trails)
+    {
+      _trails->record(_cmd, instanceCount);
+    }
+    if (_resolution)
+    {
+      _resolution->end(_cmd, 0);
+    }
+    if (_pick)
+    {
+      _pick->record(_cmd, _cameras.get());
+    }
+    _cameras->recordReadback(_cmd);
+    _cmd.end();
+
+    vk::SubmitInfo submitInfo(0, nullptr, nullptr, 1, &_cmd, 0, nullptr);
+    auto submitted = std::chrono::steady_clock::now();
+    c.graphicsQueue.submit(1, &submitInfo, _fence);
+    c.device.waitForFences(1, &_fence, true, UINT64_MAX);
+    c.device.resetFences(1, &_fence);
+
+    // Resizes apply from the next render, frameExtent describes this one.
+    // Without timestamps the budget holds submit to completion on the host,
+    // uploads and readback included
+    if (_resolution && _resolution->timestamps)
+    {
+      _resolution->update();
+    }
+    else if (_resolution)
+    {
+      _resolution->update(std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - submitted).count());
+    }
+  }
+
+  const uint8_t *Renderer::frame(uint32_t camera)
+  {
+    return _cameras->frame(camera);
+  }
+
+  vk::DeviceSize Renderer::frameSize(void)
+  {
+    return (vk::DeviceSize) frameRowBytes() * _cameras->frameExtent.height;
+  }
+
+  uint32_t Renderer::frameRowBytes(void)
+  {
+    return _cameras->frameExtent.width * 4;
+  }
+
+  vk::Extent2D Renderer::frameExtent(void)
+  {
+    return _cameras->frameExtent;
+  }
+
+  Context &Renderer::context(void)
+  {
+    return c;
+  }
+
+  Heatmap *Renderer::heatmap(void)
+  {
+    return _heatmap.get();
+  }
+
+  const void *Renderer::hostStream(util::InstanceStream stream)
+  {
+    uint32_t i = static_cast<uint32_t>(stream);
+    return _hosts[i] ? _hosts[i] : _lodStreams[i].data();
+  }
+
+  LodTree *Renderer::lod(void)
+  {
+    return _lod.get();
+  }
+
+  Trails *Renderer::trails(void)
+  {
+    return _trails.get();
+  }
+
+  void Renderer::pick(const PickRequest &r)
+  {
+    if (!_pick)
+    {
+      throw std::runtime_error("renderer variant has no pick ids");
+    }
+    _pick->request(r);
+  }
+
+  void Renderer::pollPicks(std::vector<PickResult> *out)
+  {
+    if (_pick)
+    {
+      _pick->poll(out);
+    }
+  }
+
+  Renderer::~Renderer(void)
+  {
+    c.device.waitIdle();
+    _resolution.reset();
+    _pick.reset();
+    _trails.reset();
+    _lodInstances.reset();
+    _heatmap.reset();
+    _cameras.reset();
+    _instances.reset();
+    _indices.reset();
+    _vertices.reset();
+
+    c.device.destroyFence(_fence);
+    c.device.destroyCommandPool(_pool);
+    c.destroy();
+  }
+}
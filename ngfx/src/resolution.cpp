@@ -0,0 +1,144 @@
+#include "resolution.hpp"
+#include <algorithm>
+#include <cmath>
+#include "trace.hpp"
+
+namespace ngfx
+{
+  ResolutionController::ResolutionController(
+      Context *c,
+      CameraArray *cameras,
+      const ResolutionSettings &settings,
+      uint32_t framesInFlight)
+    : settings(settings), scale(1.0f), filteredMs(-1.0),
+      _cameras(cameras), _resizes(0), _device(&c->device)
+  {
+    uint32_t familyCount = 0;
+    c->physicalDevice.getQueueFamilyProperties(
+        &familyCount,
+        (vk::QueueFamilyProperties *) nullptr);
+    std::vector<vk::QueueFamilyProperties> families(familyCount);
+    c->physicalDevice.getQueueFamilyProperties(&familyCount, families.data());
+    uint32_t validBits =
+      families[c->qFamilies.graphicsFamily.value()].timestampValidBits;
+    timestamps = validBits > 0;
+    _mask = (validBits >= 64) ? ~0ull : ((1ull << validBits) - 1);
+    _periodMs = c->physicalDevice.getProperties().limits.timestampPeriod * 1e-6;
+
+    vk::QueryPoolCreateInfo queryCI(
+        vk::QueryPoolCreateFlags(),
+        vk::QueryType::eTimestamp,
+        2 * framesInFlight,
+        vk::QueryPipelineStatisticFlags());
+    _device->createQueryPool(&queryCI, nullptr, &_queries);
+
+    // Start from the current extent of the array
+    scale = std::min((float) cameras->renderExtent.width / cameras->w,
+                     (float) cameras->renderExtent.height / cameras->h);
+    scale = std::min(std::max(scale, settings.minScale), settings.maxScale);
+    apply();
+  }
+
+  void ResolutionController::begin(vk::CommandBuffer cmd, uint32_t frame)
+  {
+    if (!timestamps)
+    {
+      return;
+    }
+    // A slot recorded again was never read, drop it
+    _recorded.erase(
+        std::remove_if(_recorded.begin(),
+                       _recorded.end(),
+                       [&](const std::pair<uint32_t, uint64_t> &r)
+                       { return r.first == frame; }),
+        _recorded.end());
+    cmd.resetQueryPool(_queries, 2 * frame, 2);
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe,
+                       _queries,
+                       2 * frame);
+  }
+
+  void ResolutionController::end(vk::CommandBuffer cmd, uint32_t frame)
+  {
+    if (!timestamps)
+    {
+      return;
+    }
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe,
+                       _queries,
+                       2 * frame + 1);
+    _recorded.push_back(std::make_pair(frame, _resizes));
+  }
+
+  bool ResolutionController::update(void)
+  {
+    NGFX_TRACE_SCOPE("ResolutionController::update");
+    bool changed = false;
+    while (!_recorded.empty())
+    {
+      uint64_t ticks[2];
+      vk::Result result = _device->getQueryPoolResults(
+          _queries,
+          2 * _recorded.front().first,
+          2,
+          sizeof(ticks),
+          ticks,
+          sizeof(uint64_t),
+          vk::QueryResultFlagBits::e64);
+      if (result != vk::Result::eSuccess)
+      {
+        break;
+      }
+      uint64_t resizes = _recorded.front().second;
+      _recorded.pop_front();
+      // Drawn at an extent that has since been corrected
+      if (resizes != _resizes)
+      {
+        continue;
+      }
+      changed |= update(((ticks[1] - ticks[0]) & _mask) * _periodMs);
+    }
+    return changed;
+  }
+
+  bool ResolutionController::update(double gpuMs)
+  {
+    filteredMs = (filteredMs < 0.0)
+      ? gpuMs
+      : filteredMs + settings.smoothing * (gpuMs - filteredMs);
+    double ratio = filteredMs / settings.targetMs;
+    if (std::abs(ratio - 1.0) <= settings.tolerance)
+    {
+      return false;
+    }
+
+    // Pass time is taken as proportional to pixels
+    double pixels = std::min(std::max(1.0 / ratio, 1.0 / settings.maxStep),
+                             settings.maxStep);
+    float next = (float) (scale * std::sqrt(pixels));
+    next = std::min(std::max(next, settings.minScale), settings.maxScale);
+    if (next == scale)
+    {
+      return false;
+    }
+
+    // Predict the time at the new extent until samples of it arrive
+    filteredMs *= (double) (next * next) / (scale * scale);
+    scale = next;
+    _resizes++;
+    apply();
+    return true;
+  }
+
+  void ResolutionController::apply(void)
+  {
+    _cameras->setRenderExtent(vk::Extent2D(
+        (uint32_t) std::lround(_cameras->w * scale),
+        (uint32_t) std::lround(_cameras->h * scale)));
+  }
+
+  ResolutionController::~ResolutionController(void)
+  {
+    _device->destroyQueryPool(_queries);
+  }
+}
@@ -3,6 +3,7 @@
 #include "context.hpp"
 #include "swap_data.hpp"
 #include "pipeline.hpp"
+#include "pack.hpp"
 
 namespace ngfx
 {
@@ -44,74 +45,120 @@ namespace ngfx
         vk::VertexInputRate::eInstance)
   };
 
-  Scene::Scene(Context *c, SwapData *s)
-    : device(&c->device), cam(s->extent), 
+  Scene::Scene(Context *c,
+               SwapData *s,
+               const util::ShaderVariant &shaderVariant,
+               Bindless *bindless)
+    : extent(s->extent), variant(shaderVariant), cam(s->extent), 
       camBuffer(
           &c->device,
           &c->physicalDevice,
           &c->cmdPool,
           sizeof(cam.cam),
-          vk::BufferUsageFlagBits::eUniformBuffer)
+          vk::BufferUsageFlagBits::eUniformBuffer,
+          util::MemoryTag::eCameras),
+      bindless(bindless), camera(0), device(&c->device)
   {
     // RenderPass
-    vk::AttachmentDescription
-      colorAttachment(vk::AttachmentDescriptionFlags(),
-                      s->format, 
-                      vk::SampleCountFlagBits::e1,
-                      vk::AttachmentLoadOp::eClear,
-                      vk::AttachmentStoreOp::eStore,
-                      vk::AttachmentLoadOp::eDontCare,
-                      vk::AttachmentStoreOp::eDontCare,
-                      vk::ImageLayout::eUndefined,
-                      vk::ImageLayout::ePresentSrcKHR);
-    vk::AttachmentReference colorAttachmentRef(
-        0,
-        vk::ImageLayout::eColorAttachmentOptimal);
+    vk::AttachmentDescription attachments[] = {
+      vk::AttachmentDescription(vk::AttachmentDescriptionFlags(),
+                                s->format, 
+                                vk::SampleCountFlagBits::e1,
+                                vk::AttachmentLoadOp::eClear,
+                                vk::AttachmentStoreOp::eStore,
+                                vk::AttachmentLoadOp::eDontCare,
+                                vk::AttachmentStoreOp::eDontCare,
+                                vk::ImageLayout::eUndefined,
+                                vk::ImageLayout::ePresentSrcKHR),
+      util::pickAttachment(vk::AttachmentLoadOp::eClear)
+    };
+    uint32_t attachmentCount = variant.pickIds ? 2 : 1;
+    vk::AttachmentReference colorAttachmentRefs[] = {
+      vk::AttachmentReference(0, vk::ImageLayout::eColorAttachmentOptimal),
+      vk::AttachmentReference(1, vk::ImageLayout::eColorAttachmentOptimal)
+    };
     
     vk::SubpassDescription subpass(
         vk::SubpassDescriptionFlags(),
         vk::PipelineBindPoint::eGraphics,
         0,
         nullptr,
-        1,
-        &colorAttachmentRef,
+        attachmentCount,
+        colorAttachmentRefs,
         nullptr,
         nullptr,
         0,
         nullptr);
     
-    vk::SubpassDependency subpassDependency(
-        0,
-        VK_SUBPASS_EXTERNAL,
-        vk::PipelineStageFlagBits::eColorAttachmentOutput,
-        vk::PipelineStageFlagBits::eColorAttachmentOutput,
-        vk::AccessFlags(),
-        vk::AccessFlagBits::eColorAttachmentWrite,
-        vk::DependencyFlags());
+    vk::SubpassDependency subpassDependencies[] = {
+      vk::SubpassDependency(
+          0,
+          VK_SUBPASS_EXTERNAL,
+          vk::PipelineStageFlagBits::eColorAttachmentOutput,
+          vk::PipelineStageFlagBits::eColorAttachmentOutput,
+          vk::AccessFlags(),
+          vk::AccessFlagBits::eColorAttachmentWrite,
+          vk::DependencyFlags()),
+      // Pick copies of an earlier frame finish before the clear
+      vk::SubpassDependency(
+          VK_SUBPASS_EXTERNAL,
+          0,
+          vk::PipelineStageFlagBits::eTransfer,
+          vk::PipelineStageFlagBits::eColorAttachmentOutput,
+          vk::AccessFlags(),
+          vk::AccessFlagBits::eColorAttachmentWrite,
+          vk::DependencyFlags())
+    };
     
     vk::RenderPassCreateInfo renderPassCI(
         vk::RenderPassCreateFlags(),
-        1,
-        &colorAttachment,
+        attachmentCount,
+        attachments,
         1,
         &subpass,
-        1,
-        &subpassDependency);
+        util::array_size(subpassDependencies),
+        subpassDependencies);
     
     c->device.createRenderPass(&renderPassCI, nullptr, &pass);
     
     // Framebuffers
     frames.resize(s->views.size());
+    if (variant.pickIds)
+    {
+      idImages.resize(s->views.size());
+      idViews.resize(s->views.size());
+      idMemory.resize(s->views.size());
+    }
     for(size_t i = 0; i < s->views.size(); i++)
     {
       vk::ImageView attachments[] = {
-        s->views[i]
+        s->views[i],
+        vk::ImageView()
       };
+      if (variant.pickIds)
+      {
+        util::createImage(&c->device,
+                          &c->physicalDevice,
+                          s->extent,
+                          1,
+                          util::kPickFormat,
+                          vk::ImageUsageFlagBits::eColorAttachment
+                          | vk::ImageUsageFlagBits::eTransferSrc,
+                          &idImages[i],
+                          &idMemory[i]);
+        idViews[i] = util::createImageView(&c->device,
+                                           idImages[i],
+                                           vk::ImageViewType::e2D,
+                                           util::kPickFormat,
+                                           0,
+                                           1);
+        attachments[1] = idViews[i];
+      }
 
       vk::FramebufferCreateInfo framebufferCI(
           vk::FramebufferCreateFlags(),
           pass,
-          1,
+          attachmentCount,
           attachments,
           s->extent.width,
           s->extent.height,
@@ -123,112 +170,82 @@ namespace ngfx
           &frames[i]);
     }
 
-    //Descriptors & buffers
-    vk::DescriptorSetLayoutBinding bindings[] = {
-      vk::DescriptorSetLayoutBinding(
-         0,
-         vk::DescriptorType::eUniformBuffer,
-         1,
-         vk::ShaderStageFlagBits::eVertex, 
-         nullptr)
-    };
-    
-    vk::DescriptorSetLayoutCreateInfo layoutCI(
-        vk::DescriptorSetLayoutCreateFlags(),
-        util::array_size(bindings),
-        bindings); 
-    
-    device->createDescriptorSetLayout(
-        &layoutCI,
-        nullptr,
-        &descLayout);
-
-    vk::PipelineLayoutCreateInfo pipelineLayoutCI(
-        vk::PipelineLayoutCreateFlags(),
-        1,
-        &descLayout,
-        0,
-        nullptr);
-
-    device->createPipelineLayout(
-        &pipelineLayoutCI,
-        nullptr,
-        &layout);
+    if (bindless)
+    {
+      camera = bindless->addCameras(1);
+      layout = bindless->layout;
+    }
+    else
+    {
+      buildDescriptors();
+    }
 
-    util::buildPipeline(
-        &c->device,
-        s->extent,
+    util::VertexInput vertexInput;
+    util::buildVertexInput(
+        variant,
         binding,
         util::array_size(binding),
         attribute,
         util::array_size(attribute),
-        "shaders/env_vert.spv",
-        "shaders/env_frag.spv",
-        false,
+        &vertexInput);
+
+    util::buildPipeline(
+        &c->device,
+        s->extent,
+        vertexInput.bindings.data(),
+        vertexInput.bindings.size(),
+        vertexInput.attributes.data(),
+        vertexInput.attributes.size(),
+        bindless ? "shaders/env_bindless_vert.spv" : "shaders/env_vert.spv",
+        variant.pickIds ? "shaders/env_id_frag.spv" : "shaders/env_frag.spv",
+        variant,
         &layout,
         &pass,
         &c->pipelineCache,
         &pipeline);
 
-    camBuffer.init();
-    createDescriptorPool();
-    createDescriptorSets();
-    camBuffer.stage(&cam.cam);
-
     // TODO: Fix hack that stores queue here, prefer to restructure fastbuffer
     q = &c->graphicsQueue;
+    if (bindless)
+    {
+      bindless->writeCameras(camera, 1, &cam.cam);
+      bindless->upload(c->graphicsQueue);
+      return;
+    }
+
+    camBuffer.init();
+    createDescriptorSets(c);
+    camBuffer.stage(&cam.cam);
     camBuffer.blockingCopy(c->graphicsQueue);
   }
 
-  void Scene::createDescriptorPool(void) {
-    vk::DescriptorPoolSize poolSize[] = {
-      vk::DescriptorPoolSize(
-          vk::DescriptorType::eUniformBuffer,
-          1)
-    };
+  void Scene::buildDescriptors(void)
+  {
+    // Same set layout as CameraArray, so either set can be bound
+    util::buildEnvDescriptorLayout(device, &descLayout);
+    descTemplate = util::createEnvTemplate(device, descLayout);
 
-    vk::DescriptorPoolCreateInfo poolInfo(
-        vk::DescriptorPoolCreateFlags(),
+    util::buildLayout(
+        device,
         1,
-        util::array_size(poolSize),
-        poolSize); 
-    
-    device->createDescriptorPool(
-       &poolInfo, 
-       nullptr, 
-       &descPool);
+        &descLayout,
+        sizeof(util::EnvPushConstants),
+        &layout);
   }
 
-  void Scene::createDescriptorSets(void)
+  void Scene::createDescriptorSets(Context *c)
   {
-    vk::DescriptorSetAllocateInfo allocInfo(descPool,
-                                            1,
-                                            &descLayout);
-
-    device->allocateDescriptorSets(&allocInfo, &descSet);
+    descSet = c->descriptors.allocate(descLayout);
 
-    vk::DescriptorBufferInfo buffInfo(
-        camBuffer.localBuffer,
-        0,
-        sizeof(cam.cam));
-    
-    vk::WriteDescriptorSet descWrite[] = { 
-      vk::WriteDescriptorSet(
-          descSet,
-          0,
-          0,
-          1,
-          vk::DescriptorType::eUniformBuffer,
-          nullptr,
-          &buffInfo,
-          nullptr)
+    util::EnvDescriptors descriptors = {
+      vk::DescriptorBufferInfo(camBuffer.localBuffer, 0, sizeof(cam.cam)),
+      vk::DescriptorBufferInfo(c->palette->localBuffer,
+                               0,
+                               c->palette->size)
     };
-
-    device->updateDescriptorSets(
-        util::array_size(descWrite),
-        descWrite,
-        0,
-        nullptr); 
+    device->updateDescriptorSetWithTemplate(descSet,
+                                            descTemplate,
+                                            &descriptors);
   }
  
   Scene::~Scene()
@@ -237,7 +254,20 @@ namespace ngfx
     {
       device->destroyFramebuffer(frame);
     }
+    for (size_t i = 0; i < idImages.size(); i++)
+    {
+      device->destroyImageView(idViews[i]);
+      device->destroyImage(idImages[i]);
+      util::freeMemory(device, idMemory[i]);
+    }
 
+    device->destroyPipeline(pipeline);
+    if (!bindless)
+    {
+      device->destroyPipelineLayout(layout);
+      device->destroyDescriptorUpdateTemplate(descTemplate);
+      device->destroyDescriptorSetLayout(descLayout);
+    }
     device->destroyRenderPass(pass);
   }
 }
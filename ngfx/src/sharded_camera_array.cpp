@@ -0,0 +1,374 @@
+#include "sharded_camera_array.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include "vulkan/vulkan.hpp"
+#include "context.hpp"
+#include "util.hpp"
+#include "trace.hpp"
+
+namespace ngfx
+{
+  ShardedCameraArray::ShardedCameraArray(
+      const std::vector<std::string> &devices,
+      uint32_t cameraCount,
+      const util::ShaderVariant &variant,
+      uint32_t instanceCapacity,
+      const util::Vertex *vertices,
+      uint32_t vertexCount,
+      const uint16_t *indices,
+      uint32_t indexCount)
+    : cams(cameraCount, Camera(vk::Extent2D(256, 256))),
+      _variant(variant), _indexCount(indexCount), _shards(devices.size())
+  {
+    if (devices.empty() || cameraCount < devices.size())
+    {
+      throw std::runtime_error("need at least one camera per shard");
+    }
+
+    // Start with an even split, rebalance() refines it from timings
+    uint32_t first = 0;
+    for (uint32_t i = 0; i < _shards.size(); i++)
+    {
+      CameraShard *shard = &_shards[i];
+      shard->firstCamera = first;
+      shard->cameraCount = cameraCount / _shards.size()
+        + (i < cameraCount % _shards.size() ? 1 : 0);
+      shard->frameMs = 0.0;
+      first += shard->cameraCount;
+
+      buildShard(shard,
+                 devices[i],
+                 instanceCapacity,
+                 vertices,
+                 vertexCount,
+                 indices);
+      buildCameras(shard);
+    }
+
+    _frames.resize(cameraCount * frameSize());
+  }
+
+  void ShardedCameraArray::buildShard(CameraShard *shard,
+                                      const std::string &device,
+                                      uint32_t instanceCapacity,
+                                      const util::Vertex *vertices,
+                                      uint32_t vertexCount,
+                                      const uint16_t *indices)
+  {
+    shard->c.reset(new Context(device.c_str(), true));
+    Context *c = shard->c.get();
+
+    shard->pool = util::createCommandPool(
+        &c->device,
+        c->qFamilies,
+        vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
+    vk::CommandBufferAllocateInfo allocInfo(
+        shard->pool,
+        vk::CommandBufferLevel::ePrimary,
+        1);
+    c->device.allocateCommandBuffers(&allocInfo, &shard->cmd);
+
+    vk::FenceCreateInfo fenceCI(vk::FenceCreateFlagBits::eSignaled);
+    c->device.createFence(&fenceCI, nullptr, &shard->fence);
+
+    uint32_t familyCount = 0;
+    c->physicalDevice.getQueueFamilyProperties(
+        &familyCount,
+        (vk::QueueFamilyProperties *) nullptr);
+    std::vector<vk::QueueFamilyProperties> families(familyCount);
+    c->physicalDevice.getQueueFamilyProperties(&familyCount, families.data());
+    shard->gpuTimestamps =
+        families[c->qFamilies.graphicsFamily.value()].timestampValidBits > 0;
+    shard->timestampPeriod =
+        c->physicalDevice.getProperties().limits.timestampPeriod;
+
+    vk::QueryPoolCreateInfo queryCI(
+        vk::QueryPoolCreateFlags(),
+        vk::QueryType::eTimestamp,
+        2,
+        vk::QueryPipelineStatisticFlags());
+    c->device.createQueryPool(&queryCI, nullptr, &shard->timestamps);
+
+    // Replicated geometry and instance data
+    shard->vertices.reset(new util::FastBuffer(
+        &c->device,
+        &c->physicalDevice,
+        &c->cmdPool,
+        vertexCount * sizeof(util::Vertex),
+        vk::BufferUsageFlagBits::eVertexBuffer,
+        util::MemoryTag::eGeometry));
+    shard->vertices->init();
+    shard->vertices->stage((void *) vertices);
+    shard->vertices->blockingCopy(c->graphicsQueue);
+    shard->vertices->makeStatic();
+
+    shard->indices.reset(new util::FastBuffer(
+        &c->device,
+        &c->physicalDevice,
+        &c->cmdPool,
+        _indexCount * sizeof(uint16_t),
+        vk::BufferUsageFlagBits::eIndexBuffer,
+        util::MemoryTag::eGeometry));
+    shard->indices->init();
+    shard->indices->stage((void *) indices);
+    shard->indices->blockingCopy(c->graphicsQueue);
+    shard->indices->makeStatic();
+
+    shard->instances.reset(new InstanceStreams(c, _variant, instanceCapacity));
+  }
+
+  void ShardedCameraArray::buildCameras(CameraShard *shard)
+  {
+    // The old array frees its own descriptor pool, sets of the instance
+    // streams stay valid
+    shard->cameras.reset();
+    shard->cameras.reset(new CameraArray(shard->c.get(),
+                                         shard->cameraCount,
+                                         _variant));
+  }
+
+  void ShardedCameraArray::writeInstances(util::InstanceStream stream,
+                                          void *data)
+  {
+    for (CameraShard &shard : _shards)
+    {
+      shard.instances->write(stream, data);
+    }
+  }
+
+  void ShardedCameraArray::render(uint32_t instanceCount)
+  {
+    NGFX_TRACE_SCOPE("ShardedCameraArray::render");
+    std::vector<std::chrono::steady_clock::time_point> starts(_shards.size());
+
+    // Record and submit on every device first so they run concurrently
+    for (uint32_t i = 0; i < _shards.size(); i++)
+    {
+      CameraShard *shard = &_shards[i];
+      Context *c = shard->c.get();
+      CameraArray *cameras = shard->cameras.get();
+
+      c->device.waitForFences(1, &shard->fence, true, UINT64_MAX);
+      c->device.resetFences(1, &shard->fence);
+
+      for (uint32_t j = 0; j < shard->cameraCount; j++)
+      {
+        cameras->cams[j] = cams[shard->firstCamera + j];
+      }
+      cameras->stageCameras();
+      cameras->camBuffer.markDirty(0, cameras->camBuffer.size);
+
+      vk::CommandBufferBeginInfo beginInfo(
+          vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+          nullptr);
+      shard->cmd.begin(beginInfo);
+      if (shard->gpuTimestamps)
+      {
+        shard->cmd.resetQueryPool(shard->timestamps, 0, 2);
+        shard->cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe,
+                                  shard->timestamps,
+                                  0);
+      }
+      cameras->camBuffer.recordDirty(shard->cmd);
+      shard->instances->recordUpload(shard->cmd);
+      cameras->record(shard->cmd,
+                      shard->vertices.get(),
+                      shard->indices.get(),
+                      _indexCount,
+                      shard->instances.get(),
+                      instanceCount);
+      cameras->recordReadback(shard->cmd);
+      if (shard->gpuTimestamps)
+      {
+        shard->cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe,
+                                  shard->timestamps,
+                                  1);
+      }
+      shard->cmd.end();
+
+      vk::SubmitInfo submitInfo(0, nullptr, nullptr, 1, &shard->cmd, 0, nullptr);
+      starts[i] = std::chrono::steady_clock::now();
+      c->graphicsQueue.submit(1, &submitInfo, shard->fence);
+    }
+
+    // Poll every device so each shard's CPU time ends at its own
+    // completion, not after the shards gathered before it
+    std::vector<std::chrono::steady_clock::time_point> ends(_shards.size());
+    {
+      NGFX_TRACE_SCOPE("ShardedCameraArray::waitShards");
+      std::vector<bool> done(_shards.size(), false);
+      uint32_t remaining = _shards.size();
+      while (remaining > 0)
+      {
+        bool progressed = false;
+        for (uint32_t i = 0; i < _shards.size(); i++)
+        {
+          if (!done[i]
+              && _shards[i].c->device.getFenceStatus(_shards[i].fence)
+                 == vk::Result::eSuccess)
+          {
+            ends[i] = std::chrono::steady_clock::now();
+            done[i] = true;
+            remaining--;
+            progressed = true;
+          }
+        }
+        if (!progressed)
+        {
+          std::this_thread::yield();
+        }
+      }
+    }
+
+    // Gather, in camera order
+    for (uint32_t i = 0; i < _shards.size(); i++)
+    {
+      CameraShard *shard = &_shards[i];
+      Context *c = shard->c.get();
+
+      double ms;
+      if (shard->gpuTimestamps)
+      {
+        uint64_t ticks[2];
+        c->device.getQueryPoolResults(
+            shard->timestamps,
+            0,
+            2,
+            sizeof(ticks),
+            ticks,
+            sizeof(uint64_t),
+            vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+        ms = (ticks[1] - ticks[0]) * shard->timestampPeriod * 1e-6;
+      }
+      else
+      {
+        // Submit to completion on the host, includes queue latency
+        ms = std::chrono::duration<double, std::milli>(
+            ends[i] - starts[i]).count();
+      }
+      shard->frameMs = (shard->frameMs == 0.0)
+        ? ms
+        : kFrameTimeSmoothing * ms + (1.0 - kFrameTimeSmoothing) * shard->frameMs;
+
+      memcpy(_frames.data() + shard->firstCamera * frameSize(),
+             shard->cameras->frame(0),
+             shard->cameraCount * frameSize());
+    }
+  }
+
+  void ShardedCameraArray::rebalance(void)
+  {
+    // Cameras per device proportional to measured throughput
+    std::vector<double> rates(_shards.size());
+    double total = 0.0;
+    for (uint32_t i = 0; i < _shards.size(); i++)
+    {
+      if (_shards[i].frameMs <= 0.0)
+      {
+        return; // not measured yet
+      }
+      rates[i] = _shards[i].cameraCount / _shards[i].frameMs;
+      total += rates[i];
+    }
+
+    uint32_t cameraCount = cams.size();
+    std::vector<uint32_t> counts(_shards.size());
+    uint32_t assigned = 0;
+    for (uint32_t i = 0; i < _shards.size(); i++)
+    {
+      counts[i] = std::max<uint32_t>(
+          1,
+          (uint32_t) (cameraCount * rates[i] / total));
+      assigned += counts[i];
+    }
+    // Settle rounding on the fastest device, never below one camera each
+    uint32_t fastest = std::max_element(rates.begin(), rates.end())
+      - rates.begin();
+    while (assigned > cameraCount)
+    {
+      uint32_t largest = std::max_element(counts.begin(), counts.end())
+        - counts.begin();
+      counts[largest]--;
+      assigned--;
+    }
+    counts[fastest] += cameraCount - assigned;
+
+    bool changed = false;
+    for (uint32_t i = 0; i < _shards.size(); i++)
+    {
+      double delta = std::abs((double) counts[i] - _shards[i].cameraCount);
+      if (delta > kRebalanceThreshold * _shards[i].cameraCount)
+      {
+        changed = true;
+      }
+    }
+    if (!changed)
+    {
+      return;
+    }
+
+    uint32_t first = 0;
+    for (uint32_t i = 0; i < _shards.size(); i++)
+    {
+      CameraShard *shard = &_shards[i];
+      shard->firstCamera = first;
+      first += counts[i];
+      if (counts[i] != shard->cameraCount)
+      {
+        shard->c->device.waitIdle();
+        shard->cameraCount = counts[i];
+        // Per camera time stays roughly constant
+        shard->frameMs = 0.0;
+        buildCameras(shard);
+      }
+    }
+  }
+
+  const uint8_t *ShardedCameraArray::frame(uint32_t camera)
+  {
+    return _frames.data() + camera * frameSize();
+  }
+
+  vk::DeviceSize ShardedCameraArray::frameSize(void)
+  {
+    return _shards[0].cameras->frameSize();
+  }
+
+  uint32_t ShardedCameraArray::shardCount(void)
+  {
+    return _shards.size();
+  }
+
+  const CameraShard &ShardedCameraArray::shard(uint32_t i)
+  {
+    return _shards[i];
+  }
+
+  void ShardedCameraArray::destroyShard(CameraShard *shard)
+  {
+    Context *c = shard->c.get();
+    c->device.waitIdle();
+
+    shard->cameras.reset();
+    shard->instances.reset();
+    shard->indices.reset();
+    shard->vertices.reset();
+
+    c->device.destroyQueryPool(shard->timestamps);
+    c->device.destroyFence(shard->fence);
+    c->device.destroyCommandPool(shard->pool);
+    c->destroy();
+    shard->c.reset();
+  }
+
+  ShardedCameraArray::~ShardedCameraArray(void)
+  {
+    for (CameraShard &shard : _shards)
+    {
+      destroyShard(&shard);
+    }
+  }
+}
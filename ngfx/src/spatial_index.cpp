@@ -0,0 +1,544 @@
+#include "spatial_index.hpp"
+#include <algorithm>
+#include <cmath>
+#include "trace.hpp"
+
+namespace ngfx
+{
+  SpatialIndex::SpatialIndex(void)
+    : _requested(0), _published(0), _stop(false)
+  {
+    _worker = std::thread(&SpatialIndex::run, this);
+  }
+
+  SpatialIndex::~SpatialIndex(void)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _pendingCv.notify_one();
+    _worker.join();
+  }
+
+  int32_t SpatialGrid::cellCoord(float v, float cellSize)
+  {
+    float c = std::floor(v / cellSize);
+    return (int32_t) std::min(std::max(c, -2147483648.0f), 2147483520.0f);
+  }
+
+  uint64_t SpatialGrid::cellKey(int32_t x, int32_t y)
+  {
+    return ((uint64_t) (uint32_t) x << 32) | (uint32_t) y;
+  }
+
+  const std::vector<SpatialGrid::Entry> *SpatialGrid::cell(int32_t x,
+                                                           int32_t y) const
+  {
+    auto it = cells.find(cellKey(x, y));
+    return (it == cells.end()) ? nullptr : &it->second;
+  }
+
+  double SpatialGrid::meanOccupancy(void) const
+  {
+    return positions.empty() ? 0.0 : (double) occupancy / positions.size();
+  }
+
+  void SpatialGrid::add(uint32_t id, glm::vec2 p)
+  {
+    uint64_t key = cellKey(cellCoord(p.x, cellSize), cellCoord(p.y, cellSize));
+    std::vector<Entry> &entries = cells[key];
+    cellOf[id] = key;
+    slotOf[id] = (uint32_t) entries.size();
+    entries.push_back(Entry{p.x, p.y, id});
+    // n^2 - (n - 1)^2
+    occupancy += 2 * entries.size() - 1;
+  }
+
+  void SpatialGrid::remove(uint32_t id)
+  {
+    auto it = cells.find(cellOf[id]);
+    std::vector<Entry> &entries = it->second;
+    occupancy -= 2 * entries.size() - 1;
+    uint32_t slot = slotOf[id];
+    entries[slot] = entries.back();
+    slotOf[entries[slot].id] = slot;
+    entries.pop_back();
+    if (entries.empty())
+    {
+      cells.erase(it);
+    }
+  }
+
+  void SpatialGrid::move(uint32_t id, glm::vec2 p)
+  {
+    positions[id] = p;
+    uint64_t key = cellKey(cellCoord(p.x, cellSize), cellCoord(p.y, cellSize));
+    if (key == cellOf[id])
+    {
+      Entry &entry = cells.find(key)->second[slotOf[id]];
+      entry.x = p.x;
+      entry.y = p.y;
+      return;
+    }
+    remove(id);
+    add(id, p);
+  }
+
+  void SpatialGrid::rebuild(const glm::vec2 *p, uint32_t count)
+  {
+    NGFX_TRACE_SCOPE("SpatialGrid::rebuild");
+    positions.assign(p, p + count);
+    cellOf.resize(count);
+    slotOf.resize(count);
+
+    glm::vec2 lo(0.0f);
+    glm::vec2 hi(0.0f);
+    if (count > 0)
+    {
+      lo = hi = positions[0];
+    }
+    for (uint32_t i = 1; i < count; i++)
+    {
+      lo = glm::min(lo, positions[i]);
+      hi = glm::max(hi, positions[i]);
+    }
+    float side = std::max(hi.x - lo.x, hi.y - lo.y);
+    if (!(side > 0.0f))
+    {
+      side = 1.0f;
+    }
+
+    // Start from an even spread over the bounds. Clusters crowd their
+    // cells, so shrink the cells by the measured crowding, bodies per
+    // cell falling with the cell area, until occupancy is near target
+    const uint32_t kMaxRefinements = 4;
+    float target = (float) SpatialIndex::kBodiesPerCell;
+    cellSize = side / std::max(std::ceil(std::sqrt(count / target)), 1.0f);
+    for (uint32_t r = 0; ; r++)
+    {
+      cells.clear();
+      occupancy = 0;
+      for (uint32_t i = 0; i < count; i++)
+      {
+        add(i, positions[i]);
+      }
+
+      double mean = meanOccupancy();
+      if (r == kMaxRefinements || mean <= 2.0 * target)
+      {
+        break;
+      }
+      // Never below 1 / 16 per step, coincident bodies never spread out
+      cellSize *= (float) std::max(std::sqrt(target / mean), 0.0625);
+    }
+    rebuiltOccupancy = meanOccupancy();
+  }
+
+  void SpatialIndex::Batch::clear(void)
+  {
+    full = false;
+    positions.clear();
+    moves.clear();
+  }
+
+  void SpatialIndex::update(const glm::vec2 *positions, uint32_t count)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _pending.full = true;
+      _pending.positions.assign(positions, positions + count);
+      _pending.moves.clear();
+      _requested++;
+    }
+    _pendingCv.notify_one();
+  }
+
+  void SpatialIndex::move(uint32_t id, glm::vec2 p)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _pending.moves.push_back(std::make_pair(id, p));
+      _requested++;
+    }
+    _pendingCv.notify_one();
+  }
+
+  void SpatialIndex::wait(void)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _publishedCv.wait(lock, [&] { return _published == _requested; });
+  }
+
+  uint64_t SpatialIndex::version(void)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _published;
+  }
+
+  std::shared_ptr<const SpatialGrid> SpatialIndex::grid(void)
+  {
+    std::lock_guard<std::mutex> lock(_gridMutex);
+    return _grid;
+  }
+
+  void SpatialIndex::apply(const Batch &batch, SpatialGrid *grid)
+  {
+    NGFX_TRACE_SCOPE("SpatialIndex::apply");
+    if (batch.full)
+    {
+      uint32_t count = (uint32_t) batch.positions.size();
+      if (count != grid->positions.size())
+      {
+        grid->rebuild(batch.positions.data(), count);
+      }
+      else
+      {
+        for (uint32_t i = 0; i < count; i++)
+        {
+          if (batch.positions[i] != grid->positions[i])
+          {
+            grid->move(i, batch.positions[i]);
+          }
+        }
+      }
+    }
+    for (const auto &m : batch.moves)
+    {
+      if (m.first < grid->positions.size())
+      {
+        grid->move(m.first, m.second);
+      }
+    }
+
+    // Bodies drifted apart or together since the cell size was chosen
+    double mean = grid->meanOccupancy();
+    if (!grid->positions.empty()
+        && (mean < 0.5 * grid->rebuiltOccupancy
+            || mean > 2.0 * grid->rebuiltOccupancy))
+    {
+      std::vector<glm::vec2> positions = grid->positions;
+      grid->rebuild(positions.data(), (uint32_t) positions.size());
+    }
+  }
+
+  void SpatialIndex::run(void)
+  {
+    Batch batch;
+    // Changes that took the spare grid's successor to the published grid
+    Batch last;
+    // Previous grid, brought up to date once no query holds it
+    std::shared_ptr<const SpatialGrid> spare;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+      _pendingCv.wait(lock, [&] { return _stop || _published != _requested; });
+      if (_stop)
+      {
+        return;
+      }
+      std::swap(batch, _pending);
+      _pending.clear();
+      uint64_t version = _requested;
+      lock.unlock();
+
+      std::shared_ptr<SpatialGrid> next;
+      std::shared_ptr<const SpatialGrid> published = grid();
+      if (spare && spare.use_count() == 1)
+      {
+        // One publish behind, a full update overwrites what it missed
+        next = std::const_pointer_cast<SpatialGrid>(spare);
+        if (!batch.full)
+        {
+          apply(last, next.get());
+        }
+      }
+      else if (published)
+      {
+        next = std::make_shared<SpatialGrid>(*published);
+      }
+      else
+      {
+        next = std::make_shared<SpatialGrid>();
+        next->cellSize = 1.0f;
+        next->occupancy = 0;
+        next->rebuiltOccupancy = 0.0;
+      }
+      spare.reset();
+      published.reset();
+      apply(batch, next.get());
+      {
+        // Queries can no longer reach the old grid once swapped out
+        std::lock_guard<std::mutex> gridLock(_gridMutex);
+        spare = _grid;
+        _grid = next;
+      }
+      std::swap(last, batch);
+
+      lock.lock();
+      _published = version;
+      _publishedCv.notify_all();
+    }
+  }
+
+  // Cells spanned by [lo, hi] on a grid, empty when there are more of
+  // them than occupied cells and walking the map is cheaper
+  static bool cellRange(const SpatialGrid &g,
+                        glm::vec2 lo,
+                        glm::vec2 hi,
+                        int32_t *x0,
+                        int32_t *x1,
+                        int32_t *y0,
+                        int32_t *y1)
+  {
+    *x0 = SpatialGrid::cellCoord(lo.x, g.cellSize);
+    *x1 = SpatialGrid::cellCoord(hi.x, g.cellSize);
+    *y0 = SpatialGrid::cellCoord(lo.y, g.cellSize);
+    *y1 = SpatialGrid::cellCoord(hi.y, g.cellSize);
+    double spanned = ((double) *x1 - *x0 + 1) * ((double) *y1 - *y0 + 1);
+    return spanned <= (double) g.cells.size();
+  }
+
+  bool SpatialIndex::pick(glm::vec2 p, float radius, uint32_t *id)
+  {
+    std::shared_ptr<const SpatialGrid> g = grid();
+    if (!g)
+    {
+      return false;
+    }
+
+    float best = radius * radius;
+    bool found = false;
+    auto visit = [&](const std::vector<SpatialGrid::Entry> &entries) {
+      for (const SpatialGrid::Entry &e : entries)
+      {
+        float dx = e.x - p.x;
+        float dy = e.y - p.y;
+        float d = dx * dx + dy * dy;
+        if (d <= best)
+        {
+          best = d;
+          *id = e.id;
+          found = true;
+        }
+      }
+    };
+
+    int32_t x0, x1, y0, y1;
+    if (!cellRange(*g, p - radius, p + radius, &x0, &x1, &y0, &y1))
+    {
+      for (const auto &c : g->cells)
+      {
+        visit(c.second);
+      }
+      return found;
+    }
+    for (int32_t y = y0; y <= y1; y++)
+    {
+      for (int32_t x = x0; x <= x1; x++)
+      {
+        if (const std::vector<SpatialGrid::Entry> *entries = g->cell(x, y))
+        {
+          visit(*entries);
+        }
+      }
+    }
+    return found;
+  }
+
+  void SpatialIndex::rect(glm::vec2 lo,
+                          glm::vec2 hi,
+                          std::vector<uint32_t> *out)
+  {
+    std::shared_ptr<const SpatialGrid> g = grid();
+    if (!g)
+    {
+      return;
+    }
+
+    auto visit = [&](const std::vector<SpatialGrid::Entry> &entries,
+                     bool inside) {
+      for (const SpatialGrid::Entry &e : entries)
+      {
+        // Interior cells need no per body test
+        if (inside
+            || (e.x >= lo.x && e.x <= hi.x && e.y >= lo.y && e.y <= hi.y))
+        {
+          out->push_back(e.id);
+        }
+      }
+    };
+
+    int32_t x0, x1, y0, y1;
+    if (!cellRange(*g, lo, hi, &x0, &x1, &y0, &y1))
+    {
+      for (const auto &c : g->cells)
+      {
+        visit(c.second, false);
+      }
+      return;
+    }
+    for (int32_t y = y0; y <= y1; y++)
+    {
+      float cellY = y * g->cellSize;
+      bool insideY = cellY >= lo.y && cellY + g->cellSize <= hi.y;
+      for (int32_t x = x0; x <= x1; x++)
+      {
+        float cellX = x * g->cellSize;
+        bool inside = insideY
+          && cellX >= lo.x && cellX + g->cellSize <= hi.x;
+        if (const std::vector<SpatialGrid::Entry> *entries = g->cell(x, y))
+        {
+          visit(*entries, inside);
+        }
+      }
+    }
+  }
+
+  void SpatialIndex::nearest(glm::vec2 p,
+                             uint32_t k,
+                             std::vector<uint32_t> *out)
+  {
+    out->clear();
+    std::shared_ptr<const SpatialGrid> g = grid();
+    if (!g || g->positions.empty() || k == 0)
+    {
+      return;
+    }
+
+    // Max heap of the k closest so far, by squared distance
+    std::vector<std::pair<float, uint32_t>> best;
+    size_t seen = 0;
+    auto visit = [&](const std::vector<SpatialGrid::Entry> &entries) {
+      seen += entries.size();
+      for (const SpatialGrid::Entry &e : entries)
+      {
+        float dx = e.x - p.x;
+        float dy = e.y - p.y;
+        float d = dx * dx + dy * dy;
+        if (best.size() < k)
+        {
+          best.push_back(std::make_pair(d, e.id));
+          std::push_heap(best.begin(), best.end());
+        }
+        else if (d < best.front().first)
+        {
+          std::pop_heap(best.begin(), best.end());
+          best.back() = std::make_pair(d, e.id);
+          std::push_heap(best.begin(), best.end());
+        }
+      }
+    };
+
+    // Visit rings of cells around p until nothing outside can be closer.
+    // Sparse grids fall back to every occupied cell once the rings would
+    // look up more cells than there are
+    int64_t cx = SpatialGrid::cellCoord(p.x, g->cellSize);
+    int64_t cy = SpatialGrid::cellCoord(p.y, g->cellSize);
+    size_t cellCount = g->cells.size();
+    for (int64_t r = 0; ; r++)
+    {
+      if ((uint64_t) (2 * r + 1) * (2 * r + 1) > cellCount)
+      {
+        best.clear();
+        for (const auto &c : g->cells)
+        {
+          visit(c.second);
+        }
+        break;
+      }
+
+      for (int64_t y = cy - r; y <= cy + r; y++)
+      {
+        bool edge = (y == cy - r || y == cy + r);
+        int64_t step = (edge || r == 0) ? 1 : 2 * r;
+        for (int64_t x = cx - r; x <= cx + r; x += step)
+        {
+          if (const std::vector<SpatialGrid::Entry> *entries =
+                  g->cell((int32_t) x, (int32_t) y))
+          {
+            visit(*entries);
+          }
+        }
+      }
+
+      if (seen == g->positions.size())
+      {
+        break;
+      }
+      if (best.size() == k)
+      {
+        glm::vec2 lo = glm::vec2(cx - r, cy - r) * g->cellSize;
+        glm::vec2 hi = glm::vec2(cx + r + 1, cy + r + 1) * g->cellSize;
+        float bound = std::min(std::min(p.x - lo.x, hi.x - p.x),
+                               std::min(p.y - lo.y, hi.y - p.y));
+        if (bound > 0.0f && bound * bound >= best.front().first)
+        {
+          break;
+        }
+      }
+    }
+
+    std::sort_heap(best.begin(), best.end());
+    out->reserve(best.size());
+    for (const auto &entry : best)
+    {
+      out->push_back(entry.second);
+    }
+  }
+
+  glm::vec2 SpatialIndex::screenToWorld(const Camera &camera,
+                                        vk::Extent2D extent,
+                                        glm::vec2 pixel)
+  {
+    glm::vec2 ndc(2.0f * pixel.x / extent.width - 1.0f,
+                  2.0f * pixel.y / extent.height - 1.0f);
+    glm::mat4 inv = glm::inverse(camera.cam);
+    glm::vec4 a = inv * glm::vec4(ndc, 0.0f, 1.0f);
+    glm::vec4 b = inv * glm::vec4(ndc, 1.0f, 1.0f);
+    a /= a.w;
+    b /= b.w;
+    if (a.z == b.z)
+    {
+      return glm::vec2(a);
+    }
+    float t = a.z / (a.z - b.z);
+    return glm::vec2(a + (b - a) * t);
+  }
+
+  bool SpatialIndex::pickScreen(const Camera &camera,
+                                vk::Extent2D extent,
+                                glm::vec2 pixel,
+                                float pixelRadius,
+                                uint32_t *id)
+  {
+    glm::vec2 p = screenToWorld(camera, extent, pixel);
+    glm::vec2 edge = screenToWorld(camera,
+                                   extent,
+                                   pixel + glm::vec2(pixelRadius, 0.0f));
+    return pick(p, glm::length(edge - p), id);
+  }
+
+  void SpatialIndex::rectScreen(const Camera &camera,
+                                vk::Extent2D extent,
+                                glm::vec2 a,
+                                glm::vec2 b,
+                                std::vector<uint32_t> *out)
+  {
+    glm::vec2 corners[] = {
+      screenToWorld(camera, extent, a),
+      screenToWorld(camera, extent, b),
+      screenToWorld(camera, extent, glm::vec2(a.x, b.y)),
+      screenToWorld(camera, extent, glm::vec2(b.x, a.y))
+    };
+    glm::vec2 lo = corners[0];
+    glm::vec2 hi = corners[0];
+    for (const glm::vec2 &corner : corners)
+    {
+      lo = glm::min(lo, corner);
+      hi = glm::max(hi, corner);
+    }
+    rect(lo, hi, out);
+  }
+}
@@ -0,0 +1,350 @@
+#include "trace.hpp"
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include "vulkan/vulkan.hpp"
+#include "context.hpp"
+#include "util.hpp"
+
+namespace ngfx
+{
+  namespace trace
+  {
+    struct Event
+    {
+      const char *name;
+      uint64_t begin;
+      uint64_t end;
+      uint32_t track;
+    };
+
+    // Single producer (the owning thread), single consumer (write())
+    struct ThreadRing
+    {
+      uint32_t tid;
+      std::atomic<uint64_t> head;
+      std::atomic<uint64_t> tail;
+      std::atomic<uint64_t> dropped;
+      Event events[kEventsPerThread];
+    };
+
+    // Rings are never freed, threads may exit before the trace is written
+    static std::mutex registryLock;
+    static std::vector<ThreadRing *> registry;
+    static thread_local ThreadRing *localRing = nullptr;
+
+    static ThreadRing *threadRing(void)
+    {
+      if (!localRing)
+      {
+        std::lock_guard<std::mutex> lock(registryLock);
+        localRing = new ThreadRing();
+        localRing->tid = registry.size() + 1;
+        localRing->head = 0;
+        localRing->tail = 0;
+        localRing->dropped = 0;
+        registry.push_back(localRing);
+      }
+      return localRing;
+    }
+
+    uint64_t now(void)
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void record(const char *name, uint64_t begin, uint64_t end, uint32_t track)
+    {
+      ThreadRing *ring = threadRing();
+      uint64_t head = ring->head.load(std::memory_order_relaxed);
+      if (head - ring->tail.load(std::memory_order_acquire) >= kEventsPerThread)
+      {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      ring->events[head % kEventsPerThread] = Event{name, begin, end, track};
+      ring->head.store(head + 1, std::memory_order_release);
+    }
+
+    bool write(const std::string &path)
+    {
+      std::ofstream file(path);
+      if (!file.is_open())
+      {
+        return false;
+      }
+
+      std::lock_guard<std::mutex> lock(registryLock);
+      std::set<uint32_t> gpuTracks;
+      bool first = true;
+
+      file << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+      for (ThreadRing *ring : registry)
+      {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        for (uint64_t i = tail; i < head; i++)
+        {
+          const Event &e = ring->events[i % kEventsPerThread];
+          // GPU tracks sit after every CPU thread id
+          uint32_t tid = e.track ? 1000 + e.track : ring->tid;
+          if (e.track)
+          {
+            gpuTracks.insert(e.track);
+          }
+          file << (first ? "" : ",\n")
+               << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1"
+               << ",\"tid\":" << tid
+               << ",\"ts\":" << e.begin / 1000.0
+               << ",\"dur\":" << (e.end - e.begin) / 1000.0 << "}";
+          first = false;
+        }
+        ring->tail.store(head, std::memory_order_release);
+
+        uint64_t dropped = ring->dropped.exchange(0);
+        if (dropped)
+        {
+          util::log(util::LogLevel::eWarning,
+                    "trace: thread " + std::to_string(ring->tid)
+                    + " dropped " + std::to_string(dropped) + " events");
+        }
+      }
+
+      for (uint32_t track : gpuTracks)
+      {
+        file << (first ? "" : ",\n")
+             << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+             << 1000 + track << ",\"args\":{\"name\":\"GPU queue "
+             << track - 1 << "\"}}";
+        first = false;
+      }
+      file << "\n]}\n";
+      return true;
+    }
+
+#ifdef NGFX_TRACE
+    GpuTrace::GpuTrace(Context *c, uint32_t capacity)
+      : _c(c), _enabled(false), _capacity(capacity),
+        _spanCount(0), _offset(0), _getCalibratedTimestamps(nullptr)
+    {
+      uint32_t familyCount = 0;
+      c->physicalDevice.getQueueFamilyProperties(
+          &familyCount,
+          (vk::QueueFamilyProperties *) nullptr);
+      std::vector<vk::QueueFamilyProperties> families(familyCount);
+      c->physicalDevice.getQueueFamilyProperties(&familyCount,
+                                                 families.data());
+      uint32_t validBits =
+          families[c->qFamilies.graphicsFamily.value()].timestampValidBits;
+      if (validBits == 0)
+      {
+        return;
+      }
+      _mask = (validBits >= 64) ? ~0ull : (1ull << validBits) - 1;
+      _period = c->physicalDevice.getProperties().limits.timestampPeriod;
+
+      vk::QueryPoolCreateInfo queryCI(
+          vk::QueryPoolCreateFlags(),
+          vk::QueryType::eTimestamp,
+          capacity * 2,
+          vk::QueryPipelineStatisticFlags());
+      c->device.createQueryPool(&queryCI, nullptr, &_queries);
+      _names.resize(capacity);
+      _enabled = true;
+
+      // Both clocks have to be calibrateable against each other
+      if (c->calibratedTimestamps)
+      {
+        auto getTimeDomains =
+            (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)
+            c->instance.getProcAddr(
+                "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+        uint32_t domainCount = 0;
+        getTimeDomains(c->physicalDevice, &domainCount, nullptr);
+        std::vector<VkTimeDomainEXT> domains(domainCount);
+        getTimeDomains(c->physicalDevice, &domainCount, domains.data());
+
+        bool device = std::count(domains.begin(),
+                                 domains.end(),
+                                 VK_TIME_DOMAIN_DEVICE_EXT) > 0;
+        bool monotonic = std::count(domains.begin(),
+                                    domains.end(),
+                                    VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT) > 0;
+        if (device && monotonic)
+        {
+          _getCalibratedTimestamps = (PFN_vkGetCalibratedTimestampsEXT)
+              c->device.getProcAddr("vkGetCalibratedTimestampsEXT");
+        }
+      }
+      calibrate();
+    }
+
+    void GpuTrace::calibrate(void)
+    {
+      if (!_enabled)
+      {
+        return;
+      }
+
+      if (_getCalibratedTimestamps)
+      {
+        VkCalibratedTimestampInfoEXT infos[] = {
+          {VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT,
+           nullptr,
+           VK_TIME_DOMAIN_DEVICE_EXT},
+          {VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT,
+           nullptr,
+           VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT},
+        };
+        uint64_t timestamps[2];
+        uint64_t deviation;
+        if (_getCalibratedTimestamps(_c->device,
+                                     util::array_size(infos),
+                                     infos,
+                                     timestamps,
+                                     &deviation) == VK_SUCCESS)
+        {
+          _offset = (int64_t) timestamps[1]
+            - (int64_t) ((timestamps[0] & _mask) * _period);
+          return;
+        }
+      }
+
+      // Estimate: one timestamp bracketed by CPU times around a blocking
+      // submit. Error is bounded by half the round trip
+      vk::CommandBuffer cmd;
+      vk::CommandBufferAllocateInfo allocInfo(
+          _c->cmdPool,
+          vk::CommandBufferLevel::ePrimary,
+          1);
+      _c->device.allocateCommandBuffers(&allocInfo, &cmd);
+
+      vk::CommandBufferBeginInfo beginInfo(
+          vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+          nullptr);
+      cmd.begin(beginInfo);
+      cmd.resetQueryPool(_queries, 0, 1);
+      cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, _queries, 0);
+      cmd.end();
+
+      vk::SubmitInfo submitInfo(0, nullptr, nullptr, 1, &cmd, 0, nullptr);
+      uint64_t before = now();
+      _c->graphicsQueue.submit(1, &submitInfo, vk::Fence());
+      _c->graphicsQueue.waitIdle();
+      uint64_t after = now();
+
+      uint64_t ticks;
+      _c->device.getQueryPoolResults(
+          _queries,
+          0,
+          1,
+          sizeof(ticks),
+          &ticks,
+          sizeof(ticks),
+          vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+      _c->device.freeCommandBuffers(_c->cmdPool, 1, &cmd);
+
+      _offset = (int64_t) ((before + after) / 2)
+        - (int64_t) ((ticks & _mask) * _period);
+    }
+
+    void GpuTrace::reset(vk::CommandBuffer cmd, uint32_t first, uint32_t count)
+    {
+      if (!_enabled || first >= _capacity)
+      {
+        return;
+      }
+      count = std::min(count, _capacity - first);
+      cmd.resetQueryPool(_queries, first * 2, count * 2);
+    }
+
+    uint32_t GpuTrace::begin(vk::CommandBuffer cmd, const char *name)
+    {
+      return begin(cmd, name, reserve(1));
+    }
+
+    uint32_t GpuTrace::reserve(uint32_t count)
+    {
+      if (!_enabled || _spanCount + count > _capacity)
+      {
+        return _capacity;
+      }
+      uint32_t first = _spanCount;
+      _spanCount += count;
+      return first;
+    }
+
+    uint32_t GpuTrace::begin(vk::CommandBuffer cmd,
+                             const char *name,
+                             uint32_t span)
+    {
+      if (!_enabled || span >= _spanCount)
+      {
+        return _capacity;
+      }
+      _names[span] = name;
+      cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe,
+                         _queries,
+                         span * 2);
+      return span;
+    }
+
+    void GpuTrace::end(vk::CommandBuffer cmd, uint32_t span)
+    {
+      if (span >= _spanCount)
+      {
+        return;
+      }
+      cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe,
+                         _queries,
+                         span * 2 + 1);
+    }
+
+    void GpuTrace::collect(uint32_t first, uint32_t count)
+    {
+      if (!_enabled || first >= _spanCount)
+      {
+        return;
+      }
+      count = std::min(count, _spanCount - first);
+
+      std::vector<uint64_t> ticks(count * 2);
+      vk::Result result = _c->device.getQueryPoolResults(
+          _queries,
+          first * 2,
+          count * 2,
+          ticks.size() * sizeof(uint64_t),
+          ticks.data(),
+          sizeof(uint64_t),
+          vk::QueryResultFlagBits::e64);
+      if (result != vk::Result::eSuccess)
+      {
+        return;
+      }
+
+      // Cheap with the extension, keeps clock drift out of long runs
+      if (_getCalibratedTimestamps)
+      {
+        calibrate();
+      }
+
+      for (uint32_t i = 0; i < count; i++)
+      {
+        uint64_t begin = _offset + (int64_t) ((ticks[i * 2] & _mask) * _period);
+        uint64_t end = _offset + (int64_t) ((ticks[i * 2 + 1] & _mask) * _period);
+        record(_names[first + i], begin, end, 1);
+      }
+    }
+
+    GpuTrace::~GpuTrace(void)
+    {
+      if (_enabled)
+      {
+        _c->device.destroyQueryPool(_queries);
+      }
+    }
+#endif
+  }
+}
@@ -0,0 +1,316 @@
+#include "trails.hpp"
+#include <algorithm>
+#include "vulkan/vulkan.hpp"
+#include "context.hpp"
+#include "util.hpp"
+#include "pipeline.hpp"
+#include "descriptors.hpp"
+#include "trace.hpp"
+
+namespace ngfx
+{
+  static const uint32_t kAppendGroupSize = 256;
+
+  Trails::Trails(Context *c,
+                 CameraArray *cameras,
+                 uint32_t capacity,
+                 uint32_t maxLength)
+    : cameras(cameras), capacity(capacity),
+      maxLength(std::max(maxLength, 2u)),
+      device(&c->device)
+  {
+    if (!cameras->variant.pulled)
+    {
+      throw std::runtime_error("trails require a pulled variant");
+    }
+    length = this->maxLength;
+    reset();
+
+    // One packed half2 per body and slot
+    util::createDeviceBuffer(device,
+                             &c->physicalDevice,
+                             (vk::DeviceSize) capacity * this->maxLength
+                             * sizeof(uint32_t),
+                             vk::BufferUsageFlagBits::eStorageBuffer,
+                             util::MemoryTag::eInstances,
+                             &ringBuffer,
+                             &ringMemory);
+
+    buildRenderPass();
+    buildDescriptors(c);
+    buildPipelines(c);
+  }
+
+  void Trails::setLength(uint32_t n)
+  {
+    length = std::min(n, maxLength);
+  }
+
+  void Trails::reset(void)
+  {
+    // The first append lands in slot 0
+    head = maxLength - 1;
+    filled = 0;
+  }
+
+  void Trails::buildRenderPass(void)
+  {
+    // Compatible with CameraArray::pass, so its framebuffers are reused
+    vk::AttachmentDescription attachments[] = {
+      vk::AttachmentDescription(
+          vk::AttachmentDescriptionFlags(),
+          vk::Format::eR8G8B8A8Srgb,
+          vk::SampleCountFlagBits::e1,
+          vk::AttachmentLoadOp::eLoad,
+          vk::AttachmentStoreOp::eStore,
+          vk::AttachmentLoadOp::eDontCare,
+          vk::AttachmentStoreOp::eDontCare,
+          vk::ImageLayout::eShaderReadOnlyOptimal,
+          vk::ImageLayout::eShaderReadOnlyOptimal),
+      util::pickAttachment(vk::AttachmentLoadOp::eLoad)
+    };
+    uint32_t attachmentCount = cameras->variant.pickIds ? 2 : 1;
+
+    vk::AttachmentReference colorAttachmentRefs[] = {
+      vk::AttachmentReference(0, vk::ImageLayout::eColorAttachmentOptimal),
+      vk::AttachmentReference(1, vk::ImageLayout::eColorAttachmentOptimal)
+    };
+
+    vk::SubpassDescription subpass(
+        vk::SubpassDescriptionFlags(),
+        vk::PipelineBindPoint::eGraphics,
+        0,
+        nullptr,
+        attachmentCount,
+        colorAttachmentRefs,
+        nullptr,
+        nullptr,
+        0,
+        nullptr);
+
+    vk::SubpassDependency subpassDependency(
+        VK_SUBPASS_EXTERNAL,
+        0,
+        vk::PipelineStageFlagBits::eColorAttachmentOutput,
+        vk::PipelineStageFlagBits::eColorAttachmentOutput,
+        vk::AccessFlagBits::eColorAttachmentWrite,
+        vk::AccessFlagBits::eColorAttachmentRead
+        | vk::AccessFlagBits::eColorAttachmentWrite,
+        vk::DependencyFlags());
+
+    vk::RenderPassCreateInfo renderPassCI(
+        vk::RenderPassCreateFlags(),
+        attachmentCount,
+        attachments,
+        1,
+        &subpass,
+        1,
+        &subpassDependency);
+
+    device->createRenderPass(&renderPassCI, nullptr, &pass);
+  }
+
+  void Trails::buildDescriptors(Context *c)
+  {
+    vk::DescriptorSetLayoutBinding binding(
+        0,
+        vk::DescriptorType::eStorageBuffer,
+        1,
+        vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eCompute,
+        nullptr);
+    vk::DescriptorSetLayoutCreateInfo layoutCI(
+        vk::DescriptorSetLayoutCreateFlags(),
+        1,
+        &binding);
+    device->createDescriptorSetLayout(&layoutCI, nullptr, &ringLayout);
+    util::buildInstanceStorageLayout(device, &storageLayout);
+
+    vk::DescriptorSetLayout appendLayouts[] = {ringLayout, storageLayout};
+    util::buildLayout(
+        device,
+        util::array_size(appendLayouts),
+        appendLayouts,
+        sizeof(TrailPushConstants),
+        &appendLayout,
+        vk::ShaderStageFlagBits::eCompute);
+
+    // Set 0 is the camera set of the array, bound as it binds it
+    vk::DescriptorSetLayout drawLayouts[] = {
+      cameras->bindless ? cameras->bindless->descLayout : cameras->descLayout,
+      ringLayout
+    };
+    util::buildLayout(
+        device,
+        util::array_size(drawLayouts),
+        drawLayouts,
+        sizeof(TrailPushConstants),
+        &drawLayout);
+
+    ringSet = c->descriptors.allocate(ringLayout);
+    vk::DescriptorBufferInfo ringInfo(ringBuffer, 0, VK_WHOLE_SIZE);
+    vk::WriteDescriptorSet write(ringSet, 0, 0, 1,
+                                 vk::DescriptorType::eStorageBuffer,
+                                 nullptr, &ringInfo, nullptr);
+    device->updateDescriptorSets(1, &write, 0, nullptr);
+  }
+
+  void Trails::buildPipelines(Context *c)
+  {
+    util::buildComputePipeline(device,
+                               "shaders/trail_append_comp.spv",
+                               cameras->variant,
+                               &appendLayout,
+                               &c->pipelineCache,
+                               &appendPipeline);
+
+    // Each instance is its own strip, so no restart index is needed
+    util::ShaderVariant lineVariant = cameras->variant;
+    lineVariant.topology = vk::PrimitiveTopology::eLineStrip;
+    util::buildPipeline(
+        device,
+        vk::Extent2D(cameras->w, cameras->h),
+        nullptr,
+        0,
+        nullptr,
+        0,
+        cameras->bindless ? "shaders/trails_bindless_vert.spv"
+                          : "shaders/trails_vert.spv",
+        lineVariant.pickIds ? "shaders/env_id_frag.spv"
+                            : "shaders/env_frag.spv",
+        lineVariant,
+        &drawLayout,
+        &pass,
+        &c->pipelineCache,
+        &drawPipeline);
+  }
+
+  void Trails::recordAppend(vk::CommandBuffer cmd,
+                            InstanceStreams *instances,
+                            uint32_t instanceCount,
+                            glm::vec4 instanceXform)
+  {
+    NGFX_TRACE_SCOPE("Trails::recordAppend");
+    instanceCount = std::min(instanceCount, capacity);
+    head = (head + 1) % maxLength;
+    filled = std::min(filled + 1, maxLength);
+
+    // Earlier draws may still read the slot being replaced
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eVertexShader,
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::DependencyFlags(),
+        0, nullptr, 0, nullptr, 0, nullptr);
+
+    TrailPushConstants push = {
+      instanceXform, xform, color, 0, head, length, capacity, maxLength,
+      instanceCount
+    };
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, appendPipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                           appendLayout,
+                           0,
+                           1,
+                           &ringSet,
+                           0,
+                           nullptr);
+    instances->bindStorage(cmd,
+                           appendLayout,
+                           1,
+                           vk::PipelineBindPoint::eCompute);
+    cmd.pushConstants(appendLayout,
+                      vk::ShaderStageFlagBits::eCompute,
+                      0,
+                      sizeof(TrailPushConstants),
+                      (void *) &push);
+    if (instanceCount > 0)
+    {
+      cmd.dispatch(
+          (instanceCount + kAppendGroupSize - 1) / kAppendGroupSize, 1, 1);
+    }
+
+    vk::MemoryBarrier toDraw(vk::AccessFlagBits::eShaderWrite,
+                             vk::AccessFlagBits::eShaderRead);
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eVertexShader,
+        vk::DependencyFlags(),
+        1, &toDraw, 0, nullptr, 0, nullptr);
+  }
+
+  void Trails::record(vk::CommandBuffer cmd, uint32_t instanceCount)
+  {
+    NGFX_TRACE_SCOPE("Trails::record");
+    instanceCount = std::min(instanceCount, capacity);
+    uint32_t points = std::min(length, filled);
+    if (points < 2 || instanceCount == 0)
+    {
+      return;
+    }
+
+    if (cameras->bindless)
+    {
+      cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
+                             drawLayout,
+                             0,
+                             1,
+                             &cameras->bindless->descSet,
+                             0,
+                             nullptr);
+    }
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
+                           drawLayout,
+                           1,
+                           1,
+                           &ringSet,
+                           0,
+                           nullptr);
+
+    for (uint32_t i = 0; i < cameras->count; i++)
+    {
+      uint32_t camera = cameras->bindless ? cameras->firstCamera + i : 0;
+      TrailPushConstants push = {
+        glm::vec4(0.0, 0.0, 1.0, 1.0), xform, color, camera, head, points,
+        capacity, maxLength, instanceCount
+      };
+
+      vk::RenderPassBeginInfo passInfo(
+          pass, cameras->fbos[i].frame,
+          vk::Rect2D(vk::Offset2D(0, 0), cameras->renderExtent), 0,
+          nullptr);
+
+      cmd.beginRenderPass(passInfo, vk::SubpassContents::eInline);
+      cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, drawPipeline);
+      util::setViewport(cmd, cameras->renderExtent);
+      if (!cameras->bindless)
+      {
+        uint32_t offset = (uint32_t) (i * cameras->camStride);
+        cmd.bindDescriptorSets(
+            vk::PipelineBindPoint::eGraphics,
+            drawLayout,
+            0,
+            1,
+            &cameras->descSet,
+            1,
+            &offset);
+      }
+      cmd.pushConstants(
+          drawLayout, vk::ShaderStageFlagBits::eVertex, 0,
+          sizeof(TrailPushConstants), (void *)&push);
+      cmd.draw(points, instanceCount, 0, 0);
+      cmd.endRenderPass();
+    }
+  }
+
+  Trails::~Trails(void)
+  {
+    device->destroyPipeline(drawPipeline);
+    device->destroyPipeline(appendPipeline);
+    device->destroyPipelineLayout(drawLayout);
+    device->destroyPipelineLayout(appendLayout);
+    device->destroyDescriptorSetLayout(storageLayout);
+    device->destroyDescriptorSetLayout(ringLayout);
+    device->destroyRenderPass(pass);
+    device->destroyBuffer(ringBuffer);
+    util::freeMemory(device, ringMemory);
+  }
+}
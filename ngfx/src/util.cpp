@@ -2,17 +2,44 @@
 #include "util.hpp"
 #include "ngfx.hpp"
 #include "config.hpp"
+#include "trace.hpp"
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_core.h>
+#include <sstream>
+#include <iomanip>
+#include <iterator>
+#include <cstdlib>
+#include <atomic>
 
 namespace ngfx
 {
   namespace util
   {
+    static std::atomic<LogCallback> logCallback(nullptr);
+
+    void setLogCallback(LogCallback callback)
+    {
+      logCallback.store(callback);
+    }
+
+    void log(LogLevel level, const std::string &message)
+    {
+      LogCallback callback = logCallback.load();
+      if (callback)
+      {
+        callback(level, message.c_str());
+      }
+    }
+
     uint32_t findMemoryType(vk::PhysicalDevice &phys,
                             uint32_t typeFilter,
                             vk::MemoryPropertyFlags requiredProps);
 
+    bool tryFindMemoryType(vk::PhysicalDevice &phys,
+                           uint32_t typeFilter,
+                           vk::MemoryPropertyFlags requiredProps,
+                           uint32_t *index);
+
     bool QueueFamilyIndices::isValid()
     {
       return graphicsFamily.has_value() 
@@ -20,63 +47,108 @@ namespace ngfx
         && transferFamily.has_value();
     }
 
-    FastBuffer::FastBuffer(void) : valid(false) {}
+    FastBuffer::FastBuffer(void)
+      : valid(false), direct(false), _evictable(false) {}
 
     FastBuffer::FastBuffer(vk::Device *dev,
                            vk::PhysicalDevice *physDev,
                            vk::CommandPool *cmdPool,
                            vk::DeviceSize size,
-                           vk::BufferUsageFlags usage)
-      : valid(false), device(dev), phys(physDev), pool(cmdPool), size(size),
-      usage(usage)
+                           vk::BufferUsageFlags usage,
+                           MemoryTag tag)
+      : valid(false), direct(false), device(dev), phys(physDev), pool(cmdPool),
+      size(size), usage(usage), tag(tag), _evictable(false)
       {}
 
     void FastBuffer::init(void)
     {
-      vk::BufferCreateInfo stagingCI(vk::BufferCreateFlagBits(),
+      vk::BufferCreateInfo localCI(vk::BufferCreateFlagBits(),
                                     size,
-                                    vk::BufferUsageFlagBits::eTransferSrc,
+                                    vk::BufferUsageFlagBits::eTransferDst
+                                    | usage,
                                     // TODO: support concurrent
                                     vk::SharingMode::eExclusive,
                                     0,
                                     nullptr);
-      device->createBuffer(&stagingCI,
+      device->createBuffer(&localCI,
                            nullptr,
-                           &stagingBuffer);
+                           &localBuffer);
 
-      vk::BufferCreateInfo localCI(vk::BufferCreateFlagBits(),
+      vk::MemoryRequirements localReqs =
+          device->getBufferMemoryRequirements(localBuffer);
+
+      // UMA devices and ReBAR dGPUs expose host visible device local
+      // memory. Write straight into it and skip staging entirely
+      // Small BAR heaps (256MB) run out quickly, fall back to staging
+      // rather than take them over budget
+      MemoryTracker *tracker = MemoryTracker::find(*device);
+      uint32_t directIndex;
+      if (util::tryFindMemoryType(*phys,
+                                  localReqs.memoryTypeBits,
+                                  vk::MemoryPropertyFlagBits::eDeviceLocal
+                                  | vk::MemoryPropertyFlagBits::eHostVisible
+                                  | vk::MemoryPropertyFlagBits::eHostCoherent,
+                                  &directIndex)
+          && (!tracker || tracker->fits(directIndex, localReqs.size)))
+      {
+        vk::MemoryAllocateInfo directAllocInfo(localReqs.size, directIndex);
+        if (util::allocateMemory(device, directAllocInfo, tag, &localMemory)
+            == vk::Result::eSuccess)
+        {
+          device->bindBufferMemory(localBuffer, localMemory, 0);
+          device->mapMemory(localMemory,
+                            0,
+                            size,
+                            vk::MemoryMapFlags(),
+                            &_handle);
+          direct = true;
+          valid = true;
+          return;
+        }
+      }
+
+      vk::BufferCreateInfo stagingCI(vk::BufferCreateFlagBits(),
                                     size,
-                                    vk::BufferUsageFlagBits::eTransferDst
-                                    | usage,
+                                    vk::BufferUsageFlagBits::eTransferSrc,
                                     // TODO: support concurrent
                                     vk::SharingMode::eExclusive,
                                     0,
                                     nullptr);
-      device->createBuffer(&localCI,
+      device->createBuffer(&stagingCI,
                            nullptr,
-                           &localBuffer);
+                           &stagingBuffer);
 
       vk::MemoryRequirements stagingReqs =
           device->getBufferMemoryRequirements(stagingBuffer);
-      vk::MemoryRequirements localReqs =
-          device->getBufferMemoryRequirements(localBuffer);
 
-      uint32_t stagingIndex =
-          util::findMemoryType(*phys,
-                               stagingReqs.memoryTypeBits,
-                               vk::MemoryPropertyFlagBits::eHostVisible
-                               | vk::MemoryPropertyFlagBits::eHostCoherent
-                               | vk::MemoryPropertyFlagBits::eHostCached);
+      // Cached staging is preferred but not exposed everywhere
+      uint32_t stagingIndex;
+      if (!util::tryFindMemoryType(*phys,
+                                   stagingReqs.memoryTypeBits,
+                                   vk::MemoryPropertyFlagBits::eHostVisible
+                                   | vk::MemoryPropertyFlagBits::eHostCoherent
+                                   | vk::MemoryPropertyFlagBits::eHostCached,
+                                   &stagingIndex))
+      {
+        stagingIndex =
+            util::findMemoryType(*phys,
+                                 stagingReqs.memoryTypeBits,
+                                 vk::MemoryPropertyFlagBits::eHostVisible
+                                 | vk::MemoryPropertyFlagBits::eHostCoherent);
+      }
       uint32_t localIndex =
           util::findMemoryType(*phys,
                                localReqs.memoryTypeBits,
                                vk::MemoryPropertyFlagBits::eDeviceLocal);
 
+      _stagingHeap = phys->getMemoryProperties()
+        .memoryTypes[stagingIndex].heapIndex;
+      _stagingBytes = stagingReqs.size;
       vk::MemoryAllocateInfo stagingAllocInfo(stagingReqs.size, stagingIndex);
-      device->allocateMemory(&stagingAllocInfo, nullptr, &stagingMemory);
+      util::allocateMemory(device, stagingAllocInfo, tag, &stagingMemory);
       device->bindBufferMemory(stagingBuffer, stagingMemory, 0);
       vk::MemoryAllocateInfo localAllocInfo(localReqs.size, localIndex);
-      device->allocateMemory(&stagingAllocInfo, nullptr, &localMemory);
+      util::allocateMemory(device, localAllocInfo, tag, &localMemory);
       device->bindBufferMemory(localBuffer, localMemory, 0);
 
       // Create and record transfer command buffer
@@ -97,6 +169,7 @@ namespace ngfx
 
       // Map memory
       device->mapMemory(stagingMemory, 0, size, vk::MemoryMapFlags(), &_handle);
+      direct = false;
       valid = true;
     }
 
@@ -106,46 +179,367 @@ namespace ngfx
       memcpy(_handle, data, size);
     }
 
+    void *FastBuffer::data(void)
+    {
+      assert(valid);
+      return _handle;
+    }
+
+    void FastBuffer::stage(void* data,
+                           vk::DeviceSize offset,
+                           vk::DeviceSize bytes)
+    {
+      assert(valid);
+      assert(offset + bytes <= size);
+      memcpy((char *) _handle + offset, (char *) data + offset, bytes);
+      markDirty(offset, bytes);
+    }
+
+    void FastBuffer::markDirty(vk::DeviceSize offset, vk::DeviceSize bytes)
+    {
+      if (bytes == 0)
+      {
+        return;
+      }
+      dirty.push_back(vk::BufferCopy(offset, offset, bytes));
+    }
+
+    vk::DeviceSize FastBuffer::recordDirty(vk::CommandBuffer cmd)
+    {
+      return recordCopy(cmd, direct ? vk::Buffer() : stagingBuffer);
+    }
+
+    vk::DeviceSize FastBuffer::recordDirty(vk::CommandBuffer cmd,
+                                           vk::Buffer source)
+    {
+      return recordCopy(cmd, source);
+    }
+
+    // A null source only counts the dirty bytes of a direct buffer
+    vk::DeviceSize FastBuffer::recordCopy(vk::CommandBuffer cmd,
+                                          vk::Buffer source)
+    {
+      assert(valid);
+      if (dirty.empty())
+      {
+        return 0;
+      }
+
+      // Coalesce overlapping and adjacent ranges in place
+      std::sort(dirty.begin(),
+                dirty.end(),
+                [](const vk::BufferCopy &a, const vk::BufferCopy &b)
+                { return a.srcOffset < b.srcOffset; });
+      size_t regionCount = 0;
+      vk::DeviceSize bytes = 0;
+      for (size_t i = 0; i < dirty.size(); i++)
+      {
+        vk::BufferCopy &last = dirty[regionCount > 0 ? regionCount - 1 : 0];
+        vk::DeviceSize end = last.srcOffset + last.size;
+        if (regionCount > 0 && dirty[i].srcOffset <= end)
+        {
+          last.size = std::max(end, dirty[i].srcOffset + dirty[i].size)
+            - last.srcOffset;
+        }
+        else
+        {
+          dirty[regionCount++] = dirty[i];
+        }
+      }
+      for (size_t i = 0; i < regionCount; i++)
+      {
+        bytes += dirty[i].size;
+      }
+
+      // Host writes to coherent memory are made visible by the submit
+      // (host write ordering is implicit in vkQueueSubmit)
+      if (!source)
+      {
+        dirty.clear();
+        return bytes;
+      }
+
+      // Consumers of the buffer, in earlier submits or this one
+      vk::AccessFlags dstAccess;
+      vk::PipelineStageFlags dstStage;
+      if (usage & vk::BufferUsageFlagBits::eVertexBuffer)
+      {
+        dstAccess |= vk::AccessFlagBits::eVertexAttributeRead;
+        dstStage |= vk::PipelineStageFlagBits::eVertexInput;
+      }
+      if (usage & vk::BufferUsageFlagBits::eIndexBuffer)
+      {
+        dstAccess |= vk::AccessFlagBits::eIndexRead;
+        dstStage |= vk::PipelineStageFlagBits::eVertexInput;
+      }
+      if (usage & (vk::BufferUsageFlagBits::eUniformBuffer
+                   | vk::BufferUsageFlagBits::eStorageBuffer))
+      {
+        dstAccess |= vk::AccessFlagBits::eUniformRead
+          | vk::AccessFlagBits::eShaderRead;
+        dstStage |= vk::PipelineStageFlagBits::eVertexShader
+          | vk::PipelineStageFlagBits::eComputeShader;
+      }
+      if (!dstStage)
+      {
+        dstStage = vk::PipelineStageFlagBits::eBottomOfPipe;
+      }
+
+      // Earlier reads on the queue finish before the copy overwrites them
+      cmd.pipelineBarrier(dstStage,
+                          vk::PipelineStageFlagBits::eTransfer,
+                          vk::DependencyFlags(),
+                          0,
+                          nullptr,
+                          0,
+                          nullptr,
+                          0,
+                          nullptr);
+      cmd.copyBuffer(source,
+                     localBuffer,
+                     (uint32_t) regionCount,
+                     dirty.data());
+
+      // Make the copy visible to whatever consumes the buffer
+      vk::BufferMemoryBarrier barrier(
+          vk::AccessFlagBits::eTransferWrite,
+          dstAccess,
+          VK_QUEUE_FAMILY_IGNORED,
+          VK_QUEUE_FAMILY_IGNORED,
+          localBuffer,
+          0,
+          size);
+      cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                          dstStage,
+                          vk::DependencyFlags(),
+                          0,
+                          nullptr,
+                          1,
+                          &barrier,
+                          0,
+                          nullptr);
+
+      dirty.clear();
+      return bytes;
+    }
+
     // TODO: add fences for external sync
     void FastBuffer::copy(vk::Queue q)
     {
       assert(valid);
+      if (direct)
+      {
+        return;
+      }
       vk::SubmitInfo submitInfo(0, nullptr, nullptr, 1, &commandBuffer, 0, nullptr);
       q.submit(1, &submitInfo, vk::Fence());
     }
 
     void FastBuffer::blockingCopy(vk::Queue q)
     {
+      NGFX_TRACE_SCOPE("FastBuffer::blockingCopy");
       assert(valid);
+      if (direct)
+      {
+        return;
+      }
       vk::SubmitInfo submitInfo(0, nullptr, nullptr, 1, &commandBuffer, 0, nullptr);
       q.submit(1, &submitInfo, vk::Fence());
       q.waitIdle();
     }
 
+    void FastBuffer::makeStatic(void)
+    {
+      assert(valid);
+      MemoryTracker *tracker = MemoryTracker::find(*device);
+      if (direct || _evictable || !tracker)
+      {
+        return;
+      }
+      _evictId = tracker->onEvict(
+          [this](uint32_t heap, vk::DeviceSize) -> vk::DeviceSize
+          {
+            if (!stagingMemory || heap != _stagingHeap)
+            {
+              return 0;
+            }
+            freeStaging();
+            return _stagingBytes;
+          });
+      _evictable = true;
+    }
+
+    void FastBuffer::freeStaging(void)
+    {
+      device->unmapMemory(stagingMemory);
+      device->freeCommandBuffers(*pool,
+                                 1,
+                                 (const vk::CommandBuffer *)&commandBuffer);
+      util::freeMemory(device, stagingMemory);
+      device->destroyBuffer(stagingBuffer);
+      stagingMemory = vk::DeviceMemory();
+      stagingBuffer = vk::Buffer();
+      _handle = nullptr;
+    }
+
     FastBuffer::~FastBuffer(void)
     {
-      if (valid)
+      if (_evictable)
       {
-        device->unmapMemory(stagingMemory);
-        device->freeCommandBuffers(*pool,
-                                   1,
-                                   (const vk::CommandBuffer *)&commandBuffer);
-        device->freeMemory(stagingMemory);
-        device->freeMemory(localMemory);
-        device->destroyBuffer(stagingBuffer);
+        MemoryTracker *tracker = MemoryTracker::find(*device);
+        if (tracker)
+        {
+          tracker->removeEvict(_evictId);
+        }
+      }
+
+      if (valid && direct)
+      {
+        device->unmapMemory(localMemory);
+        util::freeMemory(device, localMemory);
+        device->destroyBuffer(localBuffer);
+      }
+      else if (valid)
+      {
+        if (stagingMemory)
+        {
+          freeStaging();
+        }
+        util::freeMemory(device, localMemory);
         device->destroyBuffer(localBuffer);
       }
     }
 
-    std::vector<const char*> getRequiredExtensions(bool debug)
+    HostBuffer::HostBuffer(void) : valid(false), device(nullptr), size(0) {}
+
+    bool HostBuffer::import(vk::Device *dev,
+                            vk::PhysicalDevice *physDev,
+                            void *host,
+                            vk::DeviceSize bytes,
+                            vk::BufferUsageFlags usage)
     {
-      // Get required glfw Extensions
-      uint32_t glfwExtensionCount = 0;
-      const char** glfwExtensions;
-      glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+      destroy();
+      vk::DeviceSize alignment = hostImportAlignment(physDev);
+      auto getHostPointerProperties =
+          (PFN_vkGetMemoryHostPointerPropertiesEXT)
+          dev->getProcAddr("vkGetMemoryHostPointerPropertiesEXT");
+      if (alignment == 0
+          || !getHostPointerProperties
+          || (uintptr_t) host % alignment != 0
+          || bytes % alignment != 0)
+      {
+        return false;
+      }
+
+      VkMemoryHostPointerPropertiesEXT hostProps = {};
+      hostProps.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+      if (getHostPointerProperties(
+              *dev,
+              VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+              host,
+              &hostProps) != VK_SUCCESS)
+      {
+        return false;
+      }
+
+      vk::ExternalMemoryBufferCreateInfo externalCI(
+          vk::ExternalMemoryHandleTypeFlagBits::eHostAllocationEXT);
+      vk::BufferCreateInfo bufferCI(vk::BufferCreateFlags(),
+                                    bytes,
+                                    usage,
+                                    vk::SharingMode::eExclusive,
+                                    0,
+                                    nullptr);
+      bufferCI.pNext = &externalCI;
+      dev->createBuffer(&bufferCI, nullptr, &buffer);
+
+      // Host writes are only seen without flushes on coherent types
+      vk::MemoryRequirements reqs = dev->getBufferMemoryRequirements(buffer);
+      uint32_t type;
+      if (!util::tryFindMemoryType(*physDev,
+                                   reqs.memoryTypeBits
+                                   & hostProps.memoryTypeBits,
+                                   vk::MemoryPropertyFlagBits::eHostCoherent,
+                                   &type))
+      {
+        dev->destroyBuffer(buffer);
+        return false;
+      }
 
-      std::vector<const char*> extensions(glfwExtensions,
-                                          glfwExtensions + glfwExtensionCount);
+      vk::ImportMemoryHostPointerInfoEXT importInfo(
+          vk::ExternalMemoryHandleTypeFlagBits::eHostAllocationEXT,
+          host);
+      vk::MemoryAllocateInfo allocInfo(bytes, type);
+      allocInfo.pNext = &importInfo;
+      if (util::allocateMemory(dev, allocInfo, MemoryTag::eInstances, &memory)
+          != vk::Result::eSuccess)
+      {
+        dev->destroyBuffer(buffer);
+        return false;
+      }
+      dev->bindBufferMemory(buffer, memory, 0);
+
+      device = dev;
+      size = bytes;
+      valid = true;
+      return true;
+    }
+
+    void HostBuffer::destroy(void)
+    {
+      if (!valid)
+      {
+        return;
+      }
+      device->destroyBuffer(buffer);
+      util::freeMemory(device, memory);
+      valid = false;
+    }
+
+    HostBuffer::~HostBuffer(void)
+    {
+      destroy();
+    }
+
+    vk::DeviceSize hostImportAlignment(vk::PhysicalDevice *phys)
+    {
+      if (!hasDeviceExtension(phys, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME))
+      {
+        return 0;
+      }
+      vk::PhysicalDeviceExternalMemoryHostPropertiesEXT hostProps;
+      vk::PhysicalDeviceProperties2 props;
+      props.pNext = &hostProps;
+      phys->getProperties2(&props);
+      return hostProps.minImportedHostPointerAlignment;
+    }
+
+    void *allocateHostShared(vk::PhysicalDevice *phys, size_t bytes)
+    {
+      // Page alignment is what drivers ask for in practice
+      size_t alignment = std::max<size_t>(4096, hostImportAlignment(phys));
+      bytes = (bytes + alignment - 1) / alignment * alignment;
+      return std::aligned_alloc(alignment, bytes);
+    }
+
+    void freeHostShared(void *host)
+    {
+      std::free(host);
+    }
+
+    std::vector<const char*> getRequiredExtensions(bool debug, bool headless)
+    {
+      std::vector<const char*> extensions;
+
+      // Get required glfw Extensions, headless contexts have no surface
+      if (!headless)
+      {
+        uint32_t glfwExtensionCount = 0;
+        const char** glfwExtensions;
+        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        extensions.assign(glfwExtensions,
+                          glfwExtensions + glfwExtensionCount);
+      }
 
       if (debug)
       {
@@ -197,7 +591,8 @@ namespace ngfx
           & (VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT
              | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT))
       {
-        std::cerr << "validation layer: " << pCallbackData->pMessage << std::endl;
+        log(LogLevel::eWarning,
+            std::string("validation layer: ") + pCallbackData->pMessage);
       }
       return VK_FALSE;
     }
@@ -214,11 +609,15 @@ namespace ngfx
       std::vector<vk::QueueFamilyProperties> families(count);
       phys->getQueueFamilyProperties(&count, families.data());
 
+      bool headless = !surface || !*surface;
       uint i = 0;
       for (const vk::QueueFamilyProperties &family : families)
       {
         vk::Bool32 presentSupport = false;
-        phys->getSurfaceSupportKHR(i, *surface, &presentSupport);
+        if (!headless)
+        {
+          phys->getSurfaceSupportKHR(i, *surface, &presentSupport);
+        }
         if (presentSupport)
         {
           qFamilies->presentFamily = i;
@@ -241,6 +640,12 @@ namespace ngfx
       {
         qFamilies->transferFamily = qFamilies->graphicsFamily;
       }
+
+      // Nothing is presented headless, alias graphics to keep indices valid
+      if (headless)
+      {
+        qFamilies->presentFamily = qFamilies->graphicsFamily;
+      }
     }
 
     bool checkDeviceExtensionSupport(vk::PhysicalDevice *phys)
@@ -265,6 +670,70 @@ namespace ngfx
       return requiredExtensions.empty();
     }
 
+    bool hasDeviceExtension(vk::PhysicalDevice *phys, const char *name)
+    {
+      uint32_t count = 0;
+      phys->enumerateDeviceExtensionProperties(nullptr,
+                                                &count,
+                                                (vk::ExtensionProperties *) nullptr);
+      std::vector<vk::ExtensionProperties> extensions(count);
+      phys->enumerateDeviceExtensionProperties(nullptr,
+                                                &count,
+                                                extensions.data());
+
+      for (vk::ExtensionProperties &ext : extensions)
+      {
+        if (strcmp(ext.extensionName, name) == 0)
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    bool supportsDescriptorIndexing(vk::PhysicalDevice *phys)
+    {
+      if (!hasDeviceExtension(phys, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME))
+      {
+        return false;
+      }
+
+      vk::PhysicalDeviceDescriptorIndexingFeaturesEXT indexing;
+      vk::PhysicalDeviceFeatures2 features;
+      features.pNext = &indexing;
+      phys->getFeatures2(&features);
+
+      return indexing.shaderSampledImageArrayNonUniformIndexing
+        && indexing.descriptorBindingSampledImageUpdateAfterBind
+        && indexing.descriptorBindingPartiallyBound
+        && indexing.descriptorBindingVariableDescriptorCount
+        && indexing.runtimeDescriptorArray;
+    }
+
+    bool supportsAtomicInt64(vk::PhysicalDevice *phys)
+    {
+      if (!hasDeviceExtension(phys, VK_KHR_SHADER_ATOMIC_INT64_EXTENSION_NAME)
+          || !phys->getFeatures().shaderInt64)
+      {
+        return false;
+      }
+
+      vk::PhysicalDeviceShaderAtomicInt64FeaturesKHR atomics;
+      vk::PhysicalDeviceFeatures2 features;
+      features.pNext = &atomics;
+      phys->getFeatures2(&features);
+
+      return atomics.shaderBufferInt64Atomics;
+    }
+
+    bool supportsViewportIndex(vk::PhysicalDevice *phys)
+    {
+      return hasDeviceExtension(
+          phys,
+          VK_EXT_SHADER_VIEWPORT_INDEX_LAYER_EXTENSION_NAME)
+        && phys->getFeatures().multiViewport;
+    }
+
     // TODO: maybe move this into SwapchainSupportDetails
     void querySwapchainSupport(vk::PhysicalDevice *phys,
                                vk::SurfaceKHR *surface,
@@ -299,6 +768,14 @@ namespace ngfx
     bool isDeviceSuitable(vk::PhysicalDevice *phys,
                                  vk::SurfaceKHR *surface)
     {
+      // Headless only needs a graphics queue
+      if (!surface || !*surface)
+      {
+        QueueFamilyIndices families;
+        findQueueFamilies(phys, nullptr, &families);
+        return families.graphicsFamily.has_value();
+      }
+
       bool extensionsSupported = checkDeviceExtensionSupport(phys);
 
       bool swapchainAdequate = false;
@@ -373,7 +850,8 @@ namespace ngfx
     void createInstance(std::string const& appName,
                         std::string const& engineName,
                         uint32_t apiVersion,
-                        vk::Instance *instance)
+                        vk::Instance *instance,
+                        bool headless)
     {
       vk::ApplicationInfo applicationInfo(appName.c_str(),
                                           1,
@@ -382,7 +860,7 @@ namespace ngfx
                                           apiVersion);
 
       // Get extensions
-      std::vector<const char*> ext = getRequiredExtensions(ngfx::kDebug);
+      std::vector<const char*> ext = getRequiredExtensions(ngfx::kDebug, headless);
 
       // Get validation layers
       if(ngfx::kDebug && !checkValidationLayerSupport())
@@ -443,8 +921,169 @@ namespace ngfx
       return func(instance, debugMessenger, nullptr);
     }
 
+    int64_t scorePhysicalDevice(vk::PhysicalDevice *phys,
+                                std::string *rationale)
+    {
+      vk::PhysicalDeviceProperties props = phys->getProperties();
+      vk::PhysicalDeviceMemoryProperties memProps =
+          phys->getMemoryProperties();
+      std::stringstream why;
+      int64_t score = 0;
+
+      switch (props.deviceType)
+      {
+        case vk::PhysicalDeviceType::eDiscreteGpu:
+          score += 10000;
+          why << "discrete";
+          break;
+        case vk::PhysicalDeviceType::eIntegratedGpu:
+          score += 5000;
+          why << "integrated";
+          break;
+        case vk::PhysicalDeviceType::eVirtualGpu:
+          score += 2000;
+          why << "virtual";
+          break;
+        case vk::PhysicalDeviceType::eCpu:
+          score += 100;
+          why << "cpu";
+          break;
+        default:
+          why << "other";
+          break;
+      }
+
+      // Largest device local heap, 10 points per GiB up to 48 GiB. Every
+      // term below the type stays under the smallest gap between types
+      // (1900), so a CPU device reporting system RAM as device local
+      // never outranks a GPU
+      vk::DeviceSize localHeap = 0;
+      for (uint32_t i = 0; i < memProps.memoryHeapCount; i++)
+      {
+        if (memProps.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+        {
+          localHeap = std::max(localHeap, memProps.memoryHeaps[i].size);
+        }
+      }
+      score += (int64_t) std::min<vk::DeviceSize>(localHeap >> 30, 48) * 10;
+      why << ", " << (localHeap >> 20) << "MB local";
+
+      uint32_t familyCount = 0;
+      phys->getQueueFamilyProperties(&familyCount,
+                                     (vk::QueueFamilyProperties *) nullptr);
+      std::vector<vk::QueueFamilyProperties> families(familyCount);
+      phys->getQueueFamilyProperties(&familyCount, families.data());
+      for (const vk::QueueFamilyProperties &family : families)
+      {
+        if ((family.queueFlags & vk::QueueFlagBits::eTransfer)
+            && !(family.queueFlags & vk::QueueFlagBits::eGraphics))
+        {
+          score += 500;
+          why << ", transfer queue";
+          break;
+        }
+      }
+
+      if (props.apiVersion >= VK_API_VERSION_1_1)
+      {
+        vk::PhysicalDeviceMultiviewFeatures multiview;
+        vk::PhysicalDeviceFeatures2 features;
+        features.pNext = &multiview;
+        phys->getFeatures2(&features);
+        if (multiview.multiview)
+        {
+          score += 250;
+          why << ", multiview";
+        }
+      }
+
+      uint32_t extCount = 0;
+      phys->enumerateDeviceExtensionProperties(nullptr,
+                                               &extCount,
+                                               (vk::ExtensionProperties *) nullptr);
+      std::vector<vk::ExtensionProperties> extensions(extCount);
+      phys->enumerateDeviceExtensionProperties(nullptr,
+                                               &extCount,
+                                               extensions.data());
+      bool timeline = props.apiVersion >= VK_API_VERSION_1_2;
+      for (const vk::ExtensionProperties &ext : extensions)
+      {
+        if (strcmp(ext.extensionName,
+                   VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) == 0)
+        {
+          timeline = true;
+        }
+      }
+      if (timeline)
+      {
+        score += 250;
+        why << ", timeline";
+      }
+
+      // Array layers bound how many cameras fit in one layered target
+      score += std::min<uint32_t>(props.limits.maxImageArrayLayers, 2048) / 8;
+      why << ", " << props.limits.maxImageArrayLayers << " layers";
+
+      if (rationale)
+      {
+        *rationale = why.str();
+      }
+      return score;
+    }
+
+    // Override is either a device index, a device UUID in hex (dashes
+    // optional) or a case insensitive substring of the device name
+    bool matchesDeviceOverride(vk::PhysicalDevice *phys,
+                               uint32_t index,
+                               const std::string &override)
+    {
+      // Short all digit strings are indices, UUIDs are 32 characters
+      if (!override.empty() && override.size() < 10
+          && std::all_of(override.begin(), override.end(), ::isdigit))
+      {
+        return std::stoul(override) == index;
+      }
+
+      vk::PhysicalDeviceProperties props = phys->getProperties();
+      if (props.apiVersion >= VK_API_VERSION_1_1)
+      {
+        vk::PhysicalDeviceIDProperties idProps;
+        vk::PhysicalDeviceProperties2 props2;
+        props2.pNext = &idProps;
+        phys->getProperties2(&props2);
+
+        std::stringstream uuid;
+        for (uint32_t i = 0; i < VK_UUID_SIZE; i++)
+        {
+          uuid << std::hex << std::setw(2) << std::setfill('0')
+               << (uint32_t) idProps.deviceUUID[i];
+        }
+        std::string wanted;
+        for (char ch : override)
+        {
+          if (ch != '-')
+          {
+            wanted.push_back((char) ::tolower(ch));
+          }
+        }
+        if (wanted == uuid.str())
+        {
+          return true;
+        }
+      }
+
+      std::string name = props.deviceName;
+      std::string lowerName, lowerOverride;
+      std::transform(name.begin(), name.end(),
+                     std::back_inserter(lowerName), ::tolower);
+      std::transform(override.begin(), override.end(),
+                     std::back_inserter(lowerOverride), ::tolower);
+      return lowerName.find(lowerOverride) != std::string::npos;
+    }
+
     vk::PhysicalDevice pickPhysicalDevice(vk::Instance *instance,
-                                          vk::SurfaceKHR *surface)
+                                          vk::SurfaceKHR *surface,
+                                          const char *deviceOverride)
     {
       uint32_t count = 0;
       instance->enumeratePhysicalDevices(&count, (vk::PhysicalDevice *) nullptr);
@@ -457,25 +1096,67 @@ namespace ngfx
       std::vector<vk::PhysicalDevice> devices(count);
       instance->enumeratePhysicalDevices(&count, devices.data());
 
+      if (!deviceOverride)
+      {
+        deviceOverride = getenv(kDeviceOverrideEnv);
+      }
+      std::string override = deviceOverride ? deviceOverride : "";
+
       vk::PhysicalDevice selectedDevice;
-      for (int i = 0; i < devices.size(); i++)
+      int64_t bestScore = -1;
+      for (uint32_t i = 0; i < devices.size(); i++)
       {
-        if(isDeviceSuitable(&devices[i], surface))
+        std::string rationale;
+        int64_t score = scorePhysicalDevice(&devices[i], &rationale);
+        bool suitable = isDeviceSuitable(&devices[i], surface);
+        bool overridden = !override.empty()
+          && matchesDeviceOverride(&devices[i], i, override);
+
+        std::ostringstream ranking;
+        ranking << "device " << i << " '"
+                << devices[i].getProperties().deviceName << "' score "
+                << score << " (" << rationale << ")"
+                << (suitable ? "" : " unsuitable")
+                << (overridden ? " overridden" : "");
+        log(LogLevel::eInfo, ranking.str());
+
+        if (!suitable)
+        {
+          continue;
+        }
+        if (overridden)
         {
           selectedDevice = devices[i];
+          break;
+        }
+        if (override.empty() && score > bestScore)
+        {
+          selectedDevice = devices[i];
+          bestScore = score;
         }
       }
 
       if (selectedDevice == vk::PhysicalDevice())
       {
-        throw std::runtime_error("failed to find a suitable GPU");
+        throw std::runtime_error(override.empty()
+                                 ? "failed to find a suitable GPU"
+                                 : "no suitable GPU matches device override");
       }
+      std::string name = selectedDevice.getProperties().deviceName;
+      log(LogLevel::eInfo, "selected '" + name + "'");
       return selectedDevice;
     }
 
     void createLogicalDevice(vk::PhysicalDevice *physicalDevice,
                                    QueueFamilyIndices *indices,
-                                   vk::Device *device)
+                                   vk::Device *device,
+                                   bool headless,
+                                   bool descriptorIndexing,
+                                   bool calibratedTimestamps,
+                                   bool memoryBudget,
+                                   bool externalHostMemory,
+                                   bool atomicInt64,
+                                   bool viewportIndex)
     {
       float priority = 1.0f;
       std::vector<vk::DeviceQueueCreateInfo> queuesCI;
@@ -494,16 +1175,67 @@ namespace ngfx
                                       &priority);
         queuesCI.push_back(qCI);
       }
+      std::vector<const char *> extensions;
+      if (!headless)
+      {
+        extensions.assign(ngfx::kDeviceExtensions,
+                          ngfx::kDeviceExtensions + ngfx::kDeviceExtensionCount);
+      }
+
       vk::PhysicalDeviceFeatures features;
       vk::DeviceCreateInfo deviceCI(vk::DeviceCreateFlags(),
                                     (uint) queuesCI.size(),
                                     queuesCI.data(),
                                     ngfx::kValLayerCount,
                                     ngfx::kValLayers,
-                                    ngfx::kDeviceExtensionCount,
-                                    ngfx::kDeviceExtensions,
+                                    0,
+                                    nullptr,
                                     &features
                                     );
+
+      // Only the features Bindless needs, see supportsDescriptorIndexing
+      vk::PhysicalDeviceDescriptorIndexingFeaturesEXT indexing;
+      if (descriptorIndexing)
+      {
+        extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+        indexing.shaderSampledImageArrayNonUniformIndexing = true;
+        indexing.descriptorBindingSampledImageUpdateAfterBind = true;
+        indexing.descriptorBindingPartiallyBound = true;
+        indexing.descriptorBindingVariableDescriptorCount = true;
+        indexing.runtimeDescriptorArray = true;
+        deviceCI.pNext = &indexing;
+      }
+      if (calibratedTimestamps)
+      {
+        extensions.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+      }
+      if (memoryBudget)
+      {
+        extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+      }
+      if (externalHostMemory)
+      {
+        extensions.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+      }
+      // 64 bit keys of the compute rasterizer, see PointRaster
+      vk::PhysicalDeviceShaderAtomicInt64FeaturesKHR atomics;
+      if (atomicInt64)
+      {
+        extensions.push_back(VK_KHR_SHADER_ATOMIC_INT64_EXTENSION_NAME);
+        features.shaderInt64 = true;
+        atomics.shaderBufferInt64Atomics = true;
+        atomics.pNext = (void *) deviceCI.pNext;
+        deviceCI.pNext = &atomics;
+      }
+      // gl_ViewportIndex from the vertex shader, see CameraAtlas
+      if (viewportIndex)
+      {
+        extensions.push_back(VK_EXT_SHADER_VIEWPORT_INDEX_LAYER_EXTENSION_NAME);
+        features.multiViewport = true;
+      }
+      deviceCI.enabledExtensionCount = (uint32_t) extensions.size();
+      deviceCI.ppEnabledExtensionNames = extensions.data();
+
       physicalDevice->createDevice(&deviceCI, nullptr, device);
     }
 
@@ -540,9 +1272,10 @@ namespace ngfx
     }
 
     vk::CommandPool createCommandPool(vk::Device *device,
-                                      QueueFamilyIndices indices)
+                                      QueueFamilyIndices indices,
+                                      vk::CommandPoolCreateFlags flags)
     {
-      vk::CommandPoolCreateInfo poolCI(vk::CommandPoolCreateFlags(),
+      vk::CommandPoolCreateInfo poolCI(flags,
                                        indices.graphicsFamily.value());
 
       vk::CommandPool pool;
@@ -550,9 +1283,10 @@ namespace ngfx
       return pool;
     }
 
-    uint32_t findMemoryType(vk::PhysicalDevice &phys,
-                            uint32_t typeFilter,
-                            vk::MemoryPropertyFlags requiredProps)
+    bool tryFindMemoryType(vk::PhysicalDevice &phys,
+                           uint32_t typeFilter,
+                           vk::MemoryPropertyFlags requiredProps,
+                           uint32_t *index)
     {
       vk::PhysicalDeviceMemoryProperties memProps =
           phys.getMemoryProperties();
@@ -563,10 +1297,23 @@ namespace ngfx
             && (memProps.memoryTypes[i].propertyFlags
                 & requiredProps) == requiredProps))
         {
-          return i;
+          *index = i;
+          return true;
         }
       }
-      throw std::runtime_error("failed to find suitable memory type!");
+      return false;
+    }
+
+    uint32_t findMemoryType(vk::PhysicalDevice &phys,
+                            uint32_t typeFilter,
+                            vk::MemoryPropertyFlags requiredProps)
+    {
+      uint32_t index;
+      if (!tryFindMemoryType(phys, typeFilter, requiredProps, &index))
+      {
+        throw std::runtime_error("failed to find suitable memory type!");
+      }
+      return index;
     }
     
     vk::SampleCountFlags getMaxUsableSampleCount(vk::PhysicalDevice *d) {
@@ -578,5 +1325,137 @@ namespace ngfx
 
       return vk::SampleCountFlags(counts);
     }
+
+    void createImage(vk::Device *device,
+                     vk::PhysicalDevice *phys,
+                     vk::Extent2D extent,
+                     uint32_t layers,
+                     vk::Format format,
+                     vk::ImageUsageFlags usage,
+                     vk::Image *image,
+                     vk::DeviceMemory *memory)
+    {
+      vk::ImageCreateInfo imageCI(
+          vk::ImageCreateFlags(),
+          vk::ImageType::e2D,
+          format,
+          vk::Extent3D(extent.width, extent.height, 1),
+          1,
+          layers,
+          vk::SampleCountFlagBits::e1,
+          vk::ImageTiling::eOptimal,
+          usage,
+          vk::SharingMode::eExclusive);
+      device->createImage(&imageCI, nullptr, image);
+
+      vk::MemoryRequirements memReqs;
+      device->getImageMemoryRequirements(*image, &memReqs);
+      vk::MemoryAllocateInfo allocInfo(
+          memReqs.size,
+          findMemoryType(*phys,
+                         memReqs.memoryTypeBits,
+                         vk::MemoryPropertyFlagBits::eDeviceLocal));
+      allocateMemory(device, allocInfo, MemoryTag::eTextures, memory);
+      device->bindImageMemory(*image, *memory, 0);
+    }
+
+    vk::ImageView createImageView(vk::Device *device,
+                                  vk::Image image,
+                                  vk::ImageViewType type,
+                                  vk::Format format,
+                                  uint32_t firstLayer,
+                                  uint32_t layers)
+    {
+      vk::ImageViewCreateInfo viewCI(
+          vk::ImageViewCreateFlags(),
+          image,
+          type,
+          format,
+          vk::ComponentMapping(),
+          vk::ImageSubresourceRange(
+              vk::ImageAspectFlagBits::eColor,
+              0,
+              1,
+              firstLayer,
+              layers));
+      vk::ImageView view;
+      device->createImageView(&viewCI, nullptr, &view);
+      return view;
+    }
+
+    vk::AttachmentDescription pickAttachment(vk::AttachmentLoadOp load)
+    {
+      return vk::AttachmentDescription(
+          vk::AttachmentDescriptionFlags(),
+          kPickFormat,
+          vk::SampleCountFlagBits::e1,
+          load,
+          vk::AttachmentStoreOp::eStore,
+          vk::AttachmentLoadOp::eDontCare,
+          vk::AttachmentStoreOp::eDontCare,
+          (load == vk::AttachmentLoadOp::eLoad)
+          ? vk::ImageLayout::eTransferSrcOptimal
+          : vk::ImageLayout::eUndefined,
+          vk::ImageLayout::eTransferSrcOptimal);
+    }
+
+    void createDeviceBuffer(vk::Device *device,
+                            vk::PhysicalDevice *phys,
+                            vk::DeviceSize size,
+                            vk::BufferUsageFlags usage,
+                            MemoryTag tag,
+                            vk::Buffer *buffer,
+                            vk::DeviceMemory *memory)
+    {
+      vk::BufferCreateInfo bufferCI(
+          vk::BufferCreateFlags(),
+          size,
+          usage,
+          vk::SharingMode::eExclusive,
+          0,
+          nullptr);
+      device->createBuffer(&bufferCI, nullptr, buffer);
+
+      vk::MemoryRequirements memReqs =
+          device->getBufferMemoryRequirements(*buffer);
+      vk::MemoryAllocateInfo allocInfo(
+          memReqs.size,
+          findMemoryType(*phys,
+                         memReqs.memoryTypeBits,
+                         vk::MemoryPropertyFlagBits::eDeviceLocal));
+      allocateMemory(device, allocInfo, tag, memory);
+      device->bindBufferMemory(*buffer, *memory, 0);
+    }
+
+    void createHostBuffer(vk::Device *device,
+                          vk::PhysicalDevice *phys,
+                          vk::DeviceSize size,
+                          vk::BufferUsageFlags usage,
+                          MemoryTag tag,
+                          vk::Buffer *buffer,
+                          vk::DeviceMemory *memory,
+                          void **mapped)
+    {
+      vk::BufferCreateInfo bufferCI(
+          vk::BufferCreateFlags(),
+          size,
+          usage,
+          vk::SharingMode::eExclusive,
+          0,
+          nullptr);
+      device->createBuffer(&bufferCI, nullptr, buffer);
+
+      vk::MemoryRequirements memReqs =
+          device->getBufferMemoryRequirements(*buffer);
+      vk::MemoryAllocateInfo allocInfo(
+          memReqs.size,
+          findMemoryType(*phys,
+                         memReqs.memoryTypeBits,
+                         vk::MemoryPropertyFlagBits::eHostVisible
+                         | vk::MemoryPropertyFlagBits::eHostCoherent));
+      allocateMemory(device, allocInfo, tag, memory);
+      device->bindBufferMemory(*buffer, *memory, 0);
+      device->mapMemory(*memory, 0, size, vk::MemoryMapFlags(), mapped);
+    }
   }
 }